@@ -28,10 +28,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "mimehooks.h"
 #include "gmcerts.h"
 #include "gmdocument.h"
+#include "gmrequest.h"
 #include "gmutil.h"
+#include "contentcache.h"
 #include "history.h"
+#include "hostcache.h"
 #include "ipc.h"
+#include "media.h"
+#include "pagearchive.h"
 #include "periodic.h"
+#include "prefetch.h"
 #include "sitespec.h"
 #include "updater.h"
 #include "ui/certimportwidget.h"
@@ -256,8 +262,10 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "scrollspeed arg:%d type:%d\n", d->prefs.smoothScrollSpeed[mouse_ScrollType], mouse_ScrollType);
     appendFormat_String(str, "imageloadscroll arg:%d\n", d->prefs.loadImageInsteadOfScrolling);
     appendFormat_String(str, "cachesize.set arg:%d\n", d->prefs.maxCacheSize);
+    appendFormat_String(str, "diskcachesize.set arg:%d\n", d->prefs.maxDiskCacheSize);
     appendFormat_String(str, "memorysize.set arg:%d\n", d->prefs.maxMemorySize);
     appendFormat_String(str, "urlsize.set arg:%d\n", d->prefs.maxUrlSize);
+    appendFormat_String(str, "feedrequests.set arg:%d\n", d->prefs.maxFeedRequests);
     appendFormat_String(str, "decodeurls arg:%d\n", d->prefs.decodeUserVisibleURLs);
     appendFormat_String(str, "linewidth.set arg:%d\n", d->prefs.lineWidth);
     appendFormat_String(str, "linespacing.set arg:%f\n", d->prefs.lineSpacing);
@@ -296,6 +304,7 @@ static iString *serializePrefs_App_(const iApp *d) {
         { "prefs.mono.gemini", &d->prefs.monospaceGemini },
         { "prefs.mono.gopher", &d->prefs.monospaceGopher },
         { "prefs.plaintext.wrap", &d->prefs.plainTextWrap },
+        { "prefs.prefetchhosts", &d->prefs.prefetchHosts },
         { "prefs.retaintabs", &d->prefs.retainTabs },
         { "prefs.sideicon", &d->prefs.sideIcon },
         { "prefs.time.24h", &d->prefs.time24h },
@@ -699,6 +708,7 @@ static void saveState_App_(const iApp *d) {
        by the user manually. */
     iFile *f = newCStr_File(concatPath_CStr(dataDir_App_(), tempStateFileName_App_));
     if (open_File(f, writeOnly_FileMode)) {
+        beginSave_ContentCache(); /* the cached bodies that are still needed are stored again */
         writeData_File(f, magicState_App_, 4);
         writeU32_File(f, latest_FileVersion); /* version */
         iConstForEach(PtrArray, winIter, &d->mainWindows) {
@@ -757,6 +767,8 @@ static void saveState_App_(const iApp *d) {
     const char *finalName = concatPath_CStr(dataDir_App_(), stateFileName_App_);
     remove(finalName);
     rename(tempName, finalName);
+    save_ContentCache();
+    save_PageArchive();
 }
 
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
@@ -1065,6 +1077,13 @@ static void init_App_(iApp *d, int argc, char **argv) {
                       NULL,
                       0x1f306);
     }
+    init_GmRequestScheduler();
+    init_ContentCache(dataDir_App_());
+    init_PageArchive(dataDir_App_());
+    init_HostCache();
+    init_ImageDecoder();
+    init_GmPrewrapPool();
+    init_Prefetch();
     init_Feeds(dataDir_App_());
     /* Widget state init. */
     processEvents_App(postedEventsOnly_AppEventMode);
@@ -1131,6 +1150,13 @@ static void deinit_App(iApp *d) {
     deinit_PtrArray(&d->mainWindows);
     d->window = NULL;
     deinit_Feeds();
+    deinit_Prefetch();
+    deinit_GmPrewrapPool();
+    deinit_ImageDecoder();
+    deinit_HostCache();
+    deinit_PageArchive();
+    deinit_ContentCache();
+    deinit_GmRequestScheduler();
     save_Keys(dataDir_App_());
     deinit_Keys();
     deinit_Fonts();
@@ -1267,6 +1293,14 @@ const iString *debugInfo_App(void) {
         appendFormat_String(msg, "Total cache: %.3f MB\n", total.cacheSize / 1.0e6f);
         appendFormat_String(msg, "Total memory: %.3f MB\n", total.memorySize / 1.0e6f);
     }
+    appendFormat_String(msg, "## Text shaping cache\n"); {
+        const iShapeCacheStats shaping = shapeCacheStats_Text();
+        appendFormat_String(msg, "Entries: %zu / %zu\n", shaping.count, shaping.capacity);
+        appendFormat_String(msg, "Hits: %zu\n", shaping.hits);
+        appendFormat_String(msg, "Misses: %zu\n", shaping.misses);
+    }
+    appendFormat_String(msg, "## Network requests\n");
+    append_String(msg, collect_String(debugInfo_GmRequestScheduler()));
     appendFormat_String(msg, "## Documents\n");
     iForEach(ObjectList, k, docs) {
         iDocumentWidget *doc = k.object;
@@ -1298,6 +1332,7 @@ static void clearCache_App_(void) {
     iForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
         clearCache_History(history_DocumentWidget(i.object));
     }
+    clear_ContentCache();
 }
 
 iObjectList *listAllDocuments_App(void) {
@@ -2163,6 +2198,8 @@ static iBool handlePrefsCommands_(iWidget *d, const char *cmd) {
                          toInt_String(text_InputWidget(findChild_Widget(d, "prefs.tabwidth"))));
         postCommandf_App("cachesize.set arg:%d",
                          toInt_String(text_InputWidget(findChild_Widget(d, "prefs.cachesize"))));
+        postCommandf_App("diskcachesize.set arg:%d",
+                         toInt_String(text_InputWidget(findChild_Widget(d, "prefs.diskcachesize"))));
         postCommandf_App("memorysize.set arg:%d",
                          toInt_String(text_InputWidget(findChild_Widget(d, "prefs.memorysize"))));
         postCommandf_App("urlsize.set arg:%d",
@@ -2934,6 +2971,10 @@ iBool handleCommand_App(const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "prefs.prefetchhosts.changed")) {
+        d->prefs.prefetchHosts = arg_Command(cmd) != 0;
+        return iTrue;
+    }
     else if (equal_Command(cmd, "prefs.collapsepreonload.changed")) {
         d->prefs.collapsePreOnLoad = arg_Command(cmd) != 0;
         return iTrue;
@@ -2990,6 +3031,13 @@ iBool handleCommand_App(const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "diskcachesize.set")) {
+        d->prefs.maxDiskCacheSize = arg_Command(cmd);
+        if (d->prefs.maxDiskCacheSize <= 0) {
+            d->prefs.maxDiskCacheSize = 0;
+        }
+        return iTrue;
+    }
     else if (equal_Command(cmd, "memorysize.set")) {
         d->prefs.maxMemorySize = arg_Command(cmd);
         if (d->prefs.maxMemorySize <= 0) {
@@ -2997,6 +3045,10 @@ iBool handleCommand_App(const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "feedrequests.set")) {
+        d->prefs.maxFeedRequests = iClamp(arg_Command(cmd), 1, 16);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "urlsize.set")) {
         d->prefs.maxUrlSize = arg_Command(cmd);
         if (d->prefs.maxUrlSize < 1024) {
@@ -3181,7 +3233,9 @@ iBool handleCommand_App(const char *cmd) {
         setOrigin_DocumentWidget(doc, origin);
         showCollapsed_Widget(findWidget_App("document.progress"), iFalse);
         setUrlFlags_DocumentWidget(doc, url,
-           isHistory ? useCachedContentIfAvailable_DocumentWidgetSetUrlFlag : 0);
+           isHistory ? useCachedContentIfAvailable_DocumentWidgetSetUrlFlag
+           : argLabel_Command(cmd, "link") ? usePrefetchedContentIfAvailable_DocumentWidgetSetUrlFlag
+                                           : 0);
         /* Optionally, jump to a text in the document. This will only work if the document
            is already available, e.g., it's from "about:" or restored from cache. */
         const iRangecc gotoHeading = range_Command(cmd, "gotoheading");
@@ -3421,11 +3475,14 @@ iBool handleCommand_App(const char *cmd) {
             iTrue);
         setText_InputWidget(findChild_Widget(dlg, "prefs.cachesize"),
                             collectNewFormat_String("%d", d->prefs.maxCacheSize));
+        setText_InputWidget(findChild_Widget(dlg, "prefs.diskcachesize"),
+                            collectNewFormat_String("%d", d->prefs.maxDiskCacheSize));
         setText_InputWidget(findChild_Widget(dlg, "prefs.memorysize"),
                             collectNewFormat_String("%d", d->prefs.maxMemorySize));
         setText_InputWidget(findChild_Widget(dlg, "prefs.urlsize"),
                             collectNewFormat_String("%d", d->prefs.maxUrlSize));
         setToggle_Widget(findChild_Widget(dlg, "prefs.decodeurls"), d->prefs.decodeUserVisibleURLs);
+        setToggle_Widget(findChild_Widget(dlg, "prefs.prefetchhosts"), d->prefs.prefetchHosts);
         setText_InputWidget(findChild_Widget(dlg, "prefs.searchurl"), &d->prefs.strings[searchUrl_PrefsString]);
         setText_InputWidget(findChild_Widget(dlg, "prefs.ca.file"), &d->prefs.strings[caFile_PrefsString]);
         setText_InputWidget(findChild_Widget(dlg, "prefs.ca.path"), &d->prefs.strings[caPath_PrefsString]);
@@ -3503,7 +3560,7 @@ iBool handleCommand_App(const char *cmd) {
             uint32_t id = add_Bookmarks(d->bookmarks, NULL,
                                         collect_String(suffix_Command(cmd, "value")), NULL, 0);
             if (parentId) {
-                get_Bookmarks(d->bookmarks, id)->parentId = parentId;
+                setParent_Bookmarks(d->bookmarks, id, parentId);
             }
             postCommandf_App("bookmarks.changed added:%zu", id);
             setRecentFolder_Bookmarks(d->bookmarks, id);
@@ -3531,10 +3588,18 @@ iBool handleCommand_App(const char *cmd) {
         requestFinished_Bookmarks(bookmarks_App(), pointerLabel_Command(cmd, "req"));
         return iTrue;
     }
+    else if (equal_Command(cmd, "prefetch.request.finished")) {
+        requestFinished_Prefetch(pointerLabel_Command(cmd, "req"));
+        return iTrue;
+    }
     else if (equal_Command(cmd, "bookmarks.changed")) {
         save_Bookmarks(d->bookmarks, dataDir_App_());
         return iFalse;
     }
+    else if (equal_Command(cmd, "requests.start")) {
+        startQueued_GmRequestScheduler();
+        return iTrue;
+    }
     else if (equal_Command(cmd, "feeds.refresh")) {
         refresh_Feeds();
         return iTrue;
@@ -187,6 +187,8 @@ struct Impl_Bookmarks {
     iHash     bookmarks; /* bookmark ID is the hash key */
     uint32_t  recentFolderId; /* recently interacted with */
     iPtrArray remoteRequests;   
+    uint32_t  generation; /* incremented when bookmarks change */
+    iBookmarksSnapshot *snapshot; /* latest version given to readers */
 };
 
 iDefineTypeConstruction(Bookmarks)
@@ -197,6 +199,8 @@ void init_Bookmarks(iBookmarks *d) {
     init_Hash(&d->bookmarks);
     d->recentFolderId = 0;
     init_PtrArray(&d->remoteRequests);
+    d->generation = 0;
+    d->snapshot = NULL;
 }
 
 void deinit_Bookmarks(iBookmarks *d) {
@@ -208,6 +212,7 @@ void deinit_Bookmarks(iBookmarks *d) {
     deinit_PtrArray(&d->remoteRequests);
     clear_Bookmarks(d);
     deinit_Hash(&d->bookmarks);
+    iReleasePtr(&d->snapshot);
     delete_Mutex(d->mtx);
 }
 
@@ -218,12 +223,14 @@ void clear_Bookmarks(iBookmarks *d) {
     }
     clear_Hash(&d->bookmarks);
     d->idEnum = 0;
+    d->generation++;
     unlock_Mutex(d->mtx);
 }
 
 static void insertId_Bookmarks_(iBookmarks *d, iBookmark *bookmark, int id) {
     bookmark->node.key = id;
     insert_Hash(&d->bookmarks, &bookmark->node);
+    d->generation++;
 }
 
 static void insert_Bookmarks_(iBookmarks *d, iBookmark *bookmark) {
@@ -287,11 +294,15 @@ static void handleTable_BookmarkLoader_(void *context, const iString *table, iBo
     if (isStart) {
         iAssert(!d->bm);
         d->bm = new_Bookmark();
-        const int id = toInt_String(table);
+        d->bm->node.key = toInt_String(table);
+    }
+    else if (d->bm) {
+        /* Readers only see the bookmark once it is complete. */
+        const int id = d->bm->node.key;
+        lock_Mutex(d->bookmarks->mtx);
         d->bookmarks->idEnum = iMax(d->bookmarks->idEnum, id);
         insertId_Bookmarks_(d->bookmarks, d->bm, id);
-    }
-    else {
+        unlock_Mutex(d->bookmarks->mtx);
         d->bm = NULL;
     }
 }
@@ -339,6 +350,9 @@ static void init_BookmarkLoader(iBookmarkLoader *d, iBookmarks *bookmarks) {
 
 static void deinit_BookmarkLoader(iBookmarkLoader *d) {
     delete_TomlParser(d->toml);
+    if (d->bm) {
+        delete_Bookmark(d->bm); /* table was not finished */
+    }
 }
 
 static void load_BookmarkLoader(iBookmarkLoader *d, iFile *file) {
@@ -361,6 +375,7 @@ void sort_Bookmarks(iBookmarks *d, uint32_t parentId, iBookmarksCompareFunc cmp)
         iBookmark *bm = i.ptr;
         bm->order = index_PtrArrayConstIterator(&i) + 1;
     }
+    d->generation++;
     unlock_Mutex(d->mtx);
 }
 
@@ -475,6 +490,7 @@ iBool remove_Bookmarks(iBookmarks *d, uint32_t id) {
             delete_Bookmark((iBookmark *) remove_Hash(&d->bookmarks, id_Bookmark(i.ptr)));
         }
         delete_Bookmark(bm);
+        d->generation++;
     }
     unlock_Mutex(d->mtx);
     return bm != NULL;
@@ -490,6 +506,7 @@ iBool updateBookmarkIcon_Bookmarks(iBookmarks *d, const iString *url, iChar icon
             if (icon != bm->icon) {
                 bm->icon = icon;
                 changed = iTrue;
+                d->generation++;
             }
         }
     }
@@ -547,9 +564,72 @@ void reorder_Bookmarks(iBookmarks *d, uint32_t id, int newOrder) {
             bm->order++;
         }
     }
+    d->generation++;
     unlock_Mutex(d->mtx);
 }
 
+static iBookmark *beginEdit_Bookmarks_(iBookmarks *d, uint32_t id) {
+    lock_Mutex(d->mtx);
+    iBookmark *bm = get_Bookmarks(d, id);
+    if (bm) {
+        d->generation++;
+    }
+    return bm;
+}
+
+static void endEdit_Bookmarks_(iBookmarks *d) {
+    unlock_Mutex(d->mtx);
+}
+
+void setTitle_Bookmarks(iBookmarks *d, uint32_t id, const iString *title) {
+    iBookmark *bm = beginEdit_Bookmarks_(d, id);
+    if (bm) {
+        set_String(&bm->title, title);
+    }
+    endEdit_Bookmarks_(d);
+}
+
+void setUrl_Bookmarks(iBookmarks *d, uint32_t id, const iString *url) {
+    iBookmark *bm = beginEdit_Bookmarks_(d, id);
+    if (bm) {
+        set_String(&bm->url, url);
+    }
+    endEdit_Bookmarks_(d);
+}
+
+void setTags_Bookmarks(iBookmarks *d, uint32_t id, const iString *tags) {
+    iBookmark *bm = beginEdit_Bookmarks_(d, id);
+    if (bm) {
+        set_String(&bm->tags, tags);
+    }
+    endEdit_Bookmarks_(d);
+}
+
+void setUserIcon_Bookmarks(iBookmarks *d, uint32_t id, iChar icon) {
+    iBookmark *bm = beginEdit_Bookmarks_(d, id);
+    if (bm) {
+        bm->icon = icon;
+        iChangeFlags(bm->flags, userIcon_BookmarkFlag, icon != 0);
+    }
+    endEdit_Bookmarks_(d);
+}
+
+void setFlags_Bookmarks(iBookmarks *d, uint32_t id, uint32_t flags, iBool set) {
+    iBookmark *bm = beginEdit_Bookmarks_(d, id);
+    if (bm) {
+        iChangeFlags(bm->flags, flags, set);
+    }
+    endEdit_Bookmarks_(d);
+}
+
+void setParent_Bookmarks(iBookmarks *d, uint32_t id, uint32_t parentId) {
+    iBookmark *bm = beginEdit_Bookmarks_(d, id);
+    if (bm) {
+        bm->parentId = parentId;
+    }
+    endEdit_Bookmarks_(d);
+}
+
 //iBool filterTagsRegExp_Bookmarks(void *regExp, const iBookmark *bm) {
 //    iRegExpMatch m;
 //    init_RegExpMatch(&m);
@@ -577,19 +657,29 @@ uint32_t recentFolder_Bookmarks(const iBookmarks *d) {
     return d->recentFolderId;
 }
 
-const iPtrArray *list_Bookmarks(const iBookmarks *d, iBookmarksCompareFunc cmp,
-                                iBookmarksFilterFunc filter, void *context) {
-    lock_Mutex(d->mtx);
+static iPtrArray *listHash_Bookmarks_(const iHash *bookmarks, iBookmarksFilterFunc filter,
+                                      void *context) {
     iPtrArray *list = collectNew_PtrArray();
-    iConstForEach(Hash, i, &d->bookmarks) {
+    iConstForEach(Hash, i, bookmarks) {
         const iBookmark *bm = (const iBookmark *) i.value;
         if (!filter || filter(context, bm)) {
             pushBack_PtrArray(list, bm);
         }
     }
-    unlock_Mutex(d->mtx);
+    return list;
+}
+
+static void sortList_Bookmarks_(iPtrArray *list, iBookmarksCompareFunc cmp) {
     if (!cmp) cmp = cmpTimeDescending_Bookmark_;
     sort_Array(list, (int (*)(const void *, const void *)) cmp);
+}
+
+const iPtrArray *list_Bookmarks(const iBookmarks *d, iBookmarksCompareFunc cmp,
+                                iBookmarksFilterFunc filter, void *context) {
+    lock_Mutex(d->mtx);
+    iPtrArray *list = listHash_Bookmarks_(&d->bookmarks, filter, context);
+    unlock_Mutex(d->mtx);
+    sortList_Bookmarks_(list, cmp);
     return list;
 }
 
@@ -747,10 +837,12 @@ void requestFinished_Bookmarks(iBookmarks *d, iGmRequest *req) {
                     if (isEmpty_String(titleStr)) {
                         setRange_String(titleStr, urlHost_String(urlStr));
                     }
+                    lock_Mutex(d->mtx);
                     const uint32_t bmId = add_Bookmarks(d, absUrl, titleStr, NULL, 0x2913);
                     iBookmark *bm = get_Bookmarks(d, bmId);
                     bm->flags |= remote_BookmarkFlag;
                     bm->parentId = *(uint32_t *) userData_Object(req);
+                    unlock_Mutex(d->mtx);
                     delete_String(titleStr);
                 }
                 delete_String(urlStr);
@@ -785,6 +877,7 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
             }
         }
         if (numRemoved) {
+            d->generation++;
             postCommand_App("bookmarks.changed");
         }
     }
@@ -796,8 +889,73 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
         setUserData_Object(req, bmId);
         pushBack_PtrArray(&d->remoteRequests, req);
         setUrl_GmRequest(req, &bm->url);
+        setPriority_GmRequest(req, background_GmRequestPriority, d);
         iConnect(GmRequest, req, finished, req, remoteRequestFinished_Bookmarks_);
         submit_GmRequest(req);
     }
     unlock_Mutex(d->mtx);
 }
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareObjectConstructionArgs(BookmarksSnapshot, const iBookmarks *bookmarks)
+
+struct Impl_BookmarksSnapshot {
+    iObject  object;
+    uint32_t generation;
+    iHash    bookmarks; /* copies; bookmark ID is the hash key */
+};
+
+void init_BookmarksSnapshot(iBookmarksSnapshot *d, const iBookmarks *bookmarks) {
+    /* Note: `bookmarks` is locked. */
+    d->generation = bookmarks->generation;
+    init_Hash(&d->bookmarks);
+    iConstForEach(Hash, i, &bookmarks->bookmarks) {
+        const iBookmark *bm   = (const iBookmark *) i.value;
+        iBookmark *      copy = new_Bookmark();
+        set_String(&copy->url, &bm->url);
+        set_String(&copy->title, &bm->title);
+        set_String(&copy->tags, &bm->tags);
+        copy->flags    = bm->flags;
+        copy->icon     = bm->icon;
+        copy->when     = bm->when;
+        copy->parentId = bm->parentId;
+        copy->order    = bm->order;
+        copy->node.key = bm->node.key;
+        insert_Hash(&d->bookmarks, &copy->node);
+    }
+}
+
+void deinit_BookmarksSnapshot(iBookmarksSnapshot *d) {
+    iForEach(Hash, i, &d->bookmarks) {
+        delete_Bookmark((iBookmark *) i.value);
+    }
+    deinit_Hash(&d->bookmarks);
+}
+
+iDefineClass(BookmarksSnapshot)
+iDefineObjectConstructionArgs(BookmarksSnapshot, (const iBookmarks *bookmarks), bookmarks)
+
+const iBookmarksSnapshot *snapshot_Bookmarks(const iBookmarks *d) {
+    iBookmarks *mut = iConstCast(iBookmarks *, d);
+    lock_Mutex(d->mtx);
+    if (!d->snapshot || d->snapshot->generation != d->generation) {
+        /* Readers of the previous version hold their own references to it. */
+        iRelease(mut->snapshot);
+        mut->snapshot = new_BookmarksSnapshot(d);
+    }
+    const iBookmarksSnapshot *snap = ref_Object(d->snapshot);
+    unlock_Mutex(d->mtx);
+    return snap;
+}
+
+const iBookmark *get_BookmarksSnapshot(const iBookmarksSnapshot *d, uint32_t id) {
+    return (const iBookmark *) value_Hash(&d->bookmarks, id);
+}
+
+const iPtrArray *list_BookmarksSnapshot(const iBookmarksSnapshot *d, iBookmarksCompareFunc cmp,
+                                        iBookmarksFilterFunc filter, void *context) {
+    iPtrArray *list = listHash_Bookmarks_(&d->bookmarks, filter, context);
+    sortList_Bookmarks_(list, cmp);
+    return list;
+}
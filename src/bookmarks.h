@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #pragma once
 
 #include <the_Foundation/hash.h>
+#include <the_Foundation/object.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/string.h>
 #include <the_Foundation/time.h>
@@ -104,6 +105,12 @@ iBool       remove_Bookmarks            (iBookmarks *, uint32_t id);
 iBookmark * get_Bookmarks               (iBookmarks *, uint32_t id);
 void        reorder_Bookmarks           (iBookmarks *, uint32_t id, int newOrder);
 iBool       updateBookmarkIcon_Bookmarks(iBookmarks *, const iString *url, iChar icon);
+void        setTitle_Bookmarks          (iBookmarks *, uint32_t id, const iString *title);
+void        setUrl_Bookmarks            (iBookmarks *, uint32_t id, const iString *url);
+void        setTags_Bookmarks           (iBookmarks *, uint32_t id, const iString *tags);
+void        setUserIcon_Bookmarks       (iBookmarks *, uint32_t id, iChar icon); /* 0: no user icon */
+void        setFlags_Bookmarks          (iBookmarks *, uint32_t id, uint32_t flags, iBool set);
+void        setParent_Bookmarks         (iBookmarks *, uint32_t id, uint32_t parentId);
 void        setRecentFolder_Bookmarks   (iBookmarks *, uint32_t folderId);
 void        sort_Bookmarks              (iBookmarks *, uint32_t parentId, iBookmarksCompareFunc cmp);
 void        fetchRemote_Bookmarks       (iBookmarks *);
@@ -130,6 +137,17 @@ iBool       filterHomepage_Bookmark     (void *, const iBookmark *);
 const iPtrArray *list_Bookmarks(const iBookmarks *, iBookmarksCompareFunc cmp,
                                 iBookmarksFilterFunc filter, void *context);
 
+/* Background threads should read bookmarks via a snapshot: an immutable copy that is shared
+   by all readers until the bookmarks change. Writers never wait for readers; an old snapshot
+   is deleted when its last reader releases it. */
+iDeclareClass(BookmarksSnapshot)
+
+const iBookmarksSnapshot *snapshot_Bookmarks(const iBookmarks *); /* caller must iRelease */
+
+const iBookmark *get_BookmarksSnapshot  (const iBookmarksSnapshot *, uint32_t id);
+const iPtrArray *list_BookmarksSnapshot (const iBookmarksSnapshot *, iBookmarksCompareFunc cmp,
+                                         iBookmarksFilterFunc filter, void *context);
+
 enum iBookmarkListType {
     listByFolder_BookmarkListType,
     listByTag_BookmarkListType,
@@ -0,0 +1,328 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "contentcache.h"
+#include "app.h"
+#include "prefs.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/array.h>
+#include <the_Foundation/stringhash.h>
+#include <the_Foundation/stringset.h>
+#include <the_Foundation/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *dirName_ContentCache_       = "cache";
+static const char *indexFileName_ContentCache_ = "index.txt";
+
+iDeclareClass(ContentCacheEntry)
+iDeclareObjectConstruction(ContentCacheEntry)
+
+struct Impl_ContentCacheEntry {
+    iObject  object;
+    size_t   size;
+    uint64_t lastUsed; /* seconds since epoch */
+};
+
+void init_ContentCacheEntry(iContentCacheEntry *d) {
+    d->size     = 0;
+    d->lastUsed = 0;
+}
+
+void deinit_ContentCacheEntry(iContentCacheEntry *d) {
+    iUnused(d);
+}
+
+iDefineClass(ContentCacheEntry)
+iDefineObjectConstruction(ContentCacheEntry)
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(ContentCache)
+
+struct Impl_ContentCache {
+    iMutex *    mtx;
+    iString     dir;
+    iStringHash entries; /* hash => ContentCacheEntry */
+    size_t      totalSize;
+    iBool       isModified;
+    iStringSet *inUse;   /* keys stored since beginSave_ContentCache(), or NULL */
+};
+
+static iContentCache contentCache_;
+
+static uint64_t now_ContentCache_(void) {
+    iTime now;
+    initCurrent_Time(&now);
+    return (uint64_t) now.ts.tv_sec;
+}
+
+static const char *bodyPath_ContentCache_(const iContentCache *d, const iString *key) {
+    return concatPath_CStr(cstr_String(&d->dir), cstr_String(key));
+}
+
+static void load_ContentCache_(iContentCache *d) {
+    iFile *f = newCStr_File(concatPath_CStr(cstr_String(&d->dir), indexFileName_ContentCache_));
+    if (open_File(f, readOnly_FileMode | text_FileMode)) {
+        const iRangecc src  = range_Block(collect_Block(readAll_File(f)));
+        iRangecc       line = iNullRange;
+        while (nextSplit_Rangecc(src, "\n", &line)) {
+            /* Format: hash size lastUsed */
+            const char *end = line.start;
+            while (end != line.end && *end != ' ') end++;
+            if (end == line.start || end == line.end) continue;
+            char *endp = NULL;
+            const unsigned long long size     = strtoull(end, &endp, 10);
+            const unsigned long long lastUsed = strtoull(endp, NULL, 10);
+            iContentCacheEntry *entry = new_ContentCacheEntry();
+            entry->size     = (size_t) size;
+            entry->lastUsed = lastUsed;
+            d->totalSize += entry->size;
+            insert_StringHash(&d->entries, collectNewRange_String((iRangecc){ line.start, end }),
+                              entry);
+            iRelease(entry);
+        }
+    }
+    iRelease(f);
+}
+
+static size_t maxSize_ContentCache_(void) {
+    return (size_t) iMax(0, prefs_App()->maxDiskCacheSize) * 1000000;
+}
+
+static void removeOrphans_ContentCache_(iContentCache *d) {
+    /* Bodies that were written but never made it to the index, e.g., due to a crash. */
+    iForEach(DirFileInfo, i, iClob(directoryContents_FileInfo(iClob(new_FileInfo(&d->dir))))) {
+        const iString *path = path_FileInfo(i.value);
+        const iRangecc name = baseName_Path(path);
+        if (!equal_Rangecc(name, indexFileName_ContentCache_) &&
+            !value_StringHash(&d->entries, collectNewRange_String(name))) {
+            remove(cstr_String(path));
+        }
+    }
+}
+
+void init_ContentCache(const char *saveDir) {
+    iContentCache *d = &contentCache_;
+    d->mtx = new_Mutex();
+    initCStr_String(&d->dir, concatPath_CStr(saveDir, dirName_ContentCache_));
+    init_StringHash(&d->entries);
+    d->totalSize  = 0;
+    d->isModified = iFalse;
+    d->inUse      = NULL;
+    makeDirs_Path(&d->dir);
+    load_ContentCache_(d);
+    removeOrphans_ContentCache_(d);
+}
+
+void deinit_ContentCache(void) {
+    iContentCache *d = &contentCache_;
+    save_ContentCache();
+    iRelease(d->inUse);
+    deinit_StringHash(&d->entries);
+    deinit_String(&d->dir);
+    delete_Mutex(d->mtx);
+}
+
+static void trim_ContentCache_(iContentCache *d, size_t limit);
+
+void beginSave_ContentCache(void) {
+    iContentCache *d = &contentCache_;
+    lock_Mutex(d->mtx);
+    iRelease(d->inUse);
+    d->inUse = new_StringSet();
+    unlock_Mutex(d->mtx);
+}
+
+void save_ContentCache(void) {
+    iContentCache *d = &contentCache_;
+    lock_Mutex(d->mtx);
+    if (d->inUse) {
+        /* All the bodies that are still needed have now been stored. */
+        trim_ContentCache_(d, maxSize_ContentCache_());
+        iReleasePtr(&d->inUse);
+    }
+    if (d->isModified) {
+        iFile *f = newCStr_File(concatPath_CStr(cstr_String(&d->dir), indexFileName_ContentCache_));
+        if (open_File(f, writeOnly_FileMode | text_FileMode)) {
+            iString *line = new_String();
+            iConstForEach(StringHash, i, &d->entries) {
+                const iContentCacheEntry *entry = i.value->object;
+                format_String(line,
+                              "%s %zu %llu\n",
+                              cstr_String(key_StringHashConstIterator(&i)),
+                              entry->size,
+                              (unsigned long long) entry->lastUsed);
+                write_File(f, utf8_String(line));
+            }
+            delete_String(line);
+            d->isModified = iFalse;
+        }
+        iRelease(f);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static void remove_ContentCache_(iContentCache *d, const iString *key) {
+    const iContentCacheEntry *entry = value_StringHash(&d->entries, key);
+    if (entry) {
+        remove(bodyPath_ContentCache_(d, key));
+        d->totalSize -= entry->size;
+        remove_StringHash(&d->entries, key);
+        d->isModified = iTrue;
+    }
+}
+
+iDeclareType(ContentCacheCandidate)
+
+struct Impl_ContentCacheCandidate {
+    const iString *key;
+    uint64_t       lastUsed;
+};
+
+static int cmpLastUsed_ContentCacheCandidate_(const void *a, const void *b) {
+    const uint64_t s = ((const iContentCacheCandidate *) a)->lastUsed;
+    const uint64_t t = ((const iContentCacheCandidate *) b)->lastUsed;
+    return s < t ? -1 : s > t ? 1 : 0;
+}
+
+static void trim_ContentCache_(iContentCache *d, size_t limit) {
+    /* Evict the least recently used bodies that the saved state doesn't refer to. */
+    if (d->totalSize <= limit) {
+        return;
+    }
+    iArray *candidates = new_Array(sizeof(iContentCacheCandidate));
+    iConstForEach(StringHash, i, &d->entries) {
+        const iString *key = key_StringHashConstIterator(&i);
+        if (!d->inUse || !contains_StringSet(d->inUse, key)) {
+            const iContentCacheCandidate cand = {
+                collect_String(copy_String(key)),
+                ((const iContentCacheEntry *) i.value->object)->lastUsed
+            };
+            pushBack_Array(candidates, &cand);
+        }
+    }
+    sort_Array(candidates, cmpLastUsed_ContentCacheCandidate_);
+    iConstForEach(Array, j, candidates) {
+        if (d->totalSize <= limit) {
+            break;
+        }
+        remove_ContentCache_(d, ((const iContentCacheCandidate *) j.value)->key);
+    }
+    delete_Array(candidates);
+}
+
+void clear_ContentCache(void) {
+    iContentCache *d = &contentCache_;
+    lock_Mutex(d->mtx);
+    iConstForEach(StringHash, i, &d->entries) {
+        remove(bodyPath_ContentCache_(d, key_StringHashConstIterator(&i)));
+    }
+    clear_StringHash(&d->entries);
+    d->totalSize  = 0;
+    d->isModified = iTrue;
+    unlock_Mutex(d->mtx);
+}
+
+static void hashKey_ContentCache_(const iBlock *body, iString *key_out) {
+    uint8_t md5[16];
+    md5_Block(body, md5);
+    clear_String(key_out);
+    iForIndices(i, md5) {
+        appendFormat_String(key_out, "%02x", md5[i]);
+    }
+}
+
+iBool store_ContentCache(const iBlock *body, iString *key_out) {
+    iContentCache *d = &contentCache_;
+    const size_t limit = maxSize_ContentCache_();
+    if (size_Block(body) == 0 || size_Block(body) > limit) {
+        return iFalse;
+    }
+    hashKey_ContentCache_(body, key_out);
+    iBool ok = iFalse;
+    lock_Mutex(d->mtx);
+    iContentCacheEntry *entry = value_StringHash(&d->entries, key_out);
+    if (entry && entry->size == size_Block(body)) {
+        ok = iTrue; /* already have it */
+    }
+    else {
+        if (entry) {
+            remove_ContentCache_(d, key_out);
+        }
+        iFile *f = newCStr_File(bodyPath_ContentCache_(d, key_out));
+        if (open_File(f, writeOnly_FileMode)) {
+            ok = (write_File(f, body) == size_Block(body));
+        }
+        iRelease(f);
+        if (ok) {
+            entry = new_ContentCacheEntry();
+            entry->size = size_Block(body);
+            d->totalSize += entry->size;
+            insert_StringHash(&d->entries, key_out, entry);
+            iRelease(entry); /* owned by the hash */
+        }
+        else {
+            remove(bodyPath_ContentCache_(d, key_out));
+        }
+    }
+    if (ok) {
+        entry->lastUsed = now_ContentCache_();
+        d->isModified = iTrue;
+        if (d->inUse) {
+            insert_StringSet(d->inUse, key_out);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return ok;
+}
+
+iBool load_ContentCache(const iString *key, iBlock *body_out) {
+    iContentCache *d = &contentCache_;
+    iBool ok = iFalse;
+    lock_Mutex(d->mtx);
+    iContentCacheEntry *entry = value_StringHash(&d->entries, key);
+    if (entry) {
+        iFile *f = newCStr_File(bodyPath_ContentCache_(d, key));
+        if (open_File(f, readOnly_FileMode)) {
+            iBlock *data = readAll_File(f);
+            if (size_Block(data) == entry->size) {
+                set_Block(body_out, data);
+                entry->lastUsed = now_ContentCache_();
+                d->isModified = iTrue;
+                ok = iTrue;
+            }
+            delete_Block(data);
+        }
+        iRelease(f);
+        if (!ok) {
+            remove_ContentCache_(d, key); /* missing or damaged */
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return ok;
+}
@@ -39,8 +39,9 @@ enum iFileVersion {
     addedRecentUrlFlags_FileVersion     = 4,
     bookmarkFolderState_FileVersion     = 5,
     multipleWindows_FileVersion         = 6,
+    diskCachedContent_FileVersion       = 7,
     /* meta */
-    latest_FileVersion = 6, /* used by state.lgr */
+    latest_FileVersion = 7, /* used by state.lgr */
     idents_FileVersion = 1, /* used by GmCerts/idents.lgr */
 };
 
@@ -38,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/thread.h>
 #include <SDL_timer.h>
 #include <ctype.h>
+#include <string.h>
 
 iDeclareType(Feeds)
 iDeclareType(FeedJob)
@@ -88,6 +89,7 @@ struct Impl_FeedJob {
     iBool       isFirstUpdate; /* hasn't been checked ever before */
     iBool       checkHeadings;
     iBool       ignoreWeb;
+    int         numRedirects;
     iGmRequest *request;
     iPtrArray   results;
 };
@@ -99,6 +101,7 @@ static void init_FeedJob(iFeedJob *d, const iBookmark *bookmark) {
     init_PtrArray(&d->results);
     iZap(d->startTime);
     d->isFirstUpdate = iFalse;
+    d->numRedirects  = 0;
     d->checkHeadings = (bookmark->flags & headings_BookmarkFlag) != 0;
     d->ignoreWeb     = (bookmark->flags & ignoreWeb_BookmarkFlag) != 0;
 }
@@ -123,6 +126,22 @@ iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
 static const char *feedsFilename_Feeds_         = "feeds.txt";
 static const int   updateIntervalSeconds_Feeds_ = 4 * 60 * 60;
 
+/* Fingerprint of a subscription's source, used for skipping unchanged feeds. */
+iDeclareType(FeedSource)
+
+struct Impl_FeedSource {
+    iHashNode node; /* key: bookmark ID */
+    uint8_t   md5[16];
+    uint32_t  size;
+    int       flags; /* parsing options */
+    iTime     parsedAt;
+};
+
+enum iFeedSourceFlag {
+    headings_FeedSourceFlag  = iBit(1),
+    ignoreWeb_FeedSourceFlag = iBit(2),
+};
+
 struct Impl_Feeds {
     iMutex *  mtx;
     iString   saveDir;
@@ -131,21 +150,55 @@ struct Impl_Feeds {
     int       refreshTimer;
     iThread * worker;
     iBool     stopWorker;
+    iCondition wakeup; /* a request has finished or the worker should stop */
     iPtrArray jobs; /* pending */
     iSortedArray entries; /* pointers to all discovered feed entries, sorted by entry ID (URL) */
+    iHash     sources; /* FeedSource nodes */
 };
 
 static iFeeds feeds_;
 
-#define maxConcurrentRequests_Feeds 4
+static const int maxRedirects_FeedJob_ = 5;
+
+static void requestFinished_FeedJob_(iAnyObject *obj, iGmRequest *req) {
+    iFeeds *d = &feeds_;
+    iUnused(obj, req);
+    /* Wake up the worker. */
+    lock_Mutex(d->mtx);
+    signal_Condition(&d->wakeup);
+    unlock_Mutex(d->mtx);
+}
 
 static void submit_FeedJob_(iFeedJob *d) {
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, &d->url);
+    setPriority_GmRequest(d->request, background_GmRequestPriority, &feeds_);
+    iConnect(GmRequest, d->request, finished, d->request, requestFinished_FeedJob_);
     initCurrent_Time(&d->startTime);
     submit_GmRequest(d->request);
 }
 
+static iBool followRedirect_FeedJob_(iFeedJob *d) {
+    /* Resubmits the job if the feed has moved. */
+    if (category_GmStatusCode(status_GmRequest(d->request)) != categoryRedirect_GmStatusCode ||
+        d->numRedirects >= maxRedirects_FeedJob_) {
+        return iFalse;
+    }
+    const iString *dest = absoluteUrl_String(&d->url, meta_GmRequest(d->request));
+    if (!equalCase_Rangecc(urlScheme_String(dest), "gemini") || equal_String(dest, &d->url)) {
+        return iFalse;
+    }
+    set_String(&d->url, dest);
+    d->numRedirects++;
+    iReleasePtr(&d->request);
+    submit_FeedJob_(d);
+    return iTrue;
+}
+
+static iBool isSameHost_FeedJob_(const iFeedJob *d, const iFeedJob *other) {
+    return equalCase_Rangecc(urlHost_String(&d->url), urlHost_String(&other->url));
+}
+
 static iBool isSubscribed_(void *context, const iBookmark *bm) {
     iUnused(context);
     return (bm->flags & subscribed_BookmarkFlag) != 0;
@@ -155,14 +208,76 @@ static const iPtrArray *listSubscriptions_(void) {
     return list_Bookmarks(bookmarks_App(), NULL, isSubscribed_, NULL);
 }
 
-static iFeedJob *startNextJob_Feeds_(iFeeds *d) {
-    if (isEmpty_PtrArray(&d->jobs)) {
-        return NULL;
+static iFeedJob *startNextJob_Feeds_(iFeeds *d, const iPtrArray *ongoing) {
+    /* Only one request at a time per host, so capsules with many feeds aren't hammered. */
+    iForEach(PtrArray, i, &d->jobs) {
+        iFeedJob *job = i.ptr;
+        iBool isHostBusy = iFalse;
+        iConstForEach(PtrArray, j, ongoing) {
+            if (isSameHost_FeedJob_(job, j.ptr)) {
+                isHostBusy = iTrue;
+                break;
+            }
+        }
+        if (!isHostBusy) {
+            remove_PtrArrayIterator(&i);
+            submit_FeedJob_(job);
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static iBool isSourceChanged_Feeds_(iFeeds *d, const iFeedJob *job) {
+    /* Checks the received source against the fingerprint from the previous refresh, and
+       updates the fingerprint. Returns True if the source needs to be parsed. */
+    if (!isSuccess_GmStatusCode(status_GmRequest(job->request))) {
+        return iFalse; /* nothing to parse */
+    }
+    const iBlock *body  = body_GmRequest(job->request);
+    const int     flags = (job->checkHeadings ? headings_FeedSourceFlag : 0) |
+                          (job->ignoreWeb ? ignoreWeb_FeedSourceFlag : 0);
+    uint8_t md5[16];
+    md5_Block(body, md5);
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    iFeedSource *src = (iFeedSource *) value_Hash(&d->sources, job->bookmarkId);
+    /* Entries are forgotten if they haven't been seen in a while, so even an unchanged
+       source gets parsed every now and then. */
+    const iBool changed = !src || job->isFirstUpdate || src->size != size_Block(body) ||
+                          src->flags != flags || memcmp(src->md5, md5, sizeof(md5)) ||
+                          secondsSince_Time(&now, &src->parsedAt) > maxAge_Visited / 2;
+    if (changed) {
+        if (!src) {
+            src = iMalloc(FeedSource);
+            src->node.key = job->bookmarkId;
+            insert_Hash(&d->sources, &src->node);
+        }
+        memcpy(src->md5, md5, sizeof(md5));
+        src->size     = (uint32_t) size_Block(body);
+        src->flags    = flags;
+        src->parsedAt = now;
     }
-    iFeedJob *job;
-    take_PtrArray(&d->jobs, 0, (void **) &job);
-    submit_FeedJob_(job);
-    return job;
+    unlock_Mutex(d->mtx);
+    return changed;
+}
+
+static void removeSource_Feeds_(iFeeds *d, uint32_t bookmarkId) {
+    iHashNode *node = remove_Hash(&d->sources, bookmarkId);
+    if (node) {
+        free(node);
+    }
+}
+
+static iBool hasProgressed_Feeds_(const iPtrArray *ongoing) {
+    iConstForEach(PtrArray, i, ongoing) {
+        iFeedJob *job = i.ptr;
+        if (isFinished_GmRequest(job->request) || isTimedOut_FeedJob_(job)) {
+            return iTrue;
+        }
+    }
+    return iFalse;
 }
 
 static iBool isTrimmablePunctuation_(iChar c) {
@@ -278,13 +393,33 @@ static void save_Feeds_(iFeeds *d) {
         format_String(str, "%llu\n# Feeds\n", (unsigned long long)
                       integralSeconds_Time(&d->lastRefreshedAt));
         write_File(f, utf8_String(str));
+        /* Note: Saved in the worker thread, too. */
+        const iBookmarksSnapshot *bookmarks = snapshot_Bookmarks(bookmarks_App());
+        const iPtrArray *subs = list_BookmarksSnapshot(bookmarks, NULL, isSubscribed_, NULL);
         /* Index of feeds for IDs. */ {
-            iConstForEach(PtrArray, i, listSubscriptions_()) {
+            iConstForEach(PtrArray, i, subs) {
                 const iBookmark *bm = i.ptr;
                 format_String(str, "%08x %s\n", id_Bookmark(bm), cstr_String(&bm->url));
                 write_File(f, utf8_String(str));
             }
         }
+        /* Source fingerprints. */ {
+            writeData_File(f, "# Sources\n", 10);
+            iConstForEach(PtrArray, i, subs) {
+                const uint32_t     id  = id_Bookmark(i.ptr);
+                const iFeedSource *src = (const iFeedSource *) value_Hash(&d->sources, id);
+                if (src) {
+                    format_String(str, "%08x %x %u %llu ", id, src->flags, src->size,
+                                  (unsigned long long) integralSeconds_Time(&src->parsedAt));
+                    iForIndices(j, src->md5) {
+                        appendFormat_String(str, "%02x", src->md5[j]);
+                    }
+                    appendCStr_String(str, "\n");
+                    write_File(f, utf8_String(str));
+                }
+            }
+        }
+        iRelease(bookmarks);
         writeData_File(f, "# Entries\n", 10);
         iTime now;
         initCurrent_Time(&now);
@@ -436,56 +571,64 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
 static iThreadResult fetch_Feeds_(iThread *thread) {
     iFeeds *d = &feeds_;
     iUnused(thread);
-    iFeedJob *work[maxConcurrentRequests_Feeds]; /* We'll do a couple of concurrent requests. */
-    iZap(work);
+    const size_t maxConcurrent = iClamp(prefs_App()->maxFeedRequests, 1, 16);
+    iPtrArray ongoing;
+    init_PtrArray(&ongoing);
     iBool gotNew = iFalse;
     postCommand_App("feeds.update.started");
     const size_t totalJobs = size_PtrArray(&d->jobs);
     int numFinishedJobs = 0;
     while (!d->stopWorker) {
         /* Start new jobs. */
-        iForIndices(i, work) {
-            if (!work[i]) {
-                work[i] = startNextJob_Feeds_(d);
-            }
+        while (size_PtrArray(&ongoing) < maxConcurrent) {
+            iFeedJob *job = startNextJob_Feeds_(d, &ongoing);
+            if (!job) break;
+            pushBack_PtrArray(&ongoing, job);
         }
-        sleep_Thread(0.5); /* TODO: wait on a Condition so we can exit quickly */
+        /* Stop if everything has finished. */
+        if (isEmpty_PtrArray(&ongoing)) {
+            break;
+        }
+        /* Wait until a request finishes. Timeouts are checked once per second. */
+        lock_Mutex(d->mtx);
+        while (!d->stopWorker && !hasProgressed_Feeds_(&ongoing)) {
+            iTime until;
+            initTimeout_Time(&until, 1.0);
+            waitTimeout_Condition(&d->wakeup, d->mtx, &until);
+        }
+        unlock_Mutex(d->mtx);
         if (d->stopWorker) break;
-        size_t ongoing = 0;
         iBool doNotify = iFalse;
-        iForIndices(i, work) {
-            if (work[i]) {
-                if (isFinished_GmRequest(work[i]->request)) {
-                    /* TODO: Handle redirects. Need to resubmit the job with new URL. */
-                    parseResult_FeedJob_(work[i]);
-                    gotNew |= updateEntries_Feeds_(
-                        d, work[i]->checkHeadings, work[i]->bookmarkId, &work[i]->results);
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
-                    numFinishedJobs++;
-                    doNotify = iTrue;
-                }
-                else if (isTimedOut_FeedJob_(work[i])) {
-                    /* Maybe we'll get it next time! */
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
-                    numFinishedJobs++;
-                    doNotify = iTrue;
+        iForEach(PtrArray, i, &ongoing) {
+            iFeedJob *job = i.ptr;
+            if (isFinished_GmRequest(job->request)) {
+                if (followRedirect_FeedJob_(job)) {
+                    continue;
                 }
-                else {
-                    ongoing++;
+                if (isSourceChanged_Feeds_(d, job)) {
+                    parseResult_FeedJob_(job);
+                    gotNew |= updateEntries_Feeds_(
+                        d, job->checkHeadings, job->bookmarkId, &job->results);
                 }
-                /* TODO: abort job if it takes too long (> 15 seconds?) */
             }
+            else if (!isTimedOut_FeedJob_(job)) {
+                continue;
+            }
+            /* Finished or timed out; maybe we'll get it next time! */
+            remove_PtrArrayIterator(&i);
+            delete_FeedJob(job);
+            numFinishedJobs++;
+            doNotify = iTrue;
         }
         if (doNotify) {
             postCommandf_App("feeds.update.progress arg:%d total:%zu", numFinishedJobs, totalJobs);
         }
-        /* Stop if everything has finished. */
-        if (ongoing == 0 && isEmpty_PtrArray(&d->jobs)) {
-            break;
-        }
     }
+    /* Abandon unfinished requests if stopped. */
+    iForEach(PtrArray, j, &ongoing) {
+        delete_FeedJob(j.ptr);
+    }
+    deinit_PtrArray(&ongoing);
     initCurrent_Time(&d->lastRefreshedAt);
     save_Feeds_(d);
     /* Check if there are visited URLs marked as Kept that can be cleared because they are no
@@ -497,13 +640,16 @@ static iThreadResult fetch_Feeds_(iThread *thread) {
             insert_StringSet(knownEntryUrls, &entry->url);
         }
         unlock_Mutex(d->mtx);
-        iConstForEach(PtrArray, j, listKept_Visited(visited_App())) {
-            iVisitedUrl *visUrl = j.ptr;
-            if (!contains_StringSet(knownEntryUrls, &visUrl->url)) {
-                visUrl->flags &= ~kept_VisitedUrlFlag;
+        const iVisitedSnapshot *visited = snapshot_Visited(visited_App());
+        for (size_t j = 0; j < size_VisitedSnapshot(visited); j++) {
+            const iVisitedUrl *visUrl = at_VisitedSnapshot(visited, j);
+            if (visUrl->flags & kept_VisitedUrlFlag &&
+                !contains_StringSet(knownEntryUrls, &visUrl->url)) {
+                setUrlKept_Visited(visited_App(), &visUrl->url, iFalse);
 //                printf("unkept: {%s}\n", cstr_String(&visUrl->url));
             }
         }
+        iRelease(visited);
         iRelease(knownEntryUrls);
     }
     postCommandf_App("feeds.update.finished arg:%d unread:%zu", gotNew ? 1 : 0,
@@ -544,7 +690,10 @@ static uint32_t refresh_Feeds_(uint32_t interval, void *data) {
 
 static void stopWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
+        lock_Mutex(d->mtx);
         d->stopWorker = iTrue;
+        signal_Condition(&d->wakeup);
+        unlock_Mutex(d->mtx);
         join_Thread(d->worker);
         iReleasePtr(&d->worker);
     }
@@ -589,6 +738,10 @@ static void load_Feeds_(iFeeds *d) {
                 section = 2;
                 continue;
             }
+            else if (equal_Rangecc(line, "# Sources")) {
+                section = 3;
+                continue;
+            }
             switch (section) {
                 case 0: {
                     unsigned long long ts = 0;
@@ -665,6 +818,32 @@ static void load_Feeds_(iFeeds *d) {
                     delete_String(url);
                     break;
                 }
+                case 3: {
+                    uint32_t           id = 0, size = 0;
+                    int                flags = 0;
+                    unsigned long long parsedAt = 0;
+                    char               hex[33];
+                    if (sscanf(line.start, "%08x %x %u %llu %32s", &id, &flags, &size, &parsedAt,
+                               hex) == 5 && strlen(hex) == 32) {
+                        const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+                        if (node) {
+                            iFeedSource *src = iMalloc(FeedSource);
+                            src->node.key = node->bookmarkId;
+                            src->size     = size;
+                            src->flags    = flags;
+                            iZap(src->parsedAt);
+                            src->parsedAt.ts.tv_sec = parsedAt;
+                            iForIndices(j, src->md5) {
+                                unsigned int byte = 0;
+                                sscanf(hex + 2 * j, "%02x", &byte);
+                                src->md5[j] = (uint8_t) byte;
+                            }
+                            removeSource_Feeds_(d, node->bookmarkId);
+                            insert_Hash(&d->sources, &src->node);
+                        }
+                    }
+                    break;
+                }
             }
         }
     aborted:
@@ -687,8 +866,11 @@ void init_Feeds(const char *saveDir) {
     init_IntSet(&d->previouslyCheckedFeeds);
     iZap(d->lastRefreshedAt);
     d->worker = NULL;
+    d->stopWorker = iFalse;
+    init_Condition(&d->wakeup);
     init_PtrArray(&d->jobs);
     init_SortedArray(&d->entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
+    init_Hash(&d->sources);
     load_Feeds_(d);
     /* Update feeds if it has been a while. */
     int intervalSec = updateIntervalSeconds_Feeds_;
@@ -706,6 +888,7 @@ void deinit_Feeds(void) {
     iAssert(isEmpty_PtrArray(&d->jobs));
     deinit_PtrArray(&d->jobs);
     deinit_String(&d->saveDir);
+    deinit_Condition(&d->wakeup);
     delete_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
@@ -713,6 +896,10 @@ void deinit_Feeds(void) {
     }
     deinit_IntSet(&d->previouslyCheckedFeeds);
     deinit_SortedArray(&d->entries);
+    iForEach(Hash, s, &d->sources) {
+        free(s.value);
+    }
+    deinit_Hash(&d->sources);
 }
 
 void refresh_Feeds(void) {
@@ -725,6 +912,7 @@ void refreshFinished_Feeds(void) {
 
 void removeEntries_Feeds(uint32_t feedBookmarkId) {
     iFeeds *d = &feeds_;
+    iGuardMutex(d->mtx, removeSource_Feeds_(d, feedBookmarkId)); /* parse again if resubscribed */
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
         if ((*entry)->bookmarkId == feedBookmarkId) {
@@ -0,0 +1,260 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "fuzzymatch.h"
+
+#include <the_Foundation/array.h>
+
+#include <stddef.h>
+#include <string.h>
+
+/* Latin-1 Supplement and Latin Extended-A letters without diacritics, from U+00DF. */
+static const char *latinBase_FuzzyQuery_ =
+    "saaaaaaaceeeeiiiidnooooo ouuuuyt"
+    "yaaaaaaccccccccddddeeeeeeeeeeggg"
+    "ggggghhhhiiiiiiiiiiiijjkkkllllll"
+    "llllnnnnnnnnnoooooooorrrrrrsssss"
+    "sssttttttuuuuuuuuuuuuwwyyyzzzzzz"
+    "s";
+
+static uint64_t charMask_(char ch) {
+    if (ch >= 'a' && ch <= 'z') {
+        return (uint64_t) 1 << (ch - 'a');
+    }
+    if (ch >= '0' && ch <= '9') {
+        return (uint64_t) 1 << (26 + ch - '0');
+    }
+    return 0; /* other characters are not prefiltered */
+}
+
+static uint64_t mask_(const char *text, size_t len) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < len; i++) {
+        mask |= charMask_(text[i]);
+    }
+    return mask;
+}
+
+void fold_FuzzyQuery(iRangecc text, iString *folded_out) {
+    clear_String(folded_out);
+    for (const char *pos = text.start; pos < text.end; ) {
+        const unsigned char ascii = *pos;
+        if (ascii < 0x80) {
+            const char lower = (ascii >= 'A' && ascii <= 'Z' ? ascii + ('a' - 'A') : ascii);
+            appendData_Block(&folded_out->chars, &lower, 1);
+            pos++;
+            continue;
+        }
+        iChar ch  = 0;
+        int   len = decodeBytes_MultibyteChar(pos, text.end, &ch);
+        if (len <= 0) {
+            pos++; /* invalid UTF-8 */
+            continue;
+        }
+        ch = lower_Char(ch);
+        if (ch >= 0xdf && ch < 0x180 && latinBase_FuzzyQuery_[ch - 0xdf] != ' ') {
+            appendData_Block(&folded_out->chars, &latinBase_FuzzyQuery_[ch - 0xdf], 1);
+        }
+        else {
+            appendChar_String(folded_out, ch);
+        }
+        pos += len;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_FuzzyQuery {
+    iStringArray words; /* folded */
+    uint64_t     mask;  /* characters present in all the words */
+};
+
+void init_FuzzyQuery(iFuzzyQuery *d, const iString *query) {
+    init_StringArray(&d->words);
+    d->mask = 0;
+    iString *folded = new_String();
+    fold_FuzzyQuery(range_String(query), folded);
+    iRangecc word = iNullRange;
+    while (nextSplit_Rangecc(range_String(folded), " ", &word)) {
+        if (!isEmpty_Range(&word)) {
+            pushBackRange_StringArray(&d->words, word);
+            d->mask |= mask_(word.start, size_Range(&word));
+        }
+    }
+    delete_String(folded);
+}
+
+void deinit_FuzzyQuery(iFuzzyQuery *d) {
+    deinit_StringArray(&d->words);
+}
+
+iDefineTypeConstructionArgs(FuzzyQuery, (const iString *query), query)
+
+iBool isEmpty_FuzzyQuery(const iFuzzyQuery *d) {
+    return isEmpty_StringArray(&d->words);
+}
+
+static const char *find_(const char *pos, const char *end, const iString *word) {
+    /* memchr is vectorized in most C libraries, so candidates are found quickly. */
+    const char  *wordStart = cstr_String(word);
+    const size_t wordLen   = size_String(word);
+    while (end - pos >= (ptrdiff_t) wordLen) {
+        const char *found = memchr(pos, wordStart[0], end - pos - wordLen + 1);
+        if (!found) {
+            break;
+        }
+        if (!memcmp(found, wordStart, wordLen)) {
+            return found;
+        }
+        pos = found + 1;
+    }
+    return NULL;
+}
+
+static const char *findSubsequence_(const char *pos, const char *end, const iString *word,
+                                    const char **end_out) {
+    /* The characters of the word in order, possibly with a few others in between. */
+    const char  *wordStart = cstr_String(word);
+    const size_t wordLen   = size_String(word);
+    const char  *start     = memchr(pos, wordStart[0], end - pos);
+    while (start) {
+        const char *maxEnd = start + 2 * wordLen < end ? start + 2 * wordLen : end;
+        const char *at     = start + 1;
+        size_t      i      = 1;
+        for (; at < maxEnd && i < wordLen; at++) {
+            if (*at == wordStart[i]) {
+                i++;
+            }
+        }
+        if (i == wordLen) {
+            *end_out = at;
+            return start;
+        }
+        start = memchr(start + 1, wordStart[0], end - start - 1);
+    }
+    return NULL;
+}
+
+static iBool isWordStart_(const char *text, const char *pos) {
+    return pos == text || !(charMask_(pos[-1]) || (unsigned char) pos[-1] >= 0x80);
+}
+
+static float matchFolded_FuzzyQuery_(const iFuzzyQuery *d, const char *text, size_t len,
+                                     uint64_t textMask) {
+    if (isEmpty_StringArray(&d->words) || (textMask & d->mask) != d->mask) {
+        return 0.0f;
+    }
+    /* The words must appear in order. A match near the beginning or at the start of a word
+       is scored higher. Inexact matches get a lower score. */
+    const char *end   = text + len;
+    const char *pos   = text;
+    float       score = 0.0f;
+    iBool       isFirst = iTrue;
+    size_t      first = 0;
+    iConstForEach(StringArray, i, &d->words) {
+        const size_t wordLen = size_String(i.value);
+        const char  *found   = find_(pos, end, i.value);
+        float        weight  = 1.0f;
+        const char  *after   = found ? found + wordLen : NULL;
+        if (!found) {
+            if (wordLen < 3 || !(found = findSubsequence_(pos, end, i.value, &after))) {
+                return 0.0f;
+            }
+            weight = 0.25f;
+        }
+        if (isWordStart_(text, found)) {
+            weight *= 2;
+        }
+        if (isFirst) {
+            first   = found - text;
+            isFirst = iFalse;
+        }
+        score += weight * wordLen;
+        pos = after;
+    }
+    return score / (1.0f + first / 16.0f);
+}
+
+float match_FuzzyQuery(const iFuzzyQuery *d, iRangecc text) {
+    if (isEmpty_Range(&text)) {
+        return 0.0f;
+    }
+    iString *folded = new_String();
+    fold_FuzzyQuery(text, folded);
+    const float score = matchFolded_FuzzyQuery_(
+        d, cstr_String(folded), size_String(folded), mask_(cstr_String(folded), size_String(folded)));
+    delete_String(folded);
+    return score;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(FuzzyIndexEntry)
+
+struct Impl_FuzzyIndexEntry {
+    size_t   pos; /* in `texts` */
+    size_t   len;
+    uint64_t mask;
+};
+
+struct Impl_FuzzyIndex {
+    iBlock texts;   /* folded, concatenated */
+    iArray entries; /* FuzzyIndexEntry */
+};
+
+void init_FuzzyIndex(iFuzzyIndex *d) {
+    init_Block(&d->texts, 0);
+    init_Array(&d->entries, sizeof(iFuzzyIndexEntry));
+}
+
+void deinit_FuzzyIndex(iFuzzyIndex *d) {
+    deinit_Array(&d->entries);
+    deinit_Block(&d->texts);
+}
+
+iDefineTypeConstruction(FuzzyIndex)
+
+void clear_FuzzyIndex(iFuzzyIndex *d) {
+    clear_Block(&d->texts);
+    clear_Array(&d->entries);
+}
+
+size_t add_FuzzyIndex(iFuzzyIndex *d, iRangecc text) {
+    iString *folded = new_String();
+    fold_FuzzyQuery(text, folded);
+    const iFuzzyIndexEntry entry = { .pos  = size_Block(&d->texts),
+                                     .len  = size_String(folded),
+                                     .mask = mask_(cstr_String(folded), size_String(folded)) };
+    append_Block(&d->texts, &folded->chars);
+    pushBack_Array(&d->entries, &entry);
+    delete_String(folded);
+    return size_Array(&d->entries) - 1;
+}
+
+size_t size_FuzzyIndex(const iFuzzyIndex *d) {
+    return size_Array(&d->entries);
+}
+
+float match_FuzzyIndex(const iFuzzyIndex *d, size_t entry, const iFuzzyQuery *query) {
+    const iFuzzyIndexEntry *e = constAt_Array(&d->entries, entry);
+    return matchFolded_FuzzyQuery_(query, constBegin_Block(&d->texts) + e->pos, e->len, e->mask);
+}
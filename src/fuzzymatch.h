@@ -0,0 +1,49 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/range.h>
+#include <the_Foundation/string.h>
+#include <the_Foundation/stringarray.h>
+
+/* Case-insensitive matching of search words against short texts such as titles and URLs.
+   Texts are folded to lowercase with Latin diacritics removed. A mask of the characters
+   present in each text is used to quickly reject texts that cannot match. */
+
+iDeclareType(FuzzyQuery)
+iDeclareTypeConstructionArgs(FuzzyQuery, const iString *query)
+
+iBool       isEmpty_FuzzyQuery  (const iFuzzyQuery *);
+float       match_FuzzyQuery    (const iFuzzyQuery *, iRangecc text); /* zero if no match */
+
+void        fold_FuzzyQuery     (iRangecc text, iString *folded_out);
+
+/* Prebuilt index of folded texts, for matching against a large number of texts. */
+
+iDeclareType(FuzzyIndex)
+iDeclareTypeConstruction(FuzzyIndex)
+
+void        clear_FuzzyIndex    (iFuzzyIndex *);
+size_t      add_FuzzyIndex      (iFuzzyIndex *, iRangecc text); /* returns entry number */
+size_t      size_FuzzyIndex     (const iFuzzyIndex *);
+float       match_FuzzyIndex    (const iFuzzyIndex *, size_t entry, const iFuzzyQuery *query);
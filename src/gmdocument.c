@@ -35,12 +35,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "defs.h"
 
 #include <the_Foundation/intset.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/stringarray.h>
 #include <the_Foundation/stringset.h>
+#include <the_Foundation/thread.h>
+
+#include <SDL_cpuinfo.h>
 
 #include <ctype.h>
+#include <limits.h>
 
 iBool isDark_GmDocumentTheme(enum iGmDocumentTheme d) {
     if (d == gray_GmDocumentTheme) {
@@ -152,18 +157,101 @@ static uint32_t themeHash_(const iBlock *data) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(GmRunIndex)
+
+enum iGmRunIndexKey {
+    visBottom_GmRunIndexKey, /* bottom of `visBounds`, any run */
+    hitBottom_GmRunIndexKey, /* bottom of `bounds`, non-decoration runs only */
+    textEnd_GmRunIndexKey,   /* end offset of text in the source, non-decoration runs only */
+    max_GmRunIndexKey
+};
+
+/* The layout is generated from top to bottom, so these running maximums are monotonic and
+   can be binary searched. Each element corresponds to the GmRun at the same index. */
+struct Impl_GmRunIndex {
+    int max[max_GmRunIndexKey];
+};
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(GmLayoutState)
+
+/* Layout is done line by line from top to bottom. The state between lines is kept so that
+   layout can be continued when more source is appended. */
+struct Impl_GmLayoutState {
+    size_t           sourcePos; /* where the next line begins in the normalized source */
+    size_t           numRuns;
+    size_t           numLinks;
+    size_t           numHeadings;
+    size_t           numPreMeta;
+    size_t           numAuxText;
+    iBool            hasTitle;
+    iInt2            pos;
+    iBool            isFirstText;
+    iBool            addQuoteIcon;
+    iBool            isPreformat;
+    int              preFont;
+    uint16_t         preId;
+    iBool            enableIndents;
+    enum iGmLineType prevType;
+    enum iGmLineType prevNonBlankType;
+    iBool            followsBlank;
+};
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(GmLayoutJob)
+iDeclareType(GmLayoutPrefs)
+iDeclareType(GmLinkMedia)
+
+/* Settings that affect layout. Snapshots use the values that were current when the snapshot
+   was made, so the background thread doesn't need to access the app or the window. */
+struct Impl_GmLayoutPrefs {
+    float lineSpacing;
+    float imageScale; /* images are not scaled up more than this (pixel ratio and zoom) */
+    int   maxUrlSize;
+    iBool monospaceGemini;
+    iBool monospaceGopher;
+    iBool bigFirstParagraph;
+    iBool quoteIcon;
+    iBool collapsePreOnLoad;
+    iBool plainTextWrap;
+    iBool boldLinkVisited;
+};
+
+/* Media of a link as seen by a snapshot. */
+struct Impl_GmLinkMedia {
+    iGmLinkId linkId;
+    iMediaId  media;
+    iString   mime;
+    size_t    numBytes;
+    iBool     isPermanent;
+    iInt2     imageSize;
+};
+
 struct Impl_GmDocument {
     iObject object;
     enum iSourceFormat format;
     iString   unormSource; /* unnormalized source */
     iString   source;      /* normalized source */
+    size_t    unormPos;    /* how much of `unormSource` has been normalized */
+    iBool     isNormPreformat; /* normalization is inside a preformatted block at `unormPos` */
+    iBool     isSourceFinal; /* no more content will be appended */
+    enum iSourceFormat sourceFormat; /* format requested for the current source */
     iString   url;         /* for resolving relative links */
     iString   localHost;
     iInt2     size;
     int       outsideMargin;
     iBool     enableCommandLinks; /* `about:command?` only allowed on selected pages */
     iBool     isLayoutInvalidated;
+    iGmLayoutState layoutState;
+    iGmLayoutPrefs layoutPrefs;
+    iGmLayoutJob *layoutJob; /* layout running in the background */
+    const iAtomicInt *layoutCancel; /* set if this is a snapshot laid out in the background */
+    iBool     isLayoutAborted;
+    uint32_t  revision; /* incremented when the document is modified */
     iArray    layout; /* contents of source, laid out in document space */
+    iArray    runIndex; /* GmRunIndex for each run in `layout` */
     iStringArray auxText; /* generated text that appears on the page but is not part of the source */
     iPtrArray links;
     iString   title; /* the first top-level title */
@@ -172,23 +260,74 @@ struct Impl_GmDocument {
     iGmTheme  theme;
     uint32_t  themeSeed;
     iChar     siteIcon;
-    iMedia *  media;
+    iMedia *  media;       /* NULL in snapshots */
+    iArray *  linkMedia;   /* snapshots only: media of the links */
     iStringSet *openURLs; /* currently open URLs for highlighting links */
     int       warnings;
     iBool     isPaletteValid;
     iColor    palette[tmMax_ColorId]; /* copy of the color palette */
 };
 
+/* A layout job lays out a snapshot of the document in a background thread. The document
+   keeps its current layout until the job has finished and the result is taken into use. */
+struct Impl_GmLayoutJob {
+    iGmDocument *doc;
+    iGmDocument *snapshot;
+    iText *      text;     /* measuring copy of the window's fonts */
+    int          width;
+    int          canvasWidth;
+    uint32_t     revision; /* of `doc` when the snapshot was made */
+    iAtomicInt   isCancelled;
+    iAtomicInt   isFinished;
+    iThread *    thread;
+};
+
 iDefineObjectConstruction(GmDocument)
 
+static iRegExp *linkPattern_;
+static iRegExp *ansiPattern_;
+
+static void initPatterns_GmDocument_(void) {
+    /* Created in the main thread before any layout happens in the background. */
+    if (!linkPattern_) {
+        linkPattern_ = newGemtextLink_RegExp();
+        ansiPattern_ = makeAnsiEscapePattern_Text(iTrue /* with ESC */);
+    }
+}
+
+static void updateLayoutPrefs_GmDocument_(iGmDocument *d, const iWindow *window) {
+    const iPrefs *  prefs = prefs_App();
+    iGmLayoutPrefs *lp    = &d->layoutPrefs;
+    lp->lineSpacing       = prefs->lineSpacing;
+    lp->maxUrlSize        = prefs->maxUrlSize;
+    lp->monospaceGemini   = prefs->monospaceGemini;
+    lp->monospaceGopher   = prefs->monospaceGopher;
+    lp->bigFirstParagraph = prefs->bigFirstParagraph;
+    lp->quoteIcon         = prefs->quoteIcon;
+    lp->collapsePreOnLoad = prefs->collapsePreOnLoad;
+    lp->plainTextWrap     = prefs->plainTextWrap;
+    lp->boldLinkVisited   = prefs->boldLinkVisited;
+    if (window) {
+        lp->imageScale = window->pixelRatio * iMax(1.0f, prefs->zoomPercent / 100.0f);
+    }
+}
+
+static const iGmLayoutPrefs *layoutPrefs_GmDocument_(const iGmDocument *d) {
+    if (!d->layoutCancel) {
+        /* Not a snapshot, so follow the current settings. */
+        updateLayoutPrefs_GmDocument_((iGmDocument *) d, get_Window());
+    }
+    return &d->layoutPrefs;
+}
+
 static iBool isForcedMonospace_GmDocument_(const iGmDocument *d) {
     const iRangecc scheme = urlScheme_String(&d->url);
     if (equalCase_Rangecc(scheme, "gemini")) {
-        return prefs_App()->monospaceGemini;
+        return layoutPrefs_GmDocument_(d)->monospaceGemini;
     }
     if (equalCase_Rangecc(scheme, "gopher") ||
         equalCase_Rangecc(scheme, "finger")) {
-        return prefs_App()->monospaceGopher;
+        return layoutPrefs_GmDocument_(d)->monospaceGopher;
     }
     return iFalse;
 }
@@ -280,7 +419,7 @@ static int lastVisibleRunBottom_GmDocument_(const iGmDocument *d) {
         if (isEmpty_Range(&run->text)) {
             continue;
         }
-        return top_Rect(run->bounds) + height_Rect(run->bounds) * prefs_App()->lineSpacing;
+        return top_Rect(run->bounds) + height_Rect(run->bounds) * d->layoutPrefs.lineSpacing;
     }
     return 0;
 }
@@ -322,19 +461,15 @@ static iBool isAllowedLinkIcon_Char_(iChar icon) {
 
 static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *linkId) {
     /* Returns the human-readable label of the link. */
-    static iRegExp *pattern_;
-    if (!pattern_) {
-        pattern_ = newGemtextLink_RegExp();
-    }
     iRegExpMatch m;
     init_RegExpMatch(&m);
-    if (matchRange_RegExp(pattern_, line, &m)) {
+    if (matchRange_RegExp(linkPattern_, line, &m)) {
         iGmLink *link = new_GmLink();
         link->urlRange = capturedRange_RegExpMatch(&m, 1);
         setRange_String(&link->url, link->urlRange);
         set_String(&link->url, canonicalUrl_String(absoluteUrl_String(&d->url, &link->url)));
         /* If invalid, disregard the link. */
-        if ((d->format == gemini_SourceFormat && size_String(&link->url) > prefs_App()->maxUrlSize) ||
+        if ((d->format == gemini_SourceFormat && size_String(&link->url) > d->layoutPrefs.maxUrlSize) ||
             (startsWithCase_String(&link->url, "about:command")
              /* this is a special internal page that allows submitting UI events */
              && !d->enableCommandLinks)) {
@@ -477,7 +612,7 @@ static void linkContentWasLaidOut_GmDocument_(iGmDocument *d, const iGmMediaInfo
 }
 
 static iBool isNormalized_GmDocument_(const iGmDocument *d) {
-    const iPrefs *prefs = prefs_App();
+    const iGmLayoutPrefs *prefs = layoutPrefs_GmDocument_(d);
     if (d->format == plainText_SourceFormat) {
         return iTrue; /* tabs are always normalized in plain text */
     }
@@ -540,6 +675,7 @@ struct Impl_RunTypesetter {
     iBool  isPreformat;
     int    baseFont;
     int    baseColor;
+    float  lineSpacing;
 };
     
 static void init_RunTypesetter_(iRunTypesetter *d) {
@@ -616,16 +752,400 @@ static iBool typesetOneLine_RunTypesetter_(iWrapText *wrap, iRangecc wrapRange,
 //    printf("origin:%d isRTL:%d\n{%s}\n", origin, attrib.isBaseRTL, cstr_Rangecc(wrapRange));
     pushBack_Array(&d->layout, &d->run);
     d->run.flags &= ~startOfLine_GmRunFlag;
-    d->pos.y += lineHeight_Text(d->baseFont) * prefs_App()->lineSpacing;
+    d->pos.y += lineHeight_Text(d->baseFont) * d->lineSpacing;
     return iTrue; /* continue to next wrapped line */
 }
 
-static void doLayout_GmDocument_(iGmDocument *d) {
-    static iRegExp *ansiPattern_;
-    if (!ansiPattern_) {
-        ansiPattern_ = makeAnsiEscapePattern_Text(iTrue /* with ESC */);
+/*----------------------------------------------------------------------------------------------*/
+
+/* Wrapping a line only depends on its text, font, and maximum width. Large documents are
+   wrapped ahead of time in parallel, a batch of lines at a time. The sequential layout pass
+   then replays the wrapped segments when its choice of font and width matches the prediction
+   (e.g., the lede paragraph and links are always wrapped during the sequential pass).
+   A batch is split into tasks that are run by a pool of worker threads. The thread doing
+   the layout runs one of the tasks itself and then waits for the rest. */
+
+iDeclareType(GmWrapSegment)
+iDeclareType(GmPrewrap)
+iDeclareType(GmPrewrapTask)
+iDeclareType(GmPrewrapper)
+iDeclareType(GmPrewrapPool)
+
+struct Impl_GmWrapSegment {
+    iRangecc    text;
+    iTextAttrib attrib;
+    int         origin;
+    int         advance;
+};
+
+struct Impl_GmPrewrap {
+    iRangecc line;
+    int      font;
+    int      maxWidth;
+    int      baseDir;
+    int      task;
+    size_t   firstSegment;
+    size_t   numSegments;
+};
+
+enum iGmPrewrapLimits {
+    maxTasks_GmPrewrap          = 8,
+    minSourceSize_GmPrewrap     = 64 * 1024, /* smaller documents are laid out fast enough */
+    batchSourceSize_GmPrewrap   = 64 * 1024,
+};
+
+struct Impl_GmPrewrapTask {
+    iGmPrewrapper *owner;
+    int            index;
+    size_t         first; /* range of `owner->lines` */
+    size_t         end;
+    iArray         segments;
+};
+
+struct Impl_GmPrewrapper {
+    iText *          text;  /* measures text; same as the layout thread's current Text */
+    iArray           lines; /* in source order */
+    size_t           pos;   /* next line to be looked up */
+    const char *     end;   /* end of the current batch */
+    int              numTasks;
+    int              numPending; /* tasks not finished yet; guarded by the pool mutex */
+    iGmPrewrapTask   tasks[maxTasks_GmPrewrap];
+};
+
+struct Impl_GmPrewrapPool {
+    iMutex *   mtx;
+    iCondition taskAvailable; /* wakes up idle workers */
+    iCondition taskFinished;
+    iPtrArray  pending;
+    iPtrArray  workers;
+    iBool      isQuitting;
+};
+
+static iGmPrewrapPool prewrapPool_;
+
+static iBool collectSegment_GmPrewrapTask_(iWrapText *wrap, iRangecc wrapRange,
+                                           iTextAttrib attrib, int origin, int advance) {
+    iGmPrewrapTask *d = wrap->context;
+    pushBack_Array(&d->segments, &(iGmWrapSegment){ wrapRange, attrib, origin, advance });
+    return iTrue;
+}
+
+static void run_GmPrewrapTask_(iGmPrewrapTask *d) {
+    iText *oldText = current_Text();
+    setCurrent_Text(d->owner->text);
+    for (size_t i = d->first; i < d->end; i++) {
+        iGmPrewrap *pre   = at_Array(&d->owner->lines, i);
+        iWrapText   wrap  = { .text     = pre->line,
+                              .maxWidth = pre->maxWidth,
+                              .mode     = word_WrapTextMode,
+                              .wrapFunc = collectSegment_GmPrewrapTask_,
+                              .context  = d };
+        pre->task         = d->index;
+        pre->firstSegment = size_Array(&d->segments);
+        measure_WrapText(&wrap, pre->font);
+        pre->numSegments  = size_Array(&d->segments) - pre->firstSegment;
+        pre->baseDir      = wrap.baseDir;
+    }
+    setCurrent_Text(oldText);
+}
+
+static iThreadResult run_GmPrewrapPool_(iThread *thread) {
+    iGmPrewrapPool *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (isEmpty_PtrArray(&d->pending) && !d->isQuitting) {
+            wait_Condition(&d->taskAvailable, d->mtx);
+        }
+        if (d->isQuitting) {
+            break;
+        }
+        iGmPrewrapTask *task = NULL;
+        take_PtrArray(&d->pending, 0, (void **) &task);
+        unlock_Mutex(d->mtx);
+        run_GmPrewrapTask_(task);
+        lock_Mutex(d->mtx);
+        if (--task->owner->numPending == 0) {
+            broadcast_Condition(&d->taskFinished);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_GmPrewrapPool(void) {
+    iGmPrewrapPool *d = &prewrapPool_;
+    d->mtx = new_Mutex();
+    init_Condition(&d->taskAvailable);
+    init_Condition(&d->taskFinished);
+    init_PtrArray(&d->pending);
+    init_PtrArray(&d->workers);
+    d->isQuitting = iFalse;
+    /* The thread doing the layout runs one of the tasks. */
+    const int numWorkers = iMin(SDL_GetCPUCount(), maxTasks_GmPrewrap) - 1;
+    for (int i = 0; i < numWorkers; i++) {
+        iThread *worker = new_Thread(run_GmPrewrapPool_);
+        setUserData_Thread(worker, d);
+        pushBack_PtrArray(&d->workers, worker);
+        start_Thread(worker);
+    }
+}
+
+void deinit_GmPrewrapPool(void) {
+    iGmPrewrapPool *d = &prewrapPool_;
+    iGuardMutex(d->mtx, {
+        d->isQuitting = iTrue;
+        broadcast_Condition(&d->taskAvailable);
+    });
+    iForEach(PtrArray, w, &d->workers) {
+        join_Thread(w.ptr);
+        iRelease(w.ptr);
+    }
+    deinit_PtrArray(&d->workers);
+    deinit_PtrArray(&d->pending); /* nobody can be waiting for tasks any more */
+    deinit_Condition(&d->taskFinished);
+    deinit_Condition(&d->taskAvailable);
+    delete_Mutex(d->mtx);
+}
+
+static void init_GmPrewrapper_(iGmPrewrapper *d, const iGmDocument *doc, iRangecc content,
+                               iText *text) {
+    iZap(*d);
+    d->text = text;
+    init_Array(&d->lines, sizeof(iGmPrewrap));
+    if (text && size_Range(&content) >= minSourceSize_GmPrewrap && doc->size.x > 0) {
+        d->numTasks = 1 + size_PtrArray(&prewrapPool_.workers);
+    }
+    if (d->numTasks < 2) {
+        d->numTasks = 0; /* not worth it */
+    }
+    for (int i = 0; i < d->numTasks; i++) {
+        iGmPrewrapTask *t = &d->tasks[i];
+        t->owner = d;
+        t->index = i;
+        init_Array(&t->segments, sizeof(iGmWrapSegment));
+    }
+}
+
+static void deinit_GmPrewrapper_(iGmPrewrapper *d) {
+    for (int i = 0; i < d->numTasks; i++) {
+        deinit_Array(&d->tasks[i].segments);
+    }
+    deinit_Array(&d->lines);
+}
+
+static void runTasks_GmPrewrapper_(iGmPrewrapper *d) {
+    iGmPrewrapPool *pool = &prewrapPool_;
+    lock_Mutex(pool->mtx);
+    d->numPending = d->numTasks - 1;
+    for (int i = 1; i < d->numTasks; i++) {
+        pushBack_PtrArray(&pool->pending, &d->tasks[i]);
+    }
+    broadcast_Condition(&pool->taskAvailable);
+    unlock_Mutex(pool->mtx);
+    run_GmPrewrapTask_(&d->tasks[0]);
+    lock_Mutex(pool->mtx);
+    while (d->numPending > 0) {
+        wait_Condition(&pool->taskFinished, pool->mtx);
+    }
+    unlock_Mutex(pool->mtx);
+}
+
+static void prewrapBatch_GmDocument_(const iGmDocument *d, iGmPrewrapper *pw, iRangecc content,
+                                     iBool isPreformat, const float *indents, int rightMarginGaps) {
+    /* Predict the fonts and widths used by the sequential pass. This is a cheap scan that
+       tracks the preformatted blocks and skips the lines that need special treatment. */
+    const iGmLayoutPrefs *prefs = &d->layoutPrefs;
+    const iBool    isNormalized = isNormalized_GmDocument_(d);
+    const iBool    isPlainText  = (d->format == plainText_SourceFormat);
+    iRangecc       contentLine  = iNullRange;
+    clear_Array(&pw->lines);
+    pw->pos = 0;
+    pw->end = content.end;
+    while (nextSplit_Rangecc(content, "\n", &contentLine)) {
+        if (contentLine.start - content.start >= batchSourceSize_GmPrewrap) {
+            pw->end = contentLine.start;
+            break;
+        }
+        iRangecc line = contentLine;
+        if (*line.end == '\r') {
+            line.end--;
+        }
+        iGmPrewrap pre = { .maxWidth = 0 };
+        if (!isPreformat) {
+            const enum iGmLineType type = lineType_GmDocument_(d, line);
+            if (type == preformatted_GmLineType) {
+                isPreformat = iTrue;
+                continue;
+            }
+            if (type == link_GmLineType) {
+                continue;
+            }
+            trimLine_Rangecc(&line, type, isNormalized);
+            const int indent      = indents[type] * gap_Text;
+            const int rightMargin = (type == text_GmLineType || type == bullet_GmLineType ||
+                                             type == quote_GmLineType
+                                         ? rightMarginGaps : 0) * gap_Text;
+            pre.font     = d->theme.fonts[type];
+            pre.maxWidth = d->size.x - indent - rightMargin;
+        }
+        else {
+            if (d->format == gemini_SourceFormat && startsWithSc_Rangecc(line, "```", &iCaseSensitive)) {
+                isPreformat = iFalse;
+                continue;
+            }
+            pre.font = (isPlainText ? plainText_FontId : preformatted_FontId);
+            if (isPlainText && prefs->plainTextWrap) {
+                pre.maxWidth = d->size.x - (isGopher_GmDocument_(d) ? indents[preformatted_GmLineType]
+                                                                    : 0) * gap_Text;
+            }
+        }
+        if (!isEmpty_Range(&line)) {
+            pre.line = line;
+            pushBack_Array(&pw->lines, &pre);
+        }
+    }
+    /* Split the lines evenly between the tasks. */
+    const size_t numLines = size_Array(&pw->lines);
+    for (int i = 0; i < pw->numTasks; i++) {
+        iGmPrewrapTask *t = &pw->tasks[i];
+        clear_Array(&t->segments);
+        t->first = numLines * i / pw->numTasks;
+        t->end   = numLines * (i + 1) / pw->numTasks;
+    }
+    runTasks_GmPrewrapper_(pw);
+}
+
+static const iGmPrewrap *find_GmPrewrapper_(iGmPrewrapper *d, iRangecc line, int font,
+                                            int maxWidth) {
+    while (d->pos < size_Array(&d->lines)) {
+        const iGmPrewrap *pre = constAt_Array(&d->lines, d->pos);
+        if (pre->line.start > line.start) {
+            break;
+        }
+        d->pos++;
+        if (pre->line.start == line.start) {
+            return (pre->line.end == line.end && pre->font == font && pre->maxWidth == maxWidth)
+                       ? pre
+                       : NULL;
+        }
+    }
+    return NULL;
+}
+
+static void replay_GmPrewrapper_(const iGmPrewrapper *d, const iGmPrewrap *pre, iWrapText *wrap) {
+    const iArray *segments = &d->tasks[pre->task].segments;
+    for (size_t i = 0; i < pre->numSegments; i++) {
+        const iGmWrapSegment *seg = constAt_Array(segments, pre->firstSegment + i);
+        if (!wrap->wrapFunc(wrap, seg->text, seg->attrib, seg->origin, seg->advance)) {
+            break;
+        }
+    }
+    wrap->baseDir = pre->baseDir;
+}
+
+static void updateRunIndex_GmDocument_(iGmDocument *d, size_t firstRun) {
+    /* Indexes runs starting from `firstRun`; earlier entries are kept as is. */
+    const iRangecc src = range_String(&d->source);
+    iGmRunIndex    acc = { { INT_MIN, INT_MIN, -1 } };
+    resize_Array(&d->runIndex, firstRun);
+    if (firstRun > 0) {
+        acc = constValue_Array(&d->runIndex, firstRun - 1, iGmRunIndex);
+    }
+    for (size_t i = firstRun; i < size_Array(&d->layout); i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
+        acc.max[visBottom_GmRunIndexKey] =
+            iMax(acc.max[visBottom_GmRunIndexKey], bottom_Rect(run->visBounds));
+        if (~run->flags & decoration_GmRunFlag) {
+            acc.max[hitBottom_GmRunIndexKey] =
+                iMax(acc.max[hitBottom_GmRunIndexKey], bottom_Rect(run->bounds));
+            if (run->text.end >= src.start && run->text.end <= src.end) {
+                acc.max[textEnd_GmRunIndexKey] =
+                    iMax(acc.max[textEnd_GmRunIndexKey], (int) (run->text.end - src.start));
+            }
+        }
+        pushBack_Array(&d->runIndex, &acc);
+    }
+}
+
+static size_t findIndex_GmDocument_(const iGmDocument *d, enum iGmRunIndexKey key, int value) {
+    /* Binary search for the first run where the indexed maximum exceeds `value`. */
+    const iGmRunIndex *index = constData_Array(&d->runIndex);
+    size_t lo = 0;
+    size_t hi = size_Array(&d->runIndex);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (index[mid].max[key] > value) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static void markPosition_GmLayoutState_(iGmLayoutState *d, const iGmDocument *doc,
+                                        const char *sourcePos) {
+    d->sourcePos   = sourcePos - constBegin_String(&doc->source);
+    d->numRuns     = size_Array(&doc->layout);
+    d->numLinks    = size_PtrArray(&doc->links);
+    d->numHeadings = size_Array(&doc->headings);
+    d->numPreMeta  = size_Array(&doc->preMeta);
+    d->numAuxText  = size_StringArray(&doc->auxText);
+    d->hasTitle    = !isEmpty_String(&doc->title);
+}
+
+static void resetLayoutState_GmDocument_(iGmDocument *d) {
+    const iGmLayoutPrefs *prefs = &d->layoutPrefs;
+    iGmLayoutState *st    = &d->layoutState;
+    iZap(*st);
+    st->isFirstText      = prefs->bigFirstParagraph;
+    st->addQuoteIcon     = prefs->quoteIcon;
+    st->preFont          = preformatted_FontId;
+    st->prevType         = text_GmLineType;
+    st->prevNonBlankType = text_GmLineType;
+    if (d->format == plainText_SourceFormat) {
+        st->isPreformat = iTrue;
+        st->isFirstText = iFalse;
+    }
+}
+
+static iMediaId linkMedia_GmDocument_(const iGmDocument *d, iGmLinkId linkId,
+                                     iGmMediaInfo *info_out, iInt2 *imageSize_out) {
+    iZap(*info_out);
+    *imageSize_out = zero_I2();
+    if (d->linkMedia) {
+        iConstForEach(Array, i, d->linkMedia) {
+            const iGmLinkMedia *lm = i.value;
+            if (lm->linkId == linkId) {
+                info_out->type        = cstr_String(&lm->mime);
+                info_out->numBytes    = lm->numBytes;
+                info_out->isPermanent = lm->isPermanent;
+                *imageSize_out        = lm->imageSize;
+                return lm->media;
+            }
+        }
+        return iInvalidMediaId;
+    }
+    const iMediaId media = findMediaForLink_Media(d->media, linkId, none_MediaType);
+    if (media.type) {
+        info_Media(d->media, media, info_out);
+        if (media.type == image_MediaType) {
+            *imageSize_out = imageSize_Media(d->media, media);
+        }
     }
-    const iPrefs *prefs             = prefs_App();
+    return media;
+}
+
+static void cancelLayoutJob_GmDocument_(iGmDocument *d);
+
+static void layout_GmDocument_(iGmDocument *d, iBool isContinued) {
+    /* When continuing, layout resumes from the position saved in `layoutState`. */
+    if (!d->layoutCancel) {
+        cancelLayoutJob_GmDocument_(d); /* would be outdated */
+        initTheme_GmDocument_(d); /* snapshots are given a theme */
+    }
+    const iGmLayoutPrefs *prefs     = layoutPrefs_GmDocument_(d);
     const iBool   isMono            = isForcedMonospace_GmDocument_(d);
     const iBool   isGopher          = isGopher_GmDocument_(d);
     const iBool   isNarrow          = d->size.x < 90 * gap_Text;
@@ -633,7 +1153,6 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     const iBool   isExtremelyNarrow = d->size.x <= 60 * gap_Text;
     const iBool   isFullWidthImages = (d->outsideMargin < 5 * gap_UI);
     
-    initTheme_GmDocument_(d);
     d->isLayoutInvalidated = iFalse;
     /* TODO: Collect these parameters into a GmTheme. */
     float indents[max_GmLineType] = { 5, 10, 5, isNarrow ? 5 : 10, 0, 0, 5, 5 };
@@ -663,38 +1182,69 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     static const char *pointingFinger  = "\U0001f449";
     static const char *uploadArrow     = upload_Icon;
     static const char *image           = photo_Icon;
-    clear_Array(&d->layout);
-    clear_StringArray(&d->auxText);
-    clearLinks_GmDocument_(d);
-    clear_Array(&d->headings);
     const iArray *oldPreMeta = collect_Array(copy_Array(&d->preMeta)); /* remember fold states */
-    clear_Array(&d->preMeta);
-    clear_String(&d->title);
+    if (!isContinued) {
+        resetLayoutState_GmDocument_(d);
+    }
+    /* Continue from where the previous pass left off, forgetting anything that was laid out
+       after that point. */
+    iGmLayoutState st = d->layoutState;
+    const size_t firstNewRun = st.numRuns;
+    resize_Array(&d->layout, st.numRuns);
+    while (size_PtrArray(&d->links) > st.numLinks) {
+        iGmLink *link = NULL;
+        take_PtrArray(&d->links, size_PtrArray(&d->links) - 1, (void **) &link);
+        delete_GmLink(link);
+    }
+    resize_Array(&d->headings, st.numHeadings);
+    resize_Array(&d->preMeta, st.numPreMeta);
+    while (size_StringArray(&d->auxText) > st.numAuxText) {
+        remove_StringArray(&d->auxText, size_StringArray(&d->auxText) - 1);
+    }
+    if (!st.hasTitle) {
+        clear_String(&d->title);
+    }
     if (d->size.x <= 0 || isEmpty_String(&d->source)) {
+        updateRunIndex_GmDocument_(d, firstNewRun);
         return;
     }
-    updateOpenURLs_GmDocument_(d);
-    const iRangecc   content       = range_String(&d->source);
+    if (!d->layoutCancel) {
+        updateOpenURLs_GmDocument_(d); /* snapshots are given these beforehand */
+    }
+    const char *     sourceStart   = constBegin_String(&d->source);
+    const iRangecc   content       = { sourceStart + st.sourcePos, constEnd_String(&d->source) };
     iRangecc         contentLine   = iNullRange;
-    iInt2            pos           = zero_I2();
-    iBool            isFirstText   = prefs->bigFirstParagraph;
-    iBool            addQuoteIcon  = prefs->quoteIcon;
-    iBool            isPreformat   = iFalse;
-    int              preFont       = preformatted_FontId;
-    uint16_t         preId         = 0;
-    iBool            enableIndents = iFalse;
     const iBool      isNormalized  = isNormalized_GmDocument_(d);
-    enum iGmLineType prevType      = text_GmLineType;
-    enum iGmLineType prevNonBlankType = text_GmLineType;
-    iBool            followsBlank  = iFalse;
-    if (d->format == plainText_SourceFormat) {
-        isPreformat = iTrue;
-        isFirstText = iFalse;
+    iBool            isCheckpointSet = iFalse;
+    if (!isContinued) {
+        d->warnings &= ~missingGlyphs_GmDocumentWarning;
     }
-    d->warnings &= ~missingGlyphs_GmDocumentWarning;
     checkMissing_Text(); /* clear the flag */
     setAnsiFlags_Text(d->theme.ansiEscapes);
+    iGmPrewrapper prewrap;
+    init_GmPrewrapper_(&prewrap, d, content, current_Text());
     while (nextSplit_Rangecc(content, "\n", &contentLine)) {
+        if (d->layoutCancel && value_Atomic(d->layoutCancel)) {
+            d->isLayoutAborted = iTrue;
+            deinit_GmPrewrapper_(&prewrap);
+            return;
+        }
+        if (prewrap.numTasks && contentLine.start >= prewrap.end) {
+            prewrapBatch_GmDocument_(d,
+                                     &prewrap,
+                                     (iRangecc){ contentLine.start, content.end },
+                                     st.isPreformat,
+                                     indents,
+                                     isVeryNarrow || isFullWidthImages ? 0 : 4);
+        }
+        /* Remember where this line begins, in case the next pass needs to start from here. */
+        markPosition_GmLayoutState_(&st, d, contentLine.start);
+        if (!d->isSourceFinal && contentLine.end == content.end) {
+            /* The source ends with a newline, so this is not a real line. More content may
+               still be coming. */
+            break;
+        }
+        const iGmLayoutState lineStart = st;
         iRangecc line = contentLine; /* `line` will be trimmed; modifying would confuse `nextSplit_Rangecc` */
         if (*line.end == '\r') {
             line.end--; /* trim CR always */
@@ -703,28 +1253,34 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         enum iGmLineType type;
         float indent = 0.0f;
         /* Detect the type of the line. */
-        if (!isPreformat) {
+        if (!st.isPreformat) {
             type = lineType_GmDocument_(d, line);
-            if (contentLine.start == content.start) {
-                prevType = type;
+            if (contentLine.start == sourceStart) {
+                st.prevType = type;
             }
             indent = indents[type];
             if (type == preformatted_GmLineType) {
                 /* Begin a new preformatted block. */
-                isPreformat = iTrue;
-                const size_t preIndex = preId++;
-                preFont = preformatted_FontId;
+                st.isPreformat = iTrue;
+                const size_t preIndex = st.preId++;
+                st.preFont = preformatted_FontId;
                 /* Use a smaller font if the block contents are wide. */
                 iGmPreMeta meta = { .bounds = line };
                 meta.pixelRect.size = measurePreformattedBlock_GmDocument_(
-                    d, line.start, preFont, &meta.contents, &meta.bounds.end);
+                    d, line.start, st.preFont, &meta.contents, &meta.bounds.end);
+                if (!d->isSourceFinal && !isCheckpointSet && meta.bounds.end == line.end) {
+                    /* The block is not terminated yet. Its dimensions may still change, so the
+                       next pass has to lay it out again. */
+                    d->layoutState  = lineStart;
+                    isCheckpointSet = iTrue;
+                }
                 const float oversizeRatio =
                     meta.pixelRect.size.x /
                     (float) (d->size.x -
-                             (enableIndents ? indents[preformatted_GmLineType] : 0) * gap_Text);
+                             (st.enableIndents ? indents[preformatted_GmLineType] : 0) * gap_Text);
                 if (oversizeRatio > 1.0f) {
-                    preFont--; /* one notch smaller in the font size */
-                    meta.pixelRect.size = measureRange_Text(preFont, meta.contents).bounds.size;                        
+                    st.preFont--; /* one notch smaller in the font size */
+                    meta.pixelRect.size = measureRange_Text(st.preFont, meta.contents).bounds.size;                        
                 }
                 trimLine_Rangecc(&line, type, isNormalized);
                 meta.altText = line; /* without the ``` */
@@ -760,57 +1316,57 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         else {
             /* Preformatted line. */
             type = preformatted_GmLineType;
-            if (contentLine.start == content.start) {
-                prevType = type;
+            if (contentLine.start == sourceStart) {
+                st.prevType = type;
             }
             if (d->format == gemini_SourceFormat &&
                 startsWithSc_Rangecc(line, "```", &iCaseSensitive)) {
-                isPreformat = iFalse;
+                st.isPreformat = iFalse;
                 continue;
             }
             run.mediaType = max_MediaType; /* preformatted block */
-            run.mediaId = preId;
-            run.font = (d->format == plainText_SourceFormat ? plainText_FontId : preFont);
+            run.mediaId = st.preId;
+            run.font = (d->format == plainText_SourceFormat ? plainText_FontId : st.preFont);
             indent = indents[type];
         }
         /* Empty lines don't produce text runs. */
         if (isEmpty_Range(&line)) {
             if (type == quote_GmLineType && !prefs->quoteIcon) {
                 /* For quote indicators we still need to produce a run. */
-                run.visBounds.pos  = addX_I2(pos, indents[type] * gap_Text);
+                run.visBounds.pos  = addX_I2(st.pos, indents[type] * gap_Text);
                 run.visBounds.size = init_I2(gap_Text, lineHeight_Text(run.font));
                 run.bounds         = zero_Rect(); /* just visual */
                 run.text           = iNullRange;
                 run.flags          = quoteBorder_GmRunFlag | decoration_GmRunFlag;
                 pushBack_Array(&d->layout, &run);
             }
-            pos.y += lineHeight_Text(run.font) * prefs->lineSpacing;
-            prevType = type;
+            st.pos.y += lineHeight_Text(run.font) * prefs->lineSpacing;
+            st.prevType = type;
             if (type != quote_GmLineType) {
-                addQuoteIcon = prefs->quoteIcon;
+                st.addQuoteIcon = prefs->quoteIcon;
             }
-            followsBlank = iTrue;
+            st.followsBlank = iTrue;
             continue;
         }
         /* Begin indenting after the first preformatted block. */
-        if (type != preformatted_GmLineType || prevType != preformatted_GmLineType) {
-            enableIndents = iTrue;
+        if (type != preformatted_GmLineType || st.prevType != preformatted_GmLineType) {
+            st.enableIndents = iTrue;
         }
         /* Gopher: Always indent preformatted blocks. */
         if (isGopher && type == preformatted_GmLineType) {
-            enableIndents = iTrue;
+            st.enableIndents = iTrue;
         }
-        if (!enableIndents) {
+        if (!st.enableIndents) {
             indent = 0;
         }
         /* Check the margin vs. previous run. */
-        if (!isPreformat || (prevType != preformatted_GmLineType)) {
+        if (!st.isPreformat || (st.prevType != preformatted_GmLineType)) {
             int required =
-                iMax(topMargin[type], bottomMargin[prevType]) * lineHeight_Text(paragraph_FontId);
-            if (type == link_GmLineType && prevNonBlankType == link_GmLineType && followsBlank) {
+                iMax(topMargin[type], bottomMargin[st.prevType]) * lineHeight_Text(paragraph_FontId);
+            if (type == link_GmLineType && st.prevNonBlankType == link_GmLineType && st.followsBlank) {
                 required = 1.25f * lineHeight_Text(paragraph_FontId);
             }
-            if (type == quote_GmLineType && prevType == quote_GmLineType) {
+            if (type == quote_GmLineType && st.prevType == quote_GmLineType) {
                 /* No margin between consecutive quote lines. */
                 required = 0;
             }
@@ -818,14 +1374,14 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                 required = 0; /* top of document */
             }
             required *= prefs->lineSpacing;
-            int delta = pos.y - lastVisibleRunBottom_GmDocument_(d);
+            int delta = st.pos.y - lastVisibleRunBottom_GmDocument_(d);
             if (delta < required) {
-                pos.y += (required - delta);
+                st.pos.y += (required - delta);
             }
         }
         /* Folded blocks are represented by a single run with the alt text. */
-        if (isPreformat && d->format != plainText_SourceFormat) {
-            const iGmPreMeta *meta = constAt_Array(&d->preMeta, preId - 1);
+        if (st.isPreformat && d->format != plainText_SourceFormat) {
+            const iGmPreMeta *meta = constAt_Array(&d->preMeta, st.preId - 1);
             if (meta->flags & folded_GmPreMetaFlag) {
                 const iBool isBlank = isEmpty_Range(&meta->altText);
                 iGmRun      altText = { .font  = paragraph_FontId,
@@ -837,15 +1393,15 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                                              : meta->altText;
                 iInt2 size = measureWrapRange_Text(altText.font, d->size.x - 2 * margin.x,
                                                    altText.text).bounds.size;
-                altText.bounds = altText.visBounds = init_Rect(pos.x, pos.y, d->size.x,
+                altText.bounds = altText.visBounds = init_Rect(st.pos.x, st.pos.y, d->size.x,
                                                                size.y + 2 * margin.y);
                 altText.mediaType = max_MediaType; /* preformatted */
-                altText.mediaId = preId;
+                altText.mediaId = st.preId;
                 pushBack_Array(&d->layout, &altText);
-                pos.y += height_Rect(altText.bounds);
+                st.pos.y += height_Rect(altText.bounds);
                 contentLine = meta->bounds; /* Skip the whole thing. */
-                isPreformat = iFalse;
-                prevType = preformatted_GmLineType;
+                st.isPreformat = iFalse;
+                st.prevType = preformatted_GmLineType;
                 continue;
             }
         }
@@ -868,7 +1424,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             }
 #endif
             bulRun.color = tmQuote_ColorId;
-            bulRun.visBounds.pos = addX_I2(pos, (indents[text_GmLineType] - 0.55f) * gap_Text);
+            bulRun.visBounds.pos = addX_I2(st.pos, (indents[text_GmLineType] - 0.55f) * gap_Text);
             bulRun.visBounds.size =
                 init_I2((indents[bullet_GmLineType] - indents[text_GmLineType]) * gap_Text,
                         lineHeight_Text(bulRun.font));
@@ -880,8 +1436,8 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             pushBack_Array(&d->layout, &bulRun);
         }
         /* Quote icon. */
-        if (type == quote_GmLineType && addQuoteIcon) {
-            addQuoteIcon    = iFalse;
+        if (type == quote_GmLineType && st.addQuoteIcon) {
+            st.addQuoteIcon    = iFalse;
             iGmRun quoteRun = run;
             quoteRun.font   = heading1_FontId;
             quoteRun.text   = range_CStr(quote);
@@ -889,7 +1445,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             iRect vis       = visualBounds_Text(quoteRun.font, quoteRun.text);
             quoteRun.visBounds.size = measure_Text(quoteRun.font, quote).bounds.size;
             quoteRun.visBounds.pos =
-                add_I2(pos,
+                add_I2(st.pos,
                        init_I2((indents[quote_GmLineType] - 5) * gap_Text,
                                lineHeight_Text(quote_FontId) / 2 - bottom_Rect(vis)));
             quoteRun.bounds = zero_Rect(); /* just visual */
@@ -897,12 +1453,12 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             pushBack_Array(&d->layout, &quoteRun);
         }
         else if (type != quote_GmLineType) {
-            addQuoteIcon = prefs->quoteIcon;
+            st.addQuoteIcon = prefs->quoteIcon;
         }
         /* Link icon. */
         if (type == link_GmLineType) {
             iGmRun icon = run;
-            icon.visBounds.pos  = pos;
+            icon.visBounds.pos  = st.pos;
             icon.visBounds.size = init_I2(indent * gap_Text, lineHeight_Text(run.font));
             icon.bounds         = zero_Rect(); /* just visual */
             const iGmLink *link = constAt_PtrArray(&d->links, run.linkId - 1);
@@ -937,20 +1493,20 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         }
         /* Special formatting for the first paragraph (e.g., subtitle, introduction, or lede). */
 //        int bigCount = 0;
-        if (type == text_GmLineType && isFirstText) {
+        if (type == text_GmLineType && st.isFirstText) {
             if (!isMono) run.font = firstParagraph_FontId;
             run.color   = tmFirstParagraph_ColorId;
             run.isLede  = iTrue;
-            isFirstText = iFalse;
+            st.isFirstText = iFalse;
         }
         else if (type != heading1_GmLineType) {
-            isFirstText = iFalse;
+            st.isFirstText = iFalse;
         }
-        if (isPreformat && d->format != plainText_SourceFormat) {
+        if (st.isPreformat && d->format != plainText_SourceFormat) {
             /* Remember the top left coordinates of the block (first line of block). */
-            iGmPreMeta *meta = at_Array(&d->preMeta, preId - 1);
+            iGmPreMeta *meta = at_Array(&d->preMeta, st.preId - 1);
             if (~meta->flags & topLeft_GmPreMetaFlag) {
-                meta->pixelRect.pos = pos;
+                meta->pixelRect.pos = st.pos;
                 meta->flags |= topLeft_GmPreMetaFlag;
             }
         }
@@ -960,12 +1516,13 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             iRunTypesetter rts;
             init_RunTypesetter_(&rts);
             rts.run           = run;
-            rts.pos           = pos;
+            rts.pos           = st.pos;
             //rts.fonts         = fonts;
             rts.isWordWrapped = (d->format == plainText_SourceFormat ? prefs->plainTextWrap
-                                                                     : !isPreformat);
-            rts.isPreformat   = isPreformat;
+                                                                     : !st.isPreformat);
+            rts.isPreformat   = st.isPreformat;
             rts.layoutWidth   = d->size.x;
+            rts.lineSpacing   = prefs->lineSpacing;
             rts.indent        = indent * gap_Text;
             /* The right margin is used for balancing lines horizontally. */
             if (isVeryNarrow || isFullWidthImages) {
@@ -1007,7 +1564,14 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                                        .mode     = word_WrapTextMode,
                                        .wrapFunc = typesetOneLine_RunTypesetter_,
                                        .context  = &rts };
-                measure_WrapText(&wrapText, rts.run.font);
+                const iGmPrewrap *pre =
+                    find_GmPrewrapper_(&prewrap, line, rts.run.font, wrapText.maxWidth);
+                if (pre) {
+                    replay_GmPrewrapper_(&prewrap, pre, &wrapText);
+                }
+                else {
+                    measure_WrapText(&wrapText, rts.run.font);
+                }
                 if (!rts.run.isLede || size_Array(&rts.layout) <= maxLedeLines_) {
                     if (wrapText.baseDir < 0) {
                         /* Right-aligned paragraphs need margins and decorations to be flipped. */
@@ -1033,18 +1597,18 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                 }
                 /* Try again... */
                 clear_RunTypesetter_(&rts);
-                rts.pos         = pos;
+                rts.pos         = st.pos;
                 rts.run.font    = rts.baseFont  = d->theme.fonts[text_GmLineType];
                 rts.run.color   = rts.baseColor = d->theme.colors[text_GmLineType];
                 rts.run.isLede  = iFalse;
             }
-            pos = rts.pos;
+            st.pos = rts.pos;
             deinit_RunTypesetter_(&rts);
         }
         /* Flag the end of line, too. */
         if (numRunsAdded == 0) {
-            pos.y += lineHeight_Text(run.font) * prefs->lineSpacing;
-            followsBlank = iTrue;
+            st.pos.y += lineHeight_Text(run.font) * prefs->lineSpacing;
+            st.followsBlank = iTrue;
             continue;
         }
         iGmRun *lastRun = back_Array(&d->layout);
@@ -1057,9 +1621,9 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         if (type == link_GmLineType) {
             /* TODO: Cleanup here? Move to a function of its own. */
 //            enum iMediaType mediaType = none_MediaType;
-            const iMediaId media = findMediaForLink_Media(d->media, run.linkId, none_MediaType);
             iGmMediaInfo info;
-            info_Media(d->media, media, &info);
+            iInt2        imgSize;
+            const iMediaId media = linkMedia_GmDocument_(d, run.linkId, &info, &imgSize);
             run.mediaType = media.type;
             run.mediaId   = media.id;
             run.text      = iNullRange;
@@ -1067,14 +1631,13 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             run.color     = 0;
             const int margin = lineHeight_Text(paragraph_FontId) / 2;
             if (media.type) {
-                pos.y += margin;
+                st.pos.y += margin;
                 run.bounds.size.y = 0;
                 linkContentWasLaidOut_GmDocument_(d, &info, run.linkId);
             }
             switch (media.type) {
                 case image_MediaType: {
-                    const iInt2 imgSize = imageSize_Media(d->media, media);
-                    run.bounds.pos = pos;
+                    run.bounds.pos = st.pos;
                     run.bounds.size.x = d->size.x;
                     const float aspect = (float) imgSize.y / (float) imgSize.x;
                     run.bounds.size.y = d->size.x * aspect;
@@ -1086,9 +1649,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                         run.bounds.pos.x  -= d->outsideMargin;
                     }
                     run.visBounds = run.bounds;
-                    const iInt2 maxSize = mulf_I2(
-                        imgSize,
-                        get_Window()->pixelRatio * iMax(1.0f, (prefs_App()->zoomPercent / 100.0f)));
+                    const iInt2 maxSize = mulf_I2(imgSize, prefs->imageScale);
                     if (width_Rect(run.visBounds) > maxSize.x) {
                         /* Don't scale the image up. */
                         run.visBounds.size.y =
@@ -1098,14 +1659,14 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                         run.bounds.size.y    = run.visBounds.size.y;
                     }
                     pushBack_Array(&d->layout, &run);
-                    pos.y += run.bounds.size.y + margin / 2;
+                    st.pos.y += run.bounds.size.y + margin / 2;
                     /* Image metadata caption. */ {
                         run.font = FONT_ID(documentBody_FontId, semiBold_FontStyle, contentSmall_FontSize);
                         run.color = tmQuoteIcon_ColorId;
                         run.flags = decoration_GmRunFlag | caption_GmRunFlag;
                         run.mediaId = 0;
                         run.mediaType = 0;
-                        run.visBounds.pos.y = pos.y;
+                        run.visBounds.pos.y = st.pos.y;
                         run.visBounds.size.y = lineHeight_Text(run.font);
                         run.bounds = zero_Rect();
                         iString caption;
@@ -1124,12 +1685,12 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                         run.visBounds.pos.x = d->size.x / 2 - run.visBounds.size.x / 2;
                         deinit_String(&caption);
                         pushBack_Array(&d->layout, &run);
-                        pos.y += run.visBounds.size.y + margin;
+                        st.pos.y += run.visBounds.size.y + margin;
                     }
                     break;
                 }
                 case audio_MediaType: {
-                    run.bounds.pos    = pos;
+                    run.bounds.pos    = st.pos;
                     run.bounds.size.x = d->size.x;
                     run.bounds.size.y = lineHeight_Text(uiContent_FontId) + 3 * gap_UI;
                     run.visBounds     = run.bounds;
@@ -1137,7 +1698,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                     break;
                 }
                 case download_MediaType: {
-                    run.bounds.pos    = pos;
+                    run.bounds.pos    = st.pos;
                     run.bounds.size.x = d->size.x;
                     run.bounds.size.y = 2 * lineHeight_Text(uiContent_FontId) + 4 * gap_UI;
                     run.visBounds     = run.bounds;
@@ -1148,56 +1709,79 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                     break;
             }
             if (media.type && run.bounds.size.y) {
-                pos.y += run.bounds.size.y + margin;
+                st.pos.y += run.bounds.size.y + margin;
             }
         }
-        prevType = type;
-        prevNonBlankType = type;
-        followsBlank = iFalse;
+        st.prevType = type;
+        st.prevNonBlankType = type;
+        st.followsBlank = iFalse;
+    }
+    deinit_GmPrewrapper_(&prewrap);
+    if (!isCheckpointSet) {
+        markPosition_GmLayoutState_(&st, d, content.end);
+        d->layoutState = st;
     }
 #if 0
     /* Footer. */
     if (siteBanner_GmDocument(d)) {
         iGmRun footer = { .flags = decoration_GmRunFlag | footer_GmRunFlag };
-        footer.visBounds = (iRect){ pos, init_I2(d->size.x, lineHeight_Text(banner_FontId) * 2) };
+        footer.visBounds = (iRect){ st.pos, init_I2(d->size.x, lineHeight_Text(banner_FontId) * 2) };
         pushBack_Array(&d->layout, &footer);
-        pos.y += footer.visBounds.size.y;
+        st.pos.y += footer.visBounds.size.y;
     }
 #endif
-    d->size.y = pos.y;
+    d->size.y = st.pos.y;
     if (checkMissing_Text()) {
         d->warnings |= missingGlyphs_GmDocumentWarning;
     }
     /* Go over the preformatted blocks and mark them wide if at least one run is wide. */ {
         /* TODO: Store the dimensions and ranges for later access. */
-        iForEach(Array, i, &d->layout) {
-            iGmRun *run = i.value;
+        for (size_t i = firstNewRun; i < size_Array(&d->layout); i++) {
+            const iGmRun *run = constAt_Array(&d->layout, i);
             if (preId_GmRun(run) && run->flags & wide_GmRunFlag) {
                 iGmRunRange block = findPreformattedRange_GmDocument(d, run);
                 for (const iGmRun *j = block.start; j != block.end; j++) {
                     iConstCast(iGmRun *, j)->flags |= wide_GmRunFlag;
                 }
                 /* Skip to the end of the block. */
-                i.pos = block.end - (const iGmRun *) constData_Array(&d->layout) - 1;
+                i = block.end - (const iGmRun *) constData_Array(&d->layout) - 1;
             }
         }
     }
+    updateRunIndex_GmDocument_(d, firstNewRun);
     setAnsiFlags_Text(allowAll_AnsiFlag);
 //    printf("[GmDocument] layout size: %zu runs (%zu bytes)\n",
 //           size_Array(&d->layout), size_Array(&d->layout) * sizeof(iGmRun));        
 }
 
+static void doLayout_GmDocument_(iGmDocument *d) {
+    layout_GmDocument_(d, iFalse);
+}
+
 void init_GmDocument(iGmDocument *d) {
     d->format = gemini_SourceFormat;
+    d->sourceFormat = gemini_SourceFormat;
     init_String(&d->unormSource);
     init_String(&d->source);
+    d->unormPos = 0;
+    d->isNormPreformat = iFalse;
+    d->isSourceFinal = iTrue;
     init_String(&d->url);
     init_String(&d->localHost);
     d->outsideMargin = 0;
     d->size = zero_I2();
     d->enableCommandLinks = iFalse;
     d->isLayoutInvalidated = iFalse;
+    iZap(d->layoutState);
+    initPatterns_GmDocument_();
+    iZap(d->layoutPrefs);
+    d->layoutPrefs.imageScale = 1.0f;
+    d->layoutJob = NULL;
+    d->layoutCancel = NULL;
+    d->isLayoutAborted = iFalse;
+    d->revision = 0;
     init_Array(&d->layout, sizeof(iGmRun));
+    init_Array(&d->runIndex, sizeof(iGmRunIndex));
     init_StringArray(&d->auxText);
     init_PtrArray(&d->links);
     init_String(&d->title);
@@ -1206,6 +1790,7 @@ void init_GmDocument(iGmDocument *d) {
     d->themeSeed = 0;
     d->siteIcon = 0;
     d->media = new_Media();
+    d->linkMedia = NULL;
     d->openURLs = NULL;
     d->warnings = 0;
     d->isPaletteValid = iFalse;
@@ -1213,14 +1798,24 @@ void init_GmDocument(iGmDocument *d) {
 }
 
 void deinit_GmDocument(iGmDocument *d) {
+    cancelLayoutJob_GmDocument_(d);
     iReleasePtr(&d->openURLs);
-    delete_Media(d->media);
+    if (d->media) {
+        delete_Media(d->media);
+    }
+    if (d->linkMedia) {
+        iForEach(Array, i, d->linkMedia) {
+            deinit_String(&((iGmLinkMedia *) i.value)->mime);
+        }
+        delete_Array(d->linkMedia);
+    }
     deinit_String(&d->title);
     clearLinks_GmDocument_(d);
     deinit_PtrArray(&d->links);
     deinit_Array(&d->preMeta);
     deinit_Array(&d->headings);
     deinit_StringArray(&d->auxText);
+    deinit_Array(&d->runIndex);
     deinit_Array(&d->layout);
     deinit_String(&d->localHost);
     deinit_String(&d->url);
@@ -1294,6 +1889,7 @@ static void updateIconBasedOnUrl_GmDocument_(iGmDocument *d) {
 void setThemeSeed_GmDocument(iGmDocument *d, const iBlock *paletteSeed, const iBlock *iconSeed) {
     const iPrefs *        prefs = prefs_App();
     enum iGmDocumentTheme theme = currentTheme_();
+    d->revision++;
     static const iChar siteIcons[] = {
         0x203b,  0x2042,  0x205c,  0x2182,  0x25ed,  0x2600,  0x2601,  0x2604,  0x2605,  0x2606,
         0x265c,  0x265e,  0x2690,  0x2691,  0x2693,  0x2698,  0x2699,  0x26f0,  0x270e,  0x2728,
@@ -1796,6 +2392,7 @@ void invalidatePalette_GmDocument(iGmDocument *d) {
 
 void setFormat_GmDocument(iGmDocument *d, enum iSourceFormat format) {
     d->format = format;
+    d->revision++;
 }
 
 void setWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
@@ -1805,6 +2402,9 @@ void setWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
 }
 
 iBool updateWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
+    if (isLayoutPending_GmDocument(d) && d->layoutJob->width == width) {
+        return takeBackgroundLayout_GmDocument(d); /* may still be in progress */
+    }
     if (d->size.x != width || d->isLayoutInvalidated) {
         setWidth_GmDocument(d, width, canvasWidth);
         return iTrue;
@@ -1817,9 +2417,169 @@ void redoLayout_GmDocument(iGmDocument *d) {
 }
 
 void invalidateLayout_GmDocument(iGmDocument *d) {
+    cancelLayoutJob_GmDocument_(d);
     d->isLayoutInvalidated = iTrue;
 }
 
+/*----------------------------------------------------------------------------------------------*/
+
+static iGmDocument *newLayoutSnapshot_GmDocument_(const iGmDocument *d, int width,
+                                                  int canvasWidth, const iWindow *window) {
+    /* Called in the main thread. Everything the layout needs is copied, so the snapshot can
+       be laid out without touching the document, the media, or the app's settings. */
+    iGmDocument *snap = new_GmDocument();
+    delete_Media(snap->media);
+    snap->media              = NULL;
+    snap->format             = d->format;
+    snap->sourceFormat       = d->sourceFormat;
+    set_String(&snap->unormSource, &d->unormSource);
+    set_String(&snap->source, &d->source);
+    snap->unormPos           = d->unormPos;
+    snap->isNormPreformat    = d->isNormPreformat;
+    snap->isSourceFinal      = d->isSourceFinal;
+    set_String(&snap->url, &d->url);
+    set_String(&snap->localHost, &d->localHost);
+    snap->enableCommandLinks = d->enableCommandLinks;
+    snap->size.x             = width;
+    snap->outsideMargin      = iMax(0, (canvasWidth - width) / 2);
+    pushBackN_Array(&snap->preMeta, constData_Array(&d->preMeta), size_Array(&d->preMeta));
+    snap->theme              = d->theme;
+    snap->themeSeed          = d->themeSeed;
+    snap->siteIcon           = d->siteIcon;
+    snap->warnings           = d->warnings;
+    initTheme_GmDocument_(snap);
+    updateLayoutPrefs_GmDocument_(snap, window);
+    updateOpenURLs_GmDocument_(snap);
+    snap->linkMedia = new_Array(sizeof(iGmLinkMedia));
+    for (size_t i = 0; i < size_PtrArray(&d->links); i++) {
+        iGmLinkMedia lm = { .linkId = i + 1 };
+        iGmMediaInfo info;
+        lm.media = linkMedia_GmDocument_(d, lm.linkId, &info, &lm.imageSize);
+        if (lm.media.type) {
+            initCStr_String(&lm.mime, info.type ? info.type : "");
+            lm.numBytes    = info.numBytes;
+            lm.isPermanent = info.isPermanent;
+            pushBack_Array(snap->linkMedia, &lm);
+        }
+    }
+    return snap;
+}
+
+static iThreadResult runLayoutJob_GmDocument_(iThread *thread) {
+    iGmLayoutJob *d = userData_Thread(thread);
+    setCurrent_Text(d->text);
+    layout_GmDocument_(d->snapshot, iFalse);
+    setCurrent_Text(NULL);
+    if (!d->snapshot->isLayoutAborted) {
+        set_Atomic(&d->isFinished, iTrue);
+        postCommandf_App("document.layout.finished doc:%p", d->doc);
+    }
+    return 0;
+}
+
+static void deleteLayoutJob_GmDocument_(iGmDocument *d) {
+    iGmLayoutJob *job = d->layoutJob;
+    join_Thread(job->thread); /* checks for cancellation after each line */
+    iRelease(job->thread);
+    iRelease(job->snapshot);
+    if (job->text) {
+        delete_Text(job->text);
+    }
+    free(job);
+    d->layoutJob = NULL;
+}
+
+static void cancelLayoutJob_GmDocument_(iGmDocument *d) {
+    if (d->layoutJob) {
+        set_Atomic(&d->layoutJob->isCancelled, iTrue);
+        deleteLayoutJob_GmDocument_(d);
+    }
+}
+
+static void swapLayout_GmDocument_(iGmDocument *d, iGmDocument *other) {
+    /* The runs point to the snapshot's copy of the source, so that is swapped as well. The
+       contents of the sources are identical. */
+    iSwap(iString,        d->source,      other->source);
+    iSwap(iArray,         d->layout,      other->layout);
+    iSwap(iArray,         d->runIndex,    other->runIndex);
+    iSwap(iStringArray,   d->auxText,     other->auxText);
+    iSwap(iPtrArray,      d->links,       other->links);
+    iSwap(iString,        d->title,       other->title);
+    iSwap(iArray,         d->headings,    other->headings);
+    iSwap(iArray,         d->preMeta,     other->preMeta);
+    iSwap(iStringSet *,   d->openURLs,    other->openURLs);
+    iSwap(iGmLayoutState, d->layoutState, other->layoutState);
+    d->size                = other->size;
+    d->outsideMargin       = other->outsideMargin;
+    d->theme               = other->theme;
+    d->warnings            = other->warnings;
+    d->isLayoutInvalidated = iFalse;
+}
+
+static void startLayoutJob_GmDocument_(iGmDocument *d, iGmDocument *snapshot, iText *text,
+                                       int width, int canvasWidth) {
+    iAssert(!d->layoutJob);
+    iGmLayoutJob *job = iMalloc(GmLayoutJob);
+    job->doc         = d;
+    job->snapshot    = snapshot;
+    job->text        = text;
+    job->width       = width;
+    job->canvasWidth = canvasWidth;
+    job->revision    = d->revision;
+    set_Atomic(&job->isCancelled, iFalse);
+    set_Atomic(&job->isFinished, iFalse);
+    job->snapshot->layoutCancel = &job->isCancelled;
+    job->thread = new_Thread(runLayoutJob_GmDocument_);
+    setUserData_Thread(job->thread, job);
+    d->layoutJob = job;
+    start_Thread(job->thread);
+}
+
+void setWidthInBackground_GmDocument(iGmDocument *d, int width, int canvasWidth,
+                                     const iWindow *window) {
+    cancelLayoutJob_GmDocument_(d);
+    if (!window || !text_Window(window)) {
+        setWidth_GmDocument(d, width, canvasWidth);
+        return;
+    }
+    startLayoutJob_GmDocument_(d,
+                               newLayoutSnapshot_GmDocument_(d, width, canvasWidth, window),
+                               newMeasuring_Text(text_Window(window)),
+                               width,
+                               canvasWidth);
+}
+
+iBool isLayoutPending_GmDocument(const iGmDocument *d) {
+    return d->layoutJob != NULL;
+}
+
+void cancelBackgroundLayout_GmDocument(iGmDocument *d) {
+    cancelLayoutJob_GmDocument_(d);
+}
+
+iBool takeBackgroundLayout_GmDocument(iGmDocument *d) {
+    iGmLayoutJob *job = d->layoutJob;
+    if (!job || !value_Atomic(&job->isFinished)) {
+        return iFalse;
+    }
+    if (job->revision != d->revision) {
+        /* The document was modified after the snapshot was made. Start over with the same
+           fonts and settings, otherwise the modifications would be lost in the swap. */
+        const int    width       = job->width;
+        const int    canvasWidth = job->canvasWidth;
+        iGmDocument *snap        = newLayoutSnapshot_GmDocument_(d, width, canvasWidth, NULL);
+        snap->layoutPrefs.imageScale = job->snapshot->layoutPrefs.imageScale;
+        iText *text = job->text;
+        job->text = NULL;
+        deleteLayoutJob_GmDocument_(d);
+        startLayoutJob_GmDocument_(d, snap, text, width, canvasWidth);
+        return iFalse;
+    }
+    swapLayout_GmDocument_(d, job->snapshot);
+    deleteLayoutJob_GmDocument_(d);
+    return iTrue;
+}
+
 static void markLinkRunsVisited_GmDocument_(iGmDocument *d, const iIntSet *linkIds) {
     iForEach(Array, r, &d->layout) {
         iGmRun *run = r.value;
@@ -1856,6 +2616,9 @@ iBool updateOpenURLs_GmDocument(iGmDocument *d) {
     }
     markLinkRunsVisited_GmDocument_(d, &linkIds);
     deinit_IntSet(&linkIds);
+    if (wasChanged) {
+        d->revision++;
+    }
     return wasChanged;
 }
 
@@ -1863,10 +2626,10 @@ iLocalDef iBool isNormalizableSpace_(char ch) {
     return ch == ' ' || ch == '\t';
 }
 
-static void normalize_GmDocument(iGmDocument *d) {
-    iString *normalized = new_String();
-    iRangecc src = range_String(&d->source);
-    /* Check for a BOM. In UTF-8, the BOM can just be skipped if present. */ {
+static void normalize_GmDocument(iGmDocument *d, iRangecc src) {
+    iString *normalized = &d->source; /* appended to */
+    if (d->unormPos == 0) {
+        /* Check for a BOM. In UTF-8, the BOM can just be skipped if present. */
         iChar ch = 0;
         decodeBytes_MultibyteChar(src.start, src.end, &ch);
         if (ch == 0xfeff) /* zero-width non-breaking space */ {
@@ -1874,7 +2637,7 @@ static void normalize_GmDocument(iGmDocument *d) {
         }
     }
     iRangecc line = iNullRange;
-    iBool isPreformat = iFalse;
+    iBool isPreformat = d->isNormPreformat;
     if (d->format == plainText_SourceFormat) {
         isPreformat = iTrue; /* Cannot be turned off. */
     }
@@ -1882,6 +2645,9 @@ static void normalize_GmDocument(iGmDocument *d) {
     iBool wasNormalized = iFalse;
     iBool hasTabs = iFalse;
     while (nextSplit_Rangecc(src, "\n", &line)) {
+        if (!d->isSourceFinal && line.end == src.end) {
+            break; /* not a complete line */
+        }
         if (isPreformat) {
             /* Replace any tab characters with spaces for visualization. */
             for (const char *ch = line.start; ch != line.end; ch++) {
@@ -1951,19 +2717,81 @@ static void normalize_GmDocument(iGmDocument *d) {
         }
         appendCStr_String(normalized, "\n");
     }
+    d->isNormPreformat = isPreformat;
 //    printf("hasTabs: %d\n", hasTabs);
 //    printf("wasNormalized: %d\n", wasNormalized);
 //    fflush(stdout);
-    set_String(&d->source, collect_String(normalized));
     //normalize_String(&d->source); /* NFC */
 //    printf("orig:%zu norm:%zu\n", size_String(&d->unormSource), size_String(&d->source));
     /* normalized source has an extra newline at the end */
 //    iAssert(wasNormalized || equal_String(&d->unormSource, &d->source));
 }
 
+static void rebaseRange_(iRangecc *range, const char *oldStart, const char *oldEnd,
+                         const char *newStart) {
+    if (range->start >= oldStart && range->start <= oldEnd) {
+        range->end   = newStart + (range->end - oldStart);
+        range->start = newStart + (range->start - oldStart);
+    }
+}
+
+static void rebaseSource_GmDocument_(iGmDocument *d, const char *oldStart, size_t oldSize) {
+    /* The normalized source buffer has moved. Everything pointing to it needs updating. */
+    const char *oldEnd   = oldStart + oldSize;
+    const char *newStart = constBegin_String(&d->source);
+    iForEach(Array, r, &d->layout) {
+        iGmRun *run = r.value;
+        rebaseRange_(&run->text, oldStart, oldEnd, newStart);
+    }
+    iForEach(PtrArray, l, &d->links) {
+        iGmLink *link = l.ptr;
+        rebaseRange_(&link->urlRange, oldStart, oldEnd, newStart);
+        rebaseRange_(&link->labelRange, oldStart, oldEnd, newStart);
+        rebaseRange_(&link->labelIcon, oldStart, oldEnd, newStart);
+    }
+    iForEach(Array, h, &d->headings) {
+        iGmHeading *head = h.value;
+        rebaseRange_(&head->text, oldStart, oldEnd, newStart);
+    }
+    iForEach(Array, p, &d->preMeta) {
+        iGmPreMeta *meta = p.value;
+        rebaseRange_(&meta->bounds, oldStart, oldEnd, newStart);
+        rebaseRange_(&meta->altText, oldStart, oldEnd, newStart);
+        rebaseRange_(&meta->contents, oldStart, oldEnd, newStart);
+    }
+}
+
+static void appendSource_GmDocument_(iGmDocument *d) {
+    /* Normalizes the complete lines of the source that haven't been processed yet. An unterminated
+       last line is left pending until more content arrives or the source is final. */
+    const char *   oldStart = constBegin_String(&d->source);
+    const size_t   oldSize  = size_String(&d->source);
+    const iRangecc unorm    = range_String(&d->unormSource);
+    iRangecc       src      = { unorm.start + d->unormPos, unorm.end };
+    if (!d->isSourceFinal) {
+        while (src.end > src.start && src.end[-1] != '\n') {
+            src.end--;
+        }
+        if (isEmpty_Range(&src)) {
+            return;
+        }
+    }
+    if (isNormalized_GmDocument_(d)) {
+        normalize_GmDocument(d, src);
+    }
+    else {
+        appendRange_String(&d->source, src);
+    }
+    d->unormPos = src.end - unorm.start;
+    if (constBegin_String(&d->source) != oldStart) {
+        rebaseSource_GmDocument_(d, oldStart, oldSize);
+    }
+}
+
 void setUrl_GmDocument(iGmDocument *d, const iString *url) {
     url = canonicalUrl_String(url);
     set_String(&d->url, url);
+    d->revision++;
     setThemeSeed_GmDocument(d, urlPaletteSeed_String(url), urlThemeSeed_String(url));
     iUrl parts;
     init_Url(&parts, url);
@@ -2131,37 +2959,122 @@ static void convertMarkdownToGemtext_GmDocument_(iGmDocument *d) {
     d->format = gemini_SourceFormat;
 }
 
+static void detectAnsiEscapes_GmDocument_(iGmDocument *d, iRangecc range) {
+    static iRegExp *ansiEsc_;
+    if (!ansiEsc_) {
+        ansiEsc_ = new_RegExp("\x1b[[()]([0-9;AB]*?)[ABCDEFGHJKSTfimn]", 0);
+    }
+    iRegExpMatch m;
+    init_RegExpMatch(&m);
+    if (matchRange_RegExp(ansiEsc_, range, &m)) {
+        d->warnings |= ansiEscapes_GmDocumentWarning;
+    }
+}
+
+static iBool isConvertedFromMarkdown_GmDocument_(const iGmDocument *d, enum iSourceFormat format) {
+    /* Markdown is converted to Gemtext when viewing local files; otherwise it's plain text. */
+    return format == markdown_SourceFormat && equalCase_Rangecc(urlScheme_String(&d->url), "file");
+}
+
+static enum iSourceFormat effectiveFormat_GmDocument_(const iGmDocument *d,
+                                                      enum iSourceFormat format) {
+    if (format == markdown_SourceFormat) {
+        return isConvertedFromMarkdown_GmDocument_(d, format) ? gemini_SourceFormat
+                                                              : plainText_SourceFormat;
+    }
+    return format;
+}
+
+static iBool isAppendable_GmDocument_(const iGmDocument *d, const iString *source, int width,
+                                      int canvasWidth) {
+    /* Appending is possible if the old source is a prefix of the new one and nothing else
+       affecting the layout has changed. */
+    if (d->isSourceFinal || d->isLayoutInvalidated || d->format != d->sourceFormat ||
+        isConvertedFromMarkdown_GmDocument_(d, d->format) /* converted as a whole */ ||
+        d->size.x != width || d->outsideMargin != iMax(0, (canvasWidth - width) / 2)) {
+        return iFalse;
+    }
+    if (size_String(source) < size_String(&d->unormSource) ||
+        memcmp(constBegin_String(source),
+               constBegin_String(&d->unormSource),
+               size_String(&d->unormSource))) {
+        return iFalse;
+    }
+    /* Theme changes require a full layout. */
+    iGmDocument   *mut      = iConstCast(iGmDocument *, d);
+    const iGmTheme oldTheme = d->theme;
+    initTheme_GmDocument_(mut);
+    const iBool isSameTheme = !memcmp(oldTheme.fonts, d->theme.fonts, sizeof(oldTheme.fonts)) &&
+                              !memcmp(oldTheme.colors, d->theme.colors, sizeof(oldTheme.colors));
+    mut->theme = oldTheme;
+    return isSameTheme;
+}
+
 void setSource_GmDocument(iGmDocument *d, const iString *source, int width, int canvasWidth,
                           enum iGmDocumentUpdate updateType) {
-    /* TODO: This API has been set up to allow partial/progressive updating of the content.
-       Currently the entire source is replaced every time, though. */
 //    printf("[GmDocument] source update (%zu bytes), width:%d, final:%d\n",
 //           size_String(source), width, updateType == final_GmDocumentUpdate);
+    const iBool isFinal = (updateType == final_GmDocumentUpdate);
     if (size_String(source) == size_String(&d->unormSource)) {
         iAssert(equal_String(source, &d->unormSource));
 //        printf("[GmDocument] source is unchanged!\n");
+        if (d->format == d->sourceFormat) {
+            d->format = effectiveFormat_GmDocument_(d, d->format);
+        }
+        if (isFinal && !d->isSourceFinal) {
+            /* The last line can now be processed even if it isn't terminated. */
+            set_String(&d->unormSource, source); /* share the final buffer instead of a copy */
+            d->isSourceFinal = iTrue;
+            d->revision++;
+            appendSource_GmDocument_(d);
+            if (!updateWidth_GmDocument(d, width, canvasWidth)) {
+                layout_GmDocument_(d, iTrue);
+            }
+            return;
+        }
         updateWidth_GmDocument(d, width, canvasWidth);
         return; /* Nothing to do. */
     }
+    d->revision++;
+    if (isAppendable_GmDocument_(d, source, width, canvasWidth)) {
+        /* Only the new content needs to be normalized and laid out. Existing runs are kept. */
+        const iRangecc newContent = { constBegin_String(source) + d->unormPos,
+                                      constEnd_String(source) };
+        if (isFinal) {
+            /* The final source won't change any more, so its buffer can be shared. */
+            set_String(&d->unormSource, source);
+        }
+        else {
+            appendCStrN_String(&d->unormSource,
+                               constBegin_String(source) + size_String(&d->unormSource),
+                               size_String(source) - size_String(&d->unormSource));
+        }
+        detectAnsiEscapes_GmDocument_(d, newContent);
+        d->format        = effectiveFormat_GmDocument_(d, d->format);
+        d->isSourceFinal = isFinal;
+        appendSource_GmDocument_(d);
+        layout_GmDocument_(d, iTrue);
+        return;
+    }
     /* Normalize and convert to Gemtext if needed. */
     set_String(&d->unormSource, source);
-    set_String(&d->source, source);
-    /* Detect use of ANSI escapes. */ {
-        iRegExp *ansiEsc = new_RegExp("\x1b[[()]([0-9;AB]*?)[ABCDEFGHJKSTfimn]", 0);
-        iRegExpMatch m;
-        init_RegExpMatch(&m);
-        const iBool found = matchString_RegExp(ansiEsc, &d->unormSource, &m);
-        iChangeFlags(d->warnings, ansiEscapes_GmDocumentWarning, found);
-        iRelease(ansiEsc);
-    }
+    clear_String(&d->source);
+    d->sourceFormat    = d->format;
+    d->unormPos        = 0;
+    d->isNormPreformat = iFalse;
+    d->isSourceFinal   = isFinal;
+    d->warnings &= ~ansiEscapes_GmDocumentWarning;
+    detectAnsiEscapes_GmDocument_(d, range_String(&d->unormSource));
     if (d->format == gemini_SourceFormat) {
         d->theme.ansiEscapes = prefs_App()->gemtextAnsiEscapes;
     }
     else if (d->format == markdown_SourceFormat) {
         /* Attempt a conversion to Gemtext when viewing local Markdown files. */
-        if (equalCase_Rangecc(urlScheme_String(&d->url), "file")) {
+        if (isConvertedFromMarkdown_GmDocument_(d, d->format)) {
+            set_String(&d->source, source);
             convertMarkdownToGemtext_GmDocument_(d);
             set_String(&d->unormSource, &d->source); /* use the converted source from now on */
+            clear_String(&d->source);
             d->theme.ansiEscapes = allowAll_AnsiFlag; /* escapes are used for styling */
         }
         else {
@@ -2171,9 +3084,7 @@ void setSource_GmDocument(iGmDocument *d, const iString *source, int width, int
     else {
         d->theme.ansiEscapes = allowAll_AnsiFlag;
     }
-    if (isNormalized_GmDocument_(d)) {
-        normalize_GmDocument(d);
-    }
+    appendSource_GmDocument_(d);
     setWidth_GmDocument(d, width, canvasWidth); /* re-do layout */
 }
 
@@ -2181,10 +3092,12 @@ void foldPre_GmDocument(iGmDocument *d, uint16_t preId) {
     if (preId > 0 && preId <= size_Array(&d->preMeta)) {
         iGmPreMeta *meta = at_Array(&d->preMeta, preId - 1);
         meta->flags ^= folded_GmPreMetaFlag;
+        d->revision++;
     }
 }
 
 void updateVisitedLinks_GmDocument(iGmDocument *d) {
+    iBool   wasChanged = iFalse;
     iIntSet linkIds;
     init_IntSet(&linkIds);
     iForEach(PtrArray, i, &d->links) {
@@ -2194,9 +3107,13 @@ void updateVisitedLinks_GmDocument(iGmDocument *d) {
             if (isValid_Time(&visitTime)) {
                 link->flags |= visited_GmLinkFlag;
                 insert_IntSet(&linkIds, index_PtrArrayIterator(&i) + 1);
+                wasChanged = iTrue;
             }
         }
     }
+    if (wasChanged) {
+        d->revision++;
+    }
     markLinkRunsVisited_GmDocument_(d, &linkIds);
     deinit_IntSet(&linkIds);
 }
@@ -2210,21 +3127,15 @@ const iGmPreMeta *preMeta_GmDocument(const iGmDocument *d, uint16_t preId) {
 
 void render_GmDocument(const iGmDocument *d, iRangei visRangeY, iGmDocumentRenderFunc render,
                        void *context) {
-    iBool isInside = iFalse;
     setAnsiFlags_Text(d->theme.ansiEscapes);
-    /* TODO: Check lookup table for quick starting position. */
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (isInside) {
-            if (top_Rect(run->visBounds) > visRangeY.end) {
-                break;
-            }
-            render(context, run);
-        }
-        else if (bottom_Rect(run->visBounds) >= visRangeY.start) {
-            isInside = iTrue;
-            render(context, run);
+    /* The first run that reaches the visible range. */
+    const size_t first = findIndex_GmDocument_(d, visBottom_GmRunIndexKey, visRangeY.start - 1);
+    for (size_t i = first; i < size_Array(&d->layout); i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
+        if (i > first && top_Rect(run->visBounds) > visRangeY.end) {
+            break;
         }
+        render(context, run);
     }
     setAnsiFlags_Text(allowAll_AnsiFlag);
 }
@@ -2299,10 +3210,15 @@ iGmRunRange runRange_GmDocument(const iGmDocument *d) {
     return (iGmRunRange){ constFront_Array(&d->layout), constEnd_Array(&d->layout) };
 }
 
+const iString *unnormalizedSource_GmDocument(const iGmDocument *d) {
+    return &d->unormSource;
+}
+
 size_t memorySize_GmDocument(const iGmDocument *d) {
     return size_String(&d->unormSource) +
            size_String(&d->source) +
            size_Array(&d->layout) * sizeof(iGmRun) +
+           size_Array(&d->runIndex) * sizeof(iGmRunIndex) +
            size_Array(&d->links)  * sizeof(iGmLink) +
            memorySize_Media(d->media);
 }
@@ -2352,31 +3268,29 @@ iGmRunRange findPreformattedRange_GmDocument(const iGmDocument *d, const iGmRun
     return range;
 }
 
-const iGmRun *findRun_GmDocument(const iGmDocument *d, iInt2 pos) {
-    /* TODO: Perf optimization likely needed; use a block map? */
-    const iGmRun *last = NULL;
-    iBool isFirstNonDecoration = iTrue;
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (run->flags & decoration_GmRunFlag) continue;
-        const iRangei span = ySpan_Rect(run->bounds);
-        if (contains_Range(&span, pos.y)) {
-            last = run;
-            break;
-        }
-        if (isFirstNonDecoration && pos.y < top_Rect(run->bounds)) {
-            last = run;
-            break;
+static const iGmRun *prevNonDecorationRun_GmDocument_(const iGmDocument *d, size_t index) {
+    while (index-- > 0) {
+        const iGmRun *run = constAt_Array(&d->layout, index);
+        if (~run->flags & decoration_GmRunFlag) {
+            return run;
         }
-        if (top_Rect(run->bounds) > pos.y) break; /* Below the point. */
-        last = run;
-        isFirstNonDecoration = iFalse;
     }
-//    if (last) {
-//        printf("found run at (%d,%d): %p [%s]\n", pos.x, pos.y, last, cstr_Rangecc(last->text));
-//        fflush(stdout);
-//    }
-    return last;
+    return NULL;
+}
+
+const iGmRun *findRun_GmDocument(const iGmDocument *d, iInt2 pos) {
+    /* The first non-decoration run whose bottom is below the point either contains the point
+       or is the first one below it. */
+    const size_t index = findIndex_GmDocument_(d, hitBottom_GmRunIndexKey, pos.y);
+    if (index == size_Array(&d->layout)) {
+        return prevNonDecorationRun_GmDocument_(d, index); /* point is past the last run */
+    }
+    const iGmRun *run  = constAt_Array(&d->layout, index);
+    const iGmRun *prev = prevNonDecorationRun_GmDocument_(d, index);
+    if (!prev || top_Rect(run->bounds) <= pos.y) {
+        return run;
+    }
+    return prev;
 }
 
 iRangecc findLoc_GmDocument(const iGmDocument *d, iInt2 pos) {
@@ -2388,6 +3302,13 @@ iRangecc findLoc_GmDocument(const iGmDocument *d, iInt2 pos) {
 }
 
 const iGmRun *findRunAtLoc_GmDocument(const iGmDocument *d, const char *textCStr) {
+    const iRangecc src = range_String(&d->source);
+    if (textCStr >= src.start && textCStr <= src.end) {
+        const size_t index =
+            findIndex_GmDocument_(d, textEnd_GmRunIndexKey, (int) (textCStr - src.start));
+        return index < size_Array(&d->layout) ? constAt_Array(&d->layout, index) : NULL;
+    }
+    /* Not pointing to the source, so the index is of no use. */
     iConstForEach(Array, i, &d->layout) {
         const iGmRun *run = i.value;
         if (run->flags & decoration_GmRunFlag) {
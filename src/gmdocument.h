@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 iDeclareType(GmHeading)
 iDeclareType(GmPreMeta)
+iDeclareType(Window)
 iDeclareType(GmRun)
 
 enum iGmLineType {
@@ -170,6 +171,10 @@ iRangecc    findLoc_GmRun           (const iGmRun *, iInt2 pos);
 
 iDeclareClass(GmDocument)
 iDeclareObjectConstruction(GmDocument)
+
+/* Large documents are wrapped in parallel by a pool of worker threads. */
+void    init_GmPrewrapPool      (void);
+void    deinit_GmPrewrapPool    (void);
     
 enum iGmDocumentWarning {
     ansiEscapes_GmDocumentWarning   = iBit(1),
@@ -189,6 +194,16 @@ void    setWidth_GmDocument     (iGmDocument *, int width, int canvasWidth);
 iBool   updateWidth_GmDocument  (iGmDocument *, int width, int canvasWidth);
 void    redoLayout_GmDocument   (iGmDocument *);
 void    invalidateLayout_GmDocument(iGmDocument *); /* will have to be redone later */
+
+/* Background layout: the current layout remains in use until the new one is taken.
+   "document.layout.finished doc:%p" is posted when the new layout is ready. Text is measured
+   with a copy of the window's fonts. If the document is modified in the meantime, taking
+   the layout restarts the job instead. */
+void    setWidthInBackground_GmDocument (iGmDocument *, int width, int canvasWidth,
+                                         const iWindow *window);
+iBool   isLayoutPending_GmDocument      (const iGmDocument *);
+void    cancelBackgroundLayout_GmDocument(iGmDocument *);
+iBool   takeBackgroundLayout_GmDocument (iGmDocument *); /* returns true if layout changed */
 iBool   updateOpenURLs_GmDocument(iGmDocument *);
 void    setUrl_GmDocument       (iGmDocument *, const iString *url);
 void    setSource_GmDocument    (iGmDocument *, const iString *source, int width, int canvasWidth,
@@ -214,6 +229,7 @@ const iGmRun *  renderProgressive_GmDocument(const iGmDocument *d, const iGmRun
 iInt2           size_GmDocument             (const iGmDocument *);
 const iArray *  headings_GmDocument         (const iGmDocument *); /* array of GmHeadings */
 const iString * source_GmDocument           (const iGmDocument *);
+const iString * unnormalizedSource_GmDocument(const iGmDocument *); /* may share the response body */
 iGmRunRange     runRange_GmDocument         (const iGmDocument *);
 size_t          memorySize_GmDocument       (const iGmDocument *); /* bytes */
 int             warnings_GmDocument         (const iGmDocument *);
@@ -24,8 +24,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmutil.h"
 #include "gmcerts.h"
 #include "gopher.h"
+#include "hostcache.h"
 #include "app.h" /* dataDir_App() */
 #include "mimehooks.h"
+#include "pagearchive.h"
 #include "feeds.h"
 #include "bookmarks.h"
 #include "ui/text.h"
@@ -37,11 +39,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/socket.h>
 #include <the_Foundation/tlsrequest.h>
 
+#include <SDL_thread.h>
 #include <SDL_timer.h>
+#include <ctype.h>
+#include <string.h>
 
 iDefineTypeConstruction(GmResponse)
 
@@ -59,7 +65,7 @@ void init_GmResponse(iGmResponse *d) {
 void initCopy_GmResponse(iGmResponse *d, const iGmResponse *other) {
     d->statusCode = other->statusCode;
     initCopy_String(&d->meta, &other->meta);
-    initCopy_Block(&d->body, &other->body);
+    initCopy_Block(&d->body, &other->body); /* shared until modified */
     d->certFlags = other->certFlags;
     initCopy_Block(&d->certFingerprint, &other->certFingerprint);
     d->certValidUntil = other->certValidUntil;
@@ -165,6 +171,9 @@ struct Impl_GmRequest {
     iTlsRequest *        req;
     iGopher              gopher;
     iGmResponse *        resp;
+    iFile *              bodySink; /* received body data is written here, not to `resp->body` */
+    uint64_t             numSinkBytes;
+    size_t               bodyCapacity; /* reserved size of `resp->body` */
     iBool                isFilterEnabled;
     iBool                isRespLocked;
     iBool                isRespFiltered;
@@ -172,11 +181,258 @@ struct Impl_GmRequest {
     iAudience *          updated;
     iAudience *          finished;
     iGmRequestProgressFunc sendProgress;
+    enum iGmRequestPriority priority;
+    const void *         owner;    /* for sharing connections fairly */
+    iString              hostKey;  /* for limiting connections per host */
+    iTime                queuedAt;
+    iBool                isStarting; /* guarded by the scheduler's mutex */
 };
 
 iDefineObjectConstructionArgs(GmRequest, (iGmCerts *certs), certs)
 iDefineAudienceGetter(GmRequest, updated)
 iDefineAudienceGetter(GmRequest, finished)
+
+static void start_GmRequest_(iGmRequest *d);
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(RequestScheduler)
+
+struct Impl_RequestScheduler {
+    iMutex *   mtx;
+    iCondition started; /* signaled when requests are no longer being started */
+    iPtrArray  queued;  /* waiting for a free slot; oldest first */
+    iPtrArray  running; /* network requests in progress */
+    iBool      isStartPosted; /* queued requests will be started soon */
+    SDL_threadID mainThread; /* only thread where queued requests are started */
+    size_t     numStarted[max_GmRequestPriority];
+    size_t     numDelayed[max_GmRequestPriority]; /* had to wait in the queue */
+    double     totalWait[max_GmRequestPriority];  /* seconds */
+    size_t     maxQueued;
+};
+
+static iRequestScheduler scheduler_;
+
+static const size_t maxPerHost_RequestScheduler_ = 2;
+static const size_t maxRunning_RequestScheduler_ = 6; /* not counting interactive requests */
+
+static size_t maxBackground_RequestScheduler_(void) {
+    /* Feed refreshes make up most of the background requests. */
+    return iClamp((size_t) prefs_App()->maxFeedRequests, 1, maxRunning_RequestScheduler_);
+}
+
+void init_GmRequestScheduler(void) {
+    iRequestScheduler *d = &scheduler_;
+    iZap(*d);
+    d->mtx = new_Mutex();
+    init_Condition(&d->started);
+    init_PtrArray(&d->queued);
+    init_PtrArray(&d->running);
+    d->mainThread = SDL_ThreadID();
+}
+
+void deinit_GmRequestScheduler(void) {
+    iRequestScheduler *d = &scheduler_;
+    deinit_PtrArray(&d->running);
+    deinit_PtrArray(&d->queued);
+    deinit_Condition(&d->started);
+    delete_Mutex(d->mtx);
+    d->mtx = NULL;
+}
+
+static iBool canStart_RequestScheduler_(const iRequestScheduler *d, const iGmRequest *req) {
+    if (req->priority == interactive_GmRequestPriority) {
+        return iTrue;
+    }
+    size_t numHost = 0, numRunning = 0, numBackground = 0;
+    iConstForEach(PtrArray, i, &d->running) {
+        const iGmRequest *run = i.ptr;
+        if (equal_String(&run->hostKey, &req->hostKey)) {
+            numHost++;
+        }
+        if (run->priority != interactive_GmRequestPriority) {
+            numRunning++;
+        }
+        if (run->priority == background_GmRequestPriority) {
+            numBackground++;
+        }
+    }
+    return numHost < maxPerHost_RequestScheduler_ && numRunning < maxRunning_RequestScheduler_ &&
+           (req->priority != background_GmRequestPriority ||
+            numBackground < maxBackground_RequestScheduler_());
+}
+
+static size_t numRunningForOwner_RequestScheduler_(const iRequestScheduler *d, const void *owner) {
+    size_t count = 0;
+    iConstForEach(PtrArray, i, &d->running) {
+        if (((const iGmRequest *) i.ptr)->owner == owner) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void markStarted_RequestScheduler_(iRequestScheduler *d, iGmRequest *req, iBool wasQueued) {
+    pushBack_PtrArray(&d->running, req);
+    d->numStarted[req->priority]++;
+    if (wasQueued) {
+        d->numDelayed[req->priority]++;
+        d->totalWait[req->priority] += elapsedSeconds_Time(&req->queuedAt);
+    }
+}
+
+static iGmRequest *takeStartable_RequestScheduler_(iRequestScheduler *d) {
+    /* Among the startable requests of the highest priority, the one whose owner has
+       the fewest running requests goes first. */
+    iGmRequest *next     = NULL;
+    size_t      nextLoad = 0;
+    iConstForEach(PtrArray, i, &d->queued) {
+        iGmRequest *req = i.ptr;
+        if (next && req->priority > next->priority) {
+            continue;
+        }
+        if (!canStart_RequestScheduler_(d, req)) {
+            continue;
+        }
+        const size_t load = numRunningForOwner_RequestScheduler_(d, req->owner);
+        if (!next || req->priority < next->priority || load < nextLoad) {
+            next     = req;
+            nextLoad = load;
+        }
+    }
+    if (next) {
+        removeOne_PtrArray(&d->queued, next);
+        markStarted_RequestScheduler_(d, next, iTrue);
+    }
+    return next;
+}
+
+static void postStart_RequestScheduler_(iRequestScheduler *d) {
+    /* Called with the lock held. Queued requests are always started in the main thread,
+       never in the network thread of the request that freed the slot. */
+    if (!d->isStartPosted && !isEmpty_PtrArray(&d->queued)) {
+        d->isStartPosted = iTrue;
+        postCommand_App("requests.start");
+    }
+}
+
+void startQueued_GmRequestScheduler(void) {
+    iRequestScheduler *d = &scheduler_;
+    if (!d->mtx) {
+        return;
+    }
+    iAssert(SDL_ThreadID() == d->mainThread);
+    lock_Mutex(d->mtx);
+    d->isStartPosted = iFalse;
+    for (;;) {
+        iGmRequest *req = takeStartable_RequestScheduler_(d);
+        if (!req) {
+            break;
+        }
+        /* Started without holding the lock because the request may finish immediately.
+           If its owner deletes it in another thread meanwhile, the deletion waits until
+           the request has been started. */
+        const uint32_t id = req->id;
+        req->isStarting = iTrue;
+        unlock_Mutex(d->mtx);
+        start_GmRequest_(req);
+        lock_Mutex(d->mtx);
+        /* The request may have already been finished and deleted in this thread by a
+           finished callback, so it is looked up again. */
+        iConstForEach(PtrArray, i, &d->running) {
+            iGmRequest *run = i.ptr;
+            if (run == req && run->id == id) {
+                run->isStarting = iFalse;
+                break;
+            }
+        }
+        broadcast_Condition(&d->started);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static const iString *hostKey_GmRequest_(const iGmRequest *d) {
+    /* Proxied requests all connect to the proxy server. */
+    const iString *proxy = schemeProxy_App(urlScheme_String(&d->url));
+    return collect_String(
+        lower_String(proxy ? proxy : collectNewRange_String(urlHost_String(&d->url))));
+}
+
+static void submit_RequestScheduler_(iRequestScheduler *d, iGmRequest *req) {
+    if (!d->mtx) {
+        start_GmRequest_(req); /* scheduler not available */
+        return;
+    }
+    const iString *hostKey = hostKey_GmRequest_(req);
+    iBool doStart = iFalse;
+    lock_Mutex(d->mtx);
+    set_String(&req->hostKey, hostKey);
+    initCurrent_Time(&req->queuedAt);
+    if (canStart_RequestScheduler_(d, req)) {
+        markStarted_RequestScheduler_(d, req, iFalse);
+        doStart = iTrue;
+    }
+    else {
+        pushBack_PtrArray(&d->queued, req);
+        d->maxQueued = iMax(d->maxQueued, size_PtrArray(&d->queued));
+    }
+    unlock_Mutex(d->mtx);
+    if (doStart) {
+        /* Started in the submitting thread; only the owner could delete it meanwhile. */
+        start_GmRequest_(req);
+    }
+}
+
+static iBool remove_RequestScheduler_(iRequestScheduler *d, iGmRequest *req, iBool waitForStart) {
+    /* Returns True if the request was still waiting in the queue. */
+    iBool wasQueued = iFalse;
+    if (d->mtx) {
+        lock_Mutex(d->mtx);
+        /* In the main thread, a request being started can only be deleted from within
+           the start itself (e.g., by a finished callback), so there is nothing to wait for. */
+        while (waitForStart && req->isStarting && SDL_ThreadID() != d->mainThread) {
+            wait_Condition(&d->started, d->mtx);
+        }
+        wasQueued = removeOne_PtrArray(&d->queued, req);
+        if (removeOne_PtrArray(&d->running, req)) {
+            postStart_RequestScheduler_(d); /* a slot was freed */
+        }
+        unlock_Mutex(d->mtx);
+    }
+    return wasQueued;
+}
+
+iString *debugInfo_GmRequestScheduler(void) {
+    iRequestScheduler *d = &scheduler_;
+    static const char *names[max_GmRequestPriority] = { "Interactive", "Media", "Background" };
+    iString *str = new_String();
+    if (!d->mtx) {
+        return str;
+    }
+    lock_Mutex(d->mtx);
+    appendFormat_String(str,
+                        "Running: %zu\nQueued: %zu (max %zu)\n",
+                        size_PtrArray(&d->running),
+                        size_PtrArray(&d->queued),
+                        d->maxQueued);
+    iForIndices(i, names) {
+        appendFormat_String(str,
+                            "%s: %zu started, %zu delayed, %.2f s average wait\n",
+                            names[i],
+                            d->numStarted[i],
+                            d->numDelayed[i],
+                            d->numDelayed[i] ? d->totalWait[i] / d->numDelayed[i] : 0.0);
+    }
+    unlock_Mutex(d->mtx);
+    return str;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void notifyFinished_GmRequest_(iGmRequest *d) {
+    remove_RequestScheduler_(&scheduler_, d, iFalse); /* frees a connection slot */
+    iNotifyAudience(d, finished, GmRequestFinished);
+}
     
 static uint16_t port_GmRequest_(iGmRequest *d) {
     return urlPort_String(&d->url);
@@ -208,34 +464,84 @@ static void checkServerCertificate_GmRequest_(iGmRequest *d) {
     }
 }
 
+static void appendBody_GmRequest_(iGmRequest *d, const char *data, size_t size) {
+    if (d->bodySink) {
+        writeData_File(d->bodySink, data, size);
+        d->numSinkBytes += size;
+        return;
+    }
+    iBlock      *body   = &d->resp->body;
+    const size_t needed = size_Block(body) + size;
+    if (needed > d->bodyCapacity) {
+        /* Grow geometrically so large transfers don't spend their time reallocating. */
+        d->bodyCapacity = iMax(needed, iMax(d->bodyCapacity * 2, (size_t) 64 * 1024));
+        reserve_Block(body, d->bodyCapacity);
+    }
+    appendData_Block(body, data, size);
+}
+
+static void compactBody_GmRequest_(iGmRequest *d) {
+    /* The finished body is shared as-is with History and documents, so drop the unused
+       capacity that was reserved while receiving. */
+    iBlock *body = &d->resp->body;
+    if (d->bodyCapacity > size_Block(body) + size_Block(body) / 4) {
+        iBlock compact;
+        initData_Block(&compact, constData_Block(body), size_Block(body));
+        set_Block(body, &compact);
+        deinit_Block(&compact);
+    }
+    d->bodyCapacity = 0;
+}
+
+static const char *findLineEnd_(const char *start, const char *end) {
+    for (const char *pos = start; (pos = memchr(pos, '\r', end - pos)) != NULL; pos++) {
+        if (pos + 1 < end && pos[1] == '\n') {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+static int parseStatus_(iString *meta) {
+    /* <STATUS><SPACE><META>: the status is exactly two digits. */
+    const char *line = cstr_String(meta);
+    if (!isdigit((unsigned char) line[0]) || !isdigit((unsigned char) line[1])) {
+        return 0;
+    }
+    const int code = (line[0] - '0') * 10 + (line[1] - '0');
+    remove_Block(&meta->chars, 0, 2); /* leave just the <META> */
+    trimStart_String(meta);
+    return code;
+}
+
 static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
     iBool        notifyUpdate = iFalse;
     iBool        notifyDone   = iFalse;
     iGmResponse *resp         = d->resp;
     if (d->state == receivingHeader_GmRequestState) {
-        appendCStrN_String(&resp->meta, constData_Block(data), size_Block(data));
+        const char *start     = constData_Block(data);
+        const char *end       = start + size_Block(data);
+        const char *bodyStart = NULL;
+        if (endsWith_String(&resp->meta, "\r") && start != end && *start == '\n') {
+            /* CRLF was split between reads. */
+            removeEnd_String(&resp->meta, 1);
+            bodyStart = start + 1;
+        }
+        else {
+            const char *lineEnd = findLineEnd_(start, end);
+            appendCStrN_String(&resp->meta, start, (lineEnd ? lineEnd : end) - start);
+            if (lineEnd) {
+                bodyStart = lineEnd + 2;
+            }
+        }
         /* Check if the header line is complete. */
-        size_t endPos = indexOfCStr_String(&resp->meta, "\r\n");
-        if (endPos != iInvalidPos) {
+        if (bodyStart) {
             /* Move remainder to the body. */
-            setData_Block(&resp->body,
-                          constBegin_String(&resp->meta) + endPos + 2,
-                          size_String(&resp->meta) - endPos - 2);
-            remove_Block(&resp->meta.chars, endPos, iInvalidSize);
-            /* Parse and remove the code. */
-            iRegExp *metaPattern = new_RegExp("^([0-9][0-9])(( )(.*))?", 0);
+            d->bodyCapacity = 0;
+            clear_Block(&resp->body);
+            appendBody_GmRequest_(d, bodyStart, end - bodyStart);
             /* TODO: Empty <META> means no <SPACE>? Not according to the spec? */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            int code = 0;
-            if (matchString_RegExp(metaPattern, &resp->meta, &m)) {
-                code = atoi(capturedRange_RegExpMatch(&m, 1).start);
-                remove_Block(&resp->meta.chars,
-                             0,
-                             capturedRange_RegExpMatch(&m, 1).end -
-                                 constBegin_String(&resp->meta)); /* leave just the <META> */
-                trimStart_String(&resp->meta);
-            }
+            const int code = parseStatus_(&resp->meta);
             if (code == 0) {
                 clear_String(&resp->meta);
                 resp->statusCode = invalidHeader_GmStatusCode;
@@ -254,11 +560,10 @@ static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
                 }
             }
             checkServerCertificate_GmRequest_(d);
-            iRelease(metaPattern);
         }
     }
     else if (d->state == receivingBody_GmRequestState) {
-        append_Block(&resp->body, data);
+        appendBody_GmRequest_(d, constData_Block(data), size_Block(data));
         notifyUpdate = iTrue;
     }
     return (notifyUpdate ? 1 : 0) | (notifyDone ? 2 : 0);
@@ -287,7 +592,7 @@ static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         }
     }
     if (notifyDone) {
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
     }
 }
 
@@ -298,6 +603,7 @@ static void applyFilter_GmRequest_(iGmRequest *d) {
         lock_Mutex(d->mtx);
         clear_String(&d->resp->meta);
         clear_Block(&d->resp->body);
+        d->bodyCapacity = 0;
         d->state = receivingHeader_GmRequestState;
         processIncomingData_GmRequest_(d, xbody);
         d->state = finished_GmRequestState;
@@ -333,12 +639,14 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         }
     }
     checkServerCertificate_GmRequest_(d);
+    iReleasePtr(&d->bodySink);
+    compactBody_GmRequest_(d);
     unlock_Mutex(d->mtx);
     /* Check for mimehooks. */
     if (d->isRespFiltered && d->state == finished_GmRequestState) {
         applyFilter_GmRequest_(d);
     }
-    iNotifyAudience(d, finished, GmRequestFinished);
+    notifyFinished_GmRequest_(d);
 }
 
 static const iBlock *aboutPageSource_(iRangecc path, iRangecc query) {
@@ -386,6 +694,22 @@ static const iBlock *aboutPageSource_(iRangecc path, iRangecc query) {
     return src;
 }
 
+static void searchPageReady_GmRequest_(iAnyObject *obj, const iString *page) {
+    /* Called in the page archive's thread. */
+    iGmRequest *d = obj;
+    lock_Mutex(d->mtx);
+    d->resp->statusCode = success_GmStatusCode;
+    setCStr_String(&d->resp->meta, "text/gemini; charset=utf-8");
+    set_Block(&d->resp->body, utf8_String(page));
+    d->state = receivingBody_GmRequestState;
+    unlock_Mutex(d->mtx);
+    iNotifyAudience(d, updated, GmRequestUpdated);
+    lock_Mutex(d->mtx);
+    d->state = finished_GmRequestState;
+    unlock_Mutex(d->mtx);
+    notifyFinished_GmRequest_(d);
+}
+
 static const iBlock *replaceVariables_(const iBlock *block) {
     iRegExp *var = new_RegExp("\\$\\{([^}]+)\\}", 0);
     iRegExpMatch m;
@@ -498,7 +822,7 @@ static void gopherDisconnected_GmRequest_(iGmRequest *d, iSocket *socket) {
     }
     unlock_Mutex(d->mtx);
     if (notify) {
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
     }
 }
 
@@ -510,7 +834,7 @@ static void gopherError_GmRequest_(iGmRequest *d, iSocket *socket, int error, co
     format_String(&d->resp->meta, "%s (errno %d)", msg, error);
     clear_Block(&d->resp->body);
     unlock_Mutex(d->mtx);
-    iNotifyAudience(d, finished, GmRequestFinished);
+    notifyFinished_GmRequest_(d);
 }
 
 static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host, uint16_t port) {
@@ -519,7 +843,7 @@ static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host,
     d->gopher.meta   = &resp->meta;
     d->gopher.output = &resp->body;
     d->state         = receivingBody_GmRequestState;
-    d->gopher.socket = new_Socket(cstr_String(host), port);
+    d->gopher.socket = newSocket_HostCache(host, port);
     iConnect(Socket, d->gopher.socket, readyRead,    d, gopherRead_GmRequest_);
     iConnect(Socket, d->gopher.socket, disconnected, d, gopherDisconnected_GmRequest_);
     iConnect(Socket, d->gopher.socket, error,        d, gopherError_GmRequest_);
@@ -528,7 +852,7 @@ static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host,
         resp->statusCode = input_GmStatusCode;
         setCStr_String(&resp->meta, "Enter query:");
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
     }
 }
 
@@ -539,6 +863,9 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     d->id    = add_Atomic(&idGen_, 1) + 1;
     d->identity = NULL;
     d->resp  = new_GmResponse();
+    d->bodySink = NULL;
+    d->numSinkBytes = 0;
+    d->bodyCapacity = 0;
     d->isFilterEnabled = iTrue;
     d->isRespLocked    = iFalse;
     d->isRespFiltered  = iFalse;
@@ -551,10 +878,16 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     d->updated  = NULL;
     d->finished = NULL;
     d->sendProgress = NULL;
+    d->priority = interactive_GmRequestPriority;
+    d->owner    = NULL;
+    init_String(&d->hostKey);
+    iZap(d->queuedAt);
+    d->isStarting = iFalse;
     d->state    = initialized_GmRequestState;
 }
 
 void deinit_GmRequest(iGmRequest *d) {
+    remove_RequestScheduler_(&scheduler_, d, iTrue);
     if (d->req) {
         iDisconnectObject(TlsRequest, d->req, sent, d);
         iDisconnectObject(TlsRequest, d->req, readyRead, d);
@@ -570,11 +903,13 @@ void deinit_GmRequest(iGmRequest *d) {
         unlock_Mutex(d->mtx);
     }
     iReleasePtr(&d->req);
+    iReleasePtr(&d->bodySink);
     delete_TitanData(d->titan);
     deinit_Gopher(&d->gopher);
     delete_Audience(d->finished);
     delete_Audience(d->updated);
     delete_GmResponse(d->resp);
+    deinit_String(&d->hostKey);
     deinit_String(&d->url);
     delete_Mutex(d->mtx);
 }
@@ -629,6 +964,12 @@ void setSendProgressFunc_GmRequest(iGmRequest *d, iGmRequestProgressFunc func) {
     d->sendProgress = func;
 }
 
+void setPriority_GmRequest(iGmRequest *d, enum iGmRequestPriority priority, const void *owner) {
+    iAssert(d->state == initialized_GmRequestState);
+    d->priority = priority;
+    d->owner    = owner;
+}
+
 static void bytesSent_GmRequest_(iGmRequest *d, iTlsRequest *req, size_t sent, size_t toSend) {
     iUnused(req);
     if (d->sendProgress) {
@@ -661,11 +1002,27 @@ static const iString *directoryIndexPage_Archive_(const iArchive *d, const iStri
     return NULL;
 }
 
+static iBool isNetworkRequest_GmRequest_(const iGmRequest *d) {
+    const iRangecc scheme = urlScheme_String(&d->url);
+    return equalCase_Rangecc(scheme, "gemini") || equalCase_Rangecc(scheme, "titan") ||
+           equalCase_Rangecc(scheme, "gopher") || equalCase_Rangecc(scheme, "finger") ||
+           schemeProxy_App(scheme) != NULL;
+}
+
 void submit_GmRequest(iGmRequest *d) {
     iAssert(d->state == initialized_GmRequestState);
     if (d->state != initialized_GmRequestState) {
         return;
     }
+    if (isNetworkRequest_GmRequest_(d)) {
+        submit_RequestScheduler_(&scheduler_, d);
+    }
+    else {
+        start_GmRequest_(d); /* local resources are available immediately */
+    }
+}
+
+static void start_GmRequest_(iGmRequest *d) {
     set_Atomic(&d->allowUpdate, iTrue);
     iGmResponse *resp = d->resp;
     clear_GmResponse(resp);
@@ -681,7 +1038,21 @@ void submit_GmRequest(iGmRequest *d) {
     uint16_t       port = toInt_String(collect_String(newRange_String(url.port)));
     if (equalCase_Rangecc(url.scheme, "about")) {
         const iBlock *src = aboutPageSource_(url.path, url.query);
-        if (src) {
+        if (equalCase_Rangecc(url.path, "search")) {
+            if (size_Range(&url.query) > 1) {
+                /* Searching reads archived pages from disk, so it's done in the background. */
+                d->state = receivingHeader_GmRequestState;
+                submitSearch_PageArchive(collect_String(urlDecode_String(collectNewRange_String(
+                                             (iRangecc){ url.query.start + 1, url.query.end }))),
+                                         d,
+                                         searchPageReady_GmRequest_);
+                return;
+            }
+            /* Ask for the search terms. */
+            resp->statusCode = input_GmStatusCode;
+            setCStr_String(&resp->meta, cstr_Lang("search.archive.prompt"));
+        }
+        else if (src) {
             resp->statusCode = success_GmStatusCode;
             setCStr_String(&resp->meta, "text/gemini; charset=utf-8");
             set_Block(&resp->body, replaceVariables_(src));
@@ -692,7 +1063,7 @@ void submit_GmRequest(iGmRequest *d) {
             resp->statusCode = invalidLocalResource_GmStatusCode;
         }
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     else if (equalCase_Rangecc(url.scheme, "file")) {
@@ -870,7 +1241,7 @@ void submit_GmRequest(iGmRequest *d) {
             /* TODO: Use a background thread, the hook may take some time to run. */
             applyFilter_GmRequest_(d);
         }
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     else if (equalCase_Rangecc(url.scheme, "data")) {
@@ -901,7 +1272,7 @@ void submit_GmRequest(iGmRequest *d) {
         d->state = receivingBody_GmRequestState;
         iNotifyAudience(d, updated, GmRequestUpdated);
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
     else if (schemeProxy_App(url.scheme)) {
@@ -929,9 +1300,12 @@ void submit_GmRequest(iGmRequest *d) {
              !equalCase_Rangecc(url.scheme, "titan")) {
         resp->statusCode = unsupportedProtocol_GmStatusCode;
         d->state = finished_GmRequestState;
-        iNotifyAudience(d, finished, GmRequestFinished);
+        notifyFinished_GmRequest_(d);
         return;
     }
+    if (port == 0) {
+        port = GEMINI_DEFAULT_PORT; /* default Gemini port */
+    }
     d->state = receivingHeader_GmRequestState;
     d->req = new_TlsRequest();
     if (d->identity) {
@@ -940,9 +1314,6 @@ void submit_GmRequest(iGmRequest *d) {
     iConnect(TlsRequest, d->req, readyRead, d, readIncoming_GmRequest_);
     iConnect(TlsRequest, d->req, sent, d, bytesSent_GmRequest_);
     iConnect(TlsRequest, d->req, finished, d, requestFinished_GmRequest_);
-    if (port == 0) {
-        port = GEMINI_DEFAULT_PORT; /* default Gemini port */
-    }
     setHost_TlsRequest(d->req, host, port);
     /* Titan requests can have an arbitrary payload. */
     if (isTitan_GmRequest_(d)) {
@@ -978,7 +1349,40 @@ void submit_GmRequest(iGmRequest *d) {
     submit_TlsRequest(d->req);
 }
 
+iBool setBodySink_GmRequest(iGmRequest *d, const iString *path) {
+    iBool ok = iFalse;
+    lock_Mutex(d->mtx);
+    iAssert(!d->bodySink);
+    /* Filters need the entire body in memory. */
+    if (d->state == receivingBody_GmRequestState && !d->isRespFiltered) {
+        iFile *f = new_File(path);
+        if (open_File(f, writeOnly_FileMode)) {
+            /* Move what has been received so far to the file. */
+            write_File(f, &d->resp->body);
+            d->numSinkBytes += size_Block(&d->resp->body);
+            clear_Block(&d->resp->body);
+            d->bodySink = f;
+            ok = iTrue;
+        }
+        else {
+            iRelease(f);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return ok;
+}
+
 void cancel_GmRequest(iGmRequest *d) {
+    if (remove_RequestScheduler_(&scheduler_, d, iFalse)) {
+        /* Never started. */
+        lock_Mutex(d->mtx);
+        d->state = failure_GmRequestState;
+        d->resp->statusCode = tlsFailure_GmStatusCode;
+        setCStr_String(&d->resp->meta, "Request cancelled");
+        unlock_Mutex(d->mtx);
+        notifyFinished_GmRequest_(d);
+        return;
+    }
     if (d->req) {
         cancel_TlsRequest(d->req);
     }
@@ -1036,7 +1440,7 @@ const iBlock *body_GmRequest(const iGmRequest *d) {
 
 size_t bodySize_GmRequest(const iGmRequest *d) {
     size_t size;
-    iGuardMutex(d->mtx, size = size_Block(&d->resp->body));
+    iGuardMutex(d->mtx, size = d->numSinkBytes + size_Block(&d->resp->body));
     return size;
 }
 
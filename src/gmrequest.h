@@ -58,6 +58,13 @@ iGmResponse *       copy_GmResponse             (const iGmResponse *);
 
 /*----------------------------------------------------------------------------------------------*/
 
+enum iGmRequestPriority {
+    interactive_GmRequestPriority, /* user is waiting for it; started immediately */
+    media_GmRequestPriority,       /* inline images and audio */
+    background_GmRequestPriority,  /* feeds, remote bookmarks, prefetching */
+    max_GmRequestPriority
+};
+
 iDeclareClass(GmRequest)
 iDeclareObjectConstructionArgs(GmRequest, iGmCerts *)
 
@@ -74,6 +81,9 @@ void                setIdentity_GmRequest       (iGmRequest *, const iGmIdentity
 void                setTitanData_GmRequest      (iGmRequest *, const iString *mime,
                                                  const iBlock *payload, const iString *token);
 void                setSendProgressFunc_GmRequest(iGmRequest *, iGmRequestProgressFunc func);
+void                setPriority_GmRequest       (iGmRequest *, enum iGmRequestPriority priority,
+                                                 const void *owner);
+iBool               setBodySink_GmRequest       (iGmRequest *, const iString *path);
 void                submit_GmRequest            (iGmRequest *);
 void                cancel_GmRequest            (iGmRequest *);
 
@@ -85,8 +95,17 @@ iBool               isFinished_GmRequest        (const iGmRequest *);
 enum iGmStatusCode  status_GmRequest            (const iGmRequest *);
 const iString *     meta_GmRequest              (const iGmRequest *);
 const iBlock  *     body_GmRequest              (const iGmRequest *);
-size_t              bodySize_GmRequest          (const iGmRequest *);
+size_t              bodySize_GmRequest          (const iGmRequest *); /* includes sunk data */
 const iString *     url_GmRequest               (const iGmRequest *);
 
 int                 certFlags_GmRequest         (const iGmRequest *);
 iDate               certExpirationDate_GmRequest(const iGmRequest *);
+
+/* Network requests are started via a global scheduler that limits the number of concurrent
+   connections per host, lets higher priorities go first, and shares the remaining slots
+   fairly between owners (e.g., tabs). Queued requests are started in the main thread when
+   the "requests.start" command is handled. */
+void                init_GmRequestScheduler     (void); /* call in the main thread */
+void                deinit_GmRequestScheduler   (void);
+void                startQueued_GmRequestScheduler(void);
+iString *           debugInfo_GmRequestScheduler(void);
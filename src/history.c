@@ -23,10 +23,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "history.h"
 #include "ui/root.h"
 #include "app.h"
+#include "contentcache.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/ptrset.h>
 #include <the_Foundation/stringset.h>
 #include <math.h>
 
@@ -37,6 +39,7 @@ void init_RecentUrl(iRecentUrl *d) {
     d->normScrollY    = 0;
     d->cachedResponse = NULL;
     d->cachedDoc      = NULL;
+    d->wordIndex      = NULL;
     d->flags          = 0;
 }
 
@@ -44,6 +47,9 @@ void deinit_RecentUrl(iRecentUrl *d) {
     iRelease(d->cachedDoc);
     deinit_String(&d->url);
     delete_GmResponse(d->cachedResponse);
+    if (d->wordIndex) {
+        delete_WordIndex(d->wordIndex);
+    }
 }
 
 iDefineTypeConstruction(RecentUrl)
@@ -55,7 +61,28 @@ iRecentUrl *copy_RecentUrl(const iRecentUrl *d) {
     copy->cachedResponse = d->cachedResponse ? copy_GmResponse(d->cachedResponse) : NULL;
     copy->cachedDoc      = ref_Object(d->cachedDoc);
     copy->flags          = d->flags;
-    return copy;
+    return copy; /* word index is rebuilt when needed */
+}
+
+static iBool isText_GmResponse_(const iGmResponse *resp) {
+    return resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode &&
+           indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) != iInvalidPos;
+}
+
+static void releaseCachedResponse_RecentUrl_(iRecentUrl *d) {
+    delete_GmResponse(d->cachedResponse);
+    d->cachedResponse = NULL;
+    if (d->wordIndex) {
+        delete_WordIndex(d->wordIndex);
+        d->wordIndex = NULL;
+    }
+}
+
+static const iWordIndex *wordIndex_RecentUrl_(iRecentUrl *d) {
+    if (!d->wordIndex && isText_GmResponse_(d->cachedResponse)) {
+        d->wordIndex = new_WordIndex(&d->cachedResponse->body);
+    }
+    return d->wordIndex;
 }
 
 size_t cacheSize_RecentUrl(const iRecentUrl *d) {
@@ -72,6 +99,9 @@ size_t memorySize_RecentUrl(const iRecentUrl *d) {
     if (d->cachedDoc) {
         size += memorySize_GmDocument(d->cachedDoc);
     }
+    if (d->wordIndex) {
+        size += memorySize_WordIndex(d->wordIndex);
+    }
     return size;
 }
 
@@ -183,8 +213,21 @@ void serialize_History(const iHistory *d, iStream *outs) {
         write32_Stream(outs, item->normScrollY * 1.0e6f);
         writeU16_Stream(outs, item->flags);
         if (item->cachedResponse) {
-            write8_Stream(outs, 1);
-            serialize_GmResponse(item->cachedResponse, outs);
+            iString *key = new_String();
+            if (store_ContentCache(&item->cachedResponse->body, key)) {
+                /* The body is in the content cache, so only metadata is written here. */
+                iGmResponse *meta = copy_GmResponse(item->cachedResponse);
+                clear_Block(&meta->body);
+                write8_Stream(outs, 2);
+                serialize_String(key, outs);
+                serialize_GmResponse(meta, outs);
+                delete_GmResponse(meta);
+            }
+            else {
+                write8_Stream(outs, 1);
+                serialize_GmResponse(item->cachedResponse, outs);
+            }
+            delete_String(key);
         }
         else {
             write8_Stream(outs, 0);
@@ -207,7 +250,20 @@ void deserialize_History(iHistory *d, iStream *ins) {
         if (version_Stream(ins) >= addedRecentUrlFlags_FileVersion) {
             item.flags = readU16_Stream(ins);
         }
-        if (read8_Stream(ins)) {
+        const uint8_t cached = read8_Stream(ins);
+        if (cached == 2) {
+            iString *key = new_String();
+            deserialize_String(key, ins);
+            item.cachedResponse = new_GmResponse();
+            deserialize_GmResponse(item.cachedResponse, ins);
+            if (!load_ContentCache(key, &item.cachedResponse->body)) {
+                /* Evicted from the cache; will be fetched again. */
+                delete_GmResponse(item.cachedResponse);
+                item.cachedResponse = NULL;
+            }
+            delete_String(key);
+        }
+        else if (cached) {
             item.cachedResponse = new_GmResponse();
             deserialize_GmResponse(item.cachedResponse, ins);
         }
@@ -406,10 +462,10 @@ void setCachedResponse_History(iHistory *d, const iGmResponse *response) {
     lock_Mutex(d->mtx);
     iRecentUrl *item = mostRecentUrl_History(d);
     if (item) {
-        delete_GmResponse(item->cachedResponse);
-        item->cachedResponse = NULL;
+        releaseCachedResponse_RecentUrl_(item);
         if (category_GmStatusCode(response->statusCode) == categorySuccess_GmStatusCode) {
             item->cachedResponse = copy_GmResponse(response);
+            wordIndex_RecentUrl_(item); /* index the words for searching */
         }
     }
     unlock_Mutex(d->mtx);
@@ -446,14 +502,43 @@ size_t cacheSize_History(const iHistory *d) {
     return cached;
 }
 
+static size_t countOnce_(iPtrSet *counted, const void *data, size_t size) {
+    if (size == 0 || contains_PtrSet(counted, data)) {
+        return 0;
+    }
+    insert_PtrSet(counted, data);
+    return size;
+}
+
+static size_t sharedMemorySize_RecentUrl_(const iRecentUrl *d, iPtrSet *counted) {
+    size_t size = 0;
+    if (d->cachedResponse) {
+        const iBlock *body = &d->cachedResponse->body;
+        size += size_String(&d->cachedResponse->meta);
+        size += countOnce_(counted, constData_Block(body), size_Block(body));
+    }
+    if (d->cachedDoc) {
+        const iString *unorm = unnormalizedSource_GmDocument(d->cachedDoc);
+        size += memorySize_GmDocument(d->cachedDoc) - size_String(unorm);
+        size += countOnce_(counted, constBegin_String(unorm), size_String(unorm));
+    }
+    if (d->wordIndex) {
+        size += memorySize_WordIndex(d->wordIndex);
+    }
+    return size;
+}
+
 size_t memorySize_History(const iHistory *d) {
-    size_t bytes = 0;
+    /* Cached responses, their copies, and the documents made from them may all share the
+       same body buffer. Each buffer is counted only once. */
+    size_t   bytes   = 0;
+    iPtrSet *counted = new_PtrSet();
     lock_Mutex(d->mtx);
     iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        bytes += memorySize_RecentUrl(url);
+        bytes += sharedMemorySize_RecentUrl_(i.value, counted);
     }
     unlock_Mutex(d->mtx);
+    delete_PtrSet(counted);
     return bytes;
 }
 
@@ -461,10 +546,7 @@ void clearCache_History(iHistory *d) {
     lock_Mutex(d->mtx);
     iForEach(Array, i, &d->recent) {
         iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            delete_GmResponse(url->cachedResponse);
-            url->cachedResponse = NULL;
-        }
+        releaseCachedResponse_RecentUrl_(url);
         iReleasePtr(&url->cachedDoc); /* release all cached documents and media as well */
     }
     unlock_Mutex(d->mtx);
@@ -503,8 +585,7 @@ size_t pruneLeastImportant_History(iHistory *d) {
     if (chosen != iInvalidPos) {
         iRecentUrl *url = at_Array(&d->recent, chosen);
         delta = cacheSize_RecentUrl(url);
-        delete_GmResponse(url->cachedResponse);
-        url->cachedResponse = NULL;
+        releaseCachedResponse_RecentUrl_(url);
         iReleasePtr(&url->cachedDoc);
     }
     unlock_Mutex(d->mtx);
@@ -556,50 +637,47 @@ void invalidateTheme_History(iHistory *d) {
     unlock_Mutex(d->mtx);
 }
 
-const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern) {
+const iStringArray *searchContents_History(const iHistory *d, const iStringArray *words) {
     iStringArray *urls = iClob(new_StringArray());
     lock_Mutex(d->mtx);
     iStringSet inserted;
     init_StringSet(&inserted);
     iReverseConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        const iGmResponse *resp = url->cachedResponse;
-        if (resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode) {
-            if (indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) == iInvalidPos) {
-                continue;
+        iRecentUrl *url = iConstCast(iRecentUrl *, i.value);
+        /* Indices of responses restored from disk are built on the first search. */
+        const iWordIndex *index = wordIndex_RecentUrl_(url);
+        iRangei found;
+        if (index && find_WordIndex(index, words, &found)) {
+            const iBlock *body = &url->cachedResponse->body;
+            iString entry;
+            init_String(&entry);
+            iRangei cap = found;
+            const int prefix = iMin(10, cap.start);
+            cap.start   = cap.start - prefix;
+            cap.end     = iMin(cap.end + 30, (int) size_Block(body));
+            const size_t maxLen = 60;
+            if (size_Range(&cap) > maxLen) {
+                cap.end = cap.start + maxLen;
+            }
+            iString content;
+            initRange_String(&content, (iRangecc){ constBegin_Block(body) + cap.start,
+                                                   constBegin_Block(body) + cap.end });
+            /* This needs cleaning up; highlight the matched word. */
+            replace_Block(&content.chars, '\n', ' ');
+            replace_Block(&content.chars, '\r', ' ');
+            if (prefix + size_Range(&found) < size_String(&content)) {
+                insertData_Block(&content.chars, prefix + size_Range(&found), uiText_ColorEscape, 2);
             }
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(pattern, range_Block(&resp->body), &m)) {
-                iString entry;
-                init_String(&entry);
-                iRangei cap = m.range;
-                const int prefix = iMin(10, cap.start);
-                cap.start   = cap.start - prefix;
-                cap.end     = iMin(cap.end + 30, (int) size_Block(&resp->body));
-                const size_t maxLen = 60;
-                if (size_Range(&cap) > maxLen) {
-                    cap.end = cap.start + maxLen;
-                }
-                iString content;
-                initRange_String(&content, (iRangecc){ m.subject + cap.start, m.subject + cap.end });
-                /* This needs cleaning up; highlight the matched word. */
-                replace_Block(&content.chars, '\n', ' ');
-                replace_Block(&content.chars, '\r', ' ');
-                if (prefix + size_Range(&m.range) < size_String(&content)) {
-                    insertData_Block(&content.chars, prefix + size_Range(&m.range), uiText_ColorEscape, 2);
-                }
-                insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
-                format_String(
-                    &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
-                deinit_String(&content);
-                appendFormat_String(&entry, " url:%s", cstr_String(&url->url));
-                if (!contains_StringSet(&inserted, &url->url)) {
-                    pushFront_StringArray(urls, &entry);
-                    insert_StringSet(&inserted, &url->url);
-                }
-                deinit_String(&entry);
+            insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
+            format_String(
+                &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
+            deinit_String(&content);
+            appendFormat_String(&entry, " url:%s", cstr_String(&url->url));
+            if (!contains_StringSet(&inserted, &url->url)) {
+                pushFront_StringArray(urls, &entry);
+                insert_StringSet(&inserted, &url->url);
             }
+            deinit_String(&entry);
         }
     }
     deinit_StringSet(&inserted);
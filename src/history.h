@@ -24,6 +24,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "gmdocument.h"
 #include "gmrequest.h"
+#include "wordindex.h"
 
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
@@ -39,6 +40,7 @@ struct Impl_RecentUrl {
     float        normScrollY;    /* normalized to document height */
     iGmResponse *cachedResponse; /* kept in memory for quicker back navigation */
     iGmDocument *cachedDoc;      /* cached copy of the presentation: layout and media (not serialized) */
+    iWordIndex  *wordIndex;      /* words of a cached text response, for searching (not serialized) */
     uint16_t     flags;
 };
 
@@ -81,7 +83,7 @@ void        invalidateCachedLayout_History      (iHistory *);
 iBool       atNewest_History            (const iHistory *);
 iBool       atOldest_History            (const iHistory *);
 
-const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern); /* chronologically ascending */
+const iStringArray *   searchContents_History   (const iHistory *, const iStringArray *words); /* chronologically ascending */
 
 const iString *
             url_History                 (const iHistory *, size_t pos);
@@ -0,0 +1,203 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "hostcache.h"
+#include "gmutil.h"
+
+#include <the_Foundation/address.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/stringhash.h>
+#include <the_Foundation/time.h>
+
+iDeclareClass(HostAddress)
+iDeclareObjectConstruction(HostAddress)
+
+struct Impl_HostAddress {
+    iObject   object;
+    iAddress *address;
+    iTime     lookupTime;
+};
+
+void init_HostAddress(iHostAddress *d) {
+    d->address = new_Address();
+    initCurrent_Time(&d->lookupTime);
+}
+
+void deinit_HostAddress(iHostAddress *d) {
+    iRelease(d->address);
+}
+
+static iBool isExpired_HostAddress_(const iHostAddress *d, const iTime *now) {
+    static const double ttl_        = 5 * 60.0; /* seconds */
+    static const double failedTtl_  = 10.0;
+    if (isPending_Address(d->address)) {
+        return iFalse;
+    }
+    const double age = secondsSince_Time(now, &d->lookupTime);
+    return age > (isHostFound_Address(d->address) ? ttl_ : failedTtl_);
+}
+
+static iBool isUsable_HostAddress_(const iHostAddress *d) {
+    return !isPending_Address(d->address) && isHostFound_Address(d->address);
+}
+
+iDefineClass(HostAddress)
+iDefineObjectConstruction(HostAddress)
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(HostCache)
+
+struct Impl_HostCache {
+    iMutex *    mtx;
+    iStringHash addresses; /* "host:port" => HostAddress */
+};
+
+static iHostCache hostCache_;
+static const size_t maxAddresses_HostCache_ = 256;
+static const size_t maxPending_HostCache_   = 4; /* concurrent background lookups */
+
+void init_HostCache(void) {
+    iHostCache *d = &hostCache_;
+    d->mtx = new_Mutex();
+    init_StringHash(&d->addresses);
+}
+
+void deinit_HostCache(void) {
+    iHostCache *d = &hostCache_;
+    deinit_StringHash(&d->addresses);
+    delete_Mutex(d->mtx);
+}
+
+static const iString *key_HostCache_(const iString *host, uint16_t port) {
+    iString *key = collect_String(lower_String(host));
+    appendFormat_String(key, ":%u", port);
+    return key;
+}
+
+static size_t numPending_HostCache_(const iHostCache *d) {
+    size_t count = 0;
+    iConstForEach(StringHash, i, &d->addresses) {
+        const iHostAddress *addr = i.value->object;
+        if (isPending_Address(addr->address)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void evict_HostCache_(iHostCache *d, const iTime *now, iPtrArray *evicted) {
+    /* Expired entries go first; if that isn't enough, the oldest finished lookup is dropped.
+       Pending lookups are kept so their results aren't lost. The evicted addresses are
+       released by the caller after unlocking. */
+    iForEach(StringHash, i, &d->addresses) {
+        iHostAddress *addr = value_StringHashNode(i.value);
+        if (isExpired_HostAddress_(addr, now)) {
+            pushBack_PtrArray(evicted, ref_Object(addr));
+            remove_StringHashIterator(&i);
+        }
+    }
+    if (size_StringHash(&d->addresses) >= maxAddresses_HostCache_) {
+        iString *oldestKey = collectNew_String();
+        double   oldestAge = -1.0;
+        iConstForEach(StringHash, j, &d->addresses) {
+            const iHostAddress *addr = j.value->object;
+            const double        age  = secondsSince_Time(now, &addr->lookupTime);
+            if (!isPending_Address(addr->address) && age > oldestAge) {
+                set_String(oldestKey, key_StringHashConstIterator(&j));
+                oldestAge = age;
+            }
+        }
+        if (oldestAge >= 0.0) {
+            pushBack_PtrArray(evicted, ref_Object(value_StringHash(&d->addresses, oldestKey)));
+            remove_StringHash(&d->addresses, oldestKey);
+        }
+    }
+}
+
+static void releaseEvicted_HostCache_(iPtrArray *evicted) {
+    iForEach(PtrArray, i, evicted) {
+        iRelease(i.ptr);
+    }
+    deinit_PtrArray(evicted);
+}
+
+void prefetch_HostCache(const iString *host, uint16_t port) {
+    iHostCache *d = &hostCache_;
+    if (isEmpty_String(host)) {
+        return;
+    }
+    const iString *key = key_HostCache_(host, port);
+    iPtrArray evicted;
+    init_PtrArray(&evicted);
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    const iHostAddress *cached = value_StringHash(&d->addresses, key);
+    /* Prefetching is best effort: when enough lookups are already running, skip it. */
+    if ((!cached || isExpired_HostAddress_(cached, &now)) &&
+        numPending_HostCache_(d) < maxPending_HostCache_) {
+        if (size_StringHash(&d->addresses) >= maxAddresses_HostCache_) {
+            evict_HostCache_(d, &now, &evicted);
+        }
+        iHostAddress *addr = new_HostAddress();
+        lookupTcp_Address(addr->address, host, port); /* runs in the background */
+        if (cached) {
+            pushBack_PtrArray(&evicted, ref_Object(cached)); /* replaced */
+        }
+        insert_StringHash(&d->addresses, key, addr);
+        iRelease(addr);
+    }
+    unlock_Mutex(d->mtx);
+    releaseEvicted_HostCache_(&evicted);
+}
+
+void prefetchUrl_HostCache(const iString *url) {
+    iUrl parts;
+    init_Url(&parts, url);
+    /* For Gemini, resolving ahead of time warms up the system resolver for the TLS request. */
+    if (equalCase_Rangecc(parts.scheme, "gemini") || equalCase_Rangecc(parts.scheme, "gopher") ||
+        equalCase_Rangecc(parts.scheme, "finger")) {
+        prefetch_HostCache(collect_String(newRange_String(parts.host)), port_Url(&parts));
+    }
+}
+
+iSocket *newSocket_HostCache(const iString *host, uint16_t port) {
+    iHostCache *d = &hostCache_;
+    const iString *key = key_HostCache_(host, port);
+    iSocket *socket = NULL;
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    const iHostAddress *cached = value_StringHash(&d->addresses, key);
+    if (cached && isUsable_HostAddress_(cached) && !isExpired_HostAddress_(cached, &now)) {
+        socket = newAddress_Socket(cached->address);
+    }
+    unlock_Mutex(d->mtx);
+    if (!socket) {
+        /* Resolve now, and remember the result for the next connection. */
+        prefetch_HostCache(host, port);
+        socket = new_Socket(cstr_String(host), port);
+    }
+    return socket;
+}
@@ -33,6 +33,7 @@ enum iLookupResultType {
     feedEntry_LookupResultType,
     history_LookupResultType, /* visited URLs */
     content_LookupResultType, /* one of the pages in history, including current page */
+    archive_LookupResultType, /* a previously read page in the page archive */
     identity_LookupResultType,
 };
 
@@ -66,6 +66,9 @@ int main(int argc, char **argv) {
                           "ECDHE-RSA-CHACHA20-POLY1305:"
                           "ECDHE-RSA-AES128-GCM-SHA256:"
                           "DHE-RSA-AES256-GCM-SHA384");
+    /* Gemini closes the connection after each response, so resume previous sessions to skip
+       the full handshake. Sessions are cached per host, port, and client certificate. */
+    setSessionCacheEnabled_TlsRequest(iTrue);
     SDL_SetHint(SDL_HINT_VIDEO_ALLOW_SCREENSAVER, "1");
     SDL_EnableScreenSaver();
     SDL_SetHint(SDL_HINT_MAC_BACKGROUND_APP, "1");
@@ -35,8 +35,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #endif
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/stringlist.h>
+#include <the_Foundation/thread.h>
+#include <SDL_cpuinfo.h>
 #include <SDL_hints.h>
 #include <SDL_render.h>
 #include <SDL_timer.h>
@@ -65,39 +68,114 @@ static void deinit_GmMediaProps_(iGmMediaProps *d) {
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(GmImage)
+iDeclareType(ImageDecodeJob)
 
 struct Impl_GmImage {
-    iGmMediaProps props;
-    iBlock        partialData; /* cleared when image is converted to texture */
-    iInt2         size;
-    size_t        numBytes;
-    SDL_Texture * texture;
+    iGmMediaProps     props;
+    iBlock            partialData; /* cleared when image is converted to texture */
+    iInt2             size;
+    size_t            numBytes;
+    SDL_Texture *     texture;
+    iImageDecodeJob * decodeJob; /* set while a worker is decoding the image */
+    iBool             isPartial; /* more data is still being received */
+    size_t            previewBytes; /* amount of data used for the latest preview */
+};
+
+iDeclareType(ImageStyleColors)
+
+/* Theme colors are looked up on the main thread; workers only see these copies. */
+struct Impl_ImageStyleColors {
+    enum iImageStyle style;
+    iColor           background;
+    iColor           paragraph;
+    iColor           preformatted;
 };
 
+struct Impl_ImageDecodeJob {
+    const iMedia *       media;
+    iGmImage *           image; /* NULL if the image was deleted during decoding */
+    iBlock               data;
+    iString              mime;
+    iImageStyleColors    style;
+    iInt2                maxSize;
+    iInt2                headerSize; /* already used for layout */
+    iInt2                size;
+    iInt2                texSize;
+    uint8_t *            pixels;
+    iBool                isPreview; /* decoding a partially received image */
+};
+
+static void delete_ImageDecodeJob_(iImageDecodeJob *d) {
+    deinit_Block(&d->data);
+    deinit_String(&d->mime);
+    free(d->pixels);
+    free(d);
+}
+
+iDeclareType(ImageDecoder)
+
+struct Impl_ImageDecoder {
+    iMutex *   mtx;
+    iCondition jobAvailable; /* wakes up idle workers */
+    iPtrArray  pending;
+    iPtrArray  finished;
+    iPtrArray  workers;
+    iBool      isQuitting;
+};
+
+static iImageDecoder decoder_;
+
+static void cancelDecode_GmImage_(iGmImage *d) {
+    if (d->decodeJob) {
+        iGuardMutex(decoder_.mtx, {
+            iImageDecodeJob *job = d->decodeJob;
+            if (removeOne_PtrArray(&decoder_.pending, job) ||
+                removeOne_PtrArray(&decoder_.finished, job)) {
+                delete_ImageDecodeJob_(job);
+            }
+            else {
+                job->image = NULL; /* in progress; the worker drops it */
+            }
+        });
+        d->decodeJob = NULL;
+    }
+}
+
 void init_GmImage(iGmImage *d, const iBlock *data) {
     init_GmMediaProps_(&d->props);
     initCopy_Block(&d->partialData, data);
-    d->size     = zero_I2();
-    d->numBytes = 0;
-    d->texture  = NULL;
+    d->size      = zero_I2();
+    d->numBytes  = 0;
+    d->texture   = NULL;
+    d->decodeJob = NULL;
+    d->isPartial = iFalse;
+    d->previewBytes = 0;
 }
 
 void deinit_GmImage(iGmImage *d) {
+    cancelDecode_GmImage_(d);
     deinit_Block(&d->partialData);
     SDL_DestroyTexture(d->texture);
     deinit_GmMediaProps_(&d->props);
 }
 
-static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgData) {
-    if (style == original_ImageStyle) {
+static iImageStyleColors currentStyleColors_(void) {
+    return (iImageStyleColors){ prefs_App()->imageStyle,
+                                get_Color(tmBackground_ColorId),
+                                get_Color(tmParagraph_ColorId),
+                                get_Color(tmPreformatted_ColorId) };
+}
+
+static void applyImageStyle_(const iImageStyleColors *style, iInt2 size, uint8_t *imgData) {
+    if (style->style == original_ImageStyle) {
         return;
     }
     uint8_t *pos       = imgData;
     size_t   numPixels = size.x * size.y;
     float    brighten  = 0.0f;
-    if (style == bgFg_ImageStyle) {
-        iColor dark  = get_Color(tmBackground_ColorId);
-        iColor light = get_Color(tmParagraph_ColorId);
+    if (style->style == bgFg_ImageStyle) {
+        iColor dark  = style->background;
+        iColor light = style->paragraph;
         if (hsl_Color(dark).lum > hsl_Color(light).lum) {
             iSwap(iColor, dark, light);
         }        
@@ -113,9 +191,9 @@ static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgDat
         return;
     }
     iColor colorize = (iColor){ 255, 255, 255, 255 };
-    if (style != grayscale_ImageStyle) {
-        colorize = get_Color(style == textColorized_ImageStyle ? tmParagraph_ColorId
-                                                               : tmPreformatted_ColorId);
+    if (style->style != grayscale_ImageStyle) {
+        colorize = style->style == textColorized_ImageStyle ? style->paragraph
+                                                            : style->preformatted;
         /* Compensate for change in mid-tones. */
         const int colMax = iMax(iMax(colorize.r, colorize.g), colorize.b);
         brighten = iClamp(1.0f - (colorize.r + colorize.g + colorize.b) / (colMax * 3), 0.0f, 0.5f);
@@ -133,11 +211,42 @@ static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgDat
     }
 }
 
-void makeTexture_GmImage(iGmImage *d) {
-    iBlock *data     = &d->partialData;
-    d->numBytes      = size_Block(data);
+static iBool isWebP_(const iString *mime) {
+    return cmp_String(mime, "image/webp") == 0;
+}
+
+static iInt2 headerSize_(const iString *mime, const iBlock *data) {
+    /* Only parses the image header, so this is cheap enough for the main thread. */
+    iInt2 size = zero_I2();
+    if (isWebP_(mime)) {
+#if defined (LAGRANGE_ENABLE_WEBP)
+        if (!WebPGetInfo(constData_Block(data), size_Block(data), &size.x, &size.y)) {
+            size = zero_I2();
+        }
+#endif
+    }
+    else if (!stbi_info_from_memory(
+                 constData_Block(data), (int) size_Block(data), &size.x, &size.y, NULL)) {
+        size = zero_I2();
+    }
+    return size;
+}
+
+static iInt2 maxTextureSize_(void) {
+    iWindow *window = get_Window();
+    SDL_Rect dispRect;
+    SDL_GetDisplayBounds(SDL_GetWindowDisplayIndex(window->win), &dispRect);
+    const iInt2 dispSize = coord_Window(window, dispRect.w, dispRect.h);
+    return isEqual_I2(maxTextureSize_Window(window), zero_I2())
+               ? dispSize
+               : min_I2(maxTextureSize_Window(window), dispSize);
+}
+
+static void decode_ImageDecodeJob_(iImageDecodeJob *d) {
+    /* Runs in a worker thread. */
+    const iBlock *data = &d->data;
     uint8_t *imgData = NULL;
-    if (cmp_String(&d->props.mime, "image/webp") == 0) {
+    if (isWebP_(&d->mime)) {
 #if defined (LAGRANGE_ENABLE_WEBP)
         imgData = WebPDecodeRGBA(constData_Block(data), size_Block(data), &d->size.x, &d->size.y);
 #endif        
@@ -145,57 +254,183 @@ void makeTexture_GmImage(iGmImage *d) {
     else {
         imgData = stbi_load_from_memory(
             constData_Block(data), (int) size_Block(data), &d->size.x, &d->size.y, NULL, 4);
-        if (!imgData) {
+        if (!imgData && !d->isPreview) {
             fprintf(stderr, "[media] image load failed: %s\n", stbi_failure_reason());
         }
     }
+    clear_Block(&d->data);
     if (!imgData) {
-        d->size    = zero_I2();
-        d->texture = NULL;
+        d->size = zero_I2();
+        return;
     }
-    else {
-        applyImageStyle_(prefs_App()->imageStyle, d->size, imgData);        
-        /* TODO: Save some memory by checking if the alpha channel is actually in use. */
-        iWindow *window  = get_Window();
-        iInt2    texSize = d->size;
-        /* Resize down to min(maximum texture size, window size). */ {
-            SDL_Rect dispRect;
-            SDL_GetDisplayBounds(SDL_GetWindowDisplayIndex(window->win), &dispRect);
-            const iInt2 maxSize = min_I2(isEqual_I2(maxTextureSize_Window(window), zero_I2()) ?
-                                         texSize : maxTextureSize_Window(window),
-                                         coord_Window(window, dispRect.w, dispRect.h));
-            iInt2 scaled = d->size;
-            if (scaled.x > maxSize.x) {
-                scaled.y = scaled.y * maxSize.x / scaled.x;
-                scaled.x = maxSize.x;
-            }
-            if (scaled.y > maxSize.y) {
-                scaled.x = scaled.x * maxSize.y / scaled.y;
-                scaled.y = maxSize.y;
-            }
-            if (!isEqual_I2(scaled, d->size)) {
-                uint8_t *scaledImgData = malloc(scaled.x * scaled.y * 4);
-                stbir_resize_uint8(imgData, d->size.x, d->size.y, 4 * d->size.x,
-                                   scaledImgData, scaled.x, scaled.y, scaled.x * 4, 4);
-                free(imgData);
-                imgData = scaledImgData;
-                texSize = scaled;
-                /* We keep d->size for the UI. */
-            }
+    applyImageStyle_(&d->style, d->size, imgData);        
+    /* TODO: Save some memory by checking if the alpha channel is actually in use. */
+    d->texSize = d->size;
+    /* Resize down to min(maximum texture size, window size). */ {
+        iInt2 scaled = d->size;
+        if (scaled.x > d->maxSize.x) {
+            scaled.y = scaled.y * d->maxSize.x / scaled.x;
+            scaled.x = d->maxSize.x;
+        }
+        if (scaled.y > d->maxSize.y) {
+            scaled.x = scaled.x * d->maxSize.y / scaled.y;
+            scaled.y = d->maxSize.y;
+        }
+        if (!isEqual_I2(scaled, d->size)) {
+            uint8_t *scaledImgData = malloc(scaled.x * scaled.y * 4);
+            stbir_resize_uint8(imgData, d->size.x, d->size.y, 4 * d->size.x,
+                               scaledImgData, scaled.x, scaled.y, scaled.x * 4, 4);
+            free(imgData);
+            imgData = scaledImgData;
+            d->texSize = scaled;
+            /* We keep the original size for the UI. */
         }
-        /* Create the texture. */
-        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
-            imgData, texSize.x, texSize.y, 32, texSize.x * 4, SDL_PIXELFORMAT_ABGR8888);
-        /* TODO: In multiwindow case, all windows must have the same shared renderer?
-           Or at least a shared context. */
-        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1"); /* linear scaling */
-        d->texture = SDL_CreateTextureFromSurface(renderer_Window(window), surface);
-        SDL_FreeSurface(surface);
-        free(imgData);
     }
-    clear_Block(data);
+    d->pixels = imgData;
 }
 
+static void upload_ImageDecodeJob_(iImageDecodeJob *d) {
+    iGmImage *img = d->image;
+    iAssert(img);
+    img->decodeJob = NULL;
+    if (!d->pixels) {
+        if (!d->isPreview) {
+            SDL_DestroyTexture(img->texture);
+            img->size    = zero_I2();
+            img->texture = NULL;
+        }
+        return;
+    }
+    SDL_DestroyTexture(img->texture);
+    img->size = d->size;
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+        d->pixels, d->texSize.x, d->texSize.y, 32, d->texSize.x * 4, SDL_PIXELFORMAT_ABGR8888);
+    /* TODO: In multiwindow case, all windows must have the same shared renderer?
+       Or at least a shared context. */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1"); /* linear scaling */
+    img->texture = SDL_CreateTextureFromSurface(renderer_Window(get_Window()), surface);
+    SDL_FreeSurface(surface);
+}
+
+static iThreadResult run_ImageDecoder_(iThread *thread) {
+    iImageDecoder *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (isEmpty_PtrArray(&d->pending) && !d->isQuitting) {
+            wait_Condition(&d->jobAvailable, d->mtx);
+        }
+        if (d->isQuitting) {
+            break;
+        }
+        iImageDecodeJob *job = NULL;
+        take_PtrArray(&d->pending, 0, (void **) &job);
+        unlock_Mutex(d->mtx);
+        decode_ImageDecodeJob_(job);
+        lock_Mutex(d->mtx);
+        if (job->image) {
+            /* If the image turned out to be broken, the space reserved for it goes away. */
+            const iBool relayout =
+                !job->pixels && !job->isPreview && !isEqual_I2(job->headerSize, zero_I2());
+            pushBack_PtrArray(&d->finished, job);
+            postCommandf_App("media.decoded media:%p relayout:%d", job->media, relayout);
+        }
+        else {
+            delete_ImageDecodeJob_(job);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_ImageDecoder(void) {
+    iImageDecoder *d = &decoder_;
+    d->mtx = new_Mutex();
+    init_Condition(&d->jobAvailable);
+    init_PtrArray(&d->pending);
+    init_PtrArray(&d->finished);
+    init_PtrArray(&d->workers);
+    d->isQuitting = iFalse;
+    /* Leave one core for the UI. */
+    const int numWorkers = iClamp(SDL_GetCPUCount() - 1, 1, 4);
+    for (int i = 0; i < numWorkers; i++) {
+        iThread *worker = new_Thread(run_ImageDecoder_);
+        setUserData_Thread(worker, d);
+        pushBack_PtrArray(&d->workers, worker);
+        start_Thread(worker);
+    }
+}
+
+void deinit_ImageDecoder(void) {
+    iImageDecoder *d = &decoder_;
+    iGuardMutex(d->mtx, {
+        d->isQuitting = iTrue;
+        broadcast_Condition(&d->jobAvailable);
+    });
+    iForEach(PtrArray, w, &d->workers) {
+        join_Thread(w.ptr);
+        iRelease(w.ptr);
+    }
+    deinit_PtrArray(&d->workers);
+    iForEach(PtrArray, p, &d->pending) {
+        delete_ImageDecodeJob_(p.ptr);
+    }
+    iForEach(PtrArray, f, &d->finished) {
+        delete_ImageDecodeJob_(f.ptr);
+    }
+    deinit_PtrArray(&d->finished);
+    deinit_PtrArray(&d->pending);
+    deinit_Condition(&d->jobAvailable);
+    delete_Mutex(d->mtx);
+}
+
+static void submitDecode_GmImage_(iGmImage *d, const iMedia *media) {
+    cancelDecode_GmImage_(d);
+    /* The previous texture (a preview, perhaps) stays visible until the new one is ready. */
+    d->numBytes = size_Block(&d->partialData);
+    /* Layout can proceed with the final size while the pixels are being decoded. */
+    d->size     = headerSize_(&d->props.mime, &d->partialData);
+    iImageDecodeJob *job = iMalloc(ImageDecodeJob);
+    job->media      = media;
+    job->image      = d;
+    initCopy_Block(&job->data, &d->partialData);
+    initCopy_String(&job->mime, &d->props.mime);
+    job->style      = currentStyleColors_();
+    job->maxSize    = maxTextureSize_();
+    job->headerSize = d->size;
+    job->size       = zero_I2();
+    job->texSize    = zero_I2();
+    job->pixels     = NULL;
+    job->isPreview  = d->isPartial;
+    if (d->isPartial) {
+        d->previewBytes = size_Block(&d->partialData);
+    }
+    else {
+        clear_Block(&d->partialData);
+    }
+    d->decodeJob = job;
+    iGuardMutex(decoder_.mtx, {
+        pushBack_PtrArray(&decoder_.pending, job);
+        signal_Condition(&decoder_.jobAvailable);
+    });
+}
+
+static iBool canPreview_GmImage_(const iGmImage *d) {
+    /* stb_image decodes a truncated JPEG up to where the data ends, so a progressive JPEG
+       shows its first scans and a baseline JPEG its top rows. Truncated PNG and WebP data
+       just fails to decode. */
+    return cmp_String(&d->props.mime, "image/jpeg") == 0 ||
+           cmp_String(&d->props.mime, "image/jpg") == 0;
+}
+
+static void updatePreview_GmImage_(iGmImage *d, const iMedia *media) {
+    static const size_t previewInterval_ = 64 * 1024; /* bytes */
+    if (!d->decodeJob && canPreview_GmImage_(d) &&
+        size_Block(&d->partialData) >= d->previewBytes + previewInterval_) {
+        submitDecode_GmImage_(d, media);
+    }
+}
+
+
 iDefineTypeConstructionArgs(GmImage, (const iBlock *data), data)
 
 /*----------------------------------------------------------------------------------------------*/
@@ -232,6 +467,8 @@ struct Impl_GmDownload {
     float         currentRate;
     iString *     path;
     iFile *       file;
+    iBool         isStreamed; /* the request writes the file */
+    iBool         isFinished;
 };
 
 static iBool openFile_GmDownload_(iGmDownload *d) {
@@ -246,6 +483,7 @@ static iBool openFile_GmDownload_(iGmDownload *d) {
 
 static void closeFile_GmDownload_(iGmDownload *d) {
     d->currentRate = (float) (d->numBytes / elapsedSeconds_Time(&d->startTime));
+    d->isFinished  = (d->path != NULL);
     iReleasePtr(&d->file);
 }
 
@@ -258,6 +496,8 @@ void init_GmDownload(iGmDownload *d) {
     d->currentRate   = 0.0f;
     d->path          = NULL;
     d->file          = NULL;
+    d->isStreamed    = iFalse;
+    d->isFinished    = iFalse;
 }
 
 void deinit_GmDownload(iGmDownload *d) {
@@ -266,15 +506,10 @@ void deinit_GmDownload(iGmDownload *d) {
     delete_String(d->path);
 }
 
-static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
+static void updateRate_GmDownload_(iGmDownload *d, uint64_t numBytes) {
     const static unsigned rateInterval_ = 1000;
-    iAssert(d->file);
-    writeData_File(d->file,
-                   constBegin_Block(data) + d->numBytes,
-                   size_Block(data) - d->numBytes);
-    const size_t newBytes = size_Block(data) - d->numBytes;
-    d->numBytes = size_Block(data);
-    d->rateNumBytes += newBytes;
+    d->rateNumBytes += numBytes - d->numBytes;
+    d->numBytes = numBytes;
     const uint32_t now = SDL_GetTicks();
     if (now - d->rateStartTime > rateInterval_) {
         const double elapsed = (double) (now - d->rateStartTime) / 1000.0;
@@ -284,6 +519,14 @@ static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
     }
 }
 
+static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
+    iAssert(d->file);
+    writeData_File(d->file,
+                   constBegin_Block(data) + d->numBytes,
+                   size_Block(data) - d->numBytes);
+    updateRate_GmDownload_(d, size_Block(data));
+}
+
 iDefineTypeConstruction(GmDownload)
 
 /*----------------------------------------------------------------------------------------------*/
@@ -343,7 +586,9 @@ size_t memorySize_Media(const iMedia *d) {
     }
     iConstForEach(PtrArray, n, &d->items[download_MediaType]) {
         const iGmDownload *down = n.ptr;
-        memSize += down->numBytes;
+        if (!down->isStreamed) {
+            memSize += down->numBytes;
+        }
     }
     return memSize; 
 }
@@ -389,8 +634,12 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
             img = at_PtrArray(&d->items[image_MediaType], existingIndex);
             iAssert(equal_String(&img->props.mime, mime)); /* MIME cannot change */
             set_Block(&img->partialData, data);
-            if (!isPartial) {
-                makeTexture_GmImage(img);
+            img->isPartial = isPartial;
+            if (isPartial) {
+                updatePreview_GmImage_(img, d);
+            }
+            else {
+                submitDecode_GmImage_(img, d);
             }
         }
     }
@@ -435,14 +684,23 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
     }
     else if (!isDeleting) {
         if (startsWith_String(mime, "image/")) {
-            /* Copy the image to a texture. */
+            if (isPartial && isEqual_I2(headerSize_(mime, data), zero_I2())) {
+                /* Layout needs the image size, so wait until the header has been received. */
+                return iFalse;
+            }
+            /* The image is decoded in the background and then copied to a texture. */
             iGmImage *img = new_GmImage(data);
             img->props.linkId = linkId; /* TODO: use a hash? */
             img->props.isPermanent = !allowHide;
+            img->isPartial = isPartial;
             set_String(&img->props.mime, mime);
             pushBack_PtrArray(&d->items[image_MediaType], img);
-            if (!isPartial) {
-                makeTexture_GmImage(img);
+            if (isPartial) {
+                img->size = headerSize_(mime, data);
+                updatePreview_GmImage_(img, d);
+            }
+            else {
+                submitDecode_GmImage_(img, d);
             }
             isNew = iTrue;
         }
@@ -465,6 +723,44 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
     return isNew;
 }
 
+iBool streamDownload_Media(iMedia *d, uint16_t linkId, iGmRequest *req, int flags) {
+    const iMediaId existing = findLinkDownload_Media(d, linkId);
+    if (!existing.type) {
+        return iFalse;
+    }
+    iGmDownload *dl = at_PtrArray(&d->items[download_MediaType], index_MediaId(existing));
+    if (!dl->isStreamed && !dl->file) {
+        if (isEmpty_String(&dl->props.mime)) {
+            const iGmResponse *resp = lockResponse_GmRequest(req);
+            set_String(&dl->props.mime, &resp->meta);
+            unlockResponse_GmRequest(req);
+        }
+        iAssert(!isEmpty_String(&dl->props.url));
+        const iString *path = downloadPathForUrl_App(&dl->props.url, &dl->props.mime);
+        if (setBodySink_GmRequest(req, path)) {
+            dl->path       = copy_String(path);
+            dl->isStreamed = iTrue;
+        }
+        else {
+            /* Write the file ourselves from the accumulated body. */
+            openFile_GmDownload_(dl);
+        }
+    }
+    if (dl->isStreamed) {
+        updateRate_GmDownload_(dl, bodySize_GmRequest(req));
+        unlockResponse_GmRequest(lockResponse_GmRequest(req)); /* allows the next update */
+    }
+    else {
+        const iGmResponse *resp = lockResponse_GmRequest(req);
+        writeToFile_GmDownload_(dl, &resp->body);
+        unlockResponse_GmRequest(req);
+    }
+    if (~flags & partialData_MediaFlag) {
+        closeFile_GmDownload_(dl);
+    }
+    return iTrue;
+}
+
 static iMediaId findMediaPtr_Media_(const iPtrArray *items, enum iMediaType mediaType, iGmLinkId linkId) {
     iConstForEach(PtrArray, i, items) {
         const iGmMediaProps *props = i.ptr;
@@ -516,6 +812,32 @@ SDL_Texture *imageTexture_Media(const iMedia *d, iMediaId imageId) {
     return NULL;
 }
 
+iBool isImageDecoding_Media(const iMedia *d, iMediaId imageId) {
+    iAssert(imageId.type == image_MediaType);
+    const size_t index = index_MediaId(imageId);
+    if (index < size_PtrArray(&d->items[image_MediaType])) {
+        const iGmImage *img = constAt_PtrArray(&d->items[image_MediaType], index);
+        return img->decodeJob != NULL || img->isPartial;
+    }
+    return iFalse;
+}
+
+iBool uploadDecodedImages_Media(iMedia *d) {
+    iBool didUpload = iFalse;
+    iGuardMutex(decoder_.mtx, {
+        iForEach(PtrArray, i, &decoder_.finished) {
+            iImageDecodeJob *job = i.ptr;
+            if (job->media == d) {
+                upload_ImageDecodeJob_(job);
+                didUpload = iTrue;
+                remove_PtrArrayIterator(&i);
+                delete_ImageDecodeJob_(job);
+            }
+        }
+    });
+    return didUpload;
+}
+
 iBool info_Media(const iMedia *d, iMediaId mediaId, iGmMediaInfo *info_out) {
     /* TODO: Use a hash. */
     const size_t index = index_MediaId(mediaId);
@@ -595,7 +917,7 @@ void downloadStats_Media(const iMedia *d, iMediaId downloadId, const iString **p
             *path_out = dl->path;
         }
         *bytesPerSecond_out = dl->currentRate;
-        *isFinished_out = (dl->path && !dl->file);
+        *isFinished_out = dl->isFinished;
     }
 }
 
@@ -618,6 +940,7 @@ void init_MediaRequest(iMediaRequest *d, iDocumentWidget *doc, unsigned int link
     d->req    = new_GmRequest(certs_App());
     setUrl_GmRequest(d->req, url);
     enableFilters_GmRequest(d->req, enableFilters);
+    setPriority_GmRequest(d->req, media_GmRequestPriority, doc);
     iConnect(GmRequest, d->req, updated, d, updated_MediaRequest_);
     iConnect(GmRequest, d->req, finished, d, finished_MediaRequest_);
     submit_GmRequest(d->req);
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 iDeclareType(Player)
 iDeclareType(GmMediaInfo)
+iDeclareType(GmRequest)
 
 struct Impl_GmMediaInfo {
     const char *type; /* MIME */
@@ -67,9 +68,14 @@ iLocalDef size_t index_MediaId(const iMediaId mediaId) {
 
 #define iInvalidMediaId     (iMediaId){ none_MediaType, 0 }
 
+/* Images are decoded by a pool of worker threads. */
+void            init_ImageDecoder       (void);
+void            deinit_ImageDecoder     (void);
+
 void            clear_Media             (iMedia *);
 iBool           setUrl_Media            (iMedia *, uint16_t linkId, enum iMediaType mediaType, const iString *url);
 iBool           setData_Media           (iMedia *, uint16_t linkId, const iString *mime, const iBlock *data, int flags);
+iBool           streamDownload_Media    (iMedia *, uint16_t linkId, iGmRequest *req, int flags);
 
 size_t          memorySize_Media        (const iMedia *);
 iMediaId        findMediaForLink_Media  (const iMedia *, uint16_t linkId, enum iMediaType mediaType);
@@ -99,6 +105,8 @@ iLocalDef iBool downloadInfo_Media(const iMedia *d, uint16_t mediaId, iGmMediaIn
 
 iInt2           imageSize_Media         (const iMedia *, iMediaId imageId);
 SDL_Texture *   imageTexture_Media      (const iMedia *, iMediaId imageId);
+iBool           isImageDecoding_Media   (const iMedia *, iMediaId imageId); /* or still receiving */
+iBool           uploadDecodedImages_Media(iMedia *); /* main thread only */
 
 size_t          numAudio_Media          (const iMedia *);
 iPlayer *       audioPlayer_Media       (const iMedia *, iMediaId audioId);
@@ -109,7 +117,6 @@ void            downloadStats_Media     (const iMedia *, iMediaId downloadId, co
 
 /*----------------------------------------------------------------------------------------------*/
 
-iDeclareType(GmRequest)
 iDeclareType(DocumentWidget)
 
 iDeclareClass(MediaRequest)
@@ -0,0 +1,979 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "pagearchive.h"
+#include "lang.h"
+#include "wordindex.h"
+
+#include <the_Foundation/array.h>
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/stringhash.h>
+#include <the_Foundation/thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *   dirName_PageArchive_       = "archive";
+static const char *   pagesFileName_PageArchive_ = "pages.dat";
+static const char *   indexFileName_PageArchive_ = "index.dat";
+static const uint32_t pageMagic_PageArchive_     = 0x50616765; /* "Page" */
+static const uint32_t indexMagic_PageArchive_    = 0x496e6478; /* "Indx" */
+static const uint32_t indexVersion_PageArchive_  = 1;
+static const size_t   maxPageSize_PageArchive_   = 1000000;    /* larger pages are not archived */
+static const uint64_t maxSize_PageArchive_       = 100000000;  /* bytes in the pages file */
+static const uint64_t maxAge_PageArchive_        = 365 * 24 * 3600; /* seconds */
+static const size_t   maxQueryWords_PageArchive_ = 16;
+
+static uint64_t now_PageArchive_(void) {
+    iTime now;
+    initCurrent_Time(&now);
+    return (uint64_t) now.ts.tv_sec;
+}
+
+void init_ArchivedPage(iArchivedPage *d) {
+    init_String(&d->url);
+    init_String(&d->title);
+    init_String(&d->snippet);
+    iZap(d->when);
+}
+
+void deinit_ArchivedPage(iArchivedPage *d) {
+    deinit_String(&d->snippet);
+    deinit_String(&d->title);
+    deinit_String(&d->url);
+}
+
+iDefineClass(ArchivedPage)
+iDefineObjectConstruction(ArchivedPage)
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareClass(ArchivePostings)
+iDeclareObjectConstruction(ArchivePostings)
+
+struct Impl_ArchivePostings {
+    iObject object;
+    iArray  pages; /* uint32_t page numbers, ascending */
+};
+
+void init_ArchivePostings(iArchivePostings *d) {
+    init_Array(&d->pages, sizeof(uint32_t));
+}
+
+void deinit_ArchivePostings(iArchivePostings *d) {
+    deinit_Array(&d->pages);
+}
+
+iDefineClass(ArchivePostings)
+iDefineObjectConstruction(ArchivePostings)
+
+static void appendVarUInt_(iBlock *d, uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            byte |= 0x80;
+        }
+        appendData_Block(d, &byte, 1);
+    } while (value);
+}
+
+static void encode_ArchivePostings_(const iArchivePostings *d, iBlock *deltas_out) {
+    /* Page numbers are stored as variable-length deltas. */
+    uint32_t prev = 0;
+    clear_Block(deltas_out);
+    iConstForEach(Array, i, &d->pages) {
+        const uint32_t num = *(const uint32_t *) i.value;
+        appendVarUInt_(deltas_out, num - prev);
+        prev = num;
+    }
+}
+
+static iBool decode_ArchivePostings_(iArchivePostings *d, const iBlock *deltas, uint32_t numPages) {
+    const uint8_t *pos   = constData_Block(deltas);
+    const uint8_t *end   = pos + size_Block(deltas);
+    uint32_t       value = 0;
+    uint32_t       num   = 0;
+    int            shift = 0;
+    for (; pos < end; pos++) {
+        value |= (uint32_t) (*pos & 0x7f) << shift;
+        if (*pos & 0x80) {
+            shift += 7;
+            if (shift > 28) {
+                return iFalse;
+            }
+            continue;
+        }
+        num += value;
+        if (num >= numPages) {
+            return iFalse;
+        }
+        pushBack_Array(&d->pages, &num);
+        value = 0;
+        shift = 0;
+    }
+    return shift == 0;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(ArchiveEntry)
+
+struct Impl_ArchiveEntry {
+    uint64_t pos;       /* record position in the pages file */
+    uint64_t when;      /* seconds since epoch */
+    uint8_t  md5[16];   /* of the page body */
+    iBool    isRemoved; /* superseded by a newer version of the same page */
+    iString  url;
+    iString  title;
+};
+
+static void init_ArchiveEntry(iArchiveEntry *d) {
+    iZap(*d);
+    init_String(&d->url);
+    init_String(&d->title);
+}
+
+static void deinit_ArchiveEntry(iArchiveEntry *d) {
+    deinit_String(&d->title);
+    deinit_String(&d->url);
+}
+
+iDeclareType(ArchiveWord)
+
+struct Impl_ArchiveWord {
+    iString           word;
+    iArchivePostings *post; /* owned by the words hash */
+};
+
+static int cmp_ArchiveWord_(const void *a, const void *b) {
+    return cmp_String(&((const iArchiveWord *) a)->word, &((const iArchiveWord *) b)->word);
+}
+
+iDeclareType(ArchiveIndex)
+iDeclareTypeConstruction(ArchiveIndex)
+
+struct Impl_ArchiveIndex {
+    iArray      pages;       /* ArchiveEntry; the array index is the page number */
+    iStringHash words;       /* word => ArchivePostings */
+    iArray      sortedWords; /* ArchiveWord; new words are appended after `numSorted` */
+    size_t      numSorted;
+    uint64_t    fileSize;    /* indexed part of the pages file */
+    uint64_t    removedSize; /* bytes of superseded pages */
+};
+
+void init_ArchiveIndex(iArchiveIndex *d) {
+    init_Array(&d->pages, sizeof(iArchiveEntry));
+    init_StringHash(&d->words);
+    init_Array(&d->sortedWords, sizeof(iArchiveWord));
+    d->numSorted   = 0;
+    d->fileSize    = 0;
+    d->removedSize = 0;
+}
+
+void deinit_ArchiveIndex(iArchiveIndex *d) {
+    iForEach(Array, w, &d->sortedWords) {
+        deinit_String(&((iArchiveWord *) w.value)->word);
+    }
+    deinit_Array(&d->sortedWords);
+    deinit_StringHash(&d->words);
+    iForEach(Array, i, &d->pages) {
+        deinit_ArchiveEntry(i.value);
+    }
+    deinit_Array(&d->pages);
+}
+
+iDefineTypeConstruction(ArchiveIndex)
+
+static void insertWord_ArchiveIndex_(iArchiveIndex *d, const iString *word,
+                                     iArchivePostings *post) {
+    insert_StringHash(&d->words, word, post);
+    iArchiveWord entry;
+    initCopy_String(&entry.word, word);
+    entry.post = post;
+    pushBack_Array(&d->sortedWords, &entry);
+}
+
+static void sortWords_ArchiveIndex_(iArchiveIndex *d) {
+    /* Words added since the last search are sorted and merged with the rest. */
+    const size_t total = size_Array(&d->sortedWords);
+    if (d->numSorted == total) {
+        return;
+    }
+    iArchiveWord *words = data_Array(&d->sortedWords);
+    qsort(words + d->numSorted, total - d->numSorted, sizeof(iArchiveWord), cmp_ArchiveWord_);
+    if (d->numSorted > 0) {
+        iArchiveWord *merged = malloc(sizeof(iArchiveWord) * total);
+        size_t a = 0, b = d->numSorted, out = 0;
+        while (a < d->numSorted || b < total) {
+            if (b == total || (a < d->numSorted && cmp_ArchiveWord_(&words[a], &words[b]) <= 0)) {
+                merged[out++] = words[a++];
+            }
+            else {
+                merged[out++] = words[b++];
+            }
+        }
+        memcpy(words, merged, sizeof(iArchiveWord) * total);
+        free(merged);
+    }
+    d->numSorted = total;
+}
+
+static size_t lowerBound_ArchiveIndex_(const iArchiveIndex *d, const iString *prefix) {
+    /* Note: The words must be sorted. */
+    size_t lo = 0, hi = d->numSorted;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (cmp_String(&((const iArchiveWord *) constAt_Array(&d->sortedWords, mid))->word,
+                       prefix) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static uint64_t recordSize_ArchiveIndex_(const iArchiveIndex *d, size_t num) {
+    const iArchiveEntry *page = constAt_Array(&d->pages, num);
+    const uint64_t end = (num + 1 < size_Array(&d->pages)
+                              ? ((const iArchiveEntry *) constAt_Array(&d->pages, num + 1))->pos
+                              : d->fileSize);
+    return end - page->pos;
+}
+
+static iArchiveEntry *findLatest_ArchiveIndex_(iArchiveIndex *d, const iString *url, size_t *num_out) {
+    for (size_t num = size_Array(&d->pages); num-- > 0; ) {
+        iArchiveEntry *page = at_Array(&d->pages, num);
+        if (!page->isRemoved && equal_String(&page->url, url)) {
+            if (num_out) {
+                *num_out = num;
+            }
+            return page;
+        }
+    }
+    return NULL;
+}
+
+static void addPage_ArchiveIndex_(iArchiveIndex *d, uint64_t pos, uint64_t endPos, uint64_t when,
+                                  const uint8_t *md5, const iString *url, const iString *title,
+                                  const iWordIndex *words) {
+    size_t oldNum;
+    iArchiveEntry *old = findLatest_ArchiveIndex_(d, url, &oldNum);
+    if (old) {
+        d->removedSize += recordSize_ArchiveIndex_(d, oldNum);
+        old->isRemoved = iTrue;
+    }
+    const uint32_t num = size_Array(&d->pages);
+    iArchiveEntry page;
+    init_ArchiveEntry(&page);
+    page.pos  = pos;
+    page.when = when;
+    memcpy(page.md5, md5, sizeof(page.md5));
+    set_String(&page.url, url);
+    set_String(&page.title, title);
+    pushBack_Array(&d->pages, &page);
+    d->fileSize = endPos;
+    iString word;
+    init_String(&word);
+    for (size_t i = 0; i < numWords_WordIndex(words); i++) {
+        setRange_String(&word, word_WordIndex(words, i));
+        iArchivePostings *post = value_StringHash(&d->words, &word);
+        if (!post) {
+            post = new_ArchivePostings();
+            insertWord_ArchiveIndex_(d, &word, post);
+            iRelease(post); /* owned by the hash */
+        }
+        pushBack_Array(&post->pages, &num);
+    }
+    deinit_String(&word);
+}
+
+static void writeRecord_PageArchive_(iStream *outs, uint64_t when, const iString *url,
+                                     const iString *title, const iBlock *body) {
+    writeU32_Stream(outs, pageMagic_PageArchive_);
+    writeU64_Stream(outs, when);
+    serialize_String(url, outs);
+    serialize_String(title, outs);
+    serialize_Block(body, outs);
+}
+
+static iBool readRecord_PageArchive_(iStream *ins, uint64_t *when, iString *url, iString *title,
+                                     iBlock *body) {
+    if (readU32_Stream(ins) != pageMagic_PageArchive_) {
+        return iFalse;
+    }
+    *when = readU64_Stream(ins);
+    deserialize_String(url, ins);
+    deserialize_String(title, ins);
+    deserialize_Block(body, ins);
+    return iTrue;
+}
+
+static iBool rebuild_ArchiveIndex_(iArchiveIndex *d, const char *pagesPath) {
+    /* Returns false if a damaged record was found; the rest of the file is ignored. */
+    iBool ok = iTrue;
+    iFile *f = newCStr_File(pagesPath);
+    if (open_File(f, readOnly_FileMode)) {
+        iString url, title;
+        iBlock  body;
+        init_String(&url);
+        init_String(&title);
+        init_Block(&body, 0);
+        while (!atEnd_File(f)) {
+            const uint64_t pos  = pos_Stream(stream_File(f));
+            uint64_t       when = 0;
+            if (!readRecord_PageArchive_(stream_File(f), &when, &url, &title, &body)) {
+                ok = iFalse;
+                break;
+            }
+            uint8_t md5[16];
+            md5_Block(&body, md5);
+            iWordIndex *words = new_WordIndex(&body);
+            addPage_ArchiveIndex_(d, pos, pos_Stream(stream_File(f)), when, md5, &url, &title, words);
+            delete_WordIndex(words);
+        }
+        deinit_Block(&body);
+        deinit_String(&title);
+        deinit_String(&url);
+    }
+    iRelease(f);
+    return ok;
+}
+
+static void serialize_ArchiveIndex_(const iArchiveIndex *d, iStream *outs) {
+    writeU32_Stream(outs, indexMagic_PageArchive_);
+    writeU32_Stream(outs, indexVersion_PageArchive_);
+    writeU64_Stream(outs, d->fileSize);
+    writeU64_Stream(outs, d->removedSize);
+    writeU32_Stream(outs, size_Array(&d->pages));
+    iConstForEach(Array, i, &d->pages) {
+        const iArchiveEntry *page = i.value;
+        writeU64_Stream(outs, page->pos);
+        writeU64_Stream(outs, page->when);
+        write8_Stream(outs, page->isRemoved ? 1 : 0);
+        iForIndices(j, page->md5) {
+            write8_Stream(outs, page->md5[j]);
+        }
+        serialize_String(&page->url, outs);
+        serialize_String(&page->title, outs);
+    }
+    writeU32_Stream(outs, size_StringHash(&d->words));
+    iBlock *deltas = new_Block(0);
+    iConstForEach(StringHash, k, &d->words) {
+        encode_ArchivePostings_(k.value->object, deltas);
+        serialize_Block(&k.value->keyBlock, outs);
+        serialize_Block(deltas, outs);
+    }
+    delete_Block(deltas);
+}
+
+static iBool deserialize_ArchiveIndex_(iArchiveIndex *d, iStream *ins, uint64_t pagesFileSize) {
+    if (readU32_Stream(ins) != indexMagic_PageArchive_ ||
+        readU32_Stream(ins) != indexVersion_PageArchive_) {
+        return iFalse;
+    }
+    d->fileSize = readU64_Stream(ins);
+    if (d->fileSize != pagesFileSize) {
+        return iFalse; /* out of date */
+    }
+    d->removedSize = readU64_Stream(ins);
+    const uint32_t numPages = readU32_Stream(ins);
+    for (uint32_t i = 0; i < numPages; i++) {
+        iArchiveEntry page;
+        init_ArchiveEntry(&page);
+        page.pos       = readU64_Stream(ins);
+        page.when      = readU64_Stream(ins);
+        page.isRemoved = read8_Stream(ins) != 0;
+        iForIndices(j, page.md5) {
+            page.md5[j] = read8_Stream(ins);
+        }
+        deserialize_String(&page.url, ins);
+        deserialize_String(&page.title, ins);
+        pushBack_Array(&d->pages, &page);
+        if (page.pos >= d->fileSize || atEnd_Stream(ins)) {
+            return iFalse;
+        }
+    }
+    const uint32_t numWords = readU32_Stream(ins);
+    iBool ok = iTrue;
+    iString word;
+    iBlock  deltas;
+    init_String(&word);
+    init_Block(&deltas, 0);
+    for (uint32_t i = 0; i < numWords && ok; i++) {
+        deserialize_Block(&word.chars, ins);
+        deserialize_Block(&deltas, ins);
+        iArchivePostings *post = new_ArchivePostings();
+        ok = decode_ArchivePostings_(post, &deltas, numPages);
+        insertWord_ArchiveIndex_(d, &word, post);
+        iRelease(post);
+    }
+    deinit_Block(&deltas);
+    deinit_String(&word);
+    return ok;
+}
+
+static iBool isCompactionNeeded_ArchiveIndex_(const iArchiveIndex *d) {
+    if (d->fileSize > maxSize_PageArchive_ ||
+        (d->removedSize > d->fileSize / 2 && d->fileSize > maxSize_PageArchive_ / 10)) {
+        return iTrue;
+    }
+    /* Pages are in chronological order, so only the oldest one needs checking. */
+    const uint64_t oldest = now_PageArchive_() - maxAge_PageArchive_;
+    iConstForEach(Array, i, &d->pages) {
+        const iArchiveEntry *page = i.value;
+        if (!page->isRemoved) {
+            return page->when < oldest;
+        }
+    }
+    return iFalse;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(PendingPage)
+iDeclareTypeConstruction(PendingPage)
+
+struct Impl_PendingPage {
+    iString  url;
+    iBlock   body;
+    uint64_t when;
+};
+
+void init_PendingPage(iPendingPage *d) {
+    init_String(&d->url);
+    init_Block(&d->body, 0);
+    d->when = now_PageArchive_();
+}
+
+void deinit_PendingPage(iPendingPage *d) {
+    deinit_Block(&d->body);
+    deinit_String(&d->url);
+}
+
+iDefineTypeConstruction(PendingPage)
+
+iDeclareType(PendingSearch)
+iDeclareTypeConstruction(PendingSearch)
+
+struct Impl_PendingSearch {
+    iString                query;
+    iAnyObject *           context; /* referenced until done */
+    iPageArchiveSearchFunc func;
+};
+
+void init_PendingSearch(iPendingSearch *d) {
+    init_String(&d->query);
+    d->context = NULL;
+    d->func    = NULL;
+}
+
+void deinit_PendingSearch(iPendingSearch *d) {
+    iRelease(d->context);
+    deinit_String(&d->query);
+}
+
+iDefineTypeConstruction(PendingSearch)
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(PageArchive)
+
+struct Impl_PageArchive {
+    iMutex *       mtx;
+    iString        dir;
+    iArchiveIndex *index;
+    iBool          isReady;    /* index has been loaded */
+    iBool          isModified; /* index needs to be saved */
+    uint32_t       generation; /* incremented when the archive is cleared */
+    iPtrArray      pending;    /* PendingPage */
+    iPtrArray      searches;   /* PendingSearch; done before pending pages */
+    iThread *      worker;
+    iCondition     wakeup;
+    iBool          stopWorker;
+};
+
+static iPageArchive pageArchive_;
+
+static const char *path_PageArchive_(const iPageArchive *d, const char *fileName) {
+    return concatPath_CStr(cstr_String(&d->dir), fileName);
+}
+
+static uint64_t pagesFileSize_PageArchive_(const iPageArchive *d) {
+    const iString *path = collectNewCStr_String(path_PageArchive_(d, pagesFileName_PageArchive_));
+    return fileExists_FileInfo(path) ? fileSize_FileInfo(path) : 0;
+}
+
+static void title_PageArchive_(const iBlock *body, iString *title_out) {
+    /* The first top-level heading is used as the title. */
+    iRangecc line = iNullRange;
+    while (nextSplit_Rangecc(range_Block(body), "\n", &line)) {
+        if (startsWith_Rangecc(line, "# ")) {
+            line.start += 2;
+            trim_Rangecc(&line);
+            setRange_String(title_out, line);
+            return;
+        }
+    }
+    clear_String(title_out);
+}
+
+static void compact_PageArchive_(iPageArchive *d) {
+    /* Pages that are kept are copied to a new file, which is then indexed again. */
+    const uint64_t oldest = now_PageArchive_() - maxAge_PageArchive_;
+    iArray *keep = new_Array(sizeof(uint64_t)); /* record positions */
+    lock_Mutex(d->mtx);
+    const uint32_t generation = d->generation;
+    uint64_t total = 0;
+    for (size_t num = size_Array(&d->index->pages); num-- > 0; ) {
+        const iArchiveEntry *page = constAt_Array(&d->index->pages, num);
+        if (page->isRemoved) {
+            continue;
+        }
+        const uint64_t size = recordSize_ArchiveIndex_(d->index, num);
+        if (page->when < oldest || total + size > maxSize_PageArchive_ * 3 / 4) {
+            break; /* this and all older pages are dropped */
+        }
+        total += size;
+        pushFront_Array(keep, &page->pos);
+    }
+    unlock_Mutex(d->mtx);
+    const char *pagesPath = path_PageArchive_(d, pagesFileName_PageArchive_);
+    const char *newPath   = path_PageArchive_(d, "pages.dat.new");
+    iBool  ok  = iFalse;
+    iFile *src = newCStr_File(pagesPath);
+    iFile *dst = newCStr_File(newPath);
+    if (open_File(src, readOnly_FileMode) && open_File(dst, writeOnly_FileMode)) {
+        ok = iTrue;
+        iString url, title;
+        iBlock  body;
+        init_String(&url);
+        init_String(&title);
+        init_Block(&body, 0);
+        iConstForEach(Array, i, keep) {
+            uint64_t when;
+            seek_Stream(stream_File(src), *(const uint64_t *) i.value);
+            if (readRecord_PageArchive_(stream_File(src), &when, &url, &title, &body)) {
+                writeRecord_PageArchive_(stream_File(dst), when, &url, &title, &body);
+            }
+        }
+        deinit_Block(&body);
+        deinit_String(&title);
+        deinit_String(&url);
+    }
+    iRelease(dst);
+    iRelease(src);
+    delete_Array(keep);
+    iArchiveIndex *index = new_ArchiveIndex();
+    if (ok) {
+        rebuild_ArchiveIndex_(index, newPath);
+    }
+    lock_Mutex(d->mtx);
+    if (ok && d->generation == generation) {
+        remove(pagesPath);
+        rename(newPath, pagesPath);
+        delete_ArchiveIndex(d->index);
+        d->index      = index;
+        d->isModified = iTrue;
+        index         = NULL;
+    }
+    else {
+        remove(newPath); /* failed or cleared meanwhile */
+    }
+    unlock_Mutex(d->mtx);
+    if (index) {
+        delete_ArchiveIndex(index);
+    }
+}
+
+static void load_PageArchive_(iPageArchive *d) {
+    /* The saved index is used if it matches the pages file; otherwise it is rebuilt. */
+    lock_Mutex(d->mtx);
+    const uint32_t generation = d->generation;
+    unlock_Mutex(d->mtx);
+    const uint64_t fileSize = pagesFileSize_PageArchive_(d);
+    iArchiveIndex *index    = new_ArchiveIndex();
+    iBool          isValid  = (fileSize == 0);
+    iBool          isDamaged = iFalse;
+    if (fileSize) {
+        iFile *f = newCStr_File(path_PageArchive_(d, indexFileName_PageArchive_));
+        if (open_File(f, readOnly_FileMode)) {
+            isValid = deserialize_ArchiveIndex_(index, stream_File(f), fileSize);
+        }
+        iRelease(f);
+        if (!isValid) {
+            delete_ArchiveIndex(index);
+            index = new_ArchiveIndex();
+            isDamaged = !rebuild_ArchiveIndex_(index,
+                                               path_PageArchive_(d, pagesFileName_PageArchive_));
+        }
+    }
+    lock_Mutex(d->mtx);
+    d->isReady = iTrue;
+    iBool doCompact = iFalse;
+    if (d->generation == generation) {
+        delete_ArchiveIndex(d->index);
+        d->index      = index;
+        d->isModified = !isValid;
+        doCompact     = isDamaged || isCompactionNeeded_ArchiveIndex_(d->index);
+    }
+    else {
+        delete_ArchiveIndex(index); /* cleared while loading */
+    }
+    unlock_Mutex(d->mtx);
+    if (doCompact) {
+        compact_PageArchive_(d);
+    }
+}
+
+static void ingest_PageArchive_(iPageArchive *d, const iPendingPage *page) {
+    uint8_t md5[16];
+    md5_Block(&page->body, md5);
+    lock_Mutex(d->mtx);
+    const iArchiveEntry *latest = findLatest_ArchiveIndex_(d->index, &page->url, NULL);
+    const iBool isUnchanged = latest && !memcmp(latest->md5, md5, sizeof(md5));
+    unlock_Mutex(d->mtx);
+    if (isUnchanged) {
+        return;
+    }
+    iWordIndex *words = new_WordIndex(&page->body);
+    iString *   title = new_String();
+    title_PageArchive_(&page->body, title);
+    lock_Mutex(d->mtx);
+    const char *   pagesPath = path_PageArchive_(d, pagesFileName_PageArchive_);
+    const uint64_t pos       = d->index->fileSize;
+    iFile *f = newCStr_File(pagesPath);
+    if (open_File(f, append_FileMode)) {
+        writeRecord_PageArchive_(stream_File(f), page->when, &page->url, title, &page->body);
+    }
+    iRelease(f);
+    const uint64_t endPos = pagesFileSize_PageArchive_(d);
+    if (endPos > pos) {
+        addPage_ArchiveIndex_(d->index, pos, endPos, page->when, md5, &page->url, title, words);
+        d->isModified = iTrue;
+    }
+    const iBool doCompact = isCompactionNeeded_ArchiveIndex_(d->index);
+    unlock_Mutex(d->mtx);
+    delete_String(title);
+    delete_WordIndex(words);
+    if (doCompact) {
+        compact_PageArchive_(d);
+    }
+}
+
+static const iString *searchPage_PageArchive_(const iString *query);
+
+static iThreadResult worker_PageArchive_(iThread *thread) {
+    iPageArchive *d = &pageArchive_;
+    iUnused(thread);
+    load_PageArchive_(d);
+    lock_Mutex(d->mtx);
+    while (!d->stopWorker) {
+        if (!isEmpty_PtrArray(&d->searches)) {
+            iPendingSearch *search = NULL;
+            take_PtrArray(&d->searches, 0, (void **) &search);
+            unlock_Mutex(d->mtx);
+            iBeginCollect();
+            search->func(search->context, searchPage_PageArchive_(&search->query));
+            iEndCollect();
+            delete_PendingSearch(search);
+            lock_Mutex(d->mtx);
+            continue;
+        }
+        if (isEmpty_PtrArray(&d->pending)) {
+            wait_Condition(&d->wakeup, d->mtx);
+            continue;
+        }
+        iPendingPage *page = NULL;
+        take_PtrArray(&d->pending, 0, (void **) &page);
+        unlock_Mutex(d->mtx);
+        ingest_PageArchive_(d, page);
+        delete_PendingPage(page);
+        lock_Mutex(d->mtx);
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_PageArchive(const char *saveDir) {
+    iPageArchive *d = &pageArchive_;
+    d->mtx = new_Mutex();
+    initCStr_String(&d->dir, concatPath_CStr(saveDir, dirName_PageArchive_));
+    makeDirs_Path(&d->dir);
+    d->index      = new_ArchiveIndex();
+    d->isReady    = iFalse;
+    d->isModified = iFalse;
+    d->generation = 0;
+    init_PtrArray(&d->pending);
+    init_PtrArray(&d->searches);
+    init_Condition(&d->wakeup);
+    d->stopWorker = iFalse;
+    d->worker     = new_Thread(worker_PageArchive_);
+    start_Thread(d->worker);
+}
+
+void deinit_PageArchive(void) {
+    iPageArchive *d = &pageArchive_;
+    lock_Mutex(d->mtx);
+    d->stopWorker = iTrue;
+    signal_Condition(&d->wakeup);
+    unlock_Mutex(d->mtx);
+    join_Thread(d->worker);
+    iReleasePtr(&d->worker);
+    save_PageArchive();
+    iForEach(PtrArray, i, &d->pending) {
+        delete_PendingPage(i.ptr); /* not archived */
+    }
+    deinit_PtrArray(&d->pending);
+    iForEach(PtrArray, j, &d->searches) {
+        delete_PendingSearch(j.ptr); /* never done */
+    }
+    deinit_PtrArray(&d->searches);
+    deinit_Condition(&d->wakeup);
+    delete_ArchiveIndex(d->index);
+    deinit_String(&d->dir);
+    delete_Mutex(d->mtx);
+}
+
+void save_PageArchive(void) {
+    iPageArchive *d = &pageArchive_;
+    lock_Mutex(d->mtx);
+    if (d->isReady && d->isModified) {
+        iFile *f = newCStr_File(path_PageArchive_(d, indexFileName_PageArchive_));
+        if (open_File(f, writeOnly_FileMode)) {
+            serialize_ArchiveIndex_(d->index, stream_File(f));
+            d->isModified = iFalse;
+        }
+        iRelease(f);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+void clear_PageArchive(void) {
+    iPageArchive *d = &pageArchive_;
+    lock_Mutex(d->mtx);
+    iForEach(PtrArray, i, &d->pending) {
+        delete_PendingPage(i.ptr);
+    }
+    clear_PtrArray(&d->pending);
+    delete_ArchiveIndex(d->index);
+    d->index = new_ArchiveIndex();
+    d->generation++;
+    remove(path_PageArchive_(d, pagesFileName_PageArchive_));
+    remove(path_PageArchive_(d, indexFileName_PageArchive_));
+    d->isModified = iFalse;
+    unlock_Mutex(d->mtx);
+}
+
+void add_PageArchive(const iString *url, const iString *mime, const iBlock *body) {
+    iPageArchive *d = &pageArchive_;
+    if (!startsWithCase_String(mime, "text/gemini") || isEmpty_Block(body) ||
+        size_Block(body) > maxPageSize_PageArchive_) {
+        return;
+    }
+    iPendingPage *page = new_PendingPage();
+    set_String(&page->url, url);
+    set_Block(&page->body, body);
+    lock_Mutex(d->mtx);
+    pushBack_PtrArray(&d->pending, page);
+    signal_Condition(&d->wakeup);
+    unlock_Mutex(d->mtx);
+}
+
+static void snippet_PageArchive_(iFile *f, uint64_t pos, const iString *pageUrl,
+                                 const iStringArray *words, iString *snippet_out) {
+    iString url, title;
+    iBlock  body;
+    init_String(&url);
+    init_String(&title);
+    init_Block(&body, 0);
+    uint64_t when;
+    seek_Stream(stream_File(f), pos);
+    /* The file may have been compacted after the position was looked up. */
+    if (readRecord_PageArchive_(stream_File(f), &when, &url, &title, &body) &&
+        equal_String(&url, pageUrl)) {
+        iWordIndex *index = new_WordIndex(&body);
+        iRangei     found;
+        if (find_WordIndex(index, words, &found)) {
+            const char *text  = constBegin_Block(&body);
+            int         start = iMax(0, found.start - 20);
+            int         end   = iMin((int) size_Block(&body), found.end + 60);
+            /* Don't cut multibyte characters in half. */
+            while (start < found.start && (text[start] & 0xc0) == 0x80) start++;
+            while (end > found.end && end < (int) size_Block(&body) && (text[end] & 0xc0) == 0x80) end--;
+            setRange_String(snippet_out, (iRangecc){ text + start, text + end });
+            replace_Block(&snippet_out->chars, '\n', ' ');
+            replace_Block(&snippet_out->chars, '\r', ' ');
+            trim_String(snippet_out);
+        }
+        delete_WordIndex(index);
+    }
+    deinit_Block(&body);
+    deinit_String(&title);
+    deinit_String(&url);
+}
+
+const iObjectList *search_PageArchive(const iStringArray *words, size_t maxCount) {
+    iPageArchive *d        = &pageArchive_;
+    iObjectList * results  = iClob(new_ObjectList());
+    const size_t  numWords = size_StringArray(words);
+    if (numWords == 0 || numWords > maxQueryWords_PageArchive_) {
+        return results;
+    }
+    iArray *positions = new_Array(sizeof(uint64_t)); /* of the found pages' records */
+    lock_Mutex(d->mtx);
+    iArchiveIndex *index    = d->index;
+    const size_t   numPages = size_Array(&index->pages);
+    if (d->isReady && numPages > 0) {
+        /* Count for each page how many of the words it contains. Each word may be a prefix
+           of any number of indexed words. */
+        sortWords_ArchiveIndex_(index);
+        uint8_t *hits  = calloc(numPages, 1);
+        uint8_t  round = 0;
+        iConstForEach(StringArray, w, words) {
+            const iString *prefix = w.value;
+            for (size_t i = lowerBound_ArchiveIndex_(index, prefix); i < index->numSorted; i++) {
+                const iArchiveWord *word = constAt_Array(&index->sortedWords, i);
+                if (!startsWith_String(&word->word, cstr_String(prefix))) {
+                    break;
+                }
+                iConstForEach(Array, p, &word->post->pages) {
+                    const uint32_t num = *(const uint32_t *) p.value;
+                    if (hits[num] == round) {
+                        hits[num] = round + 1;
+                    }
+                }
+            }
+            round++;
+        }
+        const uint64_t oldest = now_PageArchive_() - maxAge_PageArchive_;
+        size_t         count  = 0;
+        for (size_t num = numPages; num-- > 0 && count < maxCount; ) {
+            const iArchiveEntry *page = constAt_Array(&index->pages, num);
+            if (hits[num] != round || page->isRemoved || page->when < oldest) {
+                continue;
+            }
+            iArchivedPage *found = new_ArchivedPage();
+            set_String(&found->url, &page->url);
+            set_String(&found->title, &page->title);
+            found->when.ts.tv_sec = page->when;
+            pushBack_ObjectList(results, found);
+            pushBack_Array(positions, &page->pos);
+            iRelease(found);
+            count++;
+        }
+        free(hits);
+    }
+    unlock_Mutex(d->mtx);
+    /* Snippets are read from the pages file without holding the lock. */
+    if (!isEmpty_Array(positions)) {
+        iFile *f = newCStr_File(path_PageArchive_(d, pagesFileName_PageArchive_));
+        if (open_File(f, readOnly_FileMode)) {
+            size_t pos = 0;
+            iForEach(ObjectList, i, results) {
+                iArchivedPage *found = (iArchivedPage *) i.object;
+                snippet_PageArchive_(f, *(const uint64_t *) constAt_Array(positions, pos++),
+                                     &found->url, words, &found->snippet);
+            }
+        }
+        iRelease(f);
+    }
+    delete_Array(positions);
+    return results;
+}
+
+size_t numPages_PageArchive(void) {
+    iPageArchive *d = &pageArchive_;
+    size_t count = 0;
+    lock_Mutex(d->mtx);
+    iConstForEach(Array, i, &d->index->pages) {
+        if (!((const iArchiveEntry *) i.value)->isRemoved) {
+            count++;
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return count;
+}
+
+size_t size_PageArchive(void) {
+    iPageArchive *d = &pageArchive_;
+    lock_Mutex(d->mtx);
+    const size_t size = d->index->fileSize;
+    unlock_Mutex(d->mtx);
+    return size;
+}
+
+static iString *heading_PageArchive_(const iString *query) {
+    /* The query must not be able to add lines of its own to the page. */
+    iString *heading = collectNew_String();
+    for (const char *ch = constBegin_String(query); ch != constEnd_String(query); ch++) {
+        if ((uint8_t) *ch >= 0x20 && *ch != 0x7f) {
+            appendData_Block(&heading->chars, ch, 1);
+        }
+    }
+    trim_String(heading);
+    return heading;
+}
+
+static const iString *searchPage_PageArchive_(const iString *query) {
+    iString *src = collectNew_String();
+    setCStr_String(src, translateCStr_Lang("# ${search.archive.title}\n\n"));
+    appendCStr_String(src, formatCStrs_Lang("search.archive.pagecount.n", numPages_PageArchive()));
+    appendFormat_String(src, "\n## %s\n", cstr_String(heading_PageArchive_(query)));
+    const iObjectList *found =
+        search_PageArchive(iClob(splitQuery_WordIndex(query)), 100);
+    if (isEmpty_ObjectList(found)) {
+        appendFormat_String(src, "%s\n", cstr_Lang("search.archive.nomatch"));
+    }
+    iConstForEach(ObjectList, i, found) {
+        const iArchivedPage *page = (const iArchivedPage *) i.object;
+        appendFormat_String(src,
+                            "=> %s %s \u2014 %s\n",
+                            cstr_String(&page->url),
+                            cstrCollect_String(format_Time(&page->when, "%Y-%m-%d")),
+                            isEmpty_String(&page->title) ? cstr_String(&page->url)
+                                                         : cstr_String(&page->title));
+        if (!isEmpty_String(&page->snippet)) {
+            appendFormat_String(src, "> %s\n", cstr_String(&page->snippet));
+        }
+    }
+    return src;
+}
+
+void submitSearch_PageArchive(const iString *query, iAnyObject *context,
+                              iPageArchiveSearchFunc func) {
+    iPageArchive *  d      = &pageArchive_;
+    iPendingSearch *search = new_PendingSearch();
+    set_String(&search->query, query);
+    search->context = ref_Object(context);
+    search->func    = func;
+    lock_Mutex(d->mtx);
+    pushBack_PtrArray(&d->searches, search);
+    signal_Condition(&d->wakeup);
+    unlock_Mutex(d->mtx);
+}
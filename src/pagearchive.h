@@ -0,0 +1,62 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/block.h>
+#include <the_Foundation/objectlist.h>
+#include <the_Foundation/stringarray.h>
+#include <the_Foundation/time.h>
+
+/* Searchable archive of the text pages that have been read. Pages are appended to a single
+   file on disk, and an inverted index maps each word to the pages where it appears. New
+   pages are added in a background thread. Pages are removed when they get too old or
+   when the archive grows too large. Thread safe. */
+
+iDeclareClass(ArchivedPage)
+iDeclareObjectConstruction(ArchivedPage)
+
+struct Impl_ArchivedPage {
+    iObject object;
+    iString url;
+    iString title;
+    iString snippet; /* text around the first matching word */
+    iTime   when;
+};
+
+void        init_PageArchive        (const char *saveDir);
+void        deinit_PageArchive      (void);
+void        save_PageArchive        (void); /* writes the index */
+void        clear_PageArchive       (void);
+
+void        add_PageArchive         (const iString *url, const iString *mime, const iBlock *body);
+const iObjectList *
+            search_PageArchive      (const iStringArray *words, size_t maxCount); /* newest first */
+size_t      numPages_PageArchive    (void);
+size_t      size_PageArchive        (void); /* bytes */
+
+/* The search results page is composed in the archive's thread. `func` is called there with
+   the page source, unless the archive is deinitialized before that. */
+typedef void (*iPageArchiveSearchFunc)(iAnyObject *context, const iString *page);
+
+void        submitSearch_PageArchive(const iString *query, iAnyObject *context,
+                                     iPageArchiveSearchFunc func);
@@ -0,0 +1,234 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "prefetch.h"
+#include "app.h"
+#include "gmcerts.h"
+#include "prefs.h"
+#include "sitespec.h"
+
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/time.h>
+
+iDeclareType(PrefetchItem)
+
+struct Impl_PrefetchItem {
+    iString      url;
+    iGmRequest  *request;  /* NULL after finishing */
+    iGmResponse *response; /* successful responses only */
+    iTime        when;
+};
+
+static iPrefetchItem *new_PrefetchItem_(const iString *url) {
+    iPrefetchItem *d = iMalloc(PrefetchItem);
+    initCopy_String(&d->url, url);
+    d->request  = NULL;
+    d->response = NULL;
+    initCurrent_Time(&d->when);
+    return d;
+}
+
+static void delete_PrefetchItem_(iPrefetchItem *d) {
+    if (d->request) {
+        cancel_GmRequest(d->request);
+        iRelease(d->request);
+    }
+    if (d->response) {
+        delete_GmResponse(d->response);
+    }
+    deinit_String(&d->url);
+    free(d);
+}
+
+static size_t memorySize_PrefetchItem_(const iPrefetchItem *d) {
+    return d->response ? size_Block(&d->response->body) : 0;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(Prefetch)
+
+struct Impl_Prefetch {
+    iPtrArray items; /* oldest first */
+    iTime     lastStartedAt;
+};
+
+static iPrefetch prefetch_;
+
+static const size_t maxItems_Prefetch_           = 8;
+static const double maxAge_Prefetch_             = 5 * 60.0; /* seconds */
+static const double minRequestInterval_Prefetch_ = 2.0;
+
+void init_Prefetch(void) {
+    iPrefetch *d = &prefetch_;
+    init_PtrArray(&d->items);
+    iZap(d->lastStartedAt);
+}
+
+void deinit_Prefetch(void) {
+    iPrefetch *d = &prefetch_;
+    iForEach(PtrArray, i, &d->items) {
+        delete_PrefetchItem_(i.ptr);
+    }
+    deinit_PtrArray(&d->items);
+}
+
+static size_t memoryLimit_Prefetch_(void) {
+    /* Prefetched pages may take up a quarter of the cache size allotted to navigation history. */
+    return (size_t) iMax(0, prefs_App()->maxCacheSize) * 1000000 / 4;
+}
+
+static void trim_Prefetch_(iPrefetch *d) {
+    iTime now;
+    initCurrent_Time(&now);
+    size_t total = 0;
+    iForEach(PtrArray, i, &d->items) {
+        iPrefetchItem *item = i.ptr;
+        if (!item->request && secondsSince_Time(&now, &item->when) > maxAge_Prefetch_) {
+            remove_PtrArrayIterator(&i);
+            delete_PrefetchItem_(item);
+            continue;
+        }
+        total += memorySize_PrefetchItem_(item);
+    }
+    /* Drop the oldest ones until the limits are respected. */
+    const size_t limit = memoryLimit_Prefetch_();
+    iForEach(PtrArray, j, &d->items) {
+        if (size_PtrArray(&d->items) <= maxItems_Prefetch_ && total <= limit) {
+            break;
+        }
+        iPrefetchItem *item = j.ptr;
+        if (!item->request) {
+            total -= memorySize_PrefetchItem_(item);
+            remove_PtrArrayIterator(&j);
+            delete_PrefetchItem_(item);
+        }
+    }
+}
+
+static iPrefetchItem *find_Prefetch_(iPrefetch *d, const iString *url) {
+    iConstForEach(PtrArray, i, &d->items) {
+        iPrefetchItem *item = i.ptr;
+        if (equal_String(&item->url, url)) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static iBool isPending_Prefetch_(const iPrefetch *d) {
+    iConstForEach(PtrArray, i, &d->items) {
+        if (((const iPrefetchItem *) i.ptr)->request) {
+            return iTrue;
+        }
+    }
+    return iFalse;
+}
+
+static iBool isAllowed_Prefetch_(const iString *url) {
+    iUrl parts;
+    init_Url(&parts, url);
+    /* Queries may have side effects, and client certificates imply a personalized response. */
+    if (!equalCase_Rangecc(parts.scheme, "gemini") || !isEmpty_Range(&parts.query)) {
+        return iFalse;
+    }
+    if (identityForUrl_GmCerts(certs_App(), url)) {
+        return iFalse;
+    }
+    return value_SiteSpec(collectNewRange_String(urlRoot_String(url)), prefetch_SiteSpecKey) != 0;
+}
+
+static void requestFinished_Prefetch_(iAnyObject *obj, iGmRequest *req) {
+    iUnused(obj);
+    postCommandf_App("prefetch.request.finished req:%p", req);
+}
+
+void request_Prefetch(const iString *url) {
+    iPrefetch *d = &prefetch_;
+    if (!url || isEmpty_String(url) || memoryLimit_Prefetch_() == 0) {
+        return;
+    }
+    trim_Prefetch_(d);
+    /* Only one request at a time, and not too often, so servers aren't bothered much. */
+    if (find_Prefetch_(d, url) || isPending_Prefetch_(d) ||
+        (isValid_Time(&d->lastStartedAt) &&
+         elapsedSeconds_Time(&d->lastStartedAt) < minRequestInterval_Prefetch_)) {
+        return;
+    }
+    if (!isAllowed_Prefetch_(url)) {
+        return;
+    }
+    iPrefetchItem *item = new_PrefetchItem_(url);
+    item->request = new_GmRequest(certs_App());
+    setUrl_GmRequest(item->request, url);
+    setPriority_GmRequest(item->request, background_GmRequestPriority, d);
+    iConnect(GmRequest, item->request, finished, item->request, requestFinished_Prefetch_);
+    pushBack_PtrArray(&d->items, item);
+    initCurrent_Time(&d->lastStartedAt);
+    submit_GmRequest(item->request);
+}
+
+void requestFinished_Prefetch(iGmRequest *req) {
+    iPrefetch *d = &prefetch_;
+    iForEach(PtrArray, i, &d->items) {
+        iPrefetchItem *item = i.ptr;
+        if (item->request != req) {
+            continue;
+        }
+        if (isSuccess_GmStatusCode(status_GmRequest(req))) {
+            item->response = copy_GmResponse(lockResponse_GmRequest(req));
+            unlockResponse_GmRequest(req);
+            initCurrent_Time(&item->when);
+        }
+        iRelease(item->request);
+        item->request = NULL;
+        if (!item->response) {
+            remove_PtrArrayIterator(&i);
+            delete_PrefetchItem_(item);
+        }
+        break;
+    }
+    trim_Prefetch_(d);
+}
+
+iGmResponse *take_Prefetch(const iString *url) {
+    iPrefetch *d = &prefetch_;
+    trim_Prefetch_(d);
+    iForEach(PtrArray, i, &d->items) {
+        iPrefetchItem *item = i.ptr;
+        if (!item->request && equal_String(&item->url, url)) {
+            /* Prefetching is done anonymously. If an identity has been taken into use since
+               then, the response is no longer what the server would send. */
+            if (identityForUrl_GmCerts(certs_App(), url)) {
+                remove_PtrArrayIterator(&i);
+                delete_PrefetchItem_(item);
+                return NULL;
+            }
+            iGmResponse *resp = item->response;
+            item->response = NULL;
+            remove_PtrArrayIterator(&i);
+            delete_PrefetchItem_(item);
+            return resp;
+        }
+    }
+    return NULL;
+}
@@ -73,9 +73,12 @@ void init_Prefs(iPrefs *d) {
     d->addBookmarksToBottom    = iTrue;
     d->warnAboutMissingGlyphs  = iTrue;
     d->decodeUserVisibleURLs   = iTrue;
+    d->prefetchHosts           = iFalse;
     d->maxCacheSize      = 10;
+    d->maxDiskCacheSize  = 100;
     d->maxMemorySize     = 200;
     d->maxUrlSize        = 8192;
+    d->maxFeedRequests   = 4;
     setCStr_String(&d->strings[uiFont_PrefsString], "default");
     setCStr_String(&d->strings[headingFont_PrefsString], "default");
     setCStr_String(&d->strings[bodyFont_PrefsString], "default");
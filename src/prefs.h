@@ -85,6 +85,7 @@ enum iPrefsBool {
     
     /* Network */
     decodeUserVisibleURLs_PrefsBool,
+    prefetchHosts_PrefsBool,
     
     /* Style */
     monospaceGemini_PrefsBool,
@@ -140,6 +141,7 @@ struct Impl_Prefs {
             
             /* Network */
             iBool decodeUserVisibleURLs;
+            iBool prefetchHosts; /* resolve link hosts ahead of time */
             
             /* Style */
             iBool monospaceGemini;
@@ -175,8 +177,10 @@ struct Impl_Prefs {
     int              smoothScrollSpeed[max_ScrollType];
     /* Network */
     int              maxCacheSize; /* MB */
+    int              maxDiskCacheSize; /* MB */
     int              maxMemorySize; /* MB */
     int              maxUrlSize; /* bytes; longer ones will be disregarded */
+    int              maxFeedRequests; /* concurrent requests when refreshing feeds */
     /* Style */
     iStringSet *     disabledFontPacks;
     int              gemtextAnsiEscapes;
@@ -38,6 +38,7 @@ struct Impl_SiteParams {
     int      dismissWarnings;
     iStringArray usedIdentities; /* fingerprints; latest ones at the end */
     iString  paletteSeed;
+    int      prefetch; /* hovered links may be fetched in advance */
     /* TODO: style settings */
 };
 
@@ -47,6 +48,7 @@ void init_SiteParams(iSiteParams *d) {
     d->dismissWarnings = 0;
     init_StringArray(&d->usedIdentities);
     init_String(&d->paletteSeed);
+    d->prefetch = 0;
 }
 
 void deinit_SiteParams(iSiteParams *d) {
@@ -155,6 +157,9 @@ static void handleIniKeyValue_SiteSpec_(void *context, const iString *table, con
     else if (!cmp_String(key, "paletteSeed") && value->type == string_TomlType) {
         set_String(&d->loadParams->paletteSeed, value->value.string);
     }
+    else if (!cmp_String(key, "prefetch")) {
+        d->loadParams->prefetch = number_TomlValue(value) != 0;
+    }
 }
 
 static iBool load_SiteSpec_(iSiteSpec *d) {
@@ -201,6 +206,9 @@ static void save_SiteSpec_(iSiteSpec *d) {
                 append_String(buf, collect_String(quote_String(&params->paletteSeed, iFalse)));
                 appendCStr_String(buf, "\"\n");
             }
+            if (params->prefetch) {
+                appendCStr_String(buf, "prefetch = 1\n");
+            }
             if (!isEmpty_String(buf)) {
                 writeData_File(f, "[", 1);
                 writeData_File(f, constData_Block(key), size_Block(key));
@@ -254,6 +262,10 @@ void setValue_SiteSpec(const iString *site, enum iSiteSpecKey key, int value) {
             params->dismissWarnings = value;
             needSave = iTrue;
             break;
+        case prefetch_SiteSpecKey:
+            params->prefetch = value != 0;
+            needSave = iTrue;
+            break;
         default:
             break;
     }
@@ -336,6 +348,8 @@ int value_SiteSpec(const iString *site, enum iSiteSpecKey key) {
             return params->titanPort;
         case dismissWarnings_SiteSpecKey:
             return params->dismissWarnings;
+        case prefetch_SiteSpecKey:
+            return params->prefetch;
         default:
             return 0;
     }    
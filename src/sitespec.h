@@ -32,6 +32,7 @@ enum iSiteSpecKey {
     dismissWarnings_SiteSpecKey, /* int */
     usedIdentities_SiteSpecKey,  /* StringArray */
     paletteSeed_SiteSpecKey,     /* String */
+    prefetch_SiteSpecKey,        /* int */
 };
 
 void    init_SiteSpec       (const char *saveDir);
@@ -789,12 +789,10 @@ static const iColor ansi8BitColors_[256] = {
     { 255, 255, 255, 255 }
 };
 
-void ansiColors_Color(iRangecc escapeSequence, int fgDefault, int bgDefault,
-                      iColor *fg_out, iColor *bg_out) {
-    if (!fg_out && !bg_out) {
-        return;
-    }
+void ansiColorsOrDefault_Color(iRangecc escapeSequence, iColor *fg_out, iColor *bg_out,
+                               iBool *isFgDefault_out, iBool *isBgDefault_out) {
     iColor fg, bg;
+    iBool  isFgDefault = iFalse, isBgDefault = iFalse;
     iZap(fg);
     iZap(bg);
     for (const char *ch = escapeSequence.start; ch < escapeSequence.end; ch++) {
@@ -843,7 +841,8 @@ void ansiColors_Color(iRangecc escapeSequence, int fgDefault, int bgDefault,
                 break;
             }
             case 39:
-                fg = get_Color(fgDefault);
+                iZap(fg);
+                isFgDefault = iTrue;
                 break;
             case 40:
             case 41:
@@ -856,7 +855,8 @@ void ansiColors_Color(iRangecc escapeSequence, int fgDefault, int bgDefault,
                 bg = ansi8BitColors_[arg - 40];
                 break;
             case 49:
-                bg = get_Color(bgDefault);
+                iZap(bg);
+                isBgDefault = iTrue;
                 break;
             case 90:
             case 91:
@@ -879,6 +879,33 @@ void ansiColors_Color(iRangecc escapeSequence, int fgDefault, int bgDefault,
                 bg = ansi8BitColors_[8 + arg - 100];
                 break;
         }
+        /* A color given after a reset overrides it. */
+        if (fg.a) {
+            isFgDefault = iFalse;
+        }
+        if (bg.a) {
+            isBgDefault = iFalse;
+        }
+    }
+    *fg_out          = fg;
+    *bg_out          = bg;
+    *isFgDefault_out = isFgDefault;
+    *isBgDefault_out = isBgDefault;
+}
+
+void ansiColors_Color(iRangecc escapeSequence, int fgDefault, int bgDefault,
+                      iColor *fg_out, iColor *bg_out) {
+    if (!fg_out && !bg_out) {
+        return;
+    }
+    iColor fg, bg;
+    iBool  isFgDefault, isBgDefault;
+    ansiColorsOrDefault_Color(escapeSequence, &fg, &bg, &isFgDefault, &isBgDefault);
+    if (isFgDefault) {
+        fg = get_Color(fgDefault);
+    }
+    if (isBgDefault) {
+        bg = get_Color(bgDefault);
     }
     if (fg.a && fg_out) {
         *fg_out = fg;
@@ -260,6 +260,8 @@ void            setThemePalette_Color   (enum iColorTheme theme);
 
 void            ansiColors_Color        (iRangecc escapeSequence, int fgDefault, int bgDefault,
                                          iColor *fg_out, iColor *bg_out); /* can be NULL */
+void            ansiColorsOrDefault_Color(iRangecc escapeSequence, iColor *fg_out, iColor *bg_out,
+                                         iBool *isFgDefault_out, iBool *isBgDefault_out); /* defaults unresolved */
 const char *    escape_Color            (int color);
 enum iColorId   parseEscape_Color       (const char *cstr, const char **endp);
 
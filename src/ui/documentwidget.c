@@ -38,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmutil.h"
 #include "gopher.h"
 #include "history.h"
+#include "hostcache.h"
 #include "indicatorwidget.h"
 #include "inputwidget.h"
 #include "keys.h"
@@ -46,8 +47,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "media.h"
 #include "paint.h"
 #include "periodic.h"
+#include "prefetch.h"
 #include "root.h"
 #include "mediaui.h"
+#include "pagearchive.h"
 #include "scrollwidget.h"
 #include "sitespec.h"
 #include "touch.h"
@@ -271,6 +274,8 @@ struct Impl_DocumentView {
     iVisBufMeta *  visBufMeta;
     iGmRunRange    renderRuns;
     iPtrSet *      invalidRuns;
+    size_t         layoutAnchorPos; /* source position kept in view during background layout */
+    int            layoutAnchorOffset;
 };
 
 struct Impl_DocumentWidget {
@@ -338,6 +343,8 @@ struct Impl_DocumentWidget {
 
 iDefineObjectConstruction(DocumentWidget)
 
+static const size_t minSourceSizeForBackgroundLayout_ = 256 * 1024; /* bytes */
+
 /* Sorted by proximity to F and J. */
 static const int homeRowKeys_[] = {
     'f', 'd', 's', 'a',
@@ -490,6 +497,8 @@ void init_DocumentView(iDocumentView *d) {
     d->hoverPre      = NULL;
     d->hoverAltPre   = NULL;
     d->hoverLink     = NULL;
+    d->layoutAnchorPos    = iInvalidPos;
+    d->layoutAnchorOffset = 0;
     d->animWideRunId = 0;
     init_Anim(&d->animWideRunOffset, 0);
     iZap(d->renderRuns);
@@ -654,6 +663,28 @@ static void addVisible_DocumentView_(void *context, const iGmRun *run) {
     }
 }
 
+static void prefetchVisibleHosts_DocumentView_(const iDocumentView *d) {
+    /* Resolve the hosts of visible links so a click doesn't have to wait for DNS. */
+    if (!prefs_App()->prefetchHosts) {
+        return;
+    }
+    iGmLinkId prevLinkId = 0;
+    iConstForEach(PtrArray, i, &d->visibleLinks) {
+        const iGmRun *run = i.ptr;
+        if (run->linkId != prevLinkId) {
+            prefetchUrl_HostCache(
+                absoluteUrl_String(d->owner->mod.url, linkUrl_GmDocument(d->doc, run->linkId)));
+            prevLinkId = run->linkId;
+        }
+    }
+}
+
+static void prefetchLink_DocumentView_(const iDocumentView *d, iGmLinkId linkId) {
+    /* Likely to be opened next; only actually fetched if the site allows it. */
+    request_Prefetch(urlFragmentStripped_String(
+        absoluteUrl_String(d->owner->mod.url, linkUrl_GmDocument(d->doc, linkId))));
+}
+
 static const iGmRun *lastVisibleLink_DocumentView_(const iDocumentView *d) {
     iReverseConstForEach(PtrArray, i, &d->visibleLinks) {
         const iGmRun *run = i.ptr;
@@ -747,6 +778,7 @@ static void updateHover_DocumentView_(iDocumentView *d, iInt2 mouse) {
         }
         if (d->hoverLink) {
             invalidateLink_DocumentView_(d, d->hoverLink->linkId);
+            prefetchLink_DocumentView_(d, d->hoverLink->linkId);
         }
         if (update_LinkInfo(d->owner->linkInfo,
                             d->doc,
@@ -1093,10 +1125,38 @@ static void documentRunsInvalidated_DocumentWidget_(iDocumentWidget *d) {
     documentRunsInvalidated_DocumentView_(&d->view);
 }
 
+static void scrollToLayoutAnchor_DocumentView_(iDocumentView *d) {
+    if (d->layoutAnchorPos != iInvalidPos) {
+        const iString *src = source_GmDocument(d->doc);
+        if (d->layoutAnchorPos < size_String(src)) {
+            const iGmRun *run =
+                findRunAtLoc_GmDocument(d->doc, constBegin_String(src) + d->layoutAnchorPos);
+            if (run) {
+                scrollTo_DocumentView_(d,
+                                       top_Rect(run->visBounds) + lineHeight_Text(paragraph_FontId) +
+                                           d->layoutAnchorOffset,
+                                       iFalse);
+            }
+        }
+        d->layoutAnchorPos = iInvalidPos;
+    }
+}
+
+static iBool finishBackgroundLayout_DocumentView_(iDocumentView *d) {
+    if (!takeBackgroundLayout_GmDocument(d->doc)) {
+        return iFalse;
+    }
+    setWidth_Banner(d->owner->banner, size_GmDocument(d->doc).x);
+    documentRunsInvalidated_DocumentWidget_(d->owner);
+    scrollToLayoutAnchor_DocumentView_(d);
+    return iTrue;
+}
+
 static iBool updateDocumentWidthRetainingScrollPosition_DocumentView_(iDocumentView *d,
                                                                       iBool keepCenter) {
     const int newWidth = documentWidth_DocumentView_(d);
     if (newWidth == size_GmDocument(d->doc).x && !keepCenter /* not a font change */) {
+        cancelBackgroundLayout_GmDocument(d->doc); /* back to the original width */
         return iFalse;
     }
     /* Font changes (i.e., zooming) will keep the view centered, otherwise keep the top
@@ -1109,6 +1169,18 @@ static iBool updateDocumentWidthRetainingScrollPosition_DocumentView_(iDocumentV
         /* TODO: First *fully* visible run? */
         voffset = visibleRange_DocumentView_(d).start - top_Rect(run->visBounds);
     }
+    if (!keepCenter &&
+        size_String(source_GmDocument(d->doc)) >= minSourceSizeForBackgroundLayout_) {
+        /* Large documents are laid out in the background. The old layout is shown until
+           the new one is ready. */
+        const iRangecc src = range_String(source_GmDocument(d->doc));
+        d->layoutAnchorPos =
+            (runLoc >= src.start && runLoc < src.end ? (size_t) (runLoc - src.start) : iInvalidPos);
+        d->layoutAnchorOffset = voffset;
+        setWidthInBackground_GmDocument(
+            d->doc, newWidth, width_Widget(d->owner), window_Widget(d->owner));
+        return iTrue;
+    }
     setWidth_GmDocument(d->doc, newWidth, width_Widget(d->owner));
     setWidth_Banner(d->owner->banner, newWidth);
     documentRunsInvalidated_DocumentWidget_(d->owner);
@@ -1233,6 +1305,11 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
             SDL_RenderCopy(d->paint.dst->render, tex, NULL,
                            &(SDL_Rect){ dst.pos.x, dst.pos.y, dst.size.x, dst.size.y });
         }
+        else if (isImageDecoding_Media(media_GmDocument(d->view->doc), mediaId_GmRun(run))) {
+            /* Placeholder until a worker has finished decoding. */
+            drawRect_Paint(&d->paint, dst, tmQuoteIcon_ColorId);
+            drawCentered_Text(uiLabel_FontId, dst, iFalse, tmQuote_ColorId, hourglass_Icon);
+        }
         else {
             drawRect_Paint(&d->paint, dst, tmQuoteIcon_ColorId);
             drawCentered_Text(uiLabel_FontId,
@@ -2832,6 +2909,7 @@ static void fetch_DocumentWidget_(iDocumentWidget *d) {
     set_Atomic(&d->isRequestUpdated, iFalse);
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, d->mod.url);
+    setPriority_GmRequest(d->request, interactive_GmRequestPriority, d);
     iConnect(GmRequest, d->request, updated, d, requestUpdated_DocumentWidget_);
     iConnect(GmRequest, d->request, finished, d, requestFinished_DocumentWidget_);
     submit_GmRequest(d->request);
@@ -2999,6 +3077,22 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
         as_Widget(d)->root, "document.changed doc:%p url:%s", d, cstr_String(d->mod.url));
 }
 
+static iBool updateFromPrefetch_DocumentWidget_(iDocumentWidget *d) {
+    const iRecentUrl *recent = constMostRecentUrl_History(d->mod.history);
+    if (!recent || !equalCase_String(&recent->url, d->mod.url)) {
+        return iFalse;
+    }
+    iGmResponse *resp = take_Prefetch(d->mod.url);
+    if (!resp) {
+        return iFalse;
+    }
+    setCachedResponse_History(d->mod.history, resp);
+    updateFromCachedResponse_DocumentWidget_(d, recent->normScrollY, resp, NULL);
+    setCachedDocument_History(d->mod.history, d->view.doc);
+    delete_GmResponse(resp);
+    return iTrue;
+}
+
 static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
     const iRecentUrl *recent = constMostRecentUrl_History(d->mod.history);
     if (recent && recent->cachedResponse && equalCase_String(&recent->url, d->mod.url)) {
@@ -3407,9 +3501,16 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
     if (equal_Command(cmd, "media.updated")) {
         /* Pass new data to media players. */
         const enum iGmStatusCode code = status_GmRequest(req->req);
-        if (isSuccess_GmStatusCode(code)) {
+        if (isSuccess_GmStatusCode(code) && isDownloadRequest_DocumentWidget(d, req)) {
+            /* Downloads are written to disk as the data arrives. */
+            streamDownload_Media(
+                media_GmDocument(d->view.doc), req->linkId, req->req, partialData_MediaFlag);
+            invalidate_DocumentWidget_(d);
+            refresh_Widget(as_Widget(d));
+        }
+        else if (isSuccess_GmStatusCode(code)) {
             iGmResponse *resp = lockResponse_GmRequest(req->req);
-            if (isDownloadRequest_DocumentWidget(d, req) ||
+            if (startsWith_String(&resp->meta, "image/") ||
                 startsWith_String(&resp->meta, "audio/")) {
                 /* TODO: Use a helper? This is same as below except for the partialData flag. */
                 if (setData_Media(media_GmDocument(d->view.doc),
@@ -3418,6 +3519,7 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
                                   &resp->body,
                                   partialData_MediaFlag | allowHide_MediaFlag)) {
                     redoLayout_GmDocument(d->view.doc);
+                    iZap(d->view.visibleRuns); /* pointers invalidated */
                 }
                 updateVisible_DocumentView_(&d->view);
                 invalidate_DocumentWidget_(d);
@@ -3433,9 +3535,13 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
     else if (equal_Command(cmd, "media.finished")) {
         const enum iGmStatusCode code = status_GmRequest(req->req);
         /* Give the media to the document for presentation. */
-        if (isSuccess_GmStatusCode(code)) {
-            if (isDownloadRequest_DocumentWidget(d, req) ||
-                startsWith_String(meta_GmRequest(req->req), "image/") ||
+        if (isSuccess_GmStatusCode(code) && isDownloadRequest_DocumentWidget(d, req)) {
+            streamDownload_Media(media_GmDocument(d->view.doc), req->linkId, req->req, 0);
+            invalidate_DocumentWidget_(d);
+            refresh_Widget(as_Widget(d));
+        }
+        else if (isSuccess_GmStatusCode(code)) {
+            if (startsWith_String(meta_GmRequest(req->req), "image/") ||
                 startsWith_String(meta_GmRequest(req->req), "audio/")) {
                 setData_Media(media_GmDocument(d->view.doc),
                               req->linkId,
@@ -3452,6 +3558,14 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
         else {
             const iGmError *err = get_GmError(code);
             makeSimpleMessage_Widget(format_CStr(uiTextCaution_ColorEscape "%s", err->title), err->info);
+            if (findLinkImage_Media(media_GmDocument(d->view.doc), req->linkId).type) {
+                /* Drop the partially received image. */
+                setData_Media(media_GmDocument(d->view.doc), req->linkId, NULL, NULL, 0);
+                redoLayout_GmDocument(d->view.doc);
+                iZap(d->view.visibleRuns);
+                updateVisible_DocumentView_(&d->view);
+                invalidate_DocumentWidget_(d);
+            }
             removeMediaRequest_DocumentWidget_(d, req->linkId);
         }
         return iTrue;
@@ -3830,6 +3944,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             if (d->view.visBuf->buffers[0].texture) {
                 addTicker_App(prerender_DocumentWidget_, d);
             }
+            prefetchVisibleHosts_DocumentView_(&d->view);
         }
         return iTrue;
     }
@@ -3851,6 +3966,29 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         showOrHidePinningIndicator_DocumentWidget_(d);
         refresh_Widget(w);
     }
+    else if (equal_Command(cmd, "document.layout.finished") &&
+             pointerLabel_Command(cmd, "doc") == d->view.doc) {
+        if (finishBackgroundLayout_DocumentView_(&d->view)) {
+            d->view.drawBufs->flags |= updateSideBuf_DrawBufsFlag;
+            updateVisible_DocumentView_(&d->view);
+            invalidate_DocumentWidget_(d);
+            refresh_Widget(w);
+        }
+        return iFalse; /* the same document may be shown elsewhere */
+    }
+    else if (equal_Command(cmd, "media.decoded") &&
+             pointerLabel_Command(cmd, "media") == media_GmDocument(d->view.doc)) {
+        /* Another view of the same document may have already uploaded the textures. */
+        uploadDecodedImages_Media(media_GmDocument(d->view.doc));
+        if (argLabel_Command(cmd, "relayout")) {
+            redoLayout_GmDocument(d->view.doc);
+            iZap(d->view.visibleRuns); /* pointers invalidated */
+            updateVisible_DocumentView_(&d->view);
+        }
+        invalidate_DocumentWidget_(d);
+        refresh_Widget(w);
+        return iFalse;
+    }
     else if (equal_Command(cmd, "window.focus.lost")) {
         if (d->flags & showLinkNumbers_DocumentWidgetFlag) {
             setLinkNumberMode_DocumentWidget_(d, iFalse);
@@ -4178,6 +4316,11 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                 setCachedResponse_History(d->mod.history, lockResponse_GmRequest(d->request));
                 unlockResponse_GmRequest(d->request);
             }
+            if (!equal_Rangecc(urlScheme_String(d->mod.url), "about") &&
+                isSuccess_GmStatusCode(status_GmRequest(d->request))) {
+                /* Archived for offline searching in a background thread. */
+                add_PageArchive(d->mod.url, meta_GmRequest(d->request), body_GmRequest(d->request));
+            }
         }
         iReleasePtr(&d->request);
         updateVisible_DocumentView_(&d->view);
@@ -4913,11 +5056,12 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                     visibleLinkOrdinal_DocumentView_(view, run->linkId) == ord) {
                     if (d->flags & setHoverViaKeys_DocumentWidgetFlag) {
                         view->hoverLink = run;
+                        prefetchLink_DocumentView_(view, run->linkId);
                     }
                     else {
                         postCommandf_Root(
                             w->root,
-                            "open newtab:%d url:%s",
+                            "open link:1 newtab:%d url:%s",
                             (isPinned_DocumentWidget_(d) ? otherRoot_OpenTabFlag : 0) ^
                                 (d->ordinalMode == numbersAndAlphabet_DocumentLinkOrdinalMode
                                      ? openTabMode_Sym(modState_Keys())
@@ -5052,7 +5196,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
         }
         if (ev->button.button == SDL_BUTTON_MIDDLE && view->hoverLink) {
             interactingWithLink_DocumentWidget_(d, view->hoverLink->linkId);
-            postCommandf_Root(w->root, "open newtab:%d url:%s",
+            postCommandf_Root(w->root, "open link:1 newtab:%d url:%s",
                               (isPinned_DocumentWidget_(d) ? otherRoot_OpenTabFlag : 0) |
                               (modState_Keys() & KMOD_SHIFT ? new_OpenTabFlag : newBackground_OpenTabFlag),
                               cstr_String(linkUrl_GmDocument(view->doc, view->hoverLink->linkId)));
@@ -5531,7 +5675,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                             tabMode ^= otherRoot_OpenTabFlag;
                         }
                         interactingWithLink_DocumentWidget_(d, linkId);
-                        postCommandf_Root(w->root, "open newtab:%d url:%s",
+                        postCommandf_Root(w->root, "open link:1 newtab:%d url:%s",
                                          tabMode,
                                          cstr_String(absoluteUrl_String(
                                              d->mod.url, linkUrl_GmDocument(view->doc, linkId))));
@@ -5898,14 +6042,17 @@ void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins) {
 }
 
 void setUrlFlags_DocumentWidget(iDocumentWidget *d, const iString *url, int setUrlFlags) {
-    const iBool allowCache = (setUrlFlags & useCachedContentIfAvailable_DocumentWidgetSetUrlFlag) != 0;
+    const iBool allowCache    = (setUrlFlags & useCachedContentIfAvailable_DocumentWidgetSetUrlFlag) != 0;
+    const iBool allowPrefetch = (setUrlFlags & usePrefetchedContentIfAvailable_DocumentWidgetSetUrlFlag) != 0;
     setLinkNumberMode_DocumentWidget_(d, iFalse);
     setUrl_DocumentWidget_(d, urlFragmentStripped_String(url));
     /* See if there a username in the URL. */
     parseUser_DocumentWidget_(d);
-    if (!allowCache || !updateFromHistory_DocumentWidget_(d)) {
-        fetch_DocumentWidget_(d);
+    if (allowCache ? updateFromHistory_DocumentWidget_(d)
+                   : allowPrefetch && updateFromPrefetch_DocumentWidget_(d)) {
+        return;
     }
+    fetch_DocumentWidget_(d);
 }
 
 void setUrlAndSource_DocumentWidget(iDocumentWidget *d, const iString *url, const iString *mime,
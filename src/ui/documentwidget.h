@@ -49,7 +49,8 @@ const iString *     feedTitle_DocumentWidget        (const iDocumentWidget *);
 int                 documentWidth_DocumentWidget    (const iDocumentWidget *);
 
 enum iDocumentWidgetSetUrlFlags {
-    useCachedContentIfAvailable_DocumentWidgetSetUrlFlag = iBit(1),
+    useCachedContentIfAvailable_DocumentWidgetSetUrlFlag     = iBit(1),
+    usePrefetchedContentIfAvailable_DocumentWidgetSetUrlFlag = iBit(2), /* link was activated */
 };
 
 void    setOrigin_DocumentWidget        (iDocumentWidget *, const iDocumentWidget *other);
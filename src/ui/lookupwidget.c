@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "command.h"
 #include "documentwidget.h"
 #include "feeds.h"
+#include "fuzzymatch.h"
 #include "gmcerts.h"
 #include "gmutil.h"
 #include "history.h"
@@ -34,6 +35,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "listwidget.h"
 #include "lang.h"
 #include "lookup.h"
+#include "pagearchive.h"
 #include "util.h"
 #include "visited.h"
 
@@ -43,21 +45,37 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/thread.h>
-#include <the_Foundation/regexp.h>
+
+#include <stdlib.h>
+
+iDeclareType(LookupVisit)
+
+struct Impl_LookupVisit {
+    iString url;
+    iTime   when;
+};
 
 iDeclareType(LookupJob)
 
 struct Impl_LookupJob {
-    iRegExp *term;
+    iFuzzyQuery *query;
+    iStringArray *words; /* lowercase, for the content index */
     iTime now;
     iObjectList *docs;
+    const iFuzzyIndex *visitedIndex; /* folded visited URLs */
+    const iArray *visits; /* LookupVisit for each visited index entry */
+    const iAtomicInt *cancel; /* set when a newer lookup has been submitted */
     iPtrArray results;
 };
 
 static void init_LookupJob(iLookupJob *d) {
-    d->term = NULL;
+    d->query = NULL;
+    d->words = NULL;
     initCurrent_Time(&d->now);
     d->docs = NULL;
+    d->visitedIndex = NULL;
+    d->visits = NULL;
+    d->cancel = NULL;
     init_PtrArray(&d->results);
 }
 
@@ -67,7 +85,14 @@ static void deinit_LookupJob(iLookupJob *d) {
     }
     deinit_PtrArray(&d->results);
     iRelease(d->docs);
-    iRelease(d->term);
+    iRelease(d->words);
+    if (d->query) {
+        delete_FuzzyQuery(d->query);
+    }
+}
+
+static iBool isCancelled_LookupJob_(const iLookupJob *d) {
+    return d->cancel && value_Atomic(d->cancel);
 }
 
 iDefineTypeConstruction(LookupJob)
@@ -157,17 +182,17 @@ struct Impl_LookupWidget {
     iString      pendingTerm;
     iObjectList *pendingDocs;
     iLookupJob * finishedJob;
+    iAtomicInt   cancelJob;
+    iBool        isQuitting;
+    /* Owned by the worker: */
+    iFuzzyIndex *visitedIndex;
+    iArray       visits; /* LookupVisit */
+    iBool        isVisitedIndexValid;
+    uint32_t     visitedGeneration;
 };
 
-static float scoreMatch_(const iRegExp *pattern, iRangecc text) {
-    float score = 0.0f;
-    iRegExpMatch m;
-    init_RegExpMatch(&m);
-    while (matchRange_RegExp(pattern, text, &m)) {
-        /* Match near the beginning is scored higher. */
-        score += (float) size_Range(&m.range) / ((float) m.range.start + 1);
-    }
-    return score;
+static float scoreMatch_(const iFuzzyQuery *query, iRangecc text) {
+    return match_FuzzyQuery(query, text);
 }
 
 static float bookmarkRelevance_LookupJob_(const iLookupJob *d, const iBookmark *bm) {
@@ -176,38 +201,35 @@ static float bookmarkRelevance_LookupJob_(const iLookupJob *d, const iBookmark *
     }
     iUrl parts;
     init_Url(&parts, &bm->url);
-    const float t = scoreMatch_(d->term, range_String(&bm->title));
-    const float h = scoreMatch_(d->term, parts.host);
-    const float p = scoreMatch_(d->term, parts.path);
-    const float g = scoreMatch_(d->term, range_String(&bm->tags));
+    const float t = scoreMatch_(d->query, range_String(&bm->title));
+    const float h = scoreMatch_(d->query, parts.host);
+    const float p = scoreMatch_(d->query, parts.path);
+    const float g = scoreMatch_(d->query, range_String(&bm->tags));
     return h + iMax(p, t) + 2 * g; /* extra weight for tags */
 }
 
 static float feedEntryRelevance_LookupJob_(const iLookupJob *d, const iFeedEntry *entry) {
     iUrl parts;
     init_Url(&parts, &entry->url);
-    const float t = scoreMatch_(d->term, range_String(&entry->title));
-    const float h = scoreMatch_(d->term, parts.host);
-    const float p = scoreMatch_(d->term, parts.path);
+    const float t = scoreMatch_(d->query, range_String(&entry->title));
+    const float h = scoreMatch_(d->query, parts.host);
+    const float p = scoreMatch_(d->query, parts.path);
     const double age = secondsSince_Time(&d->now, &entry->posted) / 3600.0 / 24.0; /* days */
     return (t * 3 + h + p) / (age + 1); /* extra weight for title, recency */
 }
 
 static float identityRelevance_LookupJob_(const iLookupJob *d, const iGmIdentity *identity) {
     iString *cn = subject_TlsCertificate(identity->cert);
-    const float c = scoreMatch_(d->term, range_String(cn));
-    const float n = scoreMatch_(d->term, range_String(&identity->notes));
+    const float c = scoreMatch_(d->query, range_String(cn));
+    const float n = scoreMatch_(d->query, range_String(&identity->notes));
     delete_String(cn);
     return c + 2 * n; /* extra weight for notes */
 }
 
-static float visitedRelevance_LookupJob_(const iLookupJob *d, const iVisitedUrl *vis) {
-    iUrl parts;
-    init_Url(&parts, &vis->url);
-    const float h = scoreMatch_(d->term, parts.host);
-    const float p = scoreMatch_(d->term, parts.path);
-    const double age = secondsSince_Time(&d->now, &vis->when) / 3600.0 / 24.0; /* days */
-    return iMax(h, p) / (age + 1); /* extra weight for recency */
+static float frecency_LookupJob_(const iLookupJob *d, const iTime *when) {
+    /* The weight of a visit halves in about a week. */
+    const double age = secondsSince_Time(&d->now, when) / 3600.0 / 24.0; /* days */
+    return 1.0f / (1.0f + (float) iMax(0.0, age) / 7.0f);
 }
 
 static iBool matchBookmark_LookupJob_(void *context, const iBookmark *bm) {
@@ -220,8 +242,8 @@ static iBool matchIdentity_LookupJob_(void *context, const iGmIdentity *identity
 
 static void searchBookmarks_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
-    /* TODO: Thread safety! What if a bookmark gets deleted while its being accessed here? */
-    iConstForEach(PtrArray, i, list_Bookmarks(bookmarks_App(), NULL, matchBookmark_LookupJob_, d)) {
+    const iBookmarksSnapshot *bookmarks = snapshot_Bookmarks(bookmarks_App());
+    iConstForEach(PtrArray, i, list_BookmarksSnapshot(bookmarks, NULL, matchBookmark_LookupJob_, d)) {
         const iBookmark *bm  = i.ptr;
         iLookupResult *  res = new_LookupResult();
         res->type            = bookmark_LookupResultType;
@@ -232,12 +254,14 @@ static void searchBookmarks_LookupJob_(iLookupJob *d) {
         set_String(&res->url, &bm->url);
         pushBack_PtrArray(&d->results, res);
     }
+    iRelease(bookmarks);
 }
 
 static void searchFeeds_LookupJob_(iLookupJob *d) {
+    const iBookmarksSnapshot *bookmarks = snapshot_Bookmarks(bookmarks_App());
     iConstForEach(PtrArray, i, listEntries_Feeds()) {
         const iFeedEntry *entry = i.ptr;
-        const iBookmark *bm = get_Bookmarks(bookmarks_App(), entry->bookmarkId);
+        const iBookmark *bm = get_BookmarksSnapshot(bookmarks, entry->bookmarkId);
         if (!bm) {
             continue;
         }
@@ -254,24 +278,52 @@ static void searchFeeds_LookupJob_(iLookupJob *d) {
             pushBack_PtrArray(&d->results, res);
         }
     }
+    iRelease(bookmarks);
+}
+
+iDeclareType(VisitScore)
+
+struct Impl_VisitScore {
+    float  relevance;
+    size_t index;
+};
+
+static int cmpRelevance_VisitScore_(const void *a, const void *b) {
+    return -iCmp(((const iVisitScore *) a)->relevance, ((const iVisitScore *) b)->relevance);
 }
 
 static void searchVisited_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
-    /* TODO: Thread safety! Visited URLs may be deleted while being accessed here. */
-    iConstForEach(PtrArray, i, list_Visited(visited_App(), 0)) {
-        const iVisitedUrl *vis = i.ptr;
-        const float relevance = visitedRelevance_LookupJob_(d, vis);
-        if (relevance > 0) {
-            iLookupResult *res = new_LookupResult();
-            res->type = history_LookupResultType;
-            res->relevance = relevance;
-            set_String(&res->label, &vis->url);
-            set_String(&res->url, &vis->url);
-            res->when = vis->when;
-            pushBack_PtrArray(&d->results, res);
+    const size_t maxResults = 20; /* only a few are shown */
+    const size_t count = size_FuzzyIndex(d->visitedIndex);
+    iArray *scores = new_Array(sizeof(iVisitScore));
+    for (size_t i = 0; i < count; i++) {
+        if (i % 1024 == 0 && isCancelled_LookupJob_(d)) {
+            break;
+        }
+        const float score = match_FuzzyIndex(d->visitedIndex, i, d->query);
+        if (score > 0) {
+            const iLookupVisit *vis = constAt_Array(d->visits, i);
+            const iVisitScore visitScore = { score * frecency_LookupJob_(d, &vis->when), i };
+            pushBack_Array(scores, &visitScore);
+        }
+    }
+    qsort(data_Array(scores), size_Array(scores), sizeof(iVisitScore), cmpRelevance_VisitScore_);
+    iConstForEach(Array, j, scores) {
+        if (index_ArrayConstIterator(&j) == maxResults) {
+            break;
         }
+        const iVisitScore  *visitScore = j.value;
+        const iLookupVisit *vis        = constAt_Array(d->visits, visitScore->index);
+        iLookupResult *res = new_LookupResult();
+        res->type = history_LookupResultType;
+        res->relevance = visitScore->relevance;
+        set_String(&res->label, &vis->url);
+        set_String(&res->url, &vis->url);
+        res->when = vis->when;
+        pushBack_PtrArray(&d->results, res);
     }
+    delete_Array(scores);
 }
 
 static void searchHistory_LookupJob_(iLookupJob *d) {
@@ -279,7 +331,7 @@ static void searchHistory_LookupJob_(iLookupJob *d) {
     size_t index = 0;
     iForEach(ObjectList, i, d->docs) {
         iConstForEach(StringArray, j,
-                      searchContents_History(history_DocumentWidget(i.object), d->term)) {
+                      searchContents_History(history_DocumentWidget(i.object), d->words)) {
             const char *match = cstr_String(j.value);
             const size_t matchLen = argLabel_Command(match, "len");
             iRangecc text;
@@ -298,6 +350,28 @@ static void searchHistory_LookupJob_(iLookupJob *d) {
     }
 }
 
+static void searchArchive_LookupJob_(iLookupJob *d) {
+    /* Note: Called in a background thread. */
+    size_t index = 0;
+    iConstForEach(ObjectList, i, search_PageArchive(d->words, 10)) {
+        const iArchivedPage *page = (const iArchivedPage *) i.object;
+        iLookupResult *res = new_LookupResult();
+        res->type = archive_LookupResultType;
+        res->relevance = 1.0f / ++index; /* newest comes first */
+        res->when = page->when;
+        if (!isEmpty_String(&page->snippet)) {
+            setCStr_String(&res->label, "\"");
+            append_String(&res->label, &page->snippet);
+            appendCStr_String(&res->label, "\"");
+        }
+        else {
+            set_String(&res->label, &page->title);
+        }
+        set_String(&res->url, &page->url);
+        pushBack_PtrArray(&d->results, res);
+    }
+}
+
 static void searchIdentities_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
     iConstForEach(PtrArray, i, listIdentities_GmCerts(certs_App(), matchIdentity_LookupJob_, d)) {
@@ -316,56 +390,83 @@ static void searchIdentities_LookupJob_(iLookupJob *d) {
     }
 }
 
+static void updateVisitedIndex_LookupWidget_(iLookupWidget *d) {
+    /* Note: Called in the worker thread. The folded URLs are only updated when the set of
+       visited URLs has changed. */
+    const iVisitedSnapshot *visited = snapshot_Visited(visited_App());
+    const uint32_t          gen     = generation_VisitedSnapshot(visited);
+    if (d->isVisitedIndexValid && d->visitedGeneration == gen) {
+        iRelease(visited);
+        return;
+    }
+    clear_FuzzyIndex(d->visitedIndex);
+    iForEach(Array, i, &d->visits) {
+        deinit_String(&((iLookupVisit *) i.value)->url);
+    }
+    clear_Array(&d->visits);
+    for (size_t j = 0; j < size_VisitedSnapshot(visited); j++) {
+        const iVisitedUrl *vis = at_VisitedSnapshot(visited, j);
+        if (vis->flags & transient_VisitedUrlFlag) {
+            continue;
+        }
+        iLookupVisit visit;
+        initCopy_String(&visit.url, &vis->url);
+        visit.when = vis->when;
+        pushBack_Array(&d->visits, &visit);
+        /* The scheme is not matched. */
+        iUrl parts;
+        init_Url(&parts, &vis->url);
+        add_FuzzyIndex(d->visitedIndex,
+                       isEmpty_Range(&parts.host)
+                           ? range_String(&vis->url)
+                           : (iRangecc){ parts.host.start, constEnd_String(&vis->url) });
+    }
+    iRelease(visited);
+    d->visitedGeneration   = gen;
+    d->isVisitedIndexValid = iTrue;
+}
+
 static iThreadResult worker_LookupWidget_(iThread *thread) {
     iLookupWidget *d = userData_Thread(thread);
 //    printf("[LookupWidget] worker is running\n"); fflush(stdout);
     lock_Mutex(d->mtx);
     for (;;) {
-        wait_Condition(&d->jobAvailable, d->mtx);
-        if (isEmpty_String(&d->pendingTerm)) {
-            break; /* Time to quit. */
+        while (isEmpty_String(&d->pendingTerm) && !d->isQuitting) {
+            wait_Condition(&d->jobAvailable, d->mtx);
         }
-        iLookupJob *job = new_LookupJob();
-        /* Make a regular expression to search for multiple alternative words. */ {
-            iString *pattern = new_String();
-            iRangecc word = iNullRange;
-            iBool isFirst = iTrue;
-            iString wordStr;
-            init_String(&wordStr);
-            while (nextSplit_Rangecc(range_String(&d->pendingTerm), " ", &word)) {
-                if (isEmpty_Range(&word)) continue;
-                if (!isFirst) appendCStr_String(pattern, ".*");
-                setRange_String(&wordStr, word);
-                iConstForEach(String, ch, &wordStr) {
-                    /* Escape regular expression characters. */
-                    if (isSyntaxChar_RegExp(ch.value)) {
-                        appendChar_String(pattern, '\\');
-                    }
-                    appendChar_String(pattern, ch.value);
-                }
-                isFirst = iFalse;
-            }
-            deinit_String(&wordStr);
-            iAssert(!isEmpty_String(pattern));
-            job->term = new_RegExp(cstr_String(pattern), caseInsensitive_RegExpOption);
-            delete_String(pattern);
+        if (d->isQuitting) {
+            break;
         }
-        const size_t termLen = length_String(&d->pendingTerm); /* characters */
+        set_Atomic(&d->cancelJob, iFalse);
+        iLookupJob *job = new_LookupJob();
+        job->query = new_FuzzyQuery(&d->pendingTerm);
+        job->words = splitQuery_WordIndex(&d->pendingTerm);
         clear_String(&d->pendingTerm);
         job->docs = d->pendingDocs;
+        job->cancel = &d->cancelJob;
         d->pendingDocs = NULL;
         unlock_Mutex(d->mtx);
-        /* Do the lookup. */ {
-            searchBookmarks_LookupJob_(job);
-            searchFeeds_LookupJob_(job);
-            searchVisited_LookupJob_(job);
-            if (termLen >= 3) {
-                searchHistory_LookupJob_(job);
+        updateVisitedIndex_LookupWidget_(d);
+        job->visitedIndex = d->visitedIndex;
+        job->visits = &d->visits;
+        /* Do the lookup. Stop early if a newer lookup is submitted meanwhile. */ {
+            void (*steps[])(iLookupJob *) = { searchBookmarks_LookupJob_,
+                                              searchFeeds_LookupJob_,
+                                              searchVisited_LookupJob_,
+                                              searchHistory_LookupJob_,
+                                              searchArchive_LookupJob_,
+                                              searchIdentities_LookupJob_ };
+            iForIndices(i, steps) {
+                if (isCancelled_LookupJob_(job)) break;
+                steps[i](job);
             }
-            searchIdentities_LookupJob_(job);
         }
         /* Submit the result. */
         lock_Mutex(d->mtx);
+        if (isCancelled_LookupJob_(job)) {
+            delete_LookupJob(job); /* superseded */
+            continue;
+        }
         if (d->finishedJob) {
             /* Previous results haven't been taken yet. */
             delete_LookupJob(d->finishedJob);
@@ -405,6 +506,12 @@ void init_LookupWidget(iLookupWidget *d) {
     init_String(&d->pendingTerm);
     d->pendingDocs = NULL;
     d->finishedJob = NULL;
+    set_Atomic(&d->cancelJob, iFalse);
+    d->isQuitting = iFalse;
+    d->visitedIndex = new_FuzzyIndex();
+    init_Array(&d->visits, sizeof(iLookupVisit));
+    d->isVisitedIndexValid = iFalse;
+    d->visitedGeneration = 0;
     updateMetrics_LookupWidget_(d);
     start_Thread(d->work);
 }
@@ -414,11 +521,18 @@ void deinit_LookupWidget(iLookupWidget *d) {
         iGuardMutex(d->mtx, {
             iReleasePtr(&d->pendingDocs);
             clear_String(&d->pendingTerm);
+            d->isQuitting = iTrue;
+            set_Atomic(&d->cancelJob, iTrue);
             signal_Condition(&d->jobAvailable);
         });
         join_Thread(d->work);
         iRelease(d->work);
     }
+    iForEach(Array, i, &d->visits) {
+        deinit_String(&((iLookupVisit *) i.value)->url);
+    }
+    deinit_Array(&d->visits);
+    delete_FuzzyIndex(d->visitedIndex);
     delete_LookupJob(d->finishedJob);
     deinit_String(&d->pendingTerm);
     delete_Mutex(d->mtx);
@@ -429,6 +543,7 @@ void submit_LookupWidget(iLookupWidget *d, const iString *term) {
     iGuardMutex(d->mtx, {
         set_String(&d->pendingTerm, term);
         trim_String(&d->pendingTerm);
+        set_Atomic(&d->cancelJob, iTrue); /* any ongoing lookup is now obsolete */
         iReleasePtr(&d->pendingDocs);
         if (!isEmpty_String(&d->pendingTerm)) {
             d->pendingDocs = listDocuments_App(get_Root()); /* holds reference to all open tabs */
@@ -474,6 +589,8 @@ static const char *cstr_LookupResultType(enum iLookupResultType d) {
             return "heading.lookup.history";
         case content_LookupResultType:
             return "heading.lookup.pagecontent";
+        case archive_LookupResultType:
+            return "heading.lookup.archive";
         case identity_LookupResultType:
             return "heading.lookup.identities";
         default:
@@ -582,7 +699,8 @@ static void presentResults_LookupWidget_(iLookupWidget *d) {
                 format_String(&item->command, "open url:%s", cstr_String(&res->url));
                 break;
             }
-            case content_LookupResultType: {
+            case content_LookupResultType:
+            case archive_LookupResultType: {
                 item->fg = uiText_ColorId;
                 item->font = uiContent_FontId;
                 format_String(&item->text, "%s \u2014 %s", url, cstr_String(&res->label));
@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "bookmarks.h"
 #include "certlistwidget.h"
 #include "command.h"
+#include "contentcache.h"
 #include "documentwidget.h"
 #include "feeds.h"
 #include "gmcerts.h"
@@ -36,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "labelwidget.h"
 #include "listwidget.h"
 #include "mobile.h"
+#include "pagearchive.h"
 #include "keys.h"
 #include "paint.h"
 #include "root.h"
@@ -1108,26 +1110,20 @@ iBool handleBookmarkEditorCommands_SidebarWidget_(iWidget *editor, const char *c
                                         text_InputWidget(findChild_Widget(editor, "bmed.icon"))));
             const iSidebarItem *item = d->contextItem;
             iAssert(item); /* hover item cannot have been changed */
-            iBookmark *bm = get_Bookmarks(bookmarks_App(), item->id);
-            set_String(&bm->title, title);
+            iBookmarks *bookmarks = bookmarks_App();
+            const iBookmark *bm = get_Bookmarks(bookmarks, item->id);
+            setTitle_Bookmarks(bookmarks, item->id, title);
             if (!isFolder_Bookmark(bm)) {
-                set_String(&bm->url, url);
-                set_String(&bm->tags, tags);
-                if (isEmpty_String(icon)) {
-                    bm->flags &= ~userIcon_BookmarkFlag;
-                    bm->icon = 0;
-                }
-                else {
-                    bm->flags |= userIcon_BookmarkFlag;
-                    bm->icon = first_String(icon);
-                }
-                iChangeFlags(bm->flags, homepage_BookmarkFlag, isSelected_Widget(findChild_Widget(editor, "bmed.tag.home")));
-                iChangeFlags(bm->flags, remoteSource_BookmarkFlag, isSelected_Widget(findChild_Widget(editor, "bmed.tag.remote")));
-                iChangeFlags(bm->flags, linkSplit_BookmarkFlag, isSelected_Widget(findChild_Widget(editor, "bmed.tag.linksplit")));
+                setUrl_Bookmarks(bookmarks, item->id, url);
+                setTags_Bookmarks(bookmarks, item->id, tags);
+                setUserIcon_Bookmarks(bookmarks, item->id, isEmpty_String(icon) ? 0 : first_String(icon));
+                setFlags_Bookmarks(bookmarks, item->id, homepage_BookmarkFlag, isSelected_Widget(findChild_Widget(editor, "bmed.tag.home")));
+                setFlags_Bookmarks(bookmarks, item->id, remoteSource_BookmarkFlag, isSelected_Widget(findChild_Widget(editor, "bmed.tag.remote")));
+                setFlags_Bookmarks(bookmarks, item->id, linkSplit_BookmarkFlag, isSelected_Widget(findChild_Widget(editor, "bmed.tag.linksplit")));
             }
             const iBookmark *folder = userData_Object(findChild_Widget(editor, "bmed.folder"));
             if (!folder || !hasParent_Bookmark(folder, id_Bookmark(bm))) {
-                bm->parentId = folder ? id_Bookmark(folder) : 0;
+                setParent_Bookmarks(bookmarks, item->id, folder ? id_Bookmark(folder) : 0);
             }
             postCommand_App("bookmarks.changed");
         }
@@ -1293,7 +1289,7 @@ static void bookmarkMoved_SidebarWidget_(iSidebarWidget *d, size_t index, size_t
         return;
     }
     reorder_Bookmarks(bookmarks_App(), movingItem->id, dst->order + (isBefore ? 0 : 1));
-    get_Bookmarks(bookmarks_App(), movingItem->id)->parentId = dst->parentId;
+    setParent_Bookmarks(bookmarks_App(), movingItem->id, dst->parentId);
     updateItems_SidebarWidget_(d);
     /* Don't confuse the user: keep the dragged item in hover state. */
     setHoverItem_ListWidget(d->list, dstIndex + (isBefore ? 0 : 1) + (index < dstIndex ? -1 : 0));
@@ -1304,8 +1300,7 @@ static void bookmarkMovedOntoFolder_SidebarWidget_(iSidebarWidget *d, size_t ind
                                                    size_t folderIndex) {
     const iSidebarItem *movingItem = item_ListWidget(d->list, index);
     const iSidebarItem *dstItem    = item_ListWidget(d->list, folderIndex);
-    iBookmark *bm = get_Bookmarks(bookmarks_App(), movingItem->id);
-    bm->parentId = dstItem->id;
+    setParent_Bookmarks(bookmarks_App(), movingItem->id, dstItem->id);
     postCommand_App("bookmarks.changed");
 }
 
@@ -1552,11 +1547,11 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                     (equal_Rangecc(tag, "homepage") ? homepage_BookmarkFlag : 0) |
                     (equal_Rangecc(tag, "subscribed") ? subscribed_BookmarkFlag : 0) |
                     (equal_Rangecc(tag, "remotesource") ? remoteSource_BookmarkFlag : 0);
-                iBookmark *bm = get_Bookmarks(bookmarks_App(), item->id);
+                const iBookmark *bm = get_Bookmarks(bookmarks_App(), item->id);
                 if (flag == subscribed_BookmarkFlag && (bm->flags & flag)) {
                     removeEntries_Feeds(item->id); /* get rid of unsubscribed entries */
                 }
-                bm->flags ^= flag;
+                setFlags_Bookmarks(bookmarks_App(), item->id, flag, (bm->flags & flag) == 0);
                 postCommand_App("bookmarks.changed");
             }
             return iTrue;
@@ -1687,7 +1682,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                     }
                     return iTrue;
                 }
-                iBookmark *feedBookmark = get_Bookmarks(bookmarks_App(), item->id);
+                const iBookmark *feedBookmark = get_Bookmarks(bookmarks_App(), item->id);
                 if (feedBookmark) {
                     if (isCommand_Widget(w, ev, "feed.entry.openfeed")) {
                         postCommandf_App("open url:%s", cstr_String(&feedBookmark->url));
@@ -1699,7 +1694,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                     }
                     if (isCommand_Widget(w, ev, "feed.entry.unsubscribe")) {
                         if (arg_Command(cmd)) {
-                            feedBookmark->flags &= ~subscribed_BookmarkFlag;
+                            setFlags_Bookmarks(bookmarks_App(), item->id, subscribed_BookmarkFlag, iFalse);
                             removeEntries_Feeds(id_Bookmark(feedBookmark));
                             updateItems_SidebarWidget_(d);
                         }
@@ -1771,6 +1766,8 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
             }
             else {
                 clear_Visited(visited_App());
+                clear_PageArchive();
+                clear_ContentCache();
                 updateItems_SidebarWidget_(d);
                 scrollOffset_ListWidget(d->list, 0);
             }
@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/math.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/stringlist.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/path.h>
@@ -63,6 +64,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #   define LAGRANGE_RASTER_FORMAT   SDL_PIXELFORMAT_RGBA8888
 #endif
 
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#   define LAGRANGE_GLYPH_GEOMETRY  1 /* glyph quads are submitted as vertex buffers */
+#endif
+
 iDeclareType(Font)
 iDeclareType(Glyph)
 iDeclareTypeConstructionArgs(Glyph, iChar ch)
@@ -76,6 +81,7 @@ int enableKerning_Text         = iTrue; /* looking up kern pairs is slow */
 enum iGlyphFlag {
     rasterized0_GlyphFlag = iBit(1),    /* zero offset */
     rasterized1_GlyphFlag = iBit(2),    /* half-pixel offset */
+    allocated_GlyphFlag   = iBit(3),    /* has a position in the cache texture */
 };
 
 struct Impl_Glyph {
@@ -85,6 +91,7 @@ struct Impl_Glyph {
     iRect rect[2]; /* zero and half pixel offset */
     iInt2 d[2];
     float advance; /* scaled */
+    int cacheRow; /* where allocated in the cache */
 };
 
 void init_Glyph(iGlyph *d, uint32_t glyphIndex) {
@@ -94,6 +101,7 @@ void init_Glyph(iGlyph *d, uint32_t glyphIndex) {
     d->rect[0]    = zero_Rect();
     d->rect[1]    = zero_Rect();
     d->advance    = 0.0f;
+    d->cacheRow   = -1;
 }
 
 void deinit_Glyph(iGlyph *d) {
@@ -117,6 +125,10 @@ iLocalDef void setRasterized_Glyph_(iGlyph *d, int hoff) {
     d->flags |= rasterized0_GlyphFlag << hoff;
 }
 
+iLocalDef iBool isAllocated_Glyph_(const iGlyph *d) {
+    return (d->flags & allocated_GlyphFlag) != 0;
+}
+
 iDefineTypeConstructionArgs(Glyph, (iChar ch), ch)
 
 /*-----------------------------------------------------------------------------------------------*/
@@ -126,12 +138,21 @@ static iGlyph *glyph_Font_(iFont *d, iChar ch);
 iDeclareType(GlyphTable)
 
 struct Impl_GlyphTable {
+    iMutex         mtx;    /* guards `glyphs` */
     iHash          glyphs; /* key is glyph index in the font */
     /* TODO: `glyphs` does not need to be a Hash.
        We could lazily allocate an array with glyphCount elements instead. */
     uint32_t       indexTable[128 - 32]; /* quick ASCII lookup */
 };
 
+/* Each Text has glyph tables of its own, and worker threads measure with copies of the
+   Text (see newMeasuring_Text()), so the per-table locks are normally uncontended.
+   Only the owner draws, so the cache texture positions need no locking. */
+static iMutex *missingCharsMutex_;
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+static iMutex *shapeCacheMutex_; /* see run_Font_() */
+#endif
+
 static void clearGlyphs_GlyphTable_(iGlyphTable *d) {
     if (d) {
         iForEach(Hash, i, &d->glyphs) {
@@ -142,6 +163,7 @@ static void clearGlyphs_GlyphTable_(iGlyphTable *d) {
 }
 
 static void init_GlyphTable(iGlyphTable *d) {
+    init_Mutex(&d->mtx);
     init_Hash(&d->glyphs);
     memset(d->indexTable, 0xff, sizeof(d->indexTable));
 }
@@ -149,6 +171,7 @@ static void init_GlyphTable(iGlyphTable *d) {
 static void deinit_GlyphTable(iGlyphTable *d) {
     clearGlyphs_GlyphTable_(d);
     deinit_Hash(&d->glyphs);
+    deinit_Mutex(&d->mtx);
 }
 
 iDefineTypeConstruction(GlyphTable)
@@ -213,7 +236,7 @@ static void init_Font(iFont *d, const iFontSpec *fontSpec, const iFontFile *font
     d->emAdvance  = fontFile->emAdvance * d->xScale;
     d->baseline   = fontFile->ascent * d->yScale;
     d->vertOffset = d->height * (1.0f - glyphScale) / 2 * fontSpec->vertOffsetScale[scaleType];
-    d->table = NULL;
+    d->table = new_GlyphTable(); /* created up front; worker threads may use the font */
 }
 
 static void deinit_Font(iFont *d) {
@@ -223,12 +246,10 @@ static void deinit_Font(iFont *d) {
 static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
     /* TODO: Add a small cache of ~5 most recently found indices. */
     const size_t entry = ch - 32;
-    if (!d->table) {
-        d->table = new_GlyphTable();
-    }
     iGlyphTable *table = d->table;
     if (entry < iElemCount(table->indexTable)) {
         if (table->indexTable[entry] == ~0u) {
+            /* Concurrent lookups would all store the same index. */
             table->indexTable[entry] = findGlyphIndex_FontFile(d->fontFile, ch);
         }
         return table->indexTable[entry];
@@ -242,10 +263,31 @@ iDeclareType(Text)
 iDeclareType(CacheRow)
 
 struct Impl_CacheRow {
-    int   height;
-    iInt2 pos;
+    int       page;
+    int       height;
+    iInt2     pos;      /* next free position */
+    uint32_t  lastUsed; /* cache clock when last drawn; for LRU eviction */
+    iPtrArray glyphs;   /* allocated on this row */
+};
+
+iDeclareType(CachePage)
+
+struct Impl_CachePage {
+    SDL_Texture *texture;
+    int          bottom; /* rows are assigned downwards */
+};
+
+iDeclareType(GlyphQuad)
+
+struct Impl_GlyphQuad {
+    int      page;
+    SDL_Rect src;
+    SDL_Rect dst;
+    iColor   color;
 };
 
+static const int maxCachePages_Text_ = 4;
+
 iDeclareType(PrioMapItem)
 struct Impl_PrioMapItem {
     int priority;
@@ -257,17 +299,34 @@ static int cmp_PrioMapItem_(const void *a, const void *b) {
     return -iCmp(i->priority, j->priority);
 }
 
+iDeclareType(ShapedText)
+
 struct Impl_Text {
     float          contentFontSize;
     iArray         fonts; /* fonts currently selected for use (incl. all styles/sizes) */
     int            overrideFontId; /* always checked for glyphs first, regardless of which font is used */    
     iArray         fontPriorityOrder;
     SDL_Renderer * render;
-    SDL_Texture *  cache;
-    iInt2          cacheSize;
+    iArray         cachePages;
+    iInt2          cacheSize; /* of one page */
     int            cacheRowAllocStep;
-    int            cacheBottom;
     iArray         cacheRows;
+    iArray         cacheOpenRows; /* row index (or -1) where glyphs of each height are added */
+    uint32_t       cacheClock; /* advanced whenever queued glyphs have been drawn */
+    uint32_t       cacheGeneration; /* advanced whenever the cache is reset */
+    iArray         glyphQuads; /* queued for drawing */
+#if defined (LAGRANGE_GLYPH_GEOMETRY)
+    iArray         glyphVertices; /* reused when flushing the quads */
+    iArray         glyphVertexIndices;
+#endif
+    iColor         glyphColor;
+    uint8_t        glyphAlpha;
+    SDL_BlendMode  glyphBlendMode;
+    iHash          shapeCache; /* recently prepared and shaped strings */
+    iShapedText *  shapeLruFirst; /* least recently used entry of the shape cache */
+    iShapedText *  shapeLruLast;
+    size_t         shapeHits;
+    size_t         shapeMisses;
     SDL_Palette *  grayscale;
     SDL_Palette *  blackAndWhite; /* unsmoothed glyph palette */
     iRegExp *      ansiEscape;
@@ -276,11 +335,14 @@ struct Impl_Text {
     int            baseFgColorId;
     iBool          missingGlyphs;  /* true if a glyph couldn't be found */
     iChar          missingChars[20]; /* rotating buffer of the latest missing characters */
+    iPtrArray *    ownedSpecs; /* copies of the font specs; only in measuring copies */
 };
 
 iDefineTypeConstructionArgs(Text, (SDL_Renderer *render), render)
 
-static iText  *activeText_;
+/* Each thread has its own current Text. Threads other than the main thread use measuring
+   copies (see newMeasuring_Text()). */
+static _Thread_local iText *activeText_;
 
 static void setupFontVariants_Text_(iText *d, const iFontSpec *spec, int baseId) {
 #if defined (iPlatformMobile)
@@ -360,20 +422,20 @@ static void initFonts_Text_(iText *d) {
     gap_Text = iRound(gap_UI * d->contentFontSize);
 }
 
+static void clearShapeCache_Text_(iText *d);
+
 static void deinitFonts_Text_(iText *d) {
+    clearShapeCache_Text_(d); /* refers to the fonts */
     iForEach(Array, i, &d->fonts) {
         deinit_Font(i.value);
     }
     clear_Array(&d->fonts);
 }
 
-static int maxGlyphHeight_Text_(const iText *d) {
-    /* Huge size is 2 * contentFontSize. */
-    return 4 * d->contentFontSize * fontSize_UI;
-}
-
 static void initCache_Text_(iText *d) {
+    init_Array(&d->cachePages, sizeof(iCachePage));
     init_Array(&d->cacheRows, sizeof(iCacheRow));
+    init_Array(&d->cacheOpenRows, sizeof(int));
     const int textSize = d->contentFontSize * fontSize_UI;
     iAssert(textSize > 0);
     const iInt2 cacheDims = init_I2(16, 40);
@@ -385,26 +447,111 @@ static void initCache_Text_(iText *d) {
         d->cacheSize.x = renderInfo.max_texture_width;
     }
     d->cacheRowAllocStep = iMax(2, textSize / 6);
-    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
-       once at least one glyph is stored. */
+    /* Rows are opened for each height as needed. Pages are added once the previous ones
+       have been filled. */
     for (int h = d->cacheRowAllocStep;
          h <= 5 * textSize + d->cacheRowAllocStep;
          h += d->cacheRowAllocStep) {
-        pushBack_Array(&d->cacheRows, &(iCacheRow){ .height = 0 });
+        const int none = -1;
+        pushBack_Array(&d->cacheOpenRows, &none);
     }
-    d->cacheBottom = 0;
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-    d->cache = SDL_CreateTexture(d->render,
-                                 SDL_PIXELFORMAT_RGBA4444,
-                                 SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                 d->cacheSize.x,
-                                 d->cacheSize.y);
-    SDL_SetTextureBlendMode(d->cache, SDL_BLENDMODE_BLEND);
+    d->cacheClock = 0;
 }
 
 static void deinitCache_Text_(iText *d) {
+    iForEach(Array, i, &d->cacheRows) {
+        deinit_PtrArray(&((iCacheRow *) i.value)->glyphs);
+    }
+    iForEach(Array, j, &d->cachePages) {
+        SDL_DestroyTexture(((iCachePage *) j.value)->texture);
+    }
+    deinit_Array(&d->cacheOpenRows);
     deinit_Array(&d->cacheRows);
-    SDL_DestroyTexture(d->cache);
+    deinit_Array(&d->cachePages);
+}
+
+static void addCachePage_Text_(iText *d) {
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    iCachePage page = {
+        .texture = SDL_CreateTexture(d->render,
+                                     SDL_PIXELFORMAT_RGBA4444,
+                                     SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                     d->cacheSize.x,
+                                     d->cacheSize.y),
+        .bottom = 0
+    };
+    SDL_SetTextureBlendMode(page.texture, SDL_BLENDMODE_BLEND);
+    pushBack_Array(&d->cachePages, &page);
+}
+
+#if defined (LAGRANGE_GLYPH_GEOMETRY)
+static void drawPageGeometry_Text_(iText *d, int page, SDL_Texture *tex) {
+    /* All quads of the page go in a single draw call. Colors are in the vertices. */
+    const float uScale = 1.0f / d->cacheSize.x;
+    const float vScale = 1.0f / d->cacheSize.y;
+    clear_Array(&d->glyphVertices);
+    clear_Array(&d->glyphVertexIndices);
+    iConstForEach(Array, i, &d->glyphQuads) {
+        const iGlyphQuad *quad = i.value;
+        if (quad->page != page) {
+            continue;
+        }
+        const SDL_Color clr = { quad->color.r, quad->color.g, quad->color.b, d->glyphAlpha };
+        const float     x0  = quad->dst.x;
+        const float     y0  = quad->dst.y;
+        const float     x1  = quad->dst.x + quad->dst.w;
+        const float     y1  = quad->dst.y + quad->dst.h;
+        const float     u0  = quad->src.x * uScale;
+        const float     v0  = quad->src.y * vScale;
+        const float     u1  = (quad->src.x + quad->src.w) * uScale;
+        const float     v1  = (quad->src.y + quad->src.h) * vScale;
+        const int       base = (int) size_Array(&d->glyphVertices);
+        const SDL_Vertex verts[4] = {
+            { { x0, y0 }, clr, { u0, v0 } },
+            { { x1, y0 }, clr, { u1, v0 } },
+            { { x0, y1 }, clr, { u0, v1 } },
+            { { x1, y1 }, clr, { u1, v1 } },
+        };
+        const int indices[6] = { base, base + 1, base + 2, base + 2, base + 1, base + 3 };
+        pushBackN_Array(&d->glyphVertices, verts, 4);
+        pushBackN_Array(&d->glyphVertexIndices, indices, 6);
+    }
+    if (!isEmpty_Array(&d->glyphVertices)) {
+        SDL_SetTextureColorMod(tex, 255, 255, 255);
+        SDL_SetTextureAlphaMod(tex, 255);
+        SDL_RenderGeometry(d->render,
+                           tex,
+                           constData_Array(&d->glyphVertices),
+                           (int) size_Array(&d->glyphVertices),
+                           constData_Array(&d->glyphVertexIndices),
+                           (int) size_Array(&d->glyphVertexIndices));
+    }
+}
+#endif
+
+static void flushGlyphs_Text_(iText *d) {
+    /* Queued glyphs are drawn one page at a time so a string never switches back and forth
+       between cache textures. */
+    if (!isEmpty_Array(&d->glyphQuads)) {
+        for (size_t page = 0; page < size_Array(&d->cachePages); page++) {
+            SDL_Texture *tex = ((const iCachePage *) constAt_Array(&d->cachePages, page))->texture;
+            SDL_SetTextureBlendMode(tex, d->glyphBlendMode);
+#if defined (LAGRANGE_GLYPH_GEOMETRY)
+            drawPageGeometry_Text_(d, (int) page, tex);
+#else
+            SDL_SetTextureAlphaMod(tex, d->glyphAlpha);
+            iConstForEach(Array, i, &d->glyphQuads) {
+                const iGlyphQuad *quad = i.value;
+                if (quad->page == (int) page) {
+                    SDL_SetTextureColorMod(tex, quad->color.r, quad->color.g, quad->color.b);
+                    SDL_RenderCopy(d->render, tex, &quad->src, &quad->dst);
+                }
+            }
+#endif
+        }
+        clear_Array(&d->glyphQuads);
+    }
+    d->cacheClock++; /* rows drawn so far can be evicted */
 }
 
 iRegExp *makeAnsiEscapePattern_Text(iBool includeEscChar) {
@@ -418,6 +565,14 @@ iRegExp *makeAnsiEscapePattern_Text(iBool includeEscChar) {
 void init_Text(iText *d, SDL_Renderer *render) {
     iText *oldActive = activeText_;
     activeText_ = d;
+    if (!missingCharsMutex_) {
+        missingCharsMutex_ = new_Mutex();
+    }
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    if (!shapeCacheMutex_) {
+        shapeCacheMutex_ = new_Mutex();
+    }
+#endif
     init_Array(&d->fonts, sizeof(iFont));
     init_Array(&d->fontPriorityOrder, sizeof(iPrioMapItem));
     d->contentFontSize = contentScale_Text_;
@@ -426,7 +581,22 @@ void init_Text(iText *d, SDL_Renderer *render) {
     d->baseFgColorId   = -1;
     d->missingGlyphs   = iFalse;
     iZap(d->missingChars);
+    d->ownedSpecs      = NULL;
+    d->cacheGeneration = 0;
     d->render          = render;
+    init_Array(&d->glyphQuads, sizeof(iGlyphQuad));
+#if defined (LAGRANGE_GLYPH_GEOMETRY)
+    init_Array(&d->glyphVertices, sizeof(SDL_Vertex));
+    init_Array(&d->glyphVertexIndices, sizeof(int));
+#endif
+    d->glyphColor      = (iColor){ 255, 255, 255, 255 };
+    d->glyphAlpha      = 255;
+    d->glyphBlendMode  = SDL_BLENDMODE_BLEND;
+    init_Hash(&d->shapeCache);
+    d->shapeLruFirst   = NULL;
+    d->shapeLruLast    = NULL;
+    d->shapeHits       = 0;
+    d->shapeMisses     = 0;
     /* A grayscale palette for rasterized glyphs. */ {
         SDL_Color colors[256];
         for (int i = 0; i < 256; ++i) {
@@ -449,22 +619,103 @@ void init_Text(iText *d, SDL_Renderer *render) {
 }
 
 void deinit_Text(iText *d) {
-    SDL_FreePalette(d->blackAndWhite);
-    SDL_FreePalette(d->grayscale);
+    if (d->render) {
+        SDL_FreePalette(d->blackAndWhite);
+        SDL_FreePalette(d->grayscale);
+    }
     deinitFonts_Text_(d);
+    if (d->ownedSpecs) {
+        iForEach(PtrArray, i, d->ownedSpecs) {
+            delete_FontSpec(i.ptr);
+        }
+        delete_PtrArray(d->ownedSpecs);
+    }
     deinitCache_Text_(d);
+    deinit_Hash(&d->shapeCache);
+    deinit_Array(&d->glyphQuads);
+#if defined (LAGRANGE_GLYPH_GEOMETRY)
+    deinit_Array(&d->glyphVertexIndices);
+    deinit_Array(&d->glyphVertices);
+#endif
     d->render = NULL;
     iRelease(d->ansiEscape);
     deinit_Array(&d->fontPriorityOrder);
     deinit_Array(&d->fonts);
 }
 
+static const iFontSpec *ownedSpec_Text_(iText *d, iPtrArray *origSpecs, const iFontSpec *spec) {
+    /* Font packs may be reloaded while the copy is in use, so it keeps specs of its own. */
+    for (size_t i = 0; i < size_PtrArray(origSpecs); i++) {
+        if (constAt_PtrArray(origSpecs, i) == spec) {
+            return constAt_PtrArray(d->ownedSpecs, i);
+        }
+    }
+    iFontSpec *copy = new_FontSpec();
+    set_String(&copy->id, &spec->id);
+    set_String(&copy->name, &spec->name);
+    set_String(&copy->sourcePath, &spec->sourcePath);
+    copy->flags    = spec->flags;
+    copy->priority = spec->priority;
+    memcpy(copy->heightScale, spec->heightScale, sizeof(copy->heightScale));
+    memcpy(copy->glyphScale, spec->glyphScale, sizeof(copy->glyphScale));
+    memcpy(copy->vertOffsetScale, spec->vertOffsetScale, sizeof(copy->vertOffsetScale));
+    iForIndices(i, spec->styles) {
+        copy->styles[i] = ref_Object(spec->styles[i]);
+    }
+    pushBack_PtrArray(origSpecs, spec);
+    pushBack_PtrArray(d->ownedSpecs, copy);
+    return copy;
+}
+
+iText *newMeasuring_Text(const iText *d) {
+    /* The copy has the same fonts and metrics as `d` but glyph tables and a shape cache of
+       its own, and no renderer. */
+    iText *tx = iMalloc(Text);
+    iZap(*tx);
+    init_Array(&tx->fonts, sizeof(iFont));
+    init_Array(&tx->fontPriorityOrder, sizeof(iPrioMapItem));
+    pushBackN_Array(&tx->fontPriorityOrder,
+                    constData_Array(&d->fontPriorityOrder),
+                    size_Array(&d->fontPriorityOrder));
+    tx->contentFontSize = d->contentFontSize;
+    tx->overrideFontId  = d->overrideFontId;
+    tx->ansiEscape      = makeAnsiEscapePattern_Text(iFalse /* no ESC */);
+    tx->ansiFlags       = d->ansiFlags;
+    tx->baseFontId      = -1;
+    tx->baseFgColorId   = -1;
+    tx->glyphAlpha      = 255;
+    init_Array(&tx->cachePages, sizeof(iCachePage));
+    init_Array(&tx->cacheRows, sizeof(iCacheRow));
+    init_Array(&tx->cacheOpenRows, sizeof(int));
+    init_Array(&tx->glyphQuads, sizeof(iGlyphQuad));
+#if defined (LAGRANGE_GLYPH_GEOMETRY)
+    init_Array(&tx->glyphVertices, sizeof(SDL_Vertex));
+    init_Array(&tx->glyphVertexIndices, sizeof(int));
+#endif
+    init_Hash(&tx->shapeCache);
+    tx->ownedSpecs = new_PtrArray();
+    iPtrArray origSpecs;
+    init_PtrArray(&origSpecs);
+    iConstForEach(Array, i, &d->fonts) {
+        iFont font    = *(const iFont *) i.value;
+        font.fontSpec = ownedSpec_Text_(tx, &origSpecs, font.fontSpec);
+        font.table    = new_GlyphTable();
+        pushBack_Array(&tx->fonts, &font);
+    }
+    deinit_PtrArray(&origSpecs);
+    return tx;
+}
+
 void setCurrent_Text(iText *d) {
     activeText_ = d;
 }
 
+iText *current_Text(void) {
+    return activeText_;
+}
+
 void setOpacity_Text(float opacity) {
-    SDL_SetTextureAlphaMod(activeText_->cache, iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
+    activeText_->glyphAlpha = iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f;
 }
 
 void setBaseAttributes_Text(int fontId, int fgColorId) {
@@ -491,11 +742,17 @@ void setDocumentFontSize_Text(iText *d, float fontSizeFactor) {
 }
 
 static void resetCache_Text_(iText *d) {
+    flushGlyphs_Text_(d); /* queued glyphs refer to the old pages */
     deinitCache_Text_(d);
+    /* Other threads measure with Texts of their own, so nobody else is using these. */
     iForEach(Array, i, &d->fonts) {
-        clearGlyphs_GlyphTable_(((iFont *) i.value)->table);
+        iGlyphTable *table = ((iFont *) i.value)->table;
+        lock_Mutex(&table->mtx);
+        clearGlyphs_GlyphTable_(table);
+        unlock_Mutex(&table->mtx);
     }
     initCache_Text_(d);
+    d->cacheGeneration++;
 }
 
 void resetFonts_Text(iText *d) {
@@ -504,6 +761,7 @@ void resetFonts_Text(iText *d) {
     deinitFonts_Text_(d);
     deinitCache_Text_(d);
     initCache_Text_(d);
+    d->cacheGeneration++;
     initFonts_Text_(d);
     setCurrent_Text(oldActive);
 }
@@ -539,41 +797,98 @@ static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, fl
 #endif
 }
 
-iLocalDef iCacheRow *cacheRow_Text_(iText *d, int height) {
-    return at_Array(&d->cacheRows, (height - 1) / d->cacheRowAllocStep);
+static void evictCacheRow_Text_(iText *d, int index) {
+    iCacheRow *row = at_Array(&d->cacheRows, index);
+    iForEach(PtrArray, i, &row->glyphs) {
+        iGlyph *glyph = i.ptr;
+        glyph->flags &= ~(allocated_GlyphFlag | rasterized0_GlyphFlag | rasterized1_GlyphFlag);
+        glyph->cacheRow = -1;
+    }
+    clear_PtrArray(&row->glyphs);
+    row->pos.x = 0;
+    iForEach(Array, j, &d->cacheOpenRows) {
+        int *open = j.value;
+        if (*open == index) {
+            *open = -1;
+        }
+    }
 }
 
-static iInt2 assignCachePos_Text_(iText *d, iInt2 size) {
-    iCacheRow *cur = cacheRow_Text_(d, size.y);
-    if (cur->height == 0) {
-        /* Begin a new row height. */
-        cur->height = (1 + (size.y - 1) / d->cacheRowAllocStep) * d->cacheRowAllocStep;
-        cur->pos.y = d->cacheBottom;
-        d->cacheBottom = cur->pos.y + cur->height;
+static int newCacheRow_Text_(iText *d, int height) {
+    /* Returns the index of an empty row, or -1 if every row is currently in use. */
+    for (;;) {
+        for (size_t i = 0; i < size_Array(&d->cachePages); i++) {
+            iCachePage *page = at_Array(&d->cachePages, i);
+            if (page->bottom + height <= d->cacheSize.y) {
+                iCacheRow row = { .page = i, .height = height, .pos = init_I2(0, page->bottom) };
+                init_PtrArray(&row.glyphs);
+                page->bottom += height;
+                pushBack_Array(&d->cacheRows, &row);
+                return size_Array(&d->cacheRows) - 1;
+            }
+        }
+        if ((int) size_Array(&d->cachePages) == maxCachePages_Text_) {
+            break;
+        }
+        addCachePage_Text_(d);
+    }
+    /* All pages are full. Reuse the least recently drawn row that is tall enough, unless
+       it has glyphs still waiting to be drawn. */
+    int      lru     = -1;
+    uint32_t lruAge  = 0;
+    iConstForEach(Array, i, &d->cacheRows) {
+        const iCacheRow *row = i.value;
+        const uint32_t   age = d->cacheClock - row->lastUsed;
+        if (row->height >= height && age > 0 && age > lruAge) {
+            lru    = index_ArrayConstIterator(&i);
+            lruAge = age;
+        }
     }
-    iAssert(cur->height >= size.y);
-    /* TODO: Automatically enlarge the cache if running out of space?
-       Maybe make it paged, but beware of texture swapping too often inside a text string. */
-    if (cur->pos.x + size.x > d->cacheSize.x) {
+    if (lru >= 0) {
+        evictCacheRow_Text_(d, lru);
+    }
+    return lru;
+}
+
+static SDL_Texture *cacheTexture_Glyph_(const iGlyph *d) {
+    const iCacheRow *row = constAt_Array(&activeText_->cacheRows, d->cacheRow);
+    return ((const iCachePage *) constAt_Array(&activeText_->cachePages, row->page))->texture;
+}
+
+static void queueGlyph_Text_(iText *d, const iGlyph *glyph, const SDL_Rect *src,
+                             const SDL_Rect *dst) {
+    iCacheRow *row = at_Array(&d->cacheRows, glyph->cacheRow);
+    row->lastUsed  = d->cacheClock;
+    pushBack_Array(&d->glyphQuads, &(iGlyphQuad){ row->page, *src, *dst, d->glyphColor });
+}
+
+static iBool assignCachePos_Text_(iText *d, iInt2 size, int *row_out, iInt2 *pos_out) {
+    int *open = at_Array(&d->cacheOpenRows, (size.y - 1) / d->cacheRowAllocStep);
+    iCacheRow *cur = (*open >= 0 ? at_Array(&d->cacheRows, *open) : NULL);
+    if (!cur || cur->pos.x + size.x > d->cacheSize.x) {
         /* Does not fit on this row, advance to a new location in the cache. */
-        cur->pos.y = d->cacheBottom;
-        cur->pos.x = 0;
-        d->cacheBottom += cur->height;
-        iAssert(d->cacheBottom <= d->cacheSize.y);
+        const int height = (1 + (size.y - 1) / d->cacheRowAllocStep) * d->cacheRowAllocStep;
+        const int index  = newCacheRow_Text_(d, height);
+        if (index < 0) {
+            return iFalse;
+        }
+        *open = index;
+        cur = at_Array(&d->cacheRows, index);
     }
-    const iInt2 assigned = cur->pos;
+    iAssert(cur->height >= size.y);
+    *row_out = *open;
+    *pos_out = cur->pos;
     cur->pos.x += size.x;
-    return assigned;
+    cur->lastUsed = d->cacheClock;
+    return iTrue;
 }
 
-static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
+static void measure_Font_(iFont *d, iGlyph *glyph, int hoff) {
     iRect *glRect = &glyph->rect[hoff];
     int    x0, y0, x1, y1;
     measureGlyph_FontFile(d->fontFile, index_Glyph_(glyph), d->xScale, d->yScale, hoff * 0.5f,
                           &x0, &y0, &x1, &y1);
-    glRect->size = init_I2(x1 - x0, y1 - y0);
-    /* Determine placement in the glyph cache texture, advancing in rows. */
-    glRect->pos    = assignCachePos_Text_(activeText_, glRect->size);
+    glRect->size   = init_I2(x1 - x0, y1 - y0);
     glyph->d[hoff] = init_I2(x0, y0);
     glyph->d[hoff].y += d->vertOffset;
     if (hoff == 0) { /* hoff==1 uses same metrics as `glyph` */
@@ -624,6 +939,7 @@ iLocalDef iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
     if (!*glyphIndex) {
         fprintf(stderr, "failed to find %08x (%lc)\n", ch, (int) ch); fflush(stderr);
         iText *tx = activeText_;
+        lock_Mutex(missingCharsMutex_);
         tx->missingGlyphs = iTrue;
         /* Remember a few of the latest missing characters. */
         iBool gotIt = iFalse;
@@ -639,34 +955,56 @@ iLocalDef iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
                     sizeof(tx->missingChars) - sizeof(tx->missingChars[0]));
             tx->missingChars[0] = ch;
         }
+        unlock_Mutex(missingCharsMutex_);
     }
     return d;
 }
 
 static iGlyph *glyphByIndex_Font_(iFont *d, uint32_t glyphIndex) {
-    if (!d->table) {
-        d->table = new_GlyphTable();
-    }   
+    /* This may be called from any thread; only the glyph metrics are set up here. */
+    iGlyphTable *table = d->table;
     iGlyph* glyph = NULL;
-    void *  node = value_Hash(&d->table->glyphs, glyphIndex);
+    lock_Mutex(&table->mtx);
+    void *  node = value_Hash(&table->glyphs, glyphIndex);
     if (node) {
         glyph = node;
     }
     else {
-        /* If the cache is running out of space, clear it and we'll recache what's needed currently. */
-        if (activeText_->cacheBottom > activeText_->cacheSize.y - maxGlyphHeight_Text_(activeText_)) {
+        glyph       = new_Glyph(glyphIndex);
+        glyph->font = d;
+        measure_Font_(d, glyph, 0);
+        measure_Font_(d, glyph, 1);
+        insert_Hash(&table->glyphs, &glyph->node);
+    }
+    unlock_Mutex(&table->mtx);
+    return glyph;
+}
+
+static iGlyph *allocatedGlyphByIndex_Font_(iFont *d, uint32_t glyphIndex) {
+    /* Reserves a position in the cache texture for the glyph. Main thread only. */
+    iGlyph *glyph = glyphByIndex_Font_(d, glyphIndex);
+    if (!isAllocated_Glyph_(glyph)) {
+        iText *tx = activeText_;
+        /* Both offsets are placed side by side. */
+        const iInt2 size = init_I2(glyph->rect[0].size.x + glyph->rect[1].size.x,
+                                   iMax(glyph->rect[0].size.y, glyph->rect[1].size.y));
+        int   row;
+        iInt2 pos;
+        if (!assignCachePos_Text_(tx, size, &row, &pos)) {
+            /* Every row is waiting to be drawn. Clear everything and we'll recache what's
+               needed currently. */
 #if !defined (NDEBUG)
             printf("[Text] glyph cache is full, clearing!\n"); fflush(stdout);
 #endif
-            resetCache_Text_(activeText_);
+            resetCache_Text_(tx);
+            glyph = glyphByIndex_Font_(d, glyphIndex); /* the old one was deleted */
+            assignCachePos_Text_(tx, size, &row, &pos);
         }
-        glyph       = new_Glyph(glyphIndex);
-        glyph->font = d;
-        /* New glyphs are always allocated at least. This reserves a position in the cache
-           and updates the glyph metrics. */
-        allocate_Font_(d, glyph, 0);
-        allocate_Font_(d, glyph, 1);
-        insert_Hash(&d->table->glyphs, &glyph->node);
+        glyph->rect[0].pos = pos;
+        glyph->rect[1].pos = addX_I2(pos, glyph->rect[0].size.x);
+        glyph->cacheRow    = row;
+        glyph->flags |= allocated_GlyphFlag;
+        pushBack_PtrArray(&((iCacheRow *) at_Array(&tx->cacheRows, row))->glyphs, glyph);
     }
     return glyph;
 }
@@ -1028,9 +1366,27 @@ static void prepare_AttributedText_(iAttributedText *d, int overrideBaseDir, iCh
                         setBgColor_AttributedRun_(&run, none_ColorId);
                     }
                     else {
-                        ansiColors_Color(sequence, d->baseFgColorId, none_ColorId,
-                                         ansi & allowFg_AnsiFlag ? &run.fgColor_ : NULL,
-                                         ansi & allowBg_AnsiFlag ? &run.bgColor_ : NULL);
+                        /* Default colors are kept as IDs: shaped runs are cached, and the
+                           palette may change before they are drawn again. */
+                        iColor fg, bg;
+                        iBool  isFgDefault, isBgDefault;
+                        ansiColorsOrDefault_Color(sequence, &fg, &bg, &isFgDefault, &isBgDefault);
+                        if (ansi & allowFg_AnsiFlag) {
+                            if (isFgDefault) {
+                                setFgColor_AttributedRun_(&run, d->baseFgColorId);
+                            }
+                            else if (fg.a) {
+                                run.fgColor_ = fg;
+                            }
+                        }
+                        if (ansi & allowBg_AnsiFlag) {
+                            if (isBgDefault) {
+                                setBgColor_AttributedRun_(&run, none_ColorId);
+                            }
+                            else if (bg.a) {
+                                run.bgColor_ = bg;
+                            }
+                        }
                     }
                 }
                 pos += length_Rangecc(capturedRange_RegExpMatch(&m, 0));
@@ -1190,17 +1546,15 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
                                    d->height * 4 / 3);
     int          bufX    = 0;
     iArray *     rasters = NULL;
-    SDL_Texture *oldTarget = NULL;
-    iBool        isTargetChanged = iFalse;
     iAssert(isExposed_Window(get_Window()));
     /* We'll flush the buffered rasters periodically until everything is cached. */
     size_t index = 0;
     while (index < numGlyphIndices) {
         for (; index < numGlyphIndices; index++) {
             const uint32_t glyphIndex = glyphIndices[index];
-            const int lastCacheBottom = activeText_->cacheBottom;
-            iGlyph *glyph = glyphByIndex_Font_(d, glyphIndex);
-            if (activeText_->cacheBottom < lastCacheBottom) {
+            const uint32_t lastGeneration = activeText_->cacheGeneration;
+            iGlyph *glyph = allocatedGlyphByIndex_Font_(d, glyphIndex);
+            if (activeText_->cacheGeneration != lastGeneration) {
                 /* The cache was reset due to running out of space. We need to restart from
                    the beginning! */
                 bufX = 0;
@@ -1265,16 +1619,13 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
         if (!isEmpty_Array(rasters)) {
             SDL_Texture *bufTex = SDL_CreateTextureFromSurface(activeText_->render, buf);
             SDL_SetTextureBlendMode(bufTex, SDL_BLENDMODE_NONE);
-            if (!isTargetChanged) {
-                isTargetChanged = iTrue;
-                oldTarget = SDL_GetRenderTarget(activeText_->render);
-                SDL_SetRenderTarget(activeText_->render, activeText_->cache);
-            }
+            SDL_Texture *oldTarget = SDL_GetRenderTarget(activeText_->render);
 //            printf("copying %zu rasters from %p\n", size_Array(rasters), bufTex); fflush(stdout);
             iConstForEach(Array, i, rasters) {
                 const iRasterGlyph *rg = i.value;
 //                iAssert(isEqual_I2(rg->rect.size, rg->glyph->rect[rg->hoff].size));
                 const iRect *glRect = &rg->glyph->rect[rg->hoff];
+                SDL_SetRenderTarget(activeText_->render, cacheTexture_Glyph_(rg->glyph));
                 SDL_RenderCopy(activeText_->render,
                                bufTex,
                                (const SDL_Rect *) &rg->rect,
@@ -1282,6 +1633,7 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
                 setRasterized_Glyph_(rg->glyph, rg->hoff);
 //                printf(" - %u (hoff %d)\n", index_Glyph_(rg->glyph), rg->hoff);
             }
+            SDL_SetRenderTarget(activeText_->render, oldTarget);
             SDL_DestroyTexture(bufTex);
             /* Resume with an empty buffer. */
             clear_Array(rasters);
@@ -1294,9 +1646,6 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
     if (buf) {
         SDL_FreeSurface(buf);
     }
-    if (isTargetChanged) {
-        SDL_SetRenderTarget(activeText_->render, oldTarget);
-    }
 }
 
 iLocalDef void cacheSingleGlyph_Font_(iFont *d, uint32_t glyphIndex) {
@@ -1485,6 +1834,241 @@ static void evenMonospaceAdvances_GlyphBuffer_(iGlyphBuffer *d, iFont *baseFont)
     }
 }
 
+/*----------------------------------------------------------------------------------------------*/
+
+/* The same strings get measured and drawn over and over again, so the bidi reordering, font
+   selection, and shaping results are kept for recently used strings. Entries are immutable
+   once added; they are reference counted because several threads may be measuring. */
+
+iDeclareType(ShapeKey)
+
+struct Impl_ShapeKey {
+    iFont *font;
+    iFont *baseFont;
+    size_t maxLen;
+    int    colorId;
+    int    baseFgColorId;
+    int    baseDir;
+    int    ansiFlags;
+    iChar  overrideChar;
+};
+
+struct Impl_ShapedText {
+    iHashNode       node; /* key is a hash of the text and the key */
+    iShapeKey       key;
+    iBlock          text;
+    iAttributedText attrText;
+    iArray          buffers; /* fully shaped */
+    int             refCount;
+    iBool           isRemoved; /* deleted when released */
+    iShapedText *   lruPrev; /* towards less recently used */
+    iShapedText *   lruNext;
+};
+
+static const size_t maxShapedTexts_    = 1024;
+static const size_t maxShapedTextSize_ = 512; /* longer strings are unlikely to repeat */
+
+static uint32_t hashBytes_(uint32_t hash, const void *data, size_t size) {
+    /* FNV-1a */
+    for (const uint8_t *ch = data, *end = ch + size; ch != end; ch++) {
+        hash = (hash ^ *ch) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_ShapeKey_(const iShapeKey *d, iRangecc text) {
+    /* Field by field, so struct padding doesn't affect the hash. */
+    uint32_t hash = hashBytes_(2166136261u, text.start, size_Range(&text));
+    hash = hashBytes_(hash, &d->font,          sizeof(d->font));
+    hash = hashBytes_(hash, &d->baseFont,      sizeof(d->baseFont));
+    hash = hashBytes_(hash, &d->maxLen,        sizeof(d->maxLen));
+    hash = hashBytes_(hash, &d->colorId,       sizeof(d->colorId));
+    hash = hashBytes_(hash, &d->baseFgColorId, sizeof(d->baseFgColorId));
+    hash = hashBytes_(hash, &d->baseDir,       sizeof(d->baseDir));
+    hash = hashBytes_(hash, &d->ansiFlags,     sizeof(d->ansiFlags));
+    hash = hashBytes_(hash, &d->overrideChar,  sizeof(d->overrideChar));
+    return hash;
+}
+
+static iBool equal_ShapeKey_(const iShapeKey *d, const iShapeKey *other) {
+    return d->font == other->font && d->baseFont == other->baseFont &&
+           d->maxLen == other->maxLen && d->colorId == other->colorId &&
+           d->baseFgColorId == other->baseFgColorId && d->baseDir == other->baseDir &&
+           d->ansiFlags == other->ansiFlags && d->overrideChar == other->overrideChar;
+}
+
+static void delete_ShapedText_(iShapedText *d) {
+    iForEach(Array, b, &d->buffers) {
+        deinit_GlyphBuffer_(b.value);
+    }
+    deinit_Array(&d->buffers);
+    deinit_AttributedText(&d->attrText);
+    deinit_Block(&d->text);
+    free(d);
+}
+
+static void release_ShapedText_(iShapedText *d) {
+    lock_Mutex(shapeCacheMutex_);
+    if (--d->refCount == 0 && d->isRemoved) {
+        delete_ShapedText_(d);
+    }
+    unlock_Mutex(shapeCacheMutex_);
+}
+
+static void unlinkLru_Text_(iText *d, iShapedText *shaped) {
+    /* Caller holds the lock. */
+    if (shaped->lruPrev) {
+        shaped->lruPrev->lruNext = shaped->lruNext;
+    }
+    else {
+        d->shapeLruFirst = shaped->lruNext;
+    }
+    if (shaped->lruNext) {
+        shaped->lruNext->lruPrev = shaped->lruPrev;
+    }
+    else {
+        d->shapeLruLast = shaped->lruPrev;
+    }
+    shaped->lruPrev = shaped->lruNext = NULL;
+}
+
+static void linkLru_Text_(iText *d, iShapedText *shaped) {
+    /* Caller holds the lock. `shaped` becomes the most recently used entry. */
+    shaped->lruPrev = d->shapeLruLast;
+    shaped->lruNext = NULL;
+    if (d->shapeLruLast) {
+        d->shapeLruLast->lruNext = shaped;
+    }
+    else {
+        d->shapeLruFirst = shaped;
+    }
+    d->shapeLruLast = shaped;
+}
+
+static void remove_ShapedText_(iShapedText *d) {
+    /* Caller holds the lock and has removed `d` from the cache and the LRU list. */
+    d->isRemoved = iTrue;
+    if (d->refCount == 0) {
+        delete_ShapedText_(d);
+    }
+}
+
+static void clearShapeCache_Text_(iText *d) {
+    if (!shapeCacheMutex_) {
+        return;
+    }
+    lock_Mutex(shapeCacheMutex_);
+    iForEach(Hash, i, &d->shapeCache) {
+        iShapedText *shaped = (iShapedText *) i.value;
+        remove_HashIterator(&i);
+        remove_ShapedText_(shaped);
+    }
+    d->shapeLruFirst = NULL;
+    d->shapeLruLast  = NULL;
+    unlock_Mutex(shapeCacheMutex_);
+}
+
+static iShapedText *findShapedText_Text_(iText *d, const iShapeKey *key, iRangecc text) {
+    const uint32_t hash   = hash_ShapeKey_(key, text);
+    iShapedText *  shaped = NULL;
+    lock_Mutex(shapeCacheMutex_);
+    iShapedText *found = (iShapedText *) value_Hash(&d->shapeCache, hash);
+    if (found && equal_ShapeKey_(&found->key, key) &&
+        size_Block(&found->text) == size_Range(&text) &&
+        !memcmp(constData_Block(&found->text), text.start, size_Range(&text))) {
+        shaped = found;
+        shaped->refCount++;
+        unlinkLru_Text_(d, shaped);
+        linkLru_Text_(d, shaped);
+        d->shapeHits++;
+    }
+    else {
+        d->shapeMisses++;
+    }
+    unlock_Mutex(shapeCacheMutex_);
+    return shaped;
+}
+
+static iShapedText *insertShapedText_Text_(iText *d, const iShapeKey *key, iRangecc text,
+                                           const iAttributedText *attrText,
+                                           const iArray *buffers) {
+    /* The cache takes ownership of `attrText` and `buffers`. */
+    iShapedText *shaped = iMalloc(ShapedText);
+    shaped->node.key  = hash_ShapeKey_(key, text);
+    shaped->key       = *key;
+    initData_Block(&shaped->text, text.start, size_Range(&text));
+    shaped->attrText  = *attrText;
+    shaped->buffers   = *buffers;
+    shaped->refCount  = 1; /* caller's reference */
+    shaped->isRemoved = iFalse;
+    lock_Mutex(shapeCacheMutex_);
+    if (size_Hash(&d->shapeCache) >= maxShapedTexts_ && d->shapeLruFirst) {
+        /* Evict the least recently used entry. */
+        iShapedText *lru = d->shapeLruFirst;
+        unlinkLru_Text_(d, lru);
+        remove_Hash(&d->shapeCache, lru->node.key);
+        remove_ShapedText_(lru);
+    }
+    iShapedText *old = (iShapedText *) insert_Hash(&d->shapeCache, &shaped->node);
+    if (old) {
+        unlinkLru_Text_(d, old);
+        remove_ShapedText_(old); /* hash collision */
+    }
+    linkLru_Text_(d, shaped);
+    unlock_Mutex(shapeCacheMutex_);
+    return shaped;
+}
+
+iShapeCacheStats shapeCacheStats_Text(void) {
+    iText *d = activeText_;
+    iShapeCacheStats stats;
+    lock_Mutex(shapeCacheMutex_);
+    stats.hits     = d->shapeHits;
+    stats.misses   = d->shapeMisses;
+    stats.count    = size_Hash(&d->shapeCache);
+    stats.capacity = maxShapedTexts_;
+    unlock_Mutex(shapeCacheMutex_);
+    return stats;
+}
+
+static void prepareGlyphBuffers_(const iAttributedText *attrText, iArray *buffers,
+                                 iFont *monoFont) {
+    const iChar *logicalText = constData_Array(&attrText->logical);
+    const iChar *visualText  = constData_Array(&attrText->visual);
+    const int *  logToVis    = constData_Array(&attrText->logicalToVisual);
+    const int *  visToLog    = constData_Array(&attrText->visualToLogical);
+    const size_t runCount    = size_Array(&attrText->runs);
+    init_Array(buffers, sizeof(iGlyphBuffer));
+    resize_Array(buffers, runCount);
+    /* Prepare the HarfBuzz buffers. They will be lazily shaped when needed. */
+    iConstForEach(Array, i, &attrText->runs) {
+        const iAttributedRun *run = i.value;
+        iGlyphBuffer *buf = at_Array(buffers, index_ArrayConstIterator(&i));
+        init_GlyphBuffer_(buf, run->font, logicalText);
+        /* Insert the text in visual order (LTR) in the HarfBuzz buffer for shaping.
+           First we need to map the logical run to the corresponding visual run. */
+        int v[2] = { logToVis[run->logical.start], logToVis[run->logical.end - 1] };
+        if (v[0] > v[1]) {
+            iSwap(int, v[0], v[1]); /* always LTR */
+        }
+        for (int vis = v[0]; vis <= v[1]; vis++) {
+            hb_buffer_add(buf->hb, visualText[vis], visToLog[vis]);
+        }
+        hb_buffer_set_content_type(buf->hb, HB_BUFFER_CONTENT_TYPE_UNICODE);
+        hb_buffer_set_direction(buf->hb, HB_DIRECTION_LTR); /* visual */
+        const hb_script_t script = hbScripts_[run->flags.script];
+        if (script) {
+            hb_buffer_set_script(buf->hb, script);
+        }
+    }
+    if (monoFont) {
+        /* Fit borrowed glyphs into the expected monospacing. */
+        for (size_t runIndex = 0; runIndex < runCount; runIndex++) {
+            evenMonospaceAdvances_GlyphBuffer_(at_Array(buffers, runIndex), monoFont);
+        }
+    }
+}
+
 static iRect run_Font_(iFont *d, const iRunArgs *args) {
     const int   mode         = args->mode;
     const iInt2 orig         = args->pos;
@@ -1499,11 +2083,41 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
        font is used and other attributes such as color. (HarfBuzz shaping is done
        with one specific font.) */
     iAttributedText attrText;
-    init_AttributedText(&attrText, args->text, args->maxLen, d, args->color,
-                        args->baseDir,
-                        activeText_->baseFontId >= 0 ? font_Text_(activeText_->baseFontId) : d,
-                        activeText_->baseFgColorId, 
-                        wrap ? wrap->overrideChar : 0);
+    iArray          buffers;
+    iShapeKey       shapeKey;
+    iZap(shapeKey);
+    shapeKey.font          = d;
+    shapeKey.baseFont      = activeText_->baseFontId >= 0 ? font_Text_(activeText_->baseFontId) : d;
+    shapeKey.maxLen        = args->maxLen;
+    shapeKey.colorId       = args->color;
+    shapeKey.baseFgColorId = activeText_->baseFgColorId;
+    shapeKey.baseDir       = args->baseDir;
+    shapeKey.ansiFlags     = activeText_->ansiFlags;
+    shapeKey.overrideChar  = wrap ? wrap->overrideChar : 0;
+    const iBool isCacheable = size_Range(&args->text) <= maxShapedTextSize_;
+    iShapedText *shaped =
+        isCacheable ? findShapedText_Text_(activeText_, &shapeKey, args->text) : NULL;
+    if (shaped) {
+        /* Shallow copies; owned by the cache. */
+        attrText        = shaped->attrText;
+        attrText.source = args->text;
+        buffers         = shaped->buffers;
+    }
+    else {
+        init_AttributedText(&attrText, args->text, args->maxLen, d, args->color,
+                            args->baseDir,
+                            shapeKey.baseFont,
+                            shapeKey.baseFgColorId,
+                            shapeKey.overrideChar);
+        prepareGlyphBuffers_(&attrText, &buffers, isMonospaced ? d : NULL);
+        if (isCacheable) {
+            iForEach(Array, b, &buffers) {
+                shape_GlyphBuffer_(b.value); /* must not change once cached */
+            }
+            shaped = insertShapedText_Text_(activeText_, &shapeKey, args->text, &attrText,
+                                            &buffers);
+        }
+    }
     if (wrap) {
         wrap->baseDir = attrText.isBaseRTL ? -1 : +1;
         /* TODO: Duplicated args? */
@@ -1515,40 +2129,7 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
         wrap->hitGlyphNormX_out = 0.0f;
     }
     const iChar *logicalText = constData_Array(&attrText.logical);
-    const iChar *visualText  = constData_Array(&attrText.visual);
-    const int *  logToVis    = constData_Array(&attrText.logicalToVisual);
-    const int *  visToLog    = constData_Array(&attrText.visualToLogical);
     const size_t runCount    = size_Array(&attrText.runs);
-    iArray buffers;
-    init_Array(&buffers, sizeof(iGlyphBuffer));
-    resize_Array(&buffers, runCount);
-    /* Prepare the HarfBuzz buffers. They will be lazily shaped when needed. */
-    iConstForEach(Array, i, &attrText.runs) {
-        const iAttributedRun *run = i.value;
-        iGlyphBuffer *buf = at_Array(&buffers, index_ArrayConstIterator(&i));
-        init_GlyphBuffer_(buf, run->font, logicalText);
-        /* Insert the text in visual order (LTR) in the HarfBuzz buffer for shaping.
-           First we need to map the logical run to the corresponding visual run. */
-        int v[2] = { logToVis[run->logical.start], logToVis[run->logical.end - 1] };
-        if (v[0] > v[1]) {
-            iSwap(int, v[0], v[1]); /* always LTR */
-        }
-        for (int vis = v[0]; vis <= v[1]; vis++) {
-            hb_buffer_add(buf->hb, visualText[vis], visToLog[vis]);
-        }
-        hb_buffer_set_content_type(buf->hb, HB_BUFFER_CONTENT_TYPE_UNICODE);
-        hb_buffer_set_direction(buf->hb, HB_DIRECTION_LTR); /* visual */
-        const hb_script_t script = hbScripts_[run->flags.script];
-        if (script) {
-            hb_buffer_set_script(buf->hb, script);
-        }
-    }
-    if (isMonospaced) {
-        /* Fit borrowed glyphs into the expected monospacing. */
-        for (size_t runIndex = 0; runIndex < runCount; runIndex++) {
-            evenMonospaceAdvances_GlyphBuffer_(at_Array(&buffers, runIndex), d);
-        }
-    }
     iBool        willAbortDueToWrap = iFalse;
     const size_t textLen            = size_Array(&attrText.logical);
     iRanges      wrapRuns           = { 0, runCount };
@@ -1896,7 +2477,7 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                         iAssert(isRasterized_Glyph_(glyph, hoff));
                     }
                     if (~mode & permanentColorFlag_RunMode) {
-                        SDL_SetTextureColorMod(activeText_->cache, fgClr.r, fgClr.g, fgClr.b);
+                        activeText_->glyphColor = fgClr;
                     }
                     dst.x += origin_Paint.x;
                     dst.y += origin_Paint.y;
@@ -1922,7 +2503,7 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                     if (!isSpace) {
                         SDL_Rect src;
                         memcpy(&src, &glyph->rect[hoff], sizeof(SDL_Rect));
-                        SDL_RenderCopy(activeText_->render, activeText_->cache, &src, &dst);
+                        queueGlyph_Text_(activeText_, glyph, &src, &dst);
                     }
 #if 0
                     /* Show spaces and direction. */
@@ -1970,16 +2551,32 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
     if (args->runAdvance_out) {
         *args->runAdvance_out = xCursorMax;
     }
-    iForEach(Array, b, &buffers) {
-        deinit_GlyphBuffer_(b.value);
+    if (mode & draw_RunMode) {
+        flushGlyphs_Text_(activeText_);
+    }
+    if (shaped) {
+        release_ShapedText_(shaped);
+    }
+    else {
+        iForEach(Array, b, &buffers) {
+            deinit_GlyphBuffer_(b.value);
+        }
+        deinit_Array(&buffers);
+        deinit_AttributedText(&attrText);
     }
-    deinit_Array(&buffers);
-    deinit_AttributedText(&attrText);
     return bounds;
 }
 
 #else /* !defined (LAGRANGE_ENABLE_HARFBUZZ) */
 
+static void clearShapeCache_Text_(iText *d) {
+    iUnused(d);
+}
+
+iShapeCacheStats shapeCacheStats_Text(void) {
+    return (iShapeCacheStats){ 0, 0, 0, 0 };
+}
+
 /* The fallback method: an incomplete solution for simple scripts. */
 #   define run_Font_    runSimple_Font_
 #   include "text_simple.c"
@@ -2080,7 +2677,7 @@ static void drawBoundedN_Text_(int fontId, iInt2 pos, int xposBound, int color,
     iText *      d    = activeText_;
     iFont *      font = font_Text_(fontId);
     const iColor clr  = get_Color(color & mask_ColorId);
-    SDL_SetTextureColorMod(d->cache, clr.r, clr.g, clr.b);
+    d->glyphColor = clr;
     run_Font_(font,
               &(iRunArgs){ .mode = draw_RunMode |
                                    (color & permanent_ColorId ? permanentColorFlag_RunMode : 0) |
@@ -2291,7 +2888,11 @@ void resetMissing_Text(iText *d) {
 }
 
 SDL_Texture *glyphCache_Text(void) {
-    return activeText_->cache;
+    /* Only the first page of the cache. */
+    if (isEmpty_Array(&activeText_->cachePages)) {
+        return NULL;
+    }
+    return ((const iCachePage *) front_Array(&activeText_->cachePages))->texture;
 }
 
 static void freeBitmap_(void *ptr) {
@@ -2426,9 +3027,9 @@ void init_TextBuf(iTextBuf *d, iWrapText *wrapText, int font, int color) {
         SDL_SetRenderDrawBlendMode(render, SDL_BLENDMODE_NONE);
         SDL_SetRenderDrawColor(render, 255, 255, 255, 0);
         SDL_RenderClear(render);
-        SDL_SetTextureBlendMode(activeText_->cache, SDL_BLENDMODE_NONE); /* blended when TextBuf is drawn */
+        activeText_->glyphBlendMode = SDL_BLENDMODE_NONE; /* blended when TextBuf is drawn */
         draw_WrapText(wrapText, font, zero_I2(), color | fillBackground_ColorId);
-        SDL_SetTextureBlendMode(activeText_->cache, SDL_BLENDMODE_BLEND);
+        activeText_->glyphBlendMode = SDL_BLENDMODE_BLEND;
         SDL_SetRenderTarget(render, oldTarget);
         origin_Paint = oldOrigin;
         SDL_SetTextureBlendMode(d->texture, SDL_BLENDMODE_BLEND);
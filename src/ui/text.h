@@ -111,7 +111,9 @@ iDeclareTypeConstructionArgs(Text, SDL_Renderer *)
 void    init_Text               (iText *, SDL_Renderer *);
 void    deinit_Text             (iText *);
 
-void    setCurrent_Text         (iText *);
+void    setCurrent_Text         (iText *); /* current in the calling thread */
+iText * current_Text            (void);
+iText * newMeasuring_Text       (const iText *); /* for measuring in other threads */
 
 void    setDocumentFontSize_Text(iText *, float fontSizeFactor); /* affects all except `default*` fonts */
 void    resetFonts_Text         (iText *);
@@ -233,6 +235,17 @@ void            resetMissing_Text   (iText *);
 iBool           checkMissing_Text   (void); /* returns the flag, and clears it */
 SDL_Texture *   glyphCache_Text     (void);
 
+iDeclareType(ShapeCacheStats)
+
+struct Impl_ShapeCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t count;
+    size_t capacity;
+};
+
+iShapeCacheStats shapeCacheStats_Text(void);
+
 enum iTextBlockMode { quadrants_TextBlockMode, shading_TextBlockMode };
 
 iString *   renderBlockChars_Text   (const iBlock *fontData, int height, enum iTextBlockMode,
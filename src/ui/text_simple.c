@@ -122,7 +122,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
                     ansiColors_Color(capturedRange_RegExpMatch(&m, 1),
                                      activeText_->baseFgColorId,
                                      none_ColorId, &clr, NULL);
-                    SDL_SetTextureColorMod(activeText_->cache, clr.r, clr.g, clr.b);
+                    activeText_->glyphColor = clr;
                     if (args->mode & fillBackground_RunMode) {
                         SDL_SetRenderDrawColor(activeText_->render, clr.r, clr.g, clr.b, 0);
                     }
@@ -211,7 +211,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
                 }
                 if (mode & draw_RunMode && ~mode & permanentColorFlag_RunMode) {
                     const iColor clr = get_Color(colorNum);
-                    SDL_SetTextureColorMod(activeText_->cache, clr.r, clr.g, clr.b);
+                    activeText_->glyphColor = clr;
                     if (args->mode & fillBackground_RunMode) {
                         SDL_SetRenderDrawColor(activeText_->render, clr.r, clr.g, clr.b, 0);
                     }
@@ -318,7 +318,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
                    the partially transparent pixels. */
                 SDL_RenderFillRect(activeText_->render, &dst);
             }
-            SDL_RenderCopy(activeText_->render, activeText_->cache, &src, &dst);
+            queueGlyph_Text_(activeText_, glyph, &src, &dst);
         }
         xpos += advance;
         if (!isSpace_Char(ch)) {
@@ -377,6 +377,9 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
     if (args->runAdvance_out) {
         *args->runAdvance_out = xposMax - orig.x;
     }
+    if (mode & draw_RunMode) {
+        flushGlyphs_Text_(activeText_);
+    }
 //    fflush(stdout);
     return bounds;
 }
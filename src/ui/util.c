@@ -2576,9 +2576,11 @@ iWidget *makePreferences_Widget(void) {
         const iMenuItem networkPanelItems[] = {
             { "title id:heading.prefs.network" },
             { "toggle id:prefs.decodeurls" },
+            { "toggle id:prefs.prefetchhosts" },
             { "input id:prefs.urlsize maxlen:10 selectall:1" },
             { "padding" },
             { "input id:prefs.cachesize maxlen:4 selectall:1 unit:mb" },
+            { "input id:prefs.diskcachesize maxlen:5 selectall:1 unit:mb" },
             { "input id:prefs.memorysize maxlen:4 selectall:1 unit:mb" },
             { "heading text:${prefs.proxy.gemini}" },
             { "input id:prefs.proxy.gemini noheading:1" },
@@ -2916,6 +2918,7 @@ iWidget *makePreferences_Widget(void) {
         setId_Widget(appendTwoColumnTabPage_Widget(tabs, "${heading.prefs.network}", '6', &headings, &values), "prefs.page.network");
         addChild_Widget(headings, iClob(makeHeading_Widget("${prefs.decodeurls}")));
         addChild_Widget(values, iClob(makeToggle_Widget("prefs.decodeurls")));
+        addDialogToggle_(headings, values, "${prefs.prefetchhosts}", "prefs.prefetchhosts");
         addPrefsInputWithHeading_(headings, values, "prefs.urlsize", iClob(new_InputWidget(10)));
         /* Cache size. */ {
             iInputWidget *cache = new_InputWidget(4);
@@ -2928,6 +2931,17 @@ iWidget *makePreferences_Widget(void) {
                                      resizeToParentHeight_WidgetFlag);
             setContentPadding_InputWidget(cache, 0, width_Widget(unit) - 4 * gap_UI);
         }
+        /* Disk cache size. */ {
+            iInputWidget *disk = new_InputWidget(5);
+            setSelectAllOnFocus_InputWidget(disk, iTrue);
+            addPrefsInputWithHeading_(headings, values, "prefs.diskcachesize", iClob(disk));
+            iWidget *unit =
+                addChildFlags_Widget(as_Widget(disk),
+                                     iClob(new_LabelWidget("${mb}", NULL)),
+                                     frameless_WidgetFlag | moveToParentRightEdge_WidgetFlag |
+                                         resizeToParentHeight_WidgetFlag);
+            setContentPadding_InputWidget(disk, 0, width_Widget(unit) - 4 * gap_UI);
+        }
         /* Memory size. */ {
             iInputWidget *mem = new_InputWidget(4);
             setSelectAllOnFocus_InputWidget(mem, iTrue);
@@ -3092,22 +3106,20 @@ static iBool handleBookmarkCreationCommands_SidebarWidget_(iWidget *editor, cons
             const iString *tags  = text_InputWidget(findChild_Widget(editor, "bmed.tags"));
             const iBookmark *folder = userData_Object(findChild_Widget(editor, "bmed.folder"));
             const iString *icon  = collect_String(trimmed_String(text_InputWidget(findChild_Widget(editor, "bmed.icon"))));
-            const uint32_t id    = add_Bookmarks(bookmarks_App(), url, title, tags, first_String(icon));
-            iBookmark *    bm    = get_Bookmarks(bookmarks_App(), id);
+            iBookmarks *   bookmarks = bookmarks_App();
+            const uint32_t id    = add_Bookmarks(bookmarks, url, title, tags, first_String(icon));
+            const uint32_t parentId = folder ? id_Bookmark(folder) : 0;
             if (!isEmpty_String(icon)) {
-                bm->flags |= userIcon_BookmarkFlag;
-            }
-            if (isSelected_Widget(findChild_Widget(editor, "bmed.tag.home"))) {
-                bm->flags |= homepage_BookmarkFlag;
-            }
-            if (isSelected_Widget(findChild_Widget(editor, "bmed.tag.remote"))) {
-                bm->flags |= remoteSource_BookmarkFlag;
-            }
-            if (isSelected_Widget(findChild_Widget(editor, "bmed.tag.linksplit"))) {
-                bm->flags |= linkSplit_BookmarkFlag;
+                setUserIcon_Bookmarks(bookmarks, id, first_String(icon));
             }
-            bm->parentId = folder ? id_Bookmark(folder) : 0;
-            setRecentFolder_Bookmarks(bookmarks_App(), bm->parentId);
+            setFlags_Bookmarks(bookmarks, id, homepage_BookmarkFlag,
+                               isSelected_Widget(findChild_Widget(editor, "bmed.tag.home")));
+            setFlags_Bookmarks(bookmarks, id, remoteSource_BookmarkFlag,
+                               isSelected_Widget(findChild_Widget(editor, "bmed.tag.remote")));
+            setFlags_Bookmarks(bookmarks, id, linkSplit_BookmarkFlag,
+                               isSelected_Widget(findChild_Widget(editor, "bmed.tag.linksplit")));
+            setParent_Bookmarks(bookmarks, id, parentId);
+            setRecentFolder_Bookmarks(bookmarks, parentId);
             postCommandf_App("bookmarks.changed added:%zu", id);
         }
         setupSheetTransition_Mobile(editor, iFalse);
@@ -3167,12 +3179,12 @@ static iBool handleFeedSettingCommands_(iWidget *dlg, const char *cmd) {
                 postCommand_App("feeds.refresh");
             }
         }
-        iBookmark *bm = get_Bookmarks(bookmarks_App(), id);
-        iAssert(bm);
-        set_String(&bm->title, feedTitle);
-        bm->flags |= subscribed_BookmarkFlag;
-        iChangeFlags(bm->flags, headings_BookmarkFlag, headings);
-        iChangeFlags(bm->flags, ignoreWeb_BookmarkFlag, ignoreWeb);
+        iBookmarks *bookmarks = bookmarks_App();
+        iAssert(get_Bookmarks(bookmarks, id));
+        setTitle_Bookmarks(bookmarks, id, feedTitle);
+        setFlags_Bookmarks(bookmarks, id, subscribed_BookmarkFlag, iTrue);
+        setFlags_Bookmarks(bookmarks, id, headings_BookmarkFlag, headings);
+        setFlags_Bookmarks(bookmarks, id, ignoreWeb_BookmarkFlag, ignoreWeb);
         postCommand_App("bookmarks.changed");
         setupSheetTransition_Mobile(dlg, iFalse);
         destroy_Widget(dlg);
@@ -3298,6 +3310,9 @@ static iBool siteSpecificSettingsHandler_(iWidget *dlg, const char *cmd) {
         int                 dismissed = value_SiteSpec(siteRoot, dismissWarnings_SiteSpecKey);
         iChangeFlags(dismissed, ansiEscapes_GmDocumentWarning, !warnAnsi);
         setValue_SiteSpec(siteRoot, dismissWarnings_SiteSpecKey, dismissed);
+        setValue_SiteSpec(siteRoot,
+                          prefetch_SiteSpecKey,
+                          isSelected_Widget(findChild_Widget(dlg, "sitespec.prefetch")));
         setValueString_SiteSpec(siteRoot, paletteSeed_SiteSpecKey, text_InputWidget(palSeed));
         siteSpecificThemeChanged_(dlg);
         /* Note: The active DocumentWidget may actually be different than when opening the dialog. */
@@ -3325,6 +3340,7 @@ iWidget *makeSiteSpecificSettings_Widget(const iString *url) {
         setHint_InputWidget(palSeed, cstr_Block(urlThemeSeed_String(url)));
         addPrefsInputWithHeading_(headings, values, "sitespec.palette", iClob(palSeed));
         addDialogToggle_(headings, values, "${sitespec.ansi}", "sitespec.ansi");
+        addDialogToggle_(headings, values, "${sitespec.prefetch}", "sitespec.prefetch");
         addChild_Widget(dlg, iClob(makeDialogButtons_Widget(actions, iElemCount(actions))));        
         addChild_Widget(get_Root()->widget, iClob(dlg));
         as_Widget(palSeed)->rect.size.x = 60 * gap_UI;
@@ -3334,6 +3350,8 @@ iWidget *makeSiteSpecificSettings_Widget(const iString *url) {
         const iString *site = collectNewRange_String(urlRoot_String(url));
         setToggle_Widget(findChild_Widget(dlg, "sitespec.ansi"),
                          ~value_SiteSpec(site, dismissWarnings_SiteSpecKey) & ansiEscapes_GmDocumentWarning);
+        setToggle_Widget(findChild_Widget(dlg, "sitespec.prefetch"),
+                         value_SiteSpec(site, prefetch_SiteSpecKey));
         setText_InputWidget(findChild_Widget(dlg, "sitespec.palette"),
                             valueString_SiteSpec(site, paletteSeed_SiteSpecKey));
         /* Keep a copy of the original palette seed for restoring on cancel. */
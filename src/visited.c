@@ -24,10 +24,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
-#include <the_Foundation/sortedarray.h>
+#include <the_Foundation/stringset.h>
+
+#include <stdio.h>
 
 const int maxAge_Visited = 6 * 3600 * 24 * 30; /* six months */
 
@@ -41,176 +44,607 @@ void deinit_VisitedUrl(iVisitedUrl *d) {
     deinit_String(&d->url);
 }
 
-static int cmpUrl_VisitedUrl_(const void *a, const void *b) {
-    return cmpString_String(&((const iVisitedUrl *) a)->url, &((const iVisitedUrl *) b)->url);
-}
+iDefineTypeConstruction(VisitedUrl)
 
-static int cmpNewer_VisitedUrl_(const void *insert, const void *existing) {
-    return seconds_Time(&((const iVisitedUrl *) insert  )->when) >=
-           seconds_Time(&((const iVisitedUrl *) existing)->when);
+static uint64_t hash_VisitedUrl_(const iString *url) {
+    /* FNV-1a; iHash in the_Foundation is only 32 bits, which collides too often with
+       tens of thousands of URLs. */
+    uint64_t h = 0xcbf29ce484222325ull;
+    const char *bytes = cstr_String(url);
+    for (size_t i = 0, len = size_String(url); i < len; i++) {
+        h = (h ^ (uint8_t) bytes[i]) * 0x100000001b3ull;
+    }
+    return h;
 }
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* The visited URLs are kept in an unordered array. They are located via an open-addressing
+   hash table whose slots refer to the array by index. All changes are appended to a binary
+   journal, which gets compacted when it has accumulated enough superseded records. */
+
+iDeclareType(VisitedSlot)
+
+struct Impl_VisitedSlot {
+    uint64_t hash;
+    uint32_t index; /* emptySlot_Visited_ if unused */
+};
+
+enum iVisitedRecordType {
+    visit_VisitedRecordType  = 1,
+    remove_VisitedRecordType = 2,
+};
+
+static const uint32_t emptySlot_Visited_       = 0xffffffff;
+static const size_t   minSlots_Visited_        = 1024;
+static const uint32_t journalMagic_Visited_    = 0x56697374; /* "Vist" */
+static const uint32_t journalVersion_Visited_  = 1;
+static const char *   journalFileName_Visited_ = "visited.3.bin";
+static const char *   textFileName_Visited_    = "visited.2.txt"; /* migrated from */
+
 struct Impl_Visited {
-    iMutex *mtx;
-    iSortedArray visited;
+    iMutex *  mtx;
+    iPtrArray visited; /* iVisitedUrl, in no particular order */
+    iArray    slots;   /* iVisitedSlot; size is a power of two */
+    iString   journalPath;
+    iFile *   journal; /* open for appending */
+    size_t    numRecords;
+    uint32_t  generation;
+    iMutex *  snapshotMtx; /* held while a snapshot is built; writers don't wait for it */
+    iVisitedSnapshot *snapshot; /* latest version given to readers */
+    iArray    changes; /* iVisitedUrl; made after `snapshot`, in chronological order */
 };
 
 iDefineTypeConstruction(Visited)
 
-void init_Visited(iVisited *d) {
-    d->mtx = new_Mutex();
-    init_SortedArray(&d->visited, sizeof(iVisitedUrl), cmpUrl_VisitedUrl_);
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareObjectConstructionArgs(VisitedSnapshot, uint32_t generation)
+
+/* Marks a removed URL in the list of changes. */
+static const uint16_t removed_VisitedChange_ = 0x8000;
+
+struct Impl_VisitedSnapshot {
+    iObject  object;
+    uint32_t generation;
+    iArray   urls; /* iVisitedUrl */
+};
+
+static int cmpWhenDescending_VisitedUrl_(const void *a, const void *b) {
+    return -cmp_Time(&((const iVisitedUrl *) a)->when, &((const iVisitedUrl *) b)->when);
 }
 
-void deinit_Visited(iVisited *d) {
-    iGuardMutex(d->mtx, {
-        clear_Visited(d);
-        deinit_SortedArray(&d->visited);
-    });
-    delete_Mutex(d->mtx);
+void init_VisitedSnapshot(iVisitedSnapshot *d, uint32_t generation) {
+    d->generation = generation;
+    init_Array(&d->urls, sizeof(iVisitedUrl));
+}
+
+static void copyEntries_VisitedSnapshot_(iVisitedSnapshot *d, const iPtrArray *visited) {
+    /* Note: Visited is locked. The URL strings share their data with the originals. */
+    resize_Array(&d->urls, size_PtrArray(visited));
+    iVisitedUrl *copy = data_Array(&d->urls);
+    iConstForEach(PtrArray, i, visited) {
+        const iVisitedUrl *vis = i.ptr;
+        initCopy_String(&copy->url, &vis->url);
+        copy->when  = vis->when;
+        copy->flags = vis->flags;
+        copy++;
+    }
 }
 
-void save_Visited(const iVisited *d, const char *dirPath) {
-    iString *line = new_String();
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *item = i.value;
-            format_String(line,
-                          "%llu %04x %s\n",
-                          (unsigned long long) integralSeconds_Time(&item->when),
-                          item->flags,
-                          cstr_String(&item->url));
-            writeData_File(f, cstr_String(line), size_String(line));
+static void applyChanges_VisitedSnapshot_(iVisitedSnapshot *d, const iVisitedSnapshot *base,
+                                          const iArray *changes) {
+    /* The latest change of each URL replaces its entry in `base`. */
+    iStringSet *changed = new_StringSet();
+    iArray      fresh;
+    init_Array(&fresh, sizeof(iVisitedUrl));
+    for (size_t i = size_Array(changes); i-- > 0; ) {
+        const iVisitedUrl *change = constAt_Array(changes, i);
+        if (contains_StringSet(changed, &change->url)) {
+            continue;
+        }
+        insert_StringSet(changed, &change->url);
+        if (~change->flags & removed_VisitedChange_) {
+            pushBack_Array(&fresh, change);
         }
-        unlock_Mutex(d->mtx);
     }
-    iRelease(f);
-    delete_String(line);
+    sort_Array(&fresh, cmpWhenDescending_VisitedUrl_);
+    /* Both are sorted, so they can be merged. */
+    const size_t numBase = base ? size_Array(&base->urls) : 0;
+    size_t       baseIndex = 0, freshIndex = 0;
+    for (;;) {
+        while (baseIndex < numBase &&
+               contains_StringSet(changed, &((const iVisitedUrl *)
+                                             constAt_Array(&base->urls, baseIndex))->url)) {
+            baseIndex++;
+        }
+        const iVisitedUrl *a = baseIndex < numBase ? constAt_Array(&base->urls, baseIndex) : NULL;
+        const iVisitedUrl *b = freshIndex < size_Array(&fresh) ? constAt_Array(&fresh, freshIndex)
+                                                               : NULL;
+        if (!a && !b) {
+            break;
+        }
+        const iVisitedUrl *next = (!b || (a && cmp_Time(&a->when, &b->when) >= 0)) ? a : b;
+        iVisitedUrl copy;
+        initCopy_String(&copy.url, &next->url);
+        copy.when  = next->when;
+        copy.flags = next->flags;
+        pushBack_Array(&d->urls, &copy);
+        if (next == a) {
+            baseIndex++;
+        }
+        else {
+            freshIndex++;
+        }
+    }
+    deinit_Array(&fresh); /* URLs are owned by `changes` */
+    iRelease(changed);
 }
 
-void load_Visited(iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
+void deinit_VisitedSnapshot(iVisitedSnapshot *d) {
+    iForEach(Array, i, &d->urls) {
+        deinit_VisitedUrl(i.value);
+    }
+    deinit_Array(&d->urls);
+}
+
+iDefineClass(VisitedSnapshot)
+iDefineObjectConstructionArgs(VisitedSnapshot, (uint32_t generation), generation)
+
+uint32_t generation_VisitedSnapshot(const iVisitedSnapshot *d) {
+    return d->generation;
+}
+
+size_t size_VisitedSnapshot(const iVisitedSnapshot *d) {
+    return size_Array(&d->urls);
+}
+
+const iVisitedUrl *at_VisitedSnapshot(const iVisitedSnapshot *d, size_t pos) {
+    return constAt_Array(&d->urls, pos);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void resetSlots_Visited_(iVisited *d, size_t count) {
+    const iVisitedSlot empty = { 0, emptySlot_Visited_ };
+    clear_Array(&d->slots);
+    resize_Array(&d->slots, count);
+    for (size_t i = 0; i < count; i++) {
+        set_Array(&d->slots, i, &empty);
+    }
+}
+
+static size_t slotMask_Visited_(const iVisited *d) {
+    return size_Array(&d->slots) - 1;
+}
+
+static const iVisitedUrl *constEntry_Visited_(const iVisited *d, uint32_t index) {
+    return constAt_PtrArray(&d->visited, index);
+}
+
+/* Returns the slot where `url` is, or the empty slot where it should be inserted. */
+static size_t findSlot_Visited_(const iVisited *d, uint64_t hash, const iString *url) {
+    const size_t mask = slotMask_Visited_(d);
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+        const iVisitedSlot *slot = constAt_Array(&d->slots, pos);
+        if (slot->index == emptySlot_Visited_ ||
+            (slot->hash == hash && equal_String(&constEntry_Visited_(d, slot->index)->url, url))) {
+            return pos;
+        }
+    }
+}
+
+static iVisitedUrl *find_Visited_(const iVisited *d, const iString *url) {
+    const iVisitedSlot *slot =
+        constAt_Array(&d->slots, findSlot_Visited_(d, hash_VisitedUrl_(url), url));
+    return slot->index != emptySlot_Visited_ ? at_PtrArray((iPtrArray *) &d->visited, slot->index)
+                                             : NULL;
+}
+
+static void rehash_Visited_(iVisited *d, size_t numSlots) {
+    resetSlots_Visited_(d, numSlots);
+    for (size_t i = 0; i < size_PtrArray(&d->visited); i++) {
+        const iVisitedUrl *vis  = constAt_PtrArray(&d->visited, i);
+        const uint64_t     hash = hash_VisitedUrl_(&vis->url);
+        iVisitedSlot *     slot = at_Array(&d->slots, findSlot_Visited_(d, hash, &vis->url));
+        slot->hash  = hash;
+        slot->index = (uint32_t) i;
+    }
+}
+
+static iVisitedUrl *insert_Visited_(iVisited *d, const iString *url) {
+    /* Keep the load factor at most 1/2 so probe sequences stay short. */
+    if ((size_PtrArray(&d->visited) + 1) * 2 > size_Array(&d->slots)) {
+        rehash_Visited_(d, iMax(minSlots_Visited_, size_Array(&d->slots) * 2));
+    }
+    const uint64_t hash = hash_VisitedUrl_(url);
+    iVisitedSlot * slot = at_Array(&d->slots, findSlot_Visited_(d, hash, url));
+    if (slot->index != emptySlot_Visited_) {
+        return at_PtrArray(&d->visited, slot->index);
+    }
+    iVisitedUrl *vis = new_VisitedUrl();
+    set_String(&vis->url, url);
+    slot->hash  = hash;
+    slot->index = (uint32_t) size_PtrArray(&d->visited);
+    pushBack_PtrArray(&d->visited, vis);
+    return vis;
+}
+
+static iBool remove_Visited_(iVisited *d, const iString *url) {
+    const size_t   mask = slotMask_Visited_(d);
+    size_t         hole = findSlot_Visited_(d, hash_VisitedUrl_(url), url);
+    iVisitedSlot * slot = at_Array(&d->slots, hole);
+    const uint32_t index = slot->index;
+    if (index == emptySlot_Visited_) {
+        return iFalse;
+    }
+    /* Backward-shift deletion: move later entries of the probe sequence into the hole. */
+    slot->index = emptySlot_Visited_;
+    for (size_t pos = (hole + 1) & mask;; pos = (pos + 1) & mask) {
+        iVisitedSlot *next = at_Array(&d->slots, pos);
+        if (next->index == emptySlot_Visited_) {
+            break;
+        }
+        const size_t home = next->hash & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            set_Array(&d->slots, hole, next);
+            next->index = emptySlot_Visited_;
+            hole = pos;
+        }
+    }
+    /* Fill the gap in the entry array with the last entry. */
+    delete_VisitedUrl(at_PtrArray(&d->visited, index));
+    const uint32_t last = (uint32_t) size_PtrArray(&d->visited) - 1;
+    if (index != last) {
+        iVisitedUrl *moved = at_PtrArray(&d->visited, last);
+        set_Array(&d->visited, index, &moved);
+        iVisitedSlot *movedSlot =
+            at_Array(&d->slots, findSlot_Visited_(d, hash_VisitedUrl_(&moved->url), &moved->url));
+        iAssert(movedSlot->index == last);
+        movedSlot->index = index;
+    }
+    popBack_Array(&d->visited);
+    return iTrue;
+}
+
+static void clearEntries_Visited_(iVisited *d) {
+    iForEach(PtrArray, i, &d->visited) {
+        delete_VisitedUrl(i.ptr);
+    }
+    clear_PtrArray(&d->visited);
+    resetSlots_Visited_(d, minSlots_Visited_);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void writeRecord_Visited_(iStream *outs, int type, const iString *url, const iVisitedUrl *vis) {
+    write8_Stream(outs, type);
+    writeU64_Stream(outs, vis ? integralSeconds_Time(&vis->when) : 0);
+    writeU16_Stream(outs, vis ? vis->flags : 0);
+    serialize_String(url, outs);
+}
+
+static void append_Visited_(iVisited *d, int type, const iString *url, const iVisitedUrl *vis) {
+    if (d->journal) {
+        writeRecord_Visited_(stream_File(d->journal), type, url, vis);
+        d->numRecords++;
+    }
+}
+
+static void openJournal_Visited_(iVisited *d) {
+    iReleasePtr(&d->journal);
+    if (!isEmpty_String(&d->journalPath)) {
+        d->journal = new_File(&d->journalPath);
+        if (!open_File(d->journal, append_FileMode)) {
+            iReleasePtr(&d->journal);
+        }
+    }
+}
+
+static iBool isCompactionNeeded_Visited_(const iVisited *d) {
+    return d->numRecords > 2 * size_PtrArray(&d->visited) + 1000;
+}
+
+static void compact_Visited_(iVisited *d) {
+    if (isEmpty_String(&d->journalPath)) {
+        return;
+    }
+    /* Rewrite the journal with a single record per URL. */
+    iReleasePtr(&d->journal);
+    iString *tmpPath = collect_String(copy_String(&d->journalPath));
+    appendCStr_String(tmpPath, ".tmp");
+    iFile *f = new_File(tmpPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        iStream *outs = stream_File(f);
+        writeU32_Stream(outs, journalMagic_Visited_);
+        writeU32_Stream(outs, journalVersion_Visited_);
+        iConstForEach(PtrArray, i, &d->visited) {
+            const iVisitedUrl *vis = i.ptr;
+            writeRecord_Visited_(outs, visit_VisitedRecordType, &vis->url, vis);
+        }
+        iRelease(f);
+        remove(cstr_String(&d->journalPath));
+        if (rename(cstr_String(tmpPath), cstr_String(&d->journalPath)) == 0) {
+            d->numRecords = size_PtrArray(&d->visited);
+        }
+    }
+    else {
+        iRelease(f);
+    }
+    openJournal_Visited_(d);
+}
+
+static void loadText_Visited_(iVisited *d, const char *dirPath) {
+    iFile *f = newCStr_File(concatPath_CStr(dirPath, textFileName_Visited_));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
         const iRangecc src  = range_Block(collect_Block(readAll_File(f)));
         iRangecc       line = iNullRange;
-        iTime          now;
-        initCurrent_Time(&now);
+        iString        url;
+        init_String(&url);
         while (nextSplit_Rangecc(src, "\n", &line)) {
             if (size_Range(&line) < 8) continue;
             char *endp = NULL;
             const unsigned long long ts = strtoull(line.start, &endp, 10);
             if (ts == 0) break;
             const uint32_t flags = (uint32_t) strtoul(skipSpace_CStr(endp), &endp, 16);
-            const char *urlStart = skipSpace_CStr(endp);
-            iVisitedUrl item;
-            item.when.ts = (struct timespec){ .tv_sec = ts };
-            if (~flags & kept_VisitedUrlFlag &&
-                secondsSince_Time(&now, &item.when) > maxAge_Visited) {
-                continue; /* Too old. */
+            setRange_String(&url, (iRangecc){ skipSpace_CStr(endp), line.end });
+            iVisitedUrl *vis = insert_Visited_(d, &url);
+            vis->when.ts = (struct timespec){ .tv_sec = ts };
+            vis->flags   = flags;
+        }
+        deinit_String(&url);
+    }
+    iRelease(f);
+}
+
+static iBool readUint_(iRangecc *src, size_t size, uint64_t *value_out) {
+    /* Journal values are little-endian, as written by iStream. */
+    if (size_Range(src) < size) {
+        return iFalse;
+    }
+    *value_out = 0;
+    for (size_t i = 0; i < size; i++) {
+        *value_out |= (uint64_t) (uint8_t) src->start[i] << (8 * i);
+    }
+    src->start += size;
+    return iTrue;
+}
+
+/* Returns iFalse if the journal was missing or damaged and should be rewritten. */
+static iBool loadJournal_Visited_(iVisited *d) {
+    iBool isOk = iFalse;
+    iFile *f = new_File(&d->journalPath);
+    if (open_File(f, readOnly_FileMode)) {
+        /* The whole journal is parsed in memory, so a truncated last record is easy to spot. */
+        iRangecc src = range_Block(collect_Block(readAll_File(f)));
+        uint64_t magic, version;
+        if (readUint_(&src, 4, &magic) && magic == journalMagic_Visited_ &&
+            readUint_(&src, 4, &version) && version == journalVersion_Visited_) {
+            iString url;
+            init_String(&url);
+            isOk = iTrue;
+            while (!isEmpty_Range(&src)) {
+                uint64_t type, ts, flags, len;
+                if (!readUint_(&src, 1, &type) || !readUint_(&src, 8, &ts) ||
+                    !readUint_(&src, 2, &flags) || !readUint_(&src, 4, &len) ||
+                    size_Range(&src) < len) {
+                    isOk = iFalse; /* truncated record */
+                    break;
+                }
+                setRange_String(&url, (iRangecc){ src.start, src.start + len });
+                src.start += len;
+                if (type == visit_VisitedRecordType) {
+                    iVisitedUrl *vis = insert_Visited_(d, &url);
+                    vis->when.ts = (struct timespec){ .tv_sec = ts };
+                    vis->flags   = (uint16_t) flags;
+                }
+                else if (type == remove_VisitedRecordType) {
+                    remove_Visited_(d, &url);
+                }
+                else {
+                    isOk = iFalse;
+                    break;
+                }
+                d->numRecords++;
             }
-            item.flags = flags;
-            initRange_String(&item.url, (iRangecc){ urlStart, line.end });
-            set_String(&item.url, &item.url);
-            insert_SortedArray(&d->visited, &item);
+            deinit_String(&url);
         }
-        unlock_Mutex(d->mtx);
     }
     iRelease(f);
+    return isOk;
 }
 
-void clear_Visited(iVisited *d) {
-    lock_Mutex(d->mtx);
-    iForEach(Array, v, &d->visited.values) {
-        deinit_VisitedUrl(v.value);
+static void removeExpired_Visited_(iVisited *d) {
+    /* Not journaled; the records are dropped at the next compaction. */
+    iTime now;
+    initCurrent_Time(&now);
+    for (size_t i = 0; i < size_PtrArray(&d->visited); ) {
+        const iVisitedUrl *vis = constAt_PtrArray(&d->visited, i);
+        if (~vis->flags & kept_VisitedUrlFlag &&
+            secondsSince_Time(&now, &vis->when) > maxAge_Visited) {
+            remove_Visited_(d, &vis->url); /* last entry moves to `i` */
+            continue;
+        }
+        i++;
     }
-    clear_SortedArray(&d->visited);
-    unlock_Mutex(d->mtx);
 }
 
-static size_t find_Visited_(const iVisited *d, const iString *url) {
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, url);
-    size_t pos = iInvalidPos;
+/*----------------------------------------------------------------------------------------------*/
+
+static void clearChanges_Visited_(iVisited *d) {
+    iForEach(Array, i, &d->changes) {
+        deinit_VisitedUrl(i.value);
+    }
+    clear_Array(&d->changes);
+}
+
+static void resetSnapshot_Visited_(iVisited *d) {
+    /* The next snapshot will be a full copy. */
+    clearChanges_Visited_(d);
+    iReleasePtr(&d->snapshot);
+    d->generation++;
+}
+
+static void changed_Visited_(iVisited *d, const iString *url, const iVisitedUrl *vis) {
+    d->generation++;
+    if (!d->snapshot) {
+        return; /* nothing to update incrementally */
+    }
+    if (size_Array(&d->changes) >= iMax(minSlots_Visited_, size_PtrArray(&d->visited))) {
+        resetSnapshot_Visited_(d); /* cheaper to start over */
+        return;
+    }
+    iVisitedUrl change;
+    initCopy_String(&change.url, url);
+    if (vis) {
+        change.when  = vis->when;
+        change.flags = vis->flags;
+    }
+    else {
+        iZap(change.when);
+        change.flags = removed_VisitedChange_;
+    }
+    pushBack_Array(&d->changes, &change);
+}
+
+void init_Visited(iVisited *d) {
+    d->mtx = new_Mutex();
+    init_PtrArray(&d->visited);
+    init_Array(&d->slots, sizeof(iVisitedSlot));
+    resetSlots_Visited_(d, minSlots_Visited_);
+    init_String(&d->journalPath);
+    d->journal    = NULL;
+    d->numRecords = 0;
+    d->generation = 0;
+    d->snapshotMtx = new_Mutex();
+    d->snapshot   = NULL;
+    init_Array(&d->changes, sizeof(iVisitedUrl));
+}
+
+void deinit_Visited(iVisited *d) {
     iGuardMutex(d->mtx, {
-        locate_SortedArray(&d->visited, &visit, &pos);
-        deinit_VisitedUrl(&visit);
+        iReleasePtr(&d->journal);
+        iReleasePtr(&d->snapshot);
+        clearChanges_Visited_(d);
+        deinit_Array(&d->changes);
+        clearEntries_Visited_(d);
+        deinit_String(&d->journalPath);
+        deinit_Array(&d->slots);
+        deinit_PtrArray(&d->visited);
     });
-    return pos;
+    delete_Mutex(d->snapshotMtx);
+    delete_Mutex(d->mtx);
+}
+
+void save_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    if (isEmpty_String(&d->journalPath)) {
+        setCStr_String(&d->journalPath, concatPath_CStr(dirPath, journalFileName_Visited_));
+        compact_Visited_(d);
+    }
+    else if (isCompactionNeeded_Visited_(d)) {
+        compact_Visited_(d);
+    }
+    else {
+        /* Everything is already in the journal; just make sure it has been written out. */
+        openJournal_Visited_(d);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+void load_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    iReleasePtr(&d->journal);
+    clearEntries_Visited_(d);
+    d->numRecords = 0;
+    setCStr_String(&d->journalPath, concatPath_CStr(dirPath, journalFileName_Visited_));
+    iBool isValid = iTrue;
+    if (fileExists_FileInfo(&d->journalPath)) {
+        isValid = loadJournal_Visited_(d);
+    }
+    else {
+        loadText_Visited_(d, dirPath);
+        isValid = iFalse;
+    }
+    removeExpired_Visited_(d);
+    if (!isValid || isCompactionNeeded_Visited_(d)) {
+        compact_Visited_(d);
+    }
+    else {
+        openJournal_Visited_(d);
+    }
+    resetSnapshot_Visited_(d);
+    unlock_Mutex(d->mtx);
+}
+
+void clear_Visited(iVisited *d) {
+    lock_Mutex(d->mtx);
+    clearEntries_Visited_(d);
+    compact_Visited_(d);
+    resetSnapshot_Visited_(d);
+    unlock_Mutex(d->mtx);
 }
 
 void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
     if (isEmpty_String(url)) return;
     url = canonicalUrl_String(url);
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    visit.flags = visitFlags;
-    set_String(&visit.url, url);
-    size_t pos;
+    iTime now;
+    initCurrent_Time(&now);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *old = at_SortedArray(&d->visited, pos);
-        if (old->flags & kept_VisitedUrlFlag) {
+    iVisitedUrl *vis = find_Visited_(d, url);
+    if (vis) {
+        if (vis->flags & kept_VisitedUrlFlag) {
             visitFlags |= kept_VisitedUrlFlag; /* must continue to be kept */
         }
-        if (cmpNewer_VisitedUrl_(&visit, old)) {
-            old->when = visit.when;
-            old->flags = visitFlags;
+        if (cmp_Time(&now, &vis->when) < 0) {
             unlock_Mutex(d->mtx);
-            deinit_VisitedUrl(&visit);
             return;
         }
     }
-    insert_SortedArray(&d->visited, &visit);
+    else {
+        vis = insert_Visited_(d, url);
+    }
+    vis->when  = now;
+    vis->flags = visitFlags;
+    append_Visited_(d, visit_VisitedRecordType, &vis->url, vis);
+    changed_Visited_(d, &vis->url, vis);
     unlock_Mutex(d->mtx);
 }
 
 void setUrlKept_Visited(iVisited *d, const iString *url, iBool isKept) {
     if (isEmpty_String(url)) return;
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, canonicalUrl_String(url));
-    size_t pos;
+    url = canonicalUrl_String(url);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *vis = at_SortedArray(&d->visited, pos);
+    iVisitedUrl *vis = find_Visited_(d, url);
+    if (vis && isKept != ((vis->flags & kept_VisitedUrlFlag) != 0)) {
         iChangeFlags(vis->flags, kept_VisitedUrlFlag, isKept);
+        append_Visited_(d, visit_VisitedRecordType, &vis->url, vis);
+        changed_Visited_(d, &vis->url, vis);
     }
     unlock_Mutex(d->mtx);
-    deinit_VisitedUrl(&visit);
 }
 
 void removeUrl_Visited(iVisited *d, const iString *url) {
     url = canonicalUrl_String(url);
-    iGuardMutex(d->mtx, {
-        size_t pos = find_Visited_(d, url);
-        if (pos < size_SortedArray(&d->visited)) {
-            iVisitedUrl *visUrl = at_SortedArray(&d->visited, pos);
-            if (equal_String(&visUrl->url, url)) {
-                deinit_VisitedUrl(visUrl);
-                remove_Array(&d->visited.values, pos);
-            }
-        }
-    });
+    lock_Mutex(d->mtx);
+    if (remove_Visited_(d, url)) {
+        append_Visited_(d, remove_VisitedRecordType, url, NULL);
+        changed_Visited_(d, url, NULL);
+    }
+    unlock_Mutex(d->mtx);
 }
 
 iTime urlVisitTime_Visited(const iVisited *d, const iString *url) {
-    iVisitedUrl item;
-    size_t pos;
-    iZap(item);
-    initCopy_String(&item.url, canonicalUrl_String(url));
+    iTime when;
+    iZap(when);
+    url = canonicalUrl_String(url);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &item, &pos)) {
-        item.when = ((const iVisitedUrl *) constAt_SortedArray(&d->visited, pos))->when;
+    const iVisitedUrl *vis = find_Visited_(d, url);
+    if (vis) {
+        when = vis->when;
     }
     unlock_Mutex(d->mtx);
-    deinit_String(&item.url);
-    return item.when;
+    return when;
 }
 
 iBool containsUrl_Visited(const iVisited *d, const iString *url) {
@@ -218,6 +652,57 @@ iBool containsUrl_Visited(const iVisited *d, const iString *url) {
     return isValid_Time(&time);
 }
 
+uint32_t generation_Visited(const iVisited *d) {
+    uint32_t gen;
+    iGuardMutex(d->mtx, gen = d->generation);
+    return gen;
+}
+
+const iVisitedSnapshot *snapshot_Visited(const iVisited *d) {
+    iVisited *mut = iConstCast(iVisited *, d);
+    lock_Mutex(d->snapshotMtx);
+    lock_Mutex(d->mtx);
+    if (d->snapshot && d->snapshot->generation == d->generation) {
+        const iVisitedSnapshot *snap = ref_Object(d->snapshot);
+        unlock_Mutex(d->mtx);
+        unlock_Mutex(d->snapshotMtx);
+        return snap;
+    }
+    /* The new snapshot is installed right away so that further changes are recorded relative
+       to it. Other readers wait on `snapshotMtx` until it has been built. Readers of the
+       previous version hold their own references to it. */
+    iVisitedSnapshot *base = mut->snapshot;
+    iVisitedSnapshot *snap = new_VisitedSnapshot(d->generation);
+    mut->snapshot = ref_Object(snap);
+    iArray changes;
+    init_Array(&changes, sizeof(iVisitedUrl));
+    if (base) {
+        /* Take over the recorded changes. */
+        iConstForEach(Array, i, &d->changes) {
+            pushBack_Array(&changes, i.value);
+        }
+        clear_Array(&mut->changes);
+    }
+    else {
+        /* Only the first snapshot after loading or clearing is copied in full. */
+        copyEntries_VisitedSnapshot_(snap, &d->visited);
+    }
+    unlock_Mutex(d->mtx);
+    if (base) {
+        applyChanges_VisitedSnapshot_(snap, base, &changes);
+        iRelease(base);
+    }
+    else {
+        sort_Array(&snap->urls, cmpWhenDescending_VisitedUrl_);
+    }
+    iForEach(Array, i, &changes) {
+        deinit_VisitedUrl(i.value);
+    }
+    deinit_Array(&changes);
+    unlock_Mutex(d->snapshotMtx);
+    return snap;
+}
+
 static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
     const iVisitedUrl *s = *(const void **) a, *t = *(const void **) b;
     return -cmp_Time(&s->when, &t->when);
@@ -226,8 +711,8 @@ static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
 const iPtrArray *list_Visited(const iVisited *d, size_t count) {
     iPtrArray *urls = collectNew_PtrArray();
     iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
+        iConstForEach(PtrArray, i, &d->visited) {
+            const iVisitedUrl *vis = i.ptr;
             if (~vis->flags & transient_VisitedUrlFlag) {
                 pushBack_PtrArray(urls, vis);
             }
@@ -239,16 +724,3 @@ const iPtrArray *list_Visited(const iVisited *d, size_t count) {
     }
     return urls;
 }
-
-const iPtrArray *listKept_Visited(const iVisited *d) {
-    iPtrArray *urls = collectNew_PtrArray();
-    iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (vis->flags & kept_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
-            }
-        }
-    });
-    return urls;
-}
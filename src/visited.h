@@ -24,6 +24,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "gmrequest.h"
 
+#include <the_Foundation/object.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/string.h>
 #include <the_Foundation/time.h>
@@ -49,13 +50,24 @@ iDeclareTypeConstruction(Visited)
 
 void    clear_Visited           (iVisited *);
 void    load_Visited            (iVisited *, const char *dirPath);
-void    save_Visited            (const iVisited *, const char *dirPath);
+void    save_Visited            (iVisited *, const char *dirPath); /* flushes the journal */
 
 iTime   urlVisitTime_Visited    (const iVisited *, const iString *url);
 void    visitUrl_Visited        (iVisited *, const iString *url, uint16_t visitFlags); /* adds URL to the visited URLs set */
 void    setUrlKept_Visited      (iVisited *, const iString *url, iBool isKept); /* URL is marked as (non)discardable */
 void    removeUrl_Visited       (iVisited *, const iString *url);
 iBool   containsUrl_Visited     (const iVisited *, const iString *url);
+uint32_t generation_Visited     (const iVisited *); /* changes when URLs are added, removed, or (un)kept */
 
 const iPtrArray *   list_Visited        (const iVisited *, size_t count); /* returns collected */
-const iPtrArray *   listKept_Visited    (const iVisited *);
+
+/* Background threads should read the visited URLs via a snapshot: an immutable copy of the
+   set that is shared by all readers until the set changes. Writers never wait for readers;
+   an old snapshot is deleted when its last reader releases it. */
+iDeclareClass(VisitedSnapshot)
+
+const iVisitedSnapshot *snapshot_Visited    (const iVisited *); /* caller must iRelease */
+
+uint32_t            generation_VisitedSnapshot  (const iVisitedSnapshot *);
+size_t              size_VisitedSnapshot        (const iVisitedSnapshot *);
+const iVisitedUrl * at_VisitedSnapshot          (const iVisitedSnapshot *, size_t pos); /* newest first */
@@ -0,0 +1,255 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "wordindex.h"
+
+#include <the_Foundation/array.h>
+#include <the_Foundation/string.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t maxWordLength_WordIndex_ = 64; /* bytes; longer words are not indexed */
+
+iDeclareType(WordEntry)
+
+struct Impl_WordEntry {
+    uint32_t word;    /* offset in `words` */
+    uint16_t wordLen;
+    uint16_t srcLen;  /* length of the word in the source text */
+    uint32_t srcPos;  /* first occurrence in the source text */
+};
+
+struct Impl_WordIndex {
+    iBlock words;   /* lowercase words, concatenated */
+    iArray entries; /* sorted by word */
+};
+
+/* Calls `func` for each run of alphanumeric characters in `text`. */
+static void forEachWord_(iRangecc text, void (*func)(void *, iRangecc, const iString *),
+                         void *context) {
+    iString word;
+    init_String(&word);
+    const char *start = NULL;
+    for (const char *pos = text.start; pos < text.end; ) {
+        iChar ch = 0;
+        int len = decodeBytes_MultibyteChar(pos, text.end, &ch);
+        if (len <= 0) {
+            len = 1; /* invalid UTF-8 */
+            ch  = 0;
+        }
+        if (ch && isAlphaNumeric_Char(ch)) {
+            if (!start) {
+                start = pos;
+                clear_String(&word);
+            }
+            appendChar_String(&word, lower_Char(ch));
+        }
+        else if (start) {
+            func(context, (iRangecc){ start, pos }, &word);
+            start = NULL;
+        }
+        pos += len;
+    }
+    if (start) {
+        func(context, (iRangecc){ start, text.end }, &word);
+    }
+    deinit_String(&word);
+}
+
+iDeclareType(WordOccurrence)
+
+struct Impl_WordOccurrence {
+    union {
+        size_t      offset; /* while the words are still being collected */
+        const char *ptr;
+    } word;
+    uint16_t wordLen;
+    uint16_t srcLen;
+    uint32_t srcPos;
+};
+
+iDeclareType(WordIndexBuilder)
+
+struct Impl_WordIndexBuilder {
+    const char *textStart;
+    iBlock      words;
+    iArray      occurrences;
+};
+
+static void addWord_WordIndexBuilder_(void *context, iRangecc src, const iString *word) {
+    iWordIndexBuilder *d = context;
+    if (size_String(word) > maxWordLength_WordIndex_ || size_Range(&src) > 0xffff ||
+        (size_t) (src.start - d->textStart) > 0xffffffff) {
+        return;
+    }
+    iWordOccurrence occ = { .word.offset = size_Block(&d->words),
+                            .wordLen     = size_String(word),
+                            .srcLen      = size_Range(&src),
+                            .srcPos      = src.start - d->textStart };
+    append_Block(&d->words, &word->chars);
+    pushBack_Array(&d->occurrences, &occ);
+}
+
+static int cmpWords_(const char *a, size_t aLen, const char *b, size_t bLen) {
+    const int cmp = memcmp(a, b, iMin(aLen, bLen));
+    if (cmp) {
+        return cmp;
+    }
+    return aLen < bLen ? -1 : aLen > bLen ? 1 : 0;
+}
+
+static int cmp_WordOccurrence_(const void *a, const void *b) {
+    const iWordOccurrence *x = a, *y = b;
+    const int cmp = cmpWords_(x->word.ptr, x->wordLen, y->word.ptr, y->wordLen);
+    if (cmp) {
+        return cmp;
+    }
+    return x->srcPos < y->srcPos ? -1 : x->srcPos > y->srcPos ? 1 : 0;
+}
+
+void init_WordIndex(iWordIndex *d, const iBlock *text) {
+    init_Block(&d->words, 0);
+    init_Array(&d->entries, sizeof(iWordEntry));
+    iWordIndexBuilder build = { .textStart = constBegin_Block(text) };
+    init_Block(&build.words, 0);
+    init_Array(&build.occurrences, sizeof(iWordOccurrence));
+    forEachWord_(range_Block(text), addWord_WordIndexBuilder_, &build);
+    /* The collected words don't move any more. */
+    iForEach(Array, i, &build.occurrences) {
+        iWordOccurrence *occ = i.value;
+        occ->word.ptr = constBegin_Block(&build.words) + occ->word.offset;
+    }
+    /* Sort all occurrences and keep only the first one of each word. */
+    qsort(data_Array(&build.occurrences),
+          size_Array(&build.occurrences),
+          sizeof(iWordOccurrence),
+          cmp_WordOccurrence_);
+    const iWordOccurrence *prev = NULL;
+    iConstForEach(Array, j, &build.occurrences) {
+        const iWordOccurrence *occ = j.value;
+        if (prev && cmpWords_(prev->word.ptr, prev->wordLen, occ->word.ptr, occ->wordLen) == 0) {
+            continue;
+        }
+        const iWordEntry entry = { .word    = size_Block(&d->words),
+                                   .wordLen = occ->wordLen,
+                                   .srcLen  = occ->srcLen,
+                                   .srcPos  = occ->srcPos };
+        appendData_Block(&d->words, occ->word.ptr, occ->wordLen);
+        pushBack_Array(&d->entries, &entry);
+        prev = occ;
+    }
+    deinit_Array(&build.occurrences);
+    deinit_Block(&build.words);
+}
+
+void deinit_WordIndex(iWordIndex *d) {
+    deinit_Array(&d->entries);
+    deinit_Block(&d->words);
+}
+
+iDefineTypeConstructionArgs(WordIndex, (const iBlock *text), text)
+
+static void addQueryWord_(void *context, iRangecc src, const iString *word) {
+    iUnused(src);
+    iStringArray *words = context;
+    if (size_String(word) <= maxWordLength_WordIndex_) {
+        pushBack_StringArray(words, word);
+    }
+}
+
+iStringArray *splitQuery_WordIndex(const iString *query) {
+    iStringArray *words = new_StringArray();
+    forEachWord_(range_String(query), addQueryWord_, words);
+    return words;
+}
+
+static size_t lowerBound_WordIndex_(const iWordIndex *d, const iString *prefix) {
+    const char *words = constData_Block(&d->words);
+    size_t lo = 0, hi = size_Array(&d->entries);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const iWordEntry *entry = constAt_Array(&d->entries, mid);
+        if (cmpWords_(words + entry->word, entry->wordLen,
+                      cstr_String(prefix), size_String(prefix)) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const iWordEntry *findPrefix_WordIndex_(const iWordIndex *d, const iString *prefix) {
+    /* Returns the earliest occurrence of any word beginning with `prefix`. */
+    const char *      words = constData_Block(&d->words);
+    const iWordEntry *found = NULL;
+    for (size_t i = lowerBound_WordIndex_(d, prefix); i < size_Array(&d->entries); i++) {
+        const iWordEntry *entry = constAt_Array(&d->entries, i);
+        if (entry->wordLen < size_String(prefix) ||
+            memcmp(words + entry->word, cstr_String(prefix), size_String(prefix))) {
+            break;
+        }
+        if (!found || entry->srcPos < found->srcPos) {
+            found = entry;
+        }
+    }
+    return found;
+}
+
+iBool find_WordIndex(const iWordIndex *d, const iStringArray *words, iRangei *match_out) {
+    /* All the words must be present; the match is the first occurrence of the first word. */
+    if (isEmpty_StringArray(words)) {
+        return iFalse;
+    }
+    iRangei match   = { 0, 0 };
+    iBool   isFirst = iTrue;
+    iConstForEach(StringArray, i, words) {
+        const iWordEntry *entry = findPrefix_WordIndex_(d, i.value);
+        if (!entry) {
+            return iFalse;
+        }
+        if (isFirst) {
+            match   = (iRangei){ entry->srcPos, entry->srcPos + entry->srcLen };
+            isFirst = iFalse;
+        }
+    }
+    if (match_out) {
+        *match_out = match;
+    }
+    return iTrue;
+}
+
+size_t numWords_WordIndex(const iWordIndex *d) {
+    return size_Array(&d->entries);
+}
+
+iRangecc word_WordIndex(const iWordIndex *d, size_t pos) {
+    const iWordEntry *entry = constAt_Array(&d->entries, pos);
+    const char *      start = constBegin_Block(&d->words) + entry->word;
+    return (iRangecc){ start, start + entry->wordLen };
+}
+
+size_t memorySize_WordIndex(const iWordIndex *d) {
+    return size_Block(&d->words) + size_Array(&d->entries) * sizeof(iWordEntry);
+}